@@ -5,6 +5,13 @@
 #include <string.h>
 #include <math.h>
 #include <errno.h>
+#include <pthread.h>
+
+#include "filter_io.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 
 #ifndef BLOCK_BYTES
 #define BLOCK_BYTES 64
@@ -12,6 +19,36 @@
 
 #define BLOCK_BITS  (BLOCK_BYTES * 8)   // 512 bits
 
+#define BB_BATCH_RING 64   // max prefetch distance, power of two
+
+#define SPLIT_BYTES 32      // 8 x 32-bit lanes
+#define SPLIT_LANES 8
+#define REG_BYTES   8       // one 64-bit word
+#define REG_MAX_K   16
+
+#define BB_BULK_PART_BYTES (256u << 10)   // filter bytes per partition, ~L2
+#define BB_BULK_MAX_PARTS  1024            // fan-out of the partition pass
+
+#define CNT_SLOTS   128     // 4-bit counters per 64-byte block
+#define CNT_NIBBLES 0x11111111u
+
+// Odd multipliers from Parquet's split-block filter: lane i of a SPLIT
+// block sets bit (x * salt[i]) >> 27. REGISTER uses these and eight more,
+// bit (x * salt[i]) >> 26 of its word for i < k.
+static const uint32_t BB_SALT[REG_MAX_K] = {
+    0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU,
+    0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U,
+    0x9e3779b9U, 0x85ebca6bU, 0xc2b2ae35U, 0x27d4eb2fU,
+    0x165667b1U, 0xd3a2646dU, 0xfd7046c5U, 0xb55a4f09U,
+};
+
+// AVX2 path covers exactly one 512-bit block (two ymm registers).
+#if (defined(__x86_64__) || defined(__i386__)) && BLOCK_BYTES == 64
+#define BB_HAVE_AVX2 1
+#else
+#define BB_HAVE_AVX2 0
+#endif
+
 //  64-bit mixing / hashing 
 
 static inline uint64_t splitmix64(uint64_t *x) {
@@ -39,6 +76,206 @@ static inline int block_test_bit(const uint8_t *block, uint32_t bit) {
     return (block[byte] & (uint8_t)mask) != 0;
 }
 
+#if BB_HAVE_AVX2
+// The block is viewed as 16 x 32-bit words (lo = words 0..7, hi = 8..15).
+// On little-endian this is the same bit order as block_set_bit().
+// Lane j takes 1 << (bit - 32*j); sllv yields 0 for counts outside [0,31],
+// so every lane except the target word drops out without a compare.
+__attribute__((target("avx2")))
+static inline void block_mask_avx2(uint32_t x, uint32_t step, uint32_t k,
+                                   __m256i *lo_out, __m256i *hi_out) {
+    const __m256i base_lo = _mm256_setr_epi32(0, 32, 64, 96, 128, 160, 192, 224);
+    const __m256i base_hi = _mm256_setr_epi32(256, 288, 320, 352, 384, 416, 448, 480);
+    const __m256i wrap = _mm256_set1_epi32((int)(BLOCK_BITS - 1u));
+    const __m256i one  = _mm256_set1_epi32(1);
+    const __m256i stepv = _mm256_set1_epi32((int)step);
+    __m256i acc = _mm256_set1_epi32((int)x);
+    __m256i lo = _mm256_setzero_si256();
+    __m256i hi = _mm256_setzero_si256();
+
+    for (uint32_t i = 0; i < k; i++) {
+        __m256i bit = _mm256_and_si256(acc, wrap);
+        lo = _mm256_or_si256(lo, _mm256_sllv_epi32(one, _mm256_sub_epi32(bit, base_lo)));
+        hi = _mm256_or_si256(hi, _mm256_sllv_epi32(one, _mm256_sub_epi32(bit, base_hi)));
+        acc = _mm256_add_epi32(acc, stepv);
+    }
+    *lo_out = lo;
+    *hi_out = hi;
+}
+
+__attribute__((target("avx2")))
+static int block_query_avx2(const uint8_t *block, uint32_t x, uint32_t step, uint32_t k) {
+    __m256i mlo, mhi;
+    block_mask_avx2(x, step, k, &mlo, &mhi);
+    __m256i blo = _mm256_loadu_si256((const __m256i*)block);
+    __m256i bhi = _mm256_loadu_si256((const __m256i*)(block + 32));
+    // all k bits set <=> (~b & m) == 0 in both halves
+    __m256i miss = _mm256_or_si256(_mm256_andnot_si256(blo, mlo), _mm256_andnot_si256(bhi, mhi));
+    return _mm256_testz_si256(miss, miss);
+}
+
+__attribute__((target("avx2")))
+static void block_insert_avx2(uint8_t *block, uint32_t x, uint32_t step, uint32_t k) {
+    __m256i mlo, mhi;
+    block_mask_avx2(x, step, k, &mlo, &mhi);
+    __m256i blo = _mm256_loadu_si256((const __m256i*)block);
+    __m256i bhi = _mm256_loadu_si256((const __m256i*)(block + 32));
+    _mm256_storeu_si256((__m256i*)block, _mm256_or_si256(blo, mlo));
+    _mm256_storeu_si256((__m256i*)(block + 32), _mm256_or_si256(bhi, mhi));
+}
+
+// COUNTING: the block as 16 x 32-bit words of 8 nibbles each; counter c
+// sits at bit 4c. The mask has a 1 in the low bit of each chosen counter
+// (a counter picked twice still gets one). Nibble-wise: `full` has that bit
+// set for counters at 15, `nz` for nonzero ones; adding or subtracting the
+// masked ones can never carry or borrow into a neighbour.
+__attribute__((target("avx2")))
+static inline void cnt_mask_avx2(uint32_t x, uint32_t step, uint32_t k,
+                                 __m256i *lo_out, __m256i *hi_out) {
+    const __m256i base_lo = _mm256_setr_epi32(0, 32, 64, 96, 128, 160, 192, 224);
+    const __m256i base_hi = _mm256_setr_epi32(256, 288, 320, 352, 384, 416, 448, 480);
+    const __m256i one  = _mm256_set1_epi32(1);
+    const __m256i stepv = _mm256_set1_epi32((int)step);
+    __m256i acc = _mm256_set1_epi32((int)x);
+    __m256i lo = _mm256_setzero_si256();
+    __m256i hi = _mm256_setzero_si256();
+
+    for (uint32_t i = 0; i < k; i++) {
+        // 4 * (acc >> 25)
+        __m256i bit = _mm256_slli_epi32(_mm256_srli_epi32(acc, 25), 2);
+        lo = _mm256_or_si256(lo, _mm256_sllv_epi32(one, _mm256_sub_epi32(bit, base_lo)));
+        hi = _mm256_or_si256(hi, _mm256_sllv_epi32(one, _mm256_sub_epi32(bit, base_hi)));
+        acc = _mm256_add_epi32(acc, stepv);
+    }
+    *lo_out = lo;
+    *hi_out = hi;
+}
+
+__attribute__((target("avx2")))
+static inline __m256i nib_full_avx2(__m256i c) {
+    __m256i t = _mm256_and_si256(c, _mm256_srli_epi32(c, 1));
+    t = _mm256_and_si256(t, _mm256_srli_epi32(c, 2));
+    t = _mm256_and_si256(t, _mm256_srli_epi32(c, 3));
+    return _mm256_and_si256(t, _mm256_set1_epi32((int)CNT_NIBBLES));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i nib_nz_avx2(__m256i c) {
+    __m256i t = _mm256_or_si256(c, _mm256_srli_epi32(c, 1));
+    t = _mm256_or_si256(t, _mm256_srli_epi32(c, 2));
+    t = _mm256_or_si256(t, _mm256_srli_epi32(c, 3));
+    return _mm256_and_si256(t, _mm256_set1_epi32((int)CNT_NIBBLES));
+}
+
+__attribute__((target("avx2")))
+static int cnt_query_avx2(const uint8_t *block, uint32_t x, uint32_t step, uint32_t k) {
+    __m256i mlo, mhi;
+    cnt_mask_avx2(x, step, k, &mlo, &mhi);
+    __m256i blo = _mm256_loadu_si256((const __m256i*)block);
+    __m256i bhi = _mm256_loadu_si256((const __m256i*)(block + 32));
+    __m256i miss = _mm256_or_si256(_mm256_andnot_si256(nib_nz_avx2(blo), mlo),
+                                   _mm256_andnot_si256(nib_nz_avx2(bhi), mhi));
+    return _mm256_testz_si256(miss, miss);
+}
+
+// dir = +1 increments, -1 decrements (after cnt_query_avx2 passed);
+// counters at 15 are left alone either way.
+__attribute__((target("avx2")))
+static void cnt_update_avx2(uint8_t *block, uint32_t x, uint32_t step, uint32_t k, int dir) {
+    __m256i mlo, mhi;
+    cnt_mask_avx2(x, step, k, &mlo, &mhi);
+    __m256i blo = _mm256_loadu_si256((const __m256i*)block);
+    __m256i bhi = _mm256_loadu_si256((const __m256i*)(block + 32));
+    mlo = _mm256_andnot_si256(nib_full_avx2(blo), mlo);
+    mhi = _mm256_andnot_si256(nib_full_avx2(bhi), mhi);
+    if (dir > 0) {
+        blo = _mm256_add_epi32(blo, mlo);
+        bhi = _mm256_add_epi32(bhi, mhi);
+    } else {
+        blo = _mm256_sub_epi32(blo, mlo);
+        bhi = _mm256_sub_epi32(bhi, mhi);
+    }
+    _mm256_storeu_si256((__m256i*)block, blo);
+    _mm256_storeu_si256((__m256i*)(block + 32), bhi);
+}
+
+// A split block is one ymm register: one multiply, shift and sllv give all
+// eight lane bits at once.
+__attribute__((target("avx2")))
+static inline __m256i split_mask_avx2(uint32_t x) {
+    const __m256i salt = _mm256_loadu_si256((const __m256i*)BB_SALT);
+    __m256i v = _mm256_mullo_epi32(_mm256_set1_epi32((int)x), salt);
+    return _mm256_sllv_epi32(_mm256_set1_epi32(1), _mm256_srli_epi32(v, 27));
+}
+
+__attribute__((target("avx2")))
+static int split_query_avx2(const uint8_t *block, uint32_t x) {
+    __m256i b = _mm256_loadu_si256((const __m256i*)block);
+    return _mm256_testc_si256(b, split_mask_avx2(x));
+}
+
+__attribute__((target("avx2")))
+static void split_insert_avx2(uint8_t *block, uint32_t x) {
+    __m256i b = _mm256_loadu_si256((const __m256i*)block);
+    _mm256_storeu_si256((__m256i*)block, _mm256_or_si256(b, split_mask_avx2(x)));
+}
+#endif
+
+static inline uint32_t split_bit(uint32_t x, uint32_t lane) {
+    return 1u << ((x * BB_SALT[lane]) >> 27);
+}
+
+static inline uint64_t reg_mask(uint32_t x, uint32_t k) {
+    uint64_t m = 0;
+    for (uint32_t i = 0; i < k; i++) m |= 1ULL << ((x * BB_SALT[i]) >> 26);
+    return m;
+}
+
+static inline uint32_t cnt_get(const uint8_t *block, uint32_t c) {
+    return (block[c >> 1] >> ((c & 1u) * 4)) & 0xFu;
+}
+
+static inline void cnt_add(uint8_t *block, uint32_t c, int d) {
+    block[c >> 1] = (uint8_t)(block[c >> 1] + (d << ((c & 1u) * 4)));
+}
+
+static inline int uses_fastrange(bb_layout_t layout) {
+    return layout == BB_LAYOUT_SPLIT || layout == BB_LAYOUT_REGISTER;
+}
+
+static inline size_t layout_block_bytes(bb_layout_t layout) {
+    switch (layout) {
+    case BB_LAYOUT_SPLIT:    return SPLIT_BYTES;
+    case BB_LAYOUT_REGISTER: return REG_BYTES;
+    default:                 return BLOCK_BYTES;
+    }
+}
+
+static inline int path_supported(bb_path_t path) {
+    switch (path) {
+    case BB_PATH_SCALAR:
+        return 1;
+    case BB_PATH_AVX2:
+#if BB_HAVE_AVX2
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2");
+#else
+        return 0;
+#endif
+    }
+    return 0;
+}
+
+bb_path_t blocked_bloom_best_path(void) {
+    return path_supported(BB_PATH_AVX2) ? BB_PATH_AVX2 : BB_PATH_SCALAR;
+}
+
+int blocked_bloom_set_path(blocked_bloom_t *bf, bb_path_t path) {
+    if (!bf || !path_supported(path)) return EINVAL;
+    bf->path = path;
+    return 0;
+}
+
 // m = -n ln(p) / (ln 2)^2
 // k = (m/n) ln 2
 static inline void choose_m_k(size_t n, double p, size_t *m_bits_out, uint32_t *k_out) {
@@ -60,19 +297,129 @@ static inline void choose_m_k(size_t n, double p, size_t *m_bits_out, uint32_t *
     *k_out = k;
 }
 
-int blocked_bloom_init(blocked_bloom_t *bf, size_t n_keys, double target_fpr) {
-    if (!bf || n_keys == 0) return EINVAL;
+// FPR of a layout when a block holds lambda keys on average: block loads
+// are Poisson, and a negative key must find all of its k bits (counters)
+// set in its one block.
+//
+// BLOCKED places bits by double hashing mod S = 512, so a lookup's bits are
+// an arithmetic progression. A stored key with the same step (or its
+// negation, which walks the same set backwards) and a start d < k steps
+// away covers k - d of them; that happens with probability
+// 2 (2k - 1) / (S/2 * S) per key and leaves only d bits to chance.
+static double layout_fpr(bb_layout_t layout, uint32_t k, double lambda) {
+    double block_bits = 8.0 * (double)layout_block_bytes(layout);
+    double q_step = (layout == BB_LAYOUT_SPLIT)    ? 1.0 - 1.0 / 32.0
+                  : (layout == BB_LAYOUT_COUNTING) ? 1.0 - (double)k / CNT_SLOTS
+                  :                                  pow(1.0 - 1.0 / block_bits, (double)k);
+    double p_align = (layout == BB_LAYOUT_BLOCKED)
+                   ? 2.0 * (2.0 * k - 1.0) / (block_bits / 2.0 * block_bits) : 0.0;
+    double pmf = exp(-lambda), q = 1.0, fpr = 0.0;
+    size_t jmax = (size_t)(lambda + 12.0 * sqrt(lambda) + 30.0);
+    for (size_t j = 0; j <= jmax; j++) {
+        double set = 1.0 - q;                   // q = P(a given bit still clear)
+        double f = pow(set, (double)k);
+        if (p_align > 0.0) {
+            double a = 1.0 - pow(1.0 - p_align, (double)j), run = 1.0;
+            for (uint32_t d = 1; d < k; d++) run += 2.0 * pow(set, (double)d);
+            f = (1.0 - a) * f + a * run / (2.0 * k - 1.0);
+        }
+        fpr += pmf * f;
+        pmf *= lambda / (double)(j + 1);
+        q *= q_step;
+    }
+    return fpr;
+}
+
+// Fewest bits per key (in 1/8 steps, up to 64) whose modelled FPR meets p;
+// REGISTER and COUNTING also pick the k that gets there first.
+static void choose_layout(bb_layout_t layout, double p, double *bpk_out, uint32_t *k_out) {
+    if (p <= 0.0) p = 1e-12;
 
+    double block_bits = 8.0 * (double)layout_block_bytes(layout);
+    uint32_t kmax = (layout == BB_LAYOUT_SPLIT) ? SPLIT_LANES : REG_MAX_K;
+    uint32_t kmin = (layout == BB_LAYOUT_SPLIT) ? SPLIT_LANES : 1;
+    double bpk = 1.0;
+    uint32_t k = kmin;
+    for (; bpk < 64.0; bpk += 0.125) {
+        double best = 1.0;
+        for (uint32_t kk = kmin; kk <= kmax; kk++) {
+            double f = layout_fpr(layout, kk, block_bits / bpk);
+            if (f < best) {
+                best = f;
+                k = kk;
+            }
+        }
+        if (best <= p) break;
+    }
+    *bpk_out = bpk;
+    *k_out = k;
+}
+
+// Blocks of the layout's size and k for n_keys at target_fpr. The block
+// index is taken with a 32-bit multiply-shift for SPLIT / REGISTER, so
+// those fail beyond 2^32 blocks.
+static int plan_blocks(size_t n_keys, double target_fpr, bb_layout_t layout,
+                       size_t *nblocks_out, uint32_t *k_out) {
     size_t m_bits = 0;
     uint32_t k = 0;
-    choose_m_k(n_keys, target_fpr, &m_bits, &k);
+    if (layout == BB_LAYOUT_BLOCKED) {
+        choose_m_k(n_keys, target_fpr, &m_bits, &k);
+    } else {
+        double bpk;
+        choose_layout(layout, target_fpr, &bpk, &k);
+        m_bits = (size_t)ceil(bpk * (double)n_keys);
+    }
 
-    // blocked bloom: number of 64B blocks
-    size_t nblocks = (m_bits + BLOCK_BITS - 1) / BLOCK_BITS;
+    size_t block_bytes = layout_block_bytes(layout);
+    size_t nblocks = (m_bits + 8 * block_bytes - 1) / (8 * block_bytes);
     if (nblocks == 0) nblocks = 1;
+    if (uses_fastrange(layout) && nblocks > UINT32_MAX) return EINVAL;
+
+    *nblocks_out = nblocks;
+    *k_out = k;
+    return 0;
+}
+
+size_t blocked_bloom_bytes_for(size_t n_keys, double target_fpr, bb_layout_t layout, uint32_t *k_out) {
+    if (n_keys == 0) return 0;
+    if (layout != BB_LAYOUT_BLOCKED && layout != BB_LAYOUT_SPLIT &&
+        layout != BB_LAYOUT_REGISTER && layout != BB_LAYOUT_COUNTING) {
+        return 0;
+    }
+    size_t nblocks;
+    uint32_t k;
+    if (plan_blocks(n_keys, target_fpr, layout, &nblocks, &k) != 0) return 0;
+    if (k_out) *k_out = k;
+    return nblocks * layout_block_bytes(layout);
+}
+
+double blocked_bloom_fpr_for(size_t n_keys, double target_fpr, bb_layout_t layout) {
+    if (n_keys == 0 || blocked_bloom_bytes_for(n_keys, target_fpr, layout, NULL) == 0) return 1.0;
+    size_t nblocks;
+    uint32_t k;
+    plan_blocks(n_keys, target_fpr, layout, &nblocks, &k);
+    return layout_fpr(layout, k, (double)n_keys / (double)nblocks);
+}
+
+int blocked_bloom_init(blocked_bloom_t *bf, size_t n_keys, double target_fpr) {
+    return blocked_bloom_init_layout(bf, n_keys, target_fpr, BB_LAYOUT_BLOCKED);
+}
+
+int blocked_bloom_init_layout(blocked_bloom_t *bf, size_t n_keys, double target_fpr,
+                              bb_layout_t layout) {
+    if (!bf || n_keys == 0) return EINVAL;
+    if (layout != BB_LAYOUT_BLOCKED && layout != BB_LAYOUT_SPLIT &&
+        layout != BB_LAYOUT_REGISTER && layout != BB_LAYOUT_COUNTING) {
+        return EINVAL;
+    }
+
+    size_t nblocks;
+    uint32_t k;
+    if (plan_blocks(n_keys, target_fpr, layout, &nblocks, &k) != 0) return EINVAL;
 
     // allocate contiguous array
-    size_t bytes = nblocks * (size_t)BLOCK_BYTES;
+    size_t block_bytes = layout_block_bytes(layout);
+    size_t bytes = nblocks * block_bytes;
 
     // align to cache line is nice but not required; calloc already zeroes.
     uint8_t *mem = (uint8_t*)calloc(1, bytes);
@@ -80,14 +427,89 @@ int blocked_bloom_init(blocked_bloom_t *bf, size_t n_keys, double target_fpr) {
 
     bf->blocks = mem;
     bf->nblocks = nblocks;
+    bf->block_bytes = block_bytes;
+    bf->layout = layout;
     bf->k = k;
     bf->n_keys_hint = n_keys;
     bf->target_fpr = target_fpr;
+    bf->path = blocked_bloom_best_path();
+    bf->backing = FMEM_DEFAULT;
+    bf->map = NULL;
+    bf->map_bytes = 0;
     return 0;
 }
 
+// COUNTING: counter i of a key is the top 7 bits of x + i*step. Taking
+// them mod 128 instead would leave only 128 x 64 distinct counter sets and
+// a noticeably higher FPR.
+static inline void cnt_mask(uint32_t x, uint32_t step, uint32_t k, uint64_t m[2]) {
+    m[0] = m[1] = 0;
+    for (uint32_t i = 0; i < k; i++) {
+        uint32_t c = (x + i * step) >> 25;
+        m[c >> 6] |= 1ULL << (c & 63u);
+    }
+}
+
+static inline int cnt_test(const blocked_bloom_t *bf, const uint8_t *block, uint32_t x, uint32_t step) {
+#if BB_HAVE_AVX2
+    if (bf->path == BB_PATH_AVX2) return cnt_query_avx2(block, x, step, bf->k);
+#endif
+    uint64_t m[2];
+    cnt_mask(x, step, bf->k, m);
+    for (int w = 0; w < 2; w++) {
+        for (uint64_t b = m[w]; b; b &= b - 1) {
+            if (cnt_get(block, (uint32_t)(64 * w + __builtin_ctzll(b))) == 0) return 0;
+        }
+    }
+    return 1;
+}
+
+static inline void cnt_update(const blocked_bloom_t *bf, uint8_t *block, uint32_t x, uint32_t step,
+                              int dir) {
+#if BB_HAVE_AVX2
+    if (bf->path == BB_PATH_AVX2) {
+        cnt_update_avx2(block, x, step, bf->k, dir);
+        return;
+    }
+#endif
+    uint64_t m[2];
+    cnt_mask(x, step, bf->k, m);
+    for (int w = 0; w < 2; w++) {
+        for (uint64_t b = m[w]; b; b &= b - 1) {
+            uint32_t c = (uint32_t)(64 * w + __builtin_ctzll(b));
+            if (cnt_get(block, c) != 15u) cnt_add(block, c, dir);
+        }
+    }
+}
+
+// SPLIT / REGISTER: one hash, the high half picks the block and the low
+// half drives the bit positions.
+static inline uint8_t *layout_block(const blocked_bloom_t *bf, uint64_t h) {
+    size_t b = (size_t)(((h >> 32) * (uint64_t)bf->nblocks) >> 32);
+    return bf->blocks + b * bf->block_bytes;
+}
+
 int blocked_bloom_insert(blocked_bloom_t *bf, uint64_t key) {
-    if (!bf || !bf->blocks || bf->nblocks == 0) return EINVAL;
+    if (!bf || !bf->blocks || bf->nblocks == 0 || bf->map) return EINVAL;
+
+    if (bf->layout == BB_LAYOUT_SPLIT) {
+        uint64_t h = hash64(key, 0x123456789abcdef0ULL);
+        uint8_t *block = layout_block(bf, h);
+#if BB_HAVE_AVX2
+        if (bf->path == BB_PATH_AVX2) {
+            split_insert_avx2(block, (uint32_t)h);
+            return 0;
+        }
+#endif
+        uint32_t *lanes = (uint32_t*)block;
+        for (uint32_t i = 0; i < SPLIT_LANES; i++) lanes[i] |= split_bit((uint32_t)h, i);
+        return 0;
+    }
+    if (bf->layout == BB_LAYOUT_REGISTER) {
+        uint64_t h = hash64(key, 0x123456789abcdef0ULL);
+        *(uint64_t*)layout_block(bf, h) |= reg_mask((uint32_t)h, bf->k);
+        return 0;
+    }
 
     // Two independent hashes:
     // h1 selects block; h2 generates bit positions inside the block.
@@ -101,6 +523,18 @@ int blocked_bloom_insert(blocked_bloom_t *bf, uint64_t key) {
     uint32_t step = (uint32_t)(h2 >> 32) | 1u;
     uint32_t x = (uint32_t)h2;
 
+    if (bf->layout == BB_LAYOUT_COUNTING) {
+        cnt_update(bf, block, x, step, +1);
+        return 0;
+    }
+
+#if BB_HAVE_AVX2
+    if (bf->path == BB_PATH_AVX2) {
+        block_insert_avx2(block, x, step, bf->k);
+        return 0;
+    }
+#endif
+
     for (uint32_t i = 0; i < bf->k; i++) {
         uint32_t bit = (x + i * step) & (BLOCK_BITS - 1u); 
         block_set_bit(block, bit);
@@ -108,36 +542,359 @@ int blocked_bloom_insert(blocked_bloom_t *bf, uint64_t key) {
     return 0;
 }
 
-int blocked_bloom_query(const blocked_bloom_t *bf, uint64_t key) {
-    if (!bf || !bf->blocks || bf->nblocks == 0) return 0;
+// Block address plus the double-hashing state for one key (x alone for
+// SPLIT / REGISTER).
+typedef struct {
+    const uint8_t *block;
+    uint32_t x;
+    uint32_t step;
+} bb_probe_t;
+
+static inline void bb_locate(const blocked_bloom_t *bf, uint64_t key, bb_probe_t *p) {
+    if (uses_fastrange(bf->layout)) {
+        uint64_t h = hash64(key, 0x123456789abcdef0ULL);
+        p->block = layout_block(bf, h);
+        p->x = (uint32_t)h;
+        p->step = 0;
+        return;
+    }
 
     uint64_t h1 = hash64(key, 0x123456789abcdef0ULL);
     uint64_t h2 = hash64(key, 0xfedcba9876543210ULL);
 
     size_t b = (size_t)(h1 % bf->nblocks);
-    const uint8_t *block = bf->blocks + b * (size_t)BLOCK_BYTES;
+    p->block = bf->blocks + b * (size_t)BLOCK_BYTES;
+    p->step = (uint32_t)(h2 >> 32) | 1u;
+    p->x = (uint32_t)h2;
+}
 
-    uint32_t step = (uint32_t)(h2 >> 32) | 1u;
-    uint32_t x = (uint32_t)h2;
+static inline int bb_test(const blocked_bloom_t *bf, const bb_probe_t *p) {
+    if (bf->layout == BB_LAYOUT_SPLIT) {
+#if BB_HAVE_AVX2
+        if (bf->path == BB_PATH_AVX2) return split_query_avx2(p->block, p->x);
+#endif
+        const uint32_t *lanes = (const uint32_t*)p->block;
+        for (uint32_t i = 0; i < SPLIT_LANES; i++) {
+            if (!(lanes[i] & split_bit(p->x, i))) return 0;
+        }
+        return 1;
+    }
+    if (bf->layout == BB_LAYOUT_REGISTER) {
+        uint64_t m = reg_mask(p->x, bf->k);
+        return (*(const uint64_t*)p->block & m) == m;
+    }
+    if (bf->layout == BB_LAYOUT_COUNTING) return cnt_test(bf, p->block, p->x, p->step);
+
+#if BB_HAVE_AVX2
+    if (bf->path == BB_PATH_AVX2) return block_query_avx2(p->block, p->x, p->step, bf->k);
+#endif
 
     for (uint32_t i = 0; i < bf->k; i++) {
-        uint32_t bit = (x + i * step) & (BLOCK_BITS - 1u);
-        if (!block_test_bit(block, bit)) return 0; 
+        uint32_t bit = (p->x + i * p->step) & (BLOCK_BITS - 1u);
+        if (!block_test_bit(p->block, bit)) return 0; 
     }
     return 1; 
 }
 
+int blocked_bloom_query(const blocked_bloom_t *bf, uint64_t key) {
+    if (!bf || !bf->blocks || bf->nblocks == 0) return 0;
+
+    bb_probe_t p;
+    bb_locate(bf, key, &p);
+    return bb_test(bf, &p);
+}
+
+// The bits a key sets, as masks over the 64-bit words of its block;
+// returns the number of words (block_bytes / 8). Little-endian, like the
+// AVX2 paths.
+static inline size_t bb_word_masks(const blocked_bloom_t *bf, const bb_probe_t *p, uint64_t m[8]) {
+    switch (bf->layout) {
+    case BB_LAYOUT_SPLIT:
+        memset(m, 0, 4 * sizeof(uint64_t));
+        for (uint32_t i = 0; i < SPLIT_LANES; i++) {
+            m[i >> 1] |= (uint64_t)split_bit(p->x, i) << (32 * (i & 1u));
+        }
+        return 4;
+    case BB_LAYOUT_REGISTER:
+        m[0] = reg_mask(p->x, bf->k);
+        return 1;
+    default:
+        memset(m, 0, 8 * sizeof(uint64_t));
+        for (uint32_t i = 0; i < bf->k; i++) {
+            uint32_t bit = (p->x + i * p->step) & (BLOCK_BITS - 1u);
+            m[bit >> 6] |= 1ULL << (bit & 63u);
+        }
+        return 8;
+    }
+}
+
+int blocked_bloom_insert_mt(blocked_bloom_t *bf, uint64_t key) {
+    if (!bf || !bf->blocks || bf->nblocks == 0 || bf->map || bf->layout == BB_LAYOUT_COUNTING) return EINVAL;
+
+    bb_probe_t p;
+    bb_locate(bf, key, &p);
+    uint64_t m[8];
+    size_t nw = bb_word_masks(bf, &p, m);
+    uint64_t *w = (uint64_t*)p.block;
+    for (size_t i = 0; i < nw; i++) {
+        // skip words that already hold every bit: no write, no line bouncing
+        if (m[i] && (__atomic_load_n(&w[i], __ATOMIC_RELAXED) & m[i]) != m[i]) {
+            __atomic_fetch_or(&w[i], m[i], __ATOMIC_RELAXED);
+        }
+    }
+    return 0;
+}
+
+int blocked_bloom_query_mt(const blocked_bloom_t *bf, uint64_t key) {
+    if (!bf || !bf->blocks || bf->nblocks == 0 || bf->layout == BB_LAYOUT_COUNTING) return 0;
+
+    bb_probe_t p;
+    bb_locate(bf, key, &p);
+    uint64_t m[8];
+    size_t nw = bb_word_masks(bf, &p, m);
+    const uint64_t *w = (const uint64_t*)p.block;
+    for (size_t i = 0; i < nw; i++) {
+        if ((__atomic_load_n(&w[i], __ATOMIC_RELAXED) & m[i]) != m[i]) return 0;
+    }
+    return 1;
+}
+
+typedef struct {
+    blocked_bloom_t *bf;
+    const uint64_t *keys;
+    size_t lo, hi;
+} bb_build_arg_t;
+
+static void *bb_build_slice(void *arg) {
+    bb_build_arg_t *a = (bb_build_arg_t*)arg;
+    for (size_t i = a->lo; i < a->hi; i++) blocked_bloom_insert_mt(a->bf, a->keys[i]);
+    return NULL;
+}
+
+int blocked_bloom_build_parallel(blocked_bloom_t *bf, const uint64_t *keys, size_t n, int nthreads) {
+    if (!bf || !bf->blocks || bf->layout == BB_LAYOUT_COUNTING || (!keys && n)) return EINVAL;
+    if (nthreads < 1) nthreads = 1;
+    if (nthreads > BB_MAX_THREADS) nthreads = BB_MAX_THREADS;
+    if (nthreads == 1) {
+        for (size_t i = 0; i < n; i++) blocked_bloom_insert(bf, keys[i]);
+        return 0;
+    }
+
+    pthread_t tids[BB_MAX_THREADS];
+    bb_build_arg_t args[BB_MAX_THREADS];
+    int started[BB_MAX_THREADS];
+    for (int t = 0; t < nthreads; t++) {
+        args[t] = (bb_build_arg_t){ .bf = bf, .keys = keys,
+                                    .lo = n * (size_t)t / (size_t)nthreads,
+                                    .hi = n * (size_t)(t + 1) / (size_t)nthreads };
+        started[t] = (t > 0) && pthread_create(&tids[t], NULL, bb_build_slice, &args[t]) == 0;
+    }
+    // slice 0, and any slice whose thread did not start, on this thread
+    for (int t = 0; t < nthreads; t++) {
+        if (!started[t]) bb_build_slice(&args[t]);
+    }
+    for (int t = 0; t < nthreads; t++) {
+        if (started[t]) pthread_join(tids[t], NULL);
+    }
+    return 0;
+}
+
+// Block a key lands in; the same choice bb_locate makes.
+static inline size_t bb_block_index(const blocked_bloom_t *bf, uint64_t key) {
+    uint64_t h = hash64(key, 0x123456789abcdef0ULL);
+    if (uses_fastrange(bf->layout)) return (size_t)(((h >> 32) * (uint64_t)bf->nblocks) >> 32);
+    return (size_t)(h % bf->nblocks);
+}
+
+int blocked_bloom_insert_bulk(blocked_bloom_t *bf, const uint64_t *keys, size_t n) {
+    if (!bf || !bf->blocks || bf->nblocks == 0 || bf->map || (!keys && n)) return EINVAL;
+
+    // partition p covers blocks [p << shift, (p + 1) << shift)
+    unsigned shift = 0;
+    while ((bf->block_bytes << shift) < BB_BULK_PART_BYTES) shift++;
+    while ((bf->nblocks >> shift) >= BB_BULK_MAX_PARTS) shift++;
+    size_t nparts = ((bf->nblocks - 1) >> shift) + 1;
+    size_t chunk = (n < BB_BULK_CHUNK) ? n : BB_BULK_CHUNK;
+
+    uint64_t *tmp = NULL;
+    uint16_t *pid = NULL;
+    size_t *end = NULL;
+    if (nparts > 1 && chunk > 0) {
+        tmp = (uint64_t*)malloc(chunk * sizeof(uint64_t));
+        pid = (uint16_t*)malloc(chunk * sizeof(uint16_t));
+        end = (size_t*)malloc((nparts + 1) * sizeof(size_t));
+    }
+    if (!tmp || !pid || !end) {
+        free(tmp);
+        free(pid);
+        free(end);
+        for (size_t i = 0; i < n; i++) blocked_bloom_insert(bf, keys[i]);
+        return 0;
+    }
+
+    for (size_t base = 0; base < n; base += chunk) {
+        const uint64_t *src = keys + base;
+        size_t m = (n - base < chunk) ? n - base : chunk;
+
+        memset(end, 0, (nparts + 1) * sizeof(size_t));
+        for (size_t i = 0; i < m; i++) {
+            pid[i] = (uint16_t)(bb_block_index(bf, src[i]) >> shift);
+            end[pid[i] + 1]++;
+        }
+        for (size_t p = 0; p < nparts; p++) end[p + 1] += end[p];
+        // end[p] starts at partition p's first slot and is left at its end
+        for (size_t i = 0; i < m; i++) tmp[end[pid[i]]++] = src[i];
+
+        for (size_t p = 0, i = 0; p < nparts; p++) {
+            for (; i < end[p]; i++) blocked_bloom_insert(bf, tmp[i]);
+        }
+    }
+
+    free(tmp);
+    free(pid);
+    free(end);
+    return 0;
+}
+
+int blocked_bloom_delete(blocked_bloom_t *bf, uint64_t key) {
+    if (!bf || !bf->blocks || bf->nblocks == 0 || bf->map || bf->layout != BB_LAYOUT_COUNTING) return EINVAL;
+
+    bb_probe_t p;
+    bb_locate(bf, key, &p);
+    if (!cnt_test(bf, p.block, p.x, p.step)) return ENOENT;
+    cnt_update(bf, (uint8_t*)p.block, p.x, p.step, -1);
+    return 0;
+}
+
+size_t blocked_bloom_query_batch_dist(const blocked_bloom_t *bf, const uint64_t *keys, size_t n,
+                                      uint64_t *out_bitmap, size_t dist) {
+    if (!bf || !bf->blocks || bf->nblocks == 0 || !keys || !out_bitmap) return 0;
+    if (dist > BB_BATCH_RING) dist = BB_BATCH_RING;
+
+    memset(out_bitmap, 0, ((n + 63) / 64) * sizeof(uint64_t));
+
+    // ring[i % RING] holds key i once it has been hashed and prefetched
+    bb_probe_t ring[BB_BATCH_RING];
+    size_t hits = 0;
+
+    size_t head = (dist < n) ? dist : n;
+    for (size_t i = 0; i < head; i++) {
+        bb_probe_t *p = &ring[i & (BB_BATCH_RING - 1)];
+        bb_locate(bf, keys[i], p);
+        __builtin_prefetch(p->block, 0, 3);
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        bb_probe_t cur;
+        if (dist == 0) bb_locate(bf, keys[i], &cur);
+        else cur = ring[i & (BB_BATCH_RING - 1)];
+
+        size_t ahead = i + dist;
+        if (dist && ahead < n) {
+            bb_probe_t *p = &ring[ahead & (BB_BATCH_RING - 1)];
+            bb_locate(bf, keys[ahead], p);
+            __builtin_prefetch(p->block, 0, 3);
+        }
+
+        if (bb_test(bf, &cur)) {
+            out_bitmap[i >> 6] |= 1ULL << (i & 63);
+            hits++;
+        }
+    }
+    return hits;
+}
+
+size_t blocked_bloom_query_batch(const blocked_bloom_t *bf, const uint64_t *keys, size_t n,
+                                 uint64_t *out_bitmap) {
+    return blocked_bloom_query_batch_dist(bf, keys, n, out_bitmap, BB_PREFETCH_DIST);
+}
+
 size_t blocked_bloom_bytes(const blocked_bloom_t *bf) {
     if (!bf || !bf->blocks) return 0;
-    return bf->nblocks * (size_t)BLOCK_BYTES;
+    return bf->nblocks * bf->block_bytes;
+}
+
+int blocked_bloom_set_backing(blocked_bloom_t *bf, fmem_backing_t backing, int prefault) {
+    if (!bf || !bf->blocks || bf->map) return EINVAL;
+
+    size_t bytes = blocked_bloom_bytes(bf);
+    fmem_backing_t got;
+    uint8_t *mem = (uint8_t*)fmem_alloc(bytes, backing, prefault, &got);
+    if (!mem) return ENOMEM;
+    memcpy(mem, bf->blocks, bytes);
+    fmem_free(bf->blocks, bytes, bf->backing);
+    bf->blocks = mem;
+    bf->backing = got;
+    return 0;
+}
+
+// params: nblocks, k, n_keys_hint, target_fpr (bits), layout; one section
+// of blocks
+int blocked_bloom_save(const blocked_bloom_t *bf, const char *path) {
+    if (!bf || !bf->blocks) return EINVAL;
+
+    fio_header_t h;
+    memset(&h, 0, sizeof(h));
+    h.kind = FIO_KIND_BB;
+    h.params[0] = bf->nblocks;
+    h.params[1] = bf->k;
+    h.params[2] = bf->n_keys_hint;
+    memcpy(&h.params[3], &bf->target_fpr, sizeof(double));
+    h.params[4] = (uint64_t)bf->layout;
+    h.nsections = 1;
+    h.sections[0].bytes = bf->nblocks * (uint64_t)bf->block_bytes;
+
+    const void *data[1] = { bf->blocks };
+    return fio_write(path, &h, data);
+}
+
+int blocked_bloom_open_mmap(blocked_bloom_t *bf, const char *path) {
+    if (!bf) return EINVAL;
+
+    fio_header_t h;
+    void *map = NULL;
+    size_t map_bytes = 0;
+    int err = fio_map(path, FIO_KIND_BB, &h, &map, &map_bytes);
+    if (err) return err;
+
+    bb_layout_t layout = (bb_layout_t)h.params[4];
+    size_t block_bytes = layout_block_bytes(layout);
+    if (h.nsections != 1 || h.params[0] == 0 || h.params[1] < 1 || h.params[1] > 16 ||
+        h.params[4] > BB_LAYOUT_COUNTING ||
+        (layout == BB_LAYOUT_SPLIT && h.params[1] != SPLIT_LANES) ||
+        (uses_fastrange(layout) && h.params[0] > UINT32_MAX) ||
+        h.sections[0].bytes != h.params[0] * block_bytes) {
+        munmap(map, map_bytes);
+        return EINVAL;
+    }
+
+    bf->blocks = (uint8_t*)fio_section(map, &h, 0);
+    bf->nblocks = (size_t)h.params[0];
+    bf->block_bytes = block_bytes;
+    bf->layout = layout;
+    bf->k = (uint32_t)h.params[1];
+    bf->n_keys_hint = (size_t)h.params[2];
+    memcpy(&bf->target_fpr, &h.params[3], sizeof(double));
+    bf->path = blocked_bloom_best_path();
+    bf->backing = FMEM_DEFAULT;
+    bf->map = map;
+    bf->map_bytes = map_bytes;
+    return 0;
 }
 
 void blocked_bloom_free(blocked_bloom_t *bf) {
     if (!bf) return;
-    free(bf->blocks);
+    if (bf->map) munmap(bf->map, bf->map_bytes);
+    else fmem_free(bf->blocks, blocked_bloom_bytes(bf), bf->backing);
+    bf->map = NULL;
+    bf->map_bytes = 0;
     bf->blocks = NULL;
     bf->nblocks = 0;
+    bf->block_bytes = 0;
+    bf->layout = BB_LAYOUT_BLOCKED;
     bf->k = 0;
     bf->n_keys_hint = 0;
     bf->target_fpr = 0.0;
+    bf->path = BB_PATH_SCALAR;
+    bf->backing = FMEM_DEFAULT;
 }
@@ -2,20 +2,123 @@
 #include <stdint.h>
 #include <stddef.h>
 
+#include "filter_mem.h"
+
+// Probe implementation. AVX2 builds the whole k-bit block mask in registers
+// and tests it with one compare; both paths use the same bit layout.
+typedef enum {
+    BB_PATH_SCALAR = 0,
+    BB_PATH_AVX2   = 1,
+} bb_path_t;
+
+// Bit layout. BLOCKED spreads k bits over a 64-byte block by double
+// hashing. SPLIT is a split-block filter (Parquet/Impala): 32-byte blocks of
+// 8 x 32-bit lanes and exactly one bit per lane, so k = 8. REGISTER puts all
+// k bits in a single 64-bit word. COUNTING keeps the 64-byte block but
+// holds 128 4-bit saturating counters, k of them per key, so keys can be
+// deleted; a counter that reaches 15 sticks there. All but BLOCKED size
+// themselves from a model of their own FPR instead of the classic Bloom
+// formula.
+typedef enum {
+    BB_LAYOUT_BLOCKED  = 0,
+    BB_LAYOUT_SPLIT    = 1,
+    BB_LAYOUT_REGISTER = 2,
+    BB_LAYOUT_COUNTING = 3,
+} bb_layout_t;
+
 typedef struct {
     uint8_t *blocks;        
     size_t   nblocks;     
+    size_t   block_bytes;   // 64, 32 or 8 by layout
+    bb_layout_t layout;
     uint32_t k;            
     size_t   n_keys_hint;   
     double   target_fpr;  
+    bb_path_t path;         // picked by CPUID in init
+    fmem_backing_t backing; // of blocks (filter_mem.h)
+
+    // set by blocked_bloom_open_mmap: blocks live in this read-only mapping
+    void    *map;
+    size_t   map_bytes;
 } blocked_bloom_t;
 
 int  blocked_bloom_init(blocked_bloom_t *bf, size_t n_keys, double target_fpr);
 
+// Same as blocked_bloom_init with a chosen layout; EINVAL on an unknown one.
+int  blocked_bloom_init_layout(blocked_bloom_t *bf, size_t n_keys, double target_fpr,
+                               bb_layout_t layout);
+
 int  blocked_bloom_insert(blocked_bloom_t *bf, uint64_t key);
 
+// COUNTING only (EINVAL otherwise): decrements key's counters. ENOENT, with
+// nothing changed, if one of them is already zero. Deleting a key that was
+// never inserted can cause false negatives for others.
+int  blocked_bloom_delete(blocked_bloom_t *bf, uint64_t key);
+
 int  blocked_bloom_query(const blocked_bloom_t *bf, uint64_t key);
 
+// Batched lookup: bit i of out_bitmap (ceil(n/64) words) is set iff keys[i]
+// may be present. Keys are hashed and their blocks prefetched `dist` keys
+// ahead of the probe (0 = no prefetch, max 64). Returns the number of hits.
+#define BB_PREFETCH_DIST 16
+size_t blocked_bloom_query_batch(const blocked_bloom_t *bf, const uint64_t *keys, size_t n,
+                                 uint64_t *out_bitmap);
+size_t blocked_bloom_query_batch_dist(const blocked_bloom_t *bf, const uint64_t *keys, size_t n,
+                                      uint64_t *out_bitmap, size_t dist);
+
+// Thread-safe mode for every layout but COUNTING (EINVAL there). Inserts
+// set bits with an atomic fetch-or per touched 64-bit word, so no locks are
+// needed; lookups load the same words atomically. A key is visible to every
+// thread once its insert has returned. Plain inserts and lookups must not
+// run concurrently with these.
+int  blocked_bloom_insert_mt(blocked_bloom_t *bf, uint64_t key);
+int  blocked_bloom_query_mt(const blocked_bloom_t *bf, uint64_t key);
+
+// Inserts keys[0..n) with nthreads threads (each a contiguous slice, via
+// blocked_bloom_insert_mt). Slices whose thread cannot be started are
+// inserted by the caller. EINVAL for COUNTING.
+#define BB_MAX_THREADS 256
+int  blocked_bloom_build_parallel(blocked_bloom_t *bf, const uint64_t *keys, size_t n, int nthreads);
+
+// Bulk insert for filters much larger than the cache. Keys are
+// radix-partitioned by block range in one pass (up to BB_BULK_CHUNK keys at
+// a time) and each partition is inserted while its slice of the filter
+// stays cache-resident, instead of one DRAM miss per key. Same bits as
+// inserting one by one. Small filters, or a failed temp allocation, take
+// the per-key loop. EINVAL on a mapped filter.
+#define BB_BULK_CHUNK (1u << 24)
+int  blocked_bloom_insert_bulk(blocked_bloom_t *bf, const uint64_t *keys, size_t n);
+
+// Best path supported by this CPU.
+bb_path_t blocked_bloom_best_path(void);
+
+// Force a path; EINVAL if the CPU does not support it.
+int  blocked_bloom_set_path(blocked_bloom_t *bf, bb_path_t path);
+
 size_t blocked_bloom_bytes(const blocked_bloom_t *bf);
 
+// Bytes blocked_bloom_init_layout would allocate for these arguments, and
+// the k it would pick in *k_out (if not NULL), without allocating; 0 on
+// bad arguments.
+size_t blocked_bloom_bytes_for(size_t n_keys, double target_fpr, bb_layout_t layout, uint32_t *k_out);
+
+// Modelled FPR of that filter once it holds n_keys: Poisson block loads,
+// as the non-BLOCKED layouts are sized by. BLOCKED is sized by the classic
+// formula, which ignores block load variance and its double-hashed bit
+// patterns, so it comes out higher than target_fpr. 1.0 on bad arguments.
+double blocked_bloom_fpr_for(size_t n_keys, double target_fpr, bb_layout_t layout);
+
+// Moves the blocks into memory of the given backing (filter_mem.h),
+// prefaulted if asked; bf->backing records what was obtained. EINVAL on a
+// mapped filter, ENOMEM if no memory at all.
+int  blocked_bloom_set_backing(blocked_bloom_t *bf, fmem_backing_t backing, int prefault);
+
+// Writes the filter in the shared on-disk format (filter_io.h).
+int  blocked_bloom_save(const blocked_bloom_t *bf, const char *path);
+
+// Opens a saved filter in place from a read-only mapping: queries only, as
+// the pages are mapped PROT_READ; inserts and deletes return EINVAL.
+// blocked_bloom_free unmaps it. EINVAL on a bad file.
+int  blocked_bloom_open_mmap(blocked_bloom_t *bf, const char *path);
+
 void blocked_bloom_free(blocked_bloom_t *bf);
@@ -0,0 +1,128 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define LAT_HAVE_TSC 1
+#else
+#define LAT_HAVE_TSC 0
+#endif
+
+// Per-operation latency for the benchmarks. Timestamps are TSC ticks read
+// with a fenced RDTSC / RDTSCP pair (CLOCK_MONOTONIC ns elsewhere), which
+// costs a few ns where clock_gettime costs tens. lat_calibrate() measures
+// ns per tick against CLOCK_MONOTONIC and the cost of an empty start/stop
+// pair, which lat_hist_add subtracts. Samples go into a log-linear
+// histogram (HDR style): exact below 2^LAT_SUB_BITS ticks, then
+// 2^LAT_SUB_BITS buckets per power of two, so any quantile is within
+// 1/2^LAT_SUB_BITS of the true value in fixed memory.
+#define LAT_SUB_BITS 6
+#define LAT_SUB      (1u << LAT_SUB_BITS)
+#define LAT_BUCKETS  ((64 - LAT_SUB_BITS + 1) * LAT_SUB)
+
+typedef struct {
+    uint64_t count;
+    uint64_t max;
+    uint64_t bucket[LAT_BUCKETS];
+} lat_hist_t;
+
+typedef struct {
+    double   ns_per_tick;
+    uint64_t overhead;    // ticks of an empty lat_start / lat_stop pair
+} lat_clock_t;
+
+static inline uint64_t lat_mono_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+// The fences keep the timed operation from moving across either read.
+static inline uint64_t lat_start(void) {
+#if LAT_HAVE_TSC
+    _mm_lfence();
+    return __rdtsc();
+#else
+    return lat_mono_ns();
+#endif
+}
+
+static inline uint64_t lat_stop(void) {
+#if LAT_HAVE_TSC
+    unsigned aux;
+    uint64_t t = __rdtscp(&aux);
+    _mm_lfence();
+    return t;
+#else
+    return lat_mono_ns();
+#endif
+}
+
+// Spins for about ms milliseconds; the TSC is assumed invariant.
+static inline lat_clock_t lat_calibrate(unsigned ms) {
+    lat_clock_t c = { 1.0, 0 };
+#if LAT_HAVE_TSC
+    uint64_t n0 = lat_mono_ns(), t0 = lat_start();
+    uint64_t n1, t1;
+    do {
+        n1 = lat_mono_ns();
+        t1 = lat_stop();
+    } while (n1 - n0 < (uint64_t)ms * 1000000ULL);
+    if (t1 > t0) c.ns_per_tick = (double)(n1 - n0) / (double)(t1 - t0);
+#else
+    (void)ms;
+#endif
+    uint64_t best = UINT64_MAX;
+    for (int i = 0; i < 1000; i++) {
+        uint64_t a = lat_start();
+        uint64_t b = lat_stop();
+        if (b - a < best) best = b - a;
+    }
+    c.overhead = best;
+    return c;
+}
+
+static inline void lat_hist_reset(lat_hist_t *h) {
+    memset(h, 0, sizeof(*h));
+}
+
+static inline size_t lat_bucket(uint64_t v) {
+    if (v < LAT_SUB) return (size_t)v;
+    unsigned e = 63u - (unsigned)__builtin_clzll(v) - LAT_SUB_BITS;
+    return ((size_t)(e + 1) << LAT_SUB_BITS) + (size_t)((v >> e) - LAT_SUB);
+}
+
+// Midpoint of the values that land in bucket i.
+static inline uint64_t lat_bucket_value(size_t i) {
+    if (i < LAT_SUB) return i;
+    unsigned e = (unsigned)(i >> LAT_SUB_BITS) - 1u;
+    uint64_t lo = ((uint64_t)(i & (LAT_SUB - 1)) + LAT_SUB) << e;
+    return lo + (((1ULL << e) - 1) >> 1);
+}
+
+// Adds the interval [t0, t1] less the timer's own cost.
+static inline void lat_hist_add(lat_hist_t *h, const lat_clock_t *c, uint64_t t0, uint64_t t1) {
+    uint64_t d = t1 - t0;
+    d = (d > c->overhead) ? d - c->overhead : 0;
+    h->bucket[lat_bucket(d)]++;
+    h->count++;
+    if (d > h->max) h->max = d;
+}
+
+// Quantile q in [0, 1] in ns; 0 for an empty histogram.
+static inline double lat_hist_quantile_ns(const lat_hist_t *h, const lat_clock_t *c, double q) {
+    if (h->count == 0) return 0.0;
+    uint64_t rank = (uint64_t)(q * (double)(h->count - 1)) + 1;
+    uint64_t seen = 0;
+    for (size_t i = 0; i < LAT_BUCKETS; i++) {
+        seen += h->bucket[i];
+        if (seen >= rank) {
+            uint64_t v = lat_bucket_value(i);
+            return (double)(v < h->max ? v : h->max) * c->ns_per_tick;
+        }
+    }
+    return (double)h->max * c->ns_per_tick;
+}
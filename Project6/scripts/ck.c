@@ -1,11 +1,21 @@
+#define _DEFAULT_SOURCE
 #include "ck.h"
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
 
+#include "filter_io.h"
+
 #define BUCKET_SIZE 4
 #define MAX_KICKS 500
-#define STASH_CAP 16
+#define CK_BATCH_RING 64
+#define CK_LOCK_STRIPES (1u << 16)
+#define CK_MT_RETRIES 8
+#define CK_BFS_MAX_DEPTH 5
+#define CK_BFS_MAX_NODES 1024
+#define CK_MAX_LEVELS 64
+#define CK_BULK_PART_BYTES (256u << 10)   // table bytes per partition, ~L2
+#define CK_BULK_MAX_PARTS 1024            // fan-out of a partition pass
 
 static inline uint64_t splitmix64(uint64_t *x) {
     uint64_t z = (*x += 0x9e3779b97f4a7c15ULL);
@@ -14,234 +24,896 @@ static inline uint64_t splitmix64(uint64_t *x) {
     return z ^ (z >> 31);
 }
 
-static inline uint32_t fingerprint(uint64_t key, uint32_t mask) {
+// One hash per key; every level derives its bucket index from it.
+static inline uint64_t key_hash(uint64_t key) {
     uint64_t x = key;
-    uint32_t fp = (uint32_t)splitmix64(&x) & mask;
+    return splitmix64(&x);
+}
+
+// High half of the hash, so the fingerprint is independent of the bucket
+// index taken from the low bits.
+static inline uint32_t fingerprint(uint64_t h, uint32_t mask) {
+    uint32_t fp = (uint32_t)(h >> 32) & mask;
     return fp ? fp : 1;
 }
 
-static inline size_t hash1(uint64_t key, size_t nb) {
-    uint64_t x = key;
-    return (size_t)splitmix64(&x) & (nb - 1);
+static inline size_t hash1(uint64_t h, size_t nb) {
+    return (size_t)h & (nb - 1);
 }
 
 static inline size_t hash2(size_t h1, uint32_t fp, size_t nb) {
     return (h1 ^ ((size_t)fp * 0x5bd1e995u)) & (nb - 1);
 }
 
-static inline int bucket_has_fp(const ck_slot_t *b, uint32_t fp) {
-    for (size_t i = 0; i < BUCKET_SIZE; i++) {
-        if (b[i].fp == fp) return 1;
+// A bucket is BUCKET_SIZE lanes of lane_bits (8, 16 or 32) bits: one 32-bit
+// word for 8-bit fingerprints, one 64-bit word up to 16 bits, two above.
+static inline uint8_t *bucket_ptr(const cuckoo_filter_t *cf, size_t i) {
+    return (uint8_t*)cf->table + i * cf->bucket_bytes;
+}
+
+static inline uint32_t lane_get(const cuckoo_filter_t *cf, size_t b, size_t s) {
+    const uint8_t *p = bucket_ptr(cf, b);
+    switch (cf->lane_bits) {
+    case 8:  return p[s];
+    case 16: return ((const uint16_t*)p)[s];
+    default: return ((const uint32_t*)p)[s];
     }
-    return 0;
 }
 
-static inline int bucket_insert_fp(ck_slot_t *b, uint32_t fp) {
-    for (size_t i = 0; i < BUCKET_SIZE; i++) {
-        if (b[i].fp == 0) {
-            b[i].fp = fp;
-            return 1;
-        }
+static inline void lane_set(cuckoo_filter_t *cf, size_t b, size_t s, uint32_t fp) {
+    uint8_t *p = bucket_ptr(cf, b);
+    switch (cf->lane_bits) {
+    case 8:  p[s] = (uint8_t)fp; break;
+    case 16: ((uint16_t*)p)[s] = (uint16_t)fp; break;
+    default: ((uint32_t*)p)[s] = fp; break;
     }
-    return 0;
 }
 
-static inline int bucket_delete_fp(ck_slot_t *b, uint32_t fp) {
-    for (size_t i = 0; i < BUCKET_SIZE; i++) {
-        if (b[i].fp == fp) {
-            b[i].fp = 0;
-            return 1;
-        }
+// Bucket i as up to two 64-bit words (8-bit lanes fill the low half of w[0]).
+static inline void bucket_load(const cuckoo_filter_t *cf, size_t i, uint64_t *w) {
+    const uint8_t *p = bucket_ptr(cf, i);
+    if (cf->lane_bits == 8) {
+        uint32_t x;
+        memcpy(&x, p, sizeof(x));
+        w[0] = x;
+    } else {
+        memcpy(w, p, cf->bucket_bytes);
     }
-    return 0;
 }
 
-static inline int stash_insert(cuckoo_filter_t *cf, uint64_t key, uint32_t fp) {
-    if (cf->stash_size >= cf->stash_cap) return 0;
-    cf->stash_keys[cf->stash_size] = key;
-    cf->stash_fp[cf->stash_size] = fp;
-    cf->stash_size++;
-    cf->stats.stash_inserts++;
-    cf->nitems++;
-    return 1;
+// SWAR "has value": nonzero iff some lane of x equals fp. lo has a 1 in the
+// lowest bit of every lane, hi in the highest.
+static inline int has_lane(uint64_t x, uint32_t fp, uint64_t lo, uint64_t hi) {
+    x ^= (uint64_t)fp * lo;
+    return ((x - lo) & ~x & hi) != 0;
 }
 
-static inline int stash_query(cuckoo_filter_t *cf, uint64_t key) {
-    for (size_t i = 0; i < cf->stash_size; i++) {
-        if (cf->stash_keys[i] == key) {
-            cf->stats.stash_hits++;
-            return 1;
-        }
+#define LO8  0x0101010101010101ULL
+#define HI8  0x8080808080808080ULL
+#define LO16 0x0001000100010001ULL
+#define HI16 0x8000800080008000ULL
+#define LO32 0x0000000100000001ULL
+#define HI32 0x8000000080000000ULL
+
+// fp in either candidate bucket. fp is never 0, so empty lanes never match.
+static inline int pair_has_fp(const cuckoo_filter_t *cf, const uint64_t *w1, const uint64_t *w2, uint32_t fp) {
+    switch (cf->lane_bits) {
+    case 8:  return has_lane(w1[0] | (w2[0] << 32), fp, LO8, HI8);
+    case 16: return has_lane(w1[0], fp, LO16, HI16) | has_lane(w2[0], fp, LO16, HI16);
+    default: return has_lane(w1[0], fp, LO32, HI32) | has_lane(w1[1], fp, LO32, HI32) |
+                    has_lane(w2[0], fp, LO32, HI32) | has_lane(w2[1], fp, LO32, HI32);
     }
-    return 0;
 }
 
-static inline int stash_delete(cuckoo_filter_t *cf, uint64_t key) {
-    for (size_t i = 0; i < cf->stash_size; i++) {
-        if (cf->stash_keys[i] == key) {
-            cf->stash_keys[i] = cf->stash_keys[cf->stash_size - 1];
-            cf->stash_fp[i] = cf->stash_fp[cf->stash_size - 1];
-            cf->stash_size--;
-            cf->nitems--;
-            return 1;
-        }
+static inline int bucket_find(const cuckoo_filter_t *cf, size_t b, uint32_t fp) {
+    for (size_t i = 0; i < BUCKET_SIZE; i++) {
+        if (lane_get(cf, b, i) == fp) return (int)i;
     }
-    return 0;
+    return -1;
 }
 
-static inline int try_place_no_kick(cuckoo_filter_t *cf, uint64_t key, uint32_t fp) {
-    size_t i1 = hash1(key, cf->nbuckets);
-    size_t i2 = hash2(i1, fp, cf->nbuckets);
-    ck_slot_t *b1 = cf->table + i1 * BUCKET_SIZE;
-    ck_slot_t *b2 = cf->table + i2 * BUCKET_SIZE;
-    if (bucket_insert_fp(b1, fp)) return 1;
-    if (bucket_insert_fp(b2, fp)) return 1;
-    return 0;
+static inline int bucket_delete_fp(cuckoo_filter_t *cf, size_t b, uint32_t fp) {
+    int s = bucket_find(cf, b, fp);
+    if (s < 0) return 0;
+    lane_set(cf, b, (size_t)s, 0);
+    return 1;
 }
 
-int cuckoo_init(cuckoo_filter_t *cf, size_t nkeys_hint, int fp_bits) {
-    if (!cf || fp_bits <= 0 || fp_bits > 32) return -1;
-    memset(cf, 0, sizeof(*cf));
+static void table_layout(cuckoo_filter_t *cf, size_t nb, int fp_bits) {
     cf->fp_bits = fp_bits;
     cf->fp_mask = (fp_bits == 32) ? 0xFFFFFFFFu : ((1u << fp_bits) - 1u);
+    cf->lane_bits = (fp_bits <= 8) ? 8 : (fp_bits <= 16) ? 16 : 32;
+    cf->bucket_bytes = BUCKET_SIZE * (size_t)cf->lane_bits / 8;
+    cf->nbuckets = nb;
+    cf->bucket_size = BUCKET_SIZE;
+}
+
+static int table_init(cuckoo_filter_t *cf, size_t nb, int fp_bits, fmem_backing_t backing) {
+    table_layout(cf, nb, fp_bits);
+    cf->table = fmem_alloc(nb * cf->bucket_bytes, backing, 0, &cf->backing);
+    return cf->table ? 0 : -1;
+}
 
+// First-level buckets for a hint: a power of two, at most 85% full.
+static size_t hint_buckets(size_t nkeys_hint) {
     double load = 0.85;
     size_t nb = (size_t)ceil((double)nkeys_hint / (BUCKET_SIZE * load));
     size_t p = 1;
     while (p < nb) p <<= 1;
-    nb = p;
+    return p;
+}
 
-    cf->nbuckets = nb;
-    cf->bucket_size = BUCKET_SIZE;
-    cf->nitems = 0;
-
-    cf->table = (ck_slot_t*)calloc(nb * BUCKET_SIZE, sizeof(ck_slot_t));
-    if (!cf->table) return -1;
-
-    cf->stash_cap = STASH_CAP;
-    cf->stash_size = 0;
-    cf->stash_keys = (uint64_t*)malloc(sizeof(uint64_t) * cf->stash_cap);
-    cf->stash_fp = (uint32_t*)malloc(sizeof(uint32_t) * cf->stash_cap);
-    if (!cf->stash_keys || !cf->stash_fp) {
-        free(cf->table);
-        free(cf->stash_keys);
-        free(cf->stash_fp);
+int cuckoo_init(cuckoo_filter_t *cf, size_t nkeys_hint, int fp_bits) {
+    if (!cf || fp_bits <= 0 || fp_bits > 32) return -1;
+    memset(cf, 0, sizeof(*cf));
+
+    size_t nb = hint_buckets(nkeys_hint);
+
+    if (table_init(cf, nb, fp_bits, FMEM_DEFAULT) != 0) {
         memset(cf, 0, sizeof(*cf));
         return -1;
     }
+    return 0;
+}
 
-    memset(&cf->stats, 0, sizeof(cf->stats));
+// Version stripes of one level for concurrent mode. 0 or -1.
+static int level_stripes(cuckoo_filter_t *lv) {
+    size_t n = CK_LOCK_STRIPES;
+    if (n > lv->nbuckets) n = lv->nbuckets;
+    lv->stripe_ver = (uint32_t*)calloc(n, sizeof(uint32_t));
+    if (!lv->stripe_ver) return -1;
+    lv->stripe_mask = n - 1;
     return 0;
 }
 
+// Append a level with twice the buckets of lv; later inserts go there.
+// Once concurrent mode is on the new level gets its stripes too.
+static cuckoo_filter_t *level_grow(cuckoo_filter_t *lv) {
+    cuckoo_filter_t *nx = (cuckoo_filter_t*)calloc(1, sizeof(*nx));
+    if (!nx) return NULL;
+    if (table_init(nx, lv->nbuckets * 2, lv->fp_bits, lv->backing) != 0) {
+        free(nx);
+        return NULL;
+    }
+    if (lv->stripe_ver && level_stripes(nx) != 0) {
+        fmem_free(nx->table, nx->nbuckets * nx->bucket_bytes, nx->backing);
+        free(nx);
+        return NULL;
+    }
+    nx->insert_mode = lv->insert_mode;
+    lv->next = nx;
+    return nx;
+}
+
 void cuckoo_free(cuckoo_filter_t *cf) {
     if (!cf) return;
-    free(cf->table);
-    free(cf->stash_keys);
-    free(cf->stash_fp);
+    cuckoo_filter_t *lv = cf->next;
+    while (lv) {
+        cuckoo_filter_t *nx = lv->next;
+        free(lv->stripe_ver);
+        if (!cf->map) fmem_free(lv->table, lv->nbuckets * lv->bucket_bytes, lv->backing);
+        free(lv);
+        lv = nx;
+    }
+    free(cf->stripe_ver);
+    if (cf->map) munmap(cf->map, cf->map_bytes);
+    else fmem_free(cf->table, cf->nbuckets * cf->bucket_bytes, cf->backing);
     memset(cf, 0, sizeof(*cf));
 }
 
-int cuckoo_query(cuckoo_filter_t *cf, uint64_t key) {
-    uint32_t fp = fingerprint(key, cf->fp_mask);
-    size_t i1 = hash1(key, cf->nbuckets);
-    size_t i2 = hash2(i1, fp, cf->nbuckets);
+static inline int level_has(const cuckoo_filter_t *lv, uint64_t h, uint32_t fp) {
+    size_t i1 = hash1(h, lv->nbuckets);
+    size_t i2 = hash2(i1, fp, lv->nbuckets);
 
-    ck_slot_t *b1 = cf->table + i1 * BUCKET_SIZE;
-    ck_slot_t *b2 = cf->table + i2 * BUCKET_SIZE;
+    uint64_t w1[2] = {0}, w2[2] = {0};
+    bucket_load(lv, i1, w1);
+    bucket_load(lv, i2, w2);
+    return pair_has_fp(lv, w1, w2, fp);
+}
 
-    for (size_t i = 0; i < BUCKET_SIZE; i++) {
-        if (b1[i].fp == fp || b2[i].fp == fp) return 1;
+int cuckoo_query(const cuckoo_filter_t *cf, uint64_t key) {
+    uint64_t h = key_hash(key);
+    uint32_t fp = fingerprint(h, cf->fp_mask);
+
+    for (const cuckoo_filter_t *lv = cf; lv; lv = lv->next) {
+        if (level_has(lv, h, fp)) return 1;
     }
+    return 0;
+}
 
-    return stash_query(cf, key);
+typedef struct {
+    uint64_t h;
+    uint32_t fp;
+    size_t   i1;
+    size_t   i2;
+} ck_probe_t;
+
+static inline void ck_locate(const cuckoo_filter_t *cf, uint64_t key, ck_probe_t *p) {
+    p->h = key_hash(key);
+    p->fp = fingerprint(p->h, cf->fp_mask);
+    p->i1 = hash1(p->h, cf->nbuckets);
+    p->i2 = hash2(p->i1, p->fp, cf->nbuckets);
 }
 
-int cuckoo_insert(cuckoo_filter_t *cf, uint64_t key) {
-    uint32_t fp = fingerprint(key, cf->fp_mask);
-    size_t i1 = hash1(key, cf->nbuckets);
-    size_t i2 = hash2(i1, fp, cf->nbuckets);
+static inline void ck_prefetch(const cuckoo_filter_t *cf, const ck_probe_t *p) {
+    __builtin_prefetch(bucket_ptr(cf, p->i1), 0, 3);
+    __builtin_prefetch(bucket_ptr(cf, p->i2), 0, 3);
+}
 
-    ck_slot_t *b1 = cf->table + i1 * BUCKET_SIZE;
-    ck_slot_t *b2 = cf->table + i2 * BUCKET_SIZE;
+// Only the first level is prefetched; grown levels are probed directly.
+static inline int ck_test(const cuckoo_filter_t *cf, const ck_probe_t *p) {
+    uint64_t w1[2] = {0}, w2[2] = {0};
+    bucket_load(cf, p->i1, w1);
+    bucket_load(cf, p->i2, w2);
+    if (pair_has_fp(cf, w1, w2, p->fp)) return 1;
+    for (const cuckoo_filter_t *lv = cf->next; lv; lv = lv->next) {
+        if (level_has(lv, p->h, p->fp)) return 1;
+    }
+    return 0;
+}
 
-    cf->stats.insert_calls++;
+size_t cuckoo_query_batch_dist(const cuckoo_filter_t *cf, const uint64_t *keys, size_t n,
+                               uint64_t *out_bitmap, size_t dist) {
+    if (!cf || !cf->table || !keys || !out_bitmap) return 0;
+    if (dist > CK_BATCH_RING) dist = CK_BATCH_RING;
 
-    for (size_t i = 0; i < BUCKET_SIZE; i++) {
-        cf->stats.total_probes += 2;
-        if (b1[i].fp == 0) {
-            b1[i].fp = fp;
-            cf->nitems++;
-            return 0;
+    memset(out_bitmap, 0, ((n + 63) / 64) * sizeof(uint64_t));
+
+    ck_probe_t ring[CK_BATCH_RING];
+    size_t hits = 0;
+
+    size_t head = (dist < n) ? dist : n;
+    for (size_t i = 0; i < head; i++) {
+        ck_probe_t *p = &ring[i & (CK_BATCH_RING - 1)];
+        ck_locate(cf, keys[i], p);
+        ck_prefetch(cf, p);
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        ck_probe_t cur;
+        if (dist == 0) ck_locate(cf, keys[i], &cur);
+        else cur = ring[i & (CK_BATCH_RING - 1)];
+
+        size_t ahead = i + dist;
+        if (dist && ahead < n) {
+            ck_probe_t *p = &ring[ahead & (CK_BATCH_RING - 1)];
+            ck_locate(cf, keys[ahead], p);
+            ck_prefetch(cf, p);
         }
-        if (b2[i].fp == 0) {
-            b2[i].fp = fp;
-            cf->nitems++;
-            return 0;
+
+        if (ck_test(cf, &cur)) {
+            out_bitmap[i >> 6] |= 1ULL << (i & 63);
+            hits++;
+        }
+    }
+    return hits;
+}
+
+size_t cuckoo_query_batch(const cuckoo_filter_t *cf, const uint64_t *keys, size_t n, uint64_t *out_bitmap) {
+    return cuckoo_query_batch_dist(cf, keys, n, out_bitmap, CK_PREFETCH_DIST);
+}
+
+int cuckoo_set_insert_mode(cuckoo_filter_t *cf, ck_insert_mode_t mode) {
+    if (!cf || (mode != CK_INSERT_RANDOM_WALK && mode != CK_INSERT_BFS)) return -1;
+    for (cuckoo_filter_t *lv = cf; lv; lv = lv->next) lv->insert_mode = mode;
+    return 0;
+}
+
+typedef struct {
+    size_t   bucket;
+    int      parent;   // -1 for the two roots
+    uint8_t  pslot;    // slot of the parent whose fingerprint moves here
+    uint8_t  depth;
+} ck_bfs_node_t;
+
+static int bfs_on_path(const ck_bfs_node_t *q, int k, size_t bucket) {
+    for (; k >= 0; k = q[k].parent) {
+        if (q[k].bucket == bucket) return 1;
+    }
+    return 0;
+}
+
+// Breadth-first search from i1/i2 for the shortest chain of displacements
+// that ends in a free slot, then apply it back to front and store fp in
+// the slot it frees in i1 or i2. Nothing moves unless a path is found.
+static int bfs_insert(cuckoo_filter_t *cf, cuckoo_stats_t *st, size_t i1, size_t i2, uint32_t fp) {
+    ck_bfs_node_t q[CK_BFS_MAX_NODES];
+    int head = 0, tail = 0;
+    q[tail++] = (ck_bfs_node_t){ .bucket = i1, .parent = -1 };
+    if (i2 != i1) q[tail++] = (ck_bfs_node_t){ .bucket = i2, .parent = -1 };
+
+    while (head < tail) {
+        int k = head++;
+        size_t b = q[k].bucket;
+
+        for (size_t s = 0; s < BUCKET_SIZE; s++) {
+            uint32_t f = lane_get(cf, b, s);
+            size_t alt = hash2(b, f, cf->nbuckets);
+            st->total_probes += BUCKET_SIZE;
+
+            int e = bucket_find(cf, alt, 0);
+            if (e >= 0) {
+                // (b, s) -> (alt, e), then each parent slot into the slot
+                // its child just vacated
+                lane_set(cf, alt, (size_t)e, f);
+                st->total_kicks++;
+                size_t free_s = s;
+                for (; q[k].parent >= 0; k = q[k].parent) {
+                    ck_bfs_node_t *nd = &q[k];
+                    lane_set(cf, nd->bucket, free_s, lane_get(cf, q[nd->parent].bucket, nd->pslot));
+                    st->total_kicks++;
+                    free_s = nd->pslot;
+                }
+                lane_set(cf, q[k].bucket, free_s, fp);
+                return 1;
+            }
+
+            if (q[k].depth + 1 < CK_BFS_MAX_DEPTH && tail < CK_BFS_MAX_NODES && !bfs_on_path(q, k, alt)) {
+                q[tail++] = (ck_bfs_node_t){
+                    .bucket = alt, .parent = k, .pslot = (uint8_t)s, .depth = (uint8_t)(q[k].depth + 1)
+                };
+            }
         }
     }
+    return 0;
+}
+
+// Random walk from i1. The kicks are logged so that a walk that finds no
+// free slot can be undone, leaving the level as it was.
+static int walk_insert(cuckoo_filter_t *cf, cuckoo_stats_t *st, size_t i1, uint32_t fp) {
+    size_t log_b[MAX_KICKS];
+    uint8_t log_s[MAX_KICKS];
 
     size_t idx = i1;
     uint32_t cur_fp = fp;
 
     for (size_t kick = 0; kick < MAX_KICKS; kick++) {
-        ck_slot_t *b = cf->table + idx * BUCKET_SIZE;
         size_t victim = kick % BUCKET_SIZE;
 
-        uint32_t tmp = b[victim].fp;
-        b[victim].fp = cur_fp;
+        uint32_t tmp = lane_get(cf, idx, victim);
+        lane_set(cf, idx, victim, cur_fp);
         cur_fp = tmp;
+        log_b[kick] = idx;
+        log_s[kick] = (uint8_t)victim;
 
-        cf->stats.total_kicks++;
+        st->total_kicks++;
 
         idx = hash2(idx, cur_fp, cf->nbuckets);
-        b = cf->table + idx * BUCKET_SIZE;
 
         for (size_t j = 0; j < BUCKET_SIZE; j++) {
-            cf->stats.total_probes += 1;
-            if (b[j].fp == 0) {
-                b[j].fp = cur_fp;
-                cf->nitems++;
-                return 0;
+            st->total_probes += 1;
+            if (lane_get(cf, idx, j) == 0) {
+                lane_set(cf, idx, j, cur_fp);
+                return 1;
             }
         }
     }
 
-    cf->stats.insert_fails++;
-    if (stash_insert(cf, key, fp)) return 0;
-    return -1;
+    for (size_t kick = MAX_KICKS; kick-- > 0; ) {
+        uint32_t tmp = lane_get(cf, log_b[kick], log_s[kick]);
+        lane_set(cf, log_b[kick], log_s[kick], cur_fp);
+        cur_fp = tmp;
+    }
+    return 0;
+}
+
+static int level_insert(cuckoo_filter_t *lv, cuckoo_stats_t *st, uint64_t h, uint32_t fp) {
+    size_t i1 = hash1(h, lv->nbuckets);
+    size_t i2 = hash2(i1, fp, lv->nbuckets);
+
+    for (size_t i = 0; i < BUCKET_SIZE; i++) {
+        st->total_probes += 2;
+        if (lane_get(lv, i1, i) == 0) {
+            lane_set(lv, i1, i, fp);
+            return 1;
+        }
+        if (lane_get(lv, i2, i) == 0) {
+            lane_set(lv, i2, i, fp);
+            return 1;
+        }
+    }
+
+    if (lv->insert_mode == CK_INSERT_BFS) return bfs_insert(lv, st, i1, i2, fp);
+    return walk_insert(lv, st, i1, fp);
+}
+
+// Inserts go to the newest level. When it cannot place the key a level of
+// twice the size is appended, so inserts only fail when allocation does.
+static int insert_hash(cuckoo_filter_t *cf, uint64_t h) {
+    uint32_t fp = fingerprint(h, cf->fp_mask);
+
+    cf->stats.insert_calls++;
+
+    cuckoo_filter_t *lv = cf;
+    while (lv->next) lv = lv->next;
+
+    while (!level_insert(lv, &cf->stats, h, fp)) {
+        cf->stats.insert_fails++;
+        lv = level_grow(lv);
+        if (!lv) return -1;
+        cf->stats.levels_added++;
+    }
+    cf->nitems++;
+    return 0;
+}
+
+int cuckoo_insert(cuckoo_filter_t *cf, uint64_t key) {
+    if (cf->map) return -1;
+    return insert_hash(cf, key_hash(key));
+}
+
+static inline size_t bulk_bucket(const cuckoo_filter_t *lv, uint64_t h, int alt) {
+    size_t i1 = hash1(h, lv->nbuckets);
+    return alt ? hash2(i1, fingerprint(h, lv->fp_mask), lv->nbuckets) : i1;
+}
+
+typedef struct {
+    uint64_t *tmp;
+    uint16_t *pid;
+    size_t *end;
+} ck_bulk_buf_t;
+
+// One partitioned pass over the hashes h[0..n) into level lv: each one
+// whose first (alt = 0) or alternate (alt = 1) bucket has a free slot is
+// placed there, the rest are compacted to the front of h. Returns how
+// many are left.
+static size_t bulk_pass(cuckoo_filter_t *cf, cuckoo_filter_t *lv, ck_bulk_buf_t *b,
+                        uint64_t *h, size_t n, int alt, unsigned shift, size_t nparts) {
+    memset(b->end, 0, (nparts + 1) * sizeof(size_t));
+    for (size_t i = 0; i < n; i++) {
+        b->pid[i] = (uint16_t)(bulk_bucket(lv, h[i], alt) >> shift);
+        b->end[b->pid[i] + 1]++;
+    }
+    for (size_t p = 0; p < nparts; p++) b->end[p + 1] += b->end[p];
+    // end[p] starts at partition p's first slot and is left at its end
+    for (size_t i = 0; i < n; i++) b->tmp[b->end[b->pid[i]]++] = h[i];
+
+    uint32_t mask = cf->fp_mask;
+    size_t left = 0, placed = 0;
+    for (size_t i = 0; i < n; i++) {
+        size_t bk = bulk_bucket(lv, b->tmp[i], alt);
+        uint32_t fp = fingerprint(b->tmp[i], mask);
+        size_t s = 0;
+        while (s < BUCKET_SIZE && lane_get(lv, bk, s) != 0) s++;
+        cf->stats.total_probes += (s < BUCKET_SIZE) ? s + 1 : BUCKET_SIZE;
+        if (s < BUCKET_SIZE) {
+            lane_set(lv, bk, s, fp);
+            placed++;
+        } else {
+            h[left++] = b->tmp[i];
+        }
+    }
+    cf->stats.insert_calls += placed;
+    cf->nitems += placed;
+    return left;
+}
+
+int cuckoo_insert_bulk(cuckoo_filter_t *cf, const uint64_t *keys, size_t n) {
+    if (!cf || cf->map || (!keys && n)) return -1;
+    if (n == 0) return 0;
+
+    size_t chunk = (n < CK_BULK_CHUNK) ? n : CK_BULK_CHUNK;
+    ck_bulk_buf_t b = {0};
+    uint64_t *h = (uint64_t*)malloc(chunk * sizeof(uint64_t));
+    b.tmp = (uint64_t*)malloc(chunk * sizeof(uint64_t));
+    b.pid = (uint16_t*)malloc(chunk * sizeof(uint16_t));
+    b.end = (size_t*)malloc((CK_BULK_MAX_PARTS + 1) * sizeof(size_t));
+    int fallback = !h || !b.tmp || !b.pid || !b.end;
+
+    int rc = 0;
+    for (size_t base = 0; base < n && rc == 0; base += chunk) {
+        size_t m = (n - base < chunk) ? n - base : chunk;
+
+        // the newest level can change between chunks as leftovers grow it
+        cuckoo_filter_t *lv = cf;
+        while (lv->next) lv = lv->next;
+        unsigned shift = 0;
+        while ((lv->bucket_bytes << shift) < CK_BULK_PART_BYTES) shift++;
+        while ((lv->nbuckets >> shift) >= CK_BULK_MAX_PARTS) shift++;
+        size_t nparts = ((lv->nbuckets - 1) >> shift) + 1;
+
+        if (fallback || nparts < 2) {
+            for (size_t i = 0; i < m && rc == 0; i++) rc = cuckoo_insert(cf, keys[base + i]);
+            continue;
+        }
+
+        for (size_t i = 0; i < m; i++) h[i] = key_hash(keys[base + i]);
+        size_t left = bulk_pass(cf, lv, &b, h, m, 0, shift, nparts);
+        left = bulk_pass(cf, lv, &b, h, left, 1, shift, nparts);
+        for (size_t i = 0; i < left && rc == 0; i++) rc = insert_hash(cf, h[i]);
+    }
+
+    free(h);
+    free(b.tmp);
+    free(b.pid);
+    free(b.end);
+    return rc;
+}
+
+static size_t level_list(cuckoo_filter_t *cf, cuckoo_filter_t **out) {
+    size_t n = 0;
+    for (cuckoo_filter_t *lv = cf; lv && n < CK_MAX_LEVELS; lv = lv->next) out[n++] = lv;
+    return n;
 }
 
+// Newest level first. Bucket indices are the low bits of one hash, so a
+// fingerprint matching key's buckets in level k also matches them in every
+// older level: removing a colliding key's copy in k leaves key's own copy
+// (at k or older) where the colliding key still finds it.
 int cuckoo_delete(cuckoo_filter_t *cf, uint64_t key) {
-    uint32_t fp = fingerprint(key, cf->fp_mask);
-    size_t i1 = hash1(key, cf->nbuckets);
-    size_t i2 = hash2(i1, fp, cf->nbuckets);
+    if (cf->map) return -1;
+    uint64_t h = key_hash(key);
+    uint32_t fp = fingerprint(h, cf->fp_mask);
+
+    cuckoo_filter_t *lvs[CK_MAX_LEVELS];
+    for (size_t k = level_list(cf, lvs); k-- > 0; ) {
+        cuckoo_filter_t *lv = lvs[k];
+        size_t i1 = hash1(h, lv->nbuckets);
+        size_t i2 = hash2(i1, fp, lv->nbuckets);
+        if (bucket_delete_fp(lv, i1, fp) || bucket_delete_fp(lv, i2, fp)) {
+            cf->nitems--;
+            return 0;
+        }
+    }
+    return -1;
+}
 
-    ck_slot_t *b1 = cf->table + i1 * BUCKET_SIZE;
-    ck_slot_t *b2 = cf->table + i2 * BUCKET_SIZE;
+// params: fp_bits, nitems, insert_mode; one section per level (aux = its
+// bucket count)
+int cuckoo_save(const cuckoo_filter_t *cf, const char *path) {
+    if (!cf || !cf->table) return -1;
+
+    fio_header_t h;
+    memset(&h, 0, sizeof(h));
+    h.kind = FIO_KIND_CK;
+    h.params[0] = (uint64_t)cf->fp_bits;
+    h.params[1] = cf->nitems;
+    h.params[2] = (uint64_t)cf->insert_mode;
+
+    const void *data[FIO_MAX_SECTIONS];
+    for (const cuckoo_filter_t *lv = cf; lv; lv = lv->next) {
+        if (h.nsections == FIO_MAX_SECTIONS) return -1;
+        h.sections[h.nsections].bytes = lv->nbuckets * (uint64_t)lv->bucket_bytes;
+        h.sections[h.nsections].aux = lv->nbuckets;
+        data[h.nsections++] = lv->table;
+    }
+    return fio_write(path, &h, data) ? -1 : 0;
+}
+
+int cuckoo_open_mmap(cuckoo_filter_t *cf, const char *path) {
+    if (!cf) return -1;
 
-    if (bucket_delete_fp(b1, fp) || bucket_delete_fp(b2, fp)) {
-        cf->nitems--;
+    fio_header_t h;
+    void *map = NULL;
+    size_t map_bytes = 0;
+    if (fio_map(path, FIO_KIND_CK, &h, &map, &map_bytes) != 0) return -1;
 
-        for (size_t s = 0; s < cf->stash_size; s++) {
-            uint64_t sk = cf->stash_keys[s];
-            uint32_t sfp = cf->stash_fp[s];
-            if (try_place_no_kick(cf, sk, sfp)) {
-                cf->stash_keys[s] = cf->stash_keys[cf->stash_size - 1];
-                cf->stash_fp[s] = cf->stash_fp[cf->stash_size - 1];
-                cf->stash_size--;
-                cf->nitems++;
+    int fp_bits = (int)h.params[0];
+    int ok = h.nsections >= 1 && h.nsections <= CK_MAX_LEVELS && fp_bits > 0 && fp_bits <= 32 &&
+             h.params[2] <= CK_INSERT_BFS;
+    memset(cf, 0, sizeof(*cf));
+    cuckoo_filter_t *lv = cf;
+    for (uint32_t i = 0; ok && i < h.nsections; i++) {
+        size_t nb = (size_t)h.sections[i].aux;
+        if (i > 0) {
+            // a grown level has twice the buckets of the one before (level_grow)
+            if (nb != 2 * lv->nbuckets) {
+                ok = 0;
                 break;
             }
+            lv->next = (cuckoo_filter_t*)calloc(1, sizeof(*lv));
+            lv = lv->next;
+            if (!lv) break;
         }
-        return 0;
+        table_layout(lv, nb, fp_bits);
+        lv->table = fio_section(map, &h, i);
+        lv->insert_mode = (ck_insert_mode_t)h.params[2];
+        ok = nb > 0 && (nb & (nb - 1)) == 0 && h.sections[i].bytes == nb * (uint64_t)lv->bucket_bytes;
     }
+    cf->map = map;
+    cf->map_bytes = map_bytes;
+    if (!ok || !lv) {
+        cuckoo_free(cf);
+        return -1;
+    }
+    cf->nitems = (size_t)h.params[1];
+    return 0;
+}
+
+size_t cuckoo_bytes(const cuckoo_filter_t *cf) {
+    size_t bytes = 0;
+    for (const cuckoo_filter_t *lv = cf; lv; lv = lv->next) {
+        bytes += lv->nbuckets * lv->bucket_bytes;
+    }
+    return bytes;
+}
+
+size_t cuckoo_bytes_for(size_t nkeys_hint, int fp_bits) {
+    if (fp_bits <= 0 || fp_bits > 32) return 0;
+    cuckoo_filter_t tmp;
+    table_layout(&tmp, hint_buckets(nkeys_hint), fp_bits);
+    return tmp.nbuckets * tmp.bucket_bytes;
+}
+
+int cuckoo_set_backing(cuckoo_filter_t *cf, fmem_backing_t backing, int prefault) {
+    if (!cf || !cf->table || cf->map) return -1;
+
+    for (cuckoo_filter_t *lv = cf; lv; lv = lv->next) {
+        size_t bytes = lv->nbuckets * lv->bucket_bytes;
+        fmem_backing_t got;
+        void *mem = fmem_alloc(bytes, backing, prefault, &got);
+        if (!mem) return -1;
+        memcpy(mem, lv->table, bytes);
+        fmem_free(lv->table, bytes, lv->backing);
+        lv->table = mem;
+        lv->backing = got;
+    }
+    return 0;
+}
+
+// ---- concurrent mode ----
+
+static inline void cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+static inline uint32_t *stripe_of(const cuckoo_filter_t *cf, size_t bucket) {
+    return &cf->stripe_ver[bucket & cf->stripe_mask];
+}
+
+static inline uint32_t stripe_read_begin(const uint32_t *v) {
+    uint32_t x;
+    while ((x = __atomic_load_n(v, __ATOMIC_ACQUIRE)) & 1u) cpu_relax();
+    return x;
+}
+
+static inline int stripe_read_retry(const uint32_t *v, uint32_t x) {
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(v, __ATOMIC_RELAXED) != x;
+}
+
+static inline void stripe_lock(uint32_t *v) {
+    for (;;) {
+        uint32_t x = __atomic_load_n(v, __ATOMIC_RELAXED);
+        if (!(x & 1u) &&
+            __atomic_compare_exchange_n(v, &x, x + 1u, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            // order the odd version before the data stores that follow, so a
+            // reader that sees a new slot also sees the version change
+            __atomic_thread_fence(__ATOMIC_RELEASE);
+            return;
+        }
+        cpu_relax();
+    }
+}
+
+static inline void stripe_unlock(uint32_t *v) {
+    __atomic_fetch_add(v, 1u, __ATOMIC_RELEASE);
+}
 
-    if (stash_delete(cf, key)) return 0;
+// Lock the stripes of two buckets in address order (once if shared).
+static inline void lock_pair(cuckoo_filter_t *cf, size_t a, size_t b) {
+    uint32_t *la = stripe_of(cf, a);
+    uint32_t *lb = stripe_of(cf, b);
+    if (la == lb) { stripe_lock(la); return; }
+    if (la > lb) { uint32_t *t = la; la = lb; lb = t; }
+    stripe_lock(la);
+    stripe_lock(lb);
+}
+
+static inline void unlock_pair(cuckoo_filter_t *cf, size_t a, size_t b) {
+    uint32_t *la = stripe_of(cf, a);
+    uint32_t *lb = stripe_of(cf, b);
+    stripe_unlock(la);
+    if (la != lb) stripe_unlock(lb);
+}
+
+static inline uint32_t slot_load(const cuckoo_filter_t *cf, size_t b, size_t s) {
+    const uint8_t *p = bucket_ptr(cf, b);
+    switch (cf->lane_bits) {
+    case 8:  return __atomic_load_n(&p[s], __ATOMIC_RELAXED);
+    case 16: return __atomic_load_n(&((const uint16_t*)p)[s], __ATOMIC_RELAXED);
+    default: return __atomic_load_n(&((const uint32_t*)p)[s], __ATOMIC_RELAXED);
+    }
+}
+
+static inline void slot_store(cuckoo_filter_t *cf, size_t b, size_t s, uint32_t fp) {
+    uint8_t *p = bucket_ptr(cf, b);
+    switch (cf->lane_bits) {
+    case 8:  __atomic_store_n(&p[s], (uint8_t)fp, __ATOMIC_RELAXED); break;
+    case 16: __atomic_store_n(&((uint16_t*)p)[s], (uint16_t)fp, __ATOMIC_RELAXED); break;
+    default: __atomic_store_n(&((uint32_t*)p)[s], fp, __ATOMIC_RELAXED); break;
+    }
+}
+
+static inline void bucket_load_mt(const cuckoo_filter_t *cf, size_t i, uint64_t *w) {
+    const uint8_t *p = bucket_ptr(cf, i);
+    switch (cf->lane_bits) {
+    case 8:  w[0] = __atomic_load_n((const uint32_t*)p, __ATOMIC_RELAXED); break;
+    case 16: w[0] = __atomic_load_n((const uint64_t*)p, __ATOMIC_RELAXED); break;
+    default:
+        w[0] = __atomic_load_n((const uint64_t*)p, __ATOMIC_RELAXED);
+        w[1] = __atomic_load_n((const uint64_t*)p + 1, __ATOMIC_RELAXED);
+        break;
+    }
+}
+
+static inline int bucket_find_mt(const cuckoo_filter_t *cf, size_t b, uint32_t fp) {
+    for (size_t i = 0; i < BUCKET_SIZE; i++) {
+        if (slot_load(cf, b, i) == fp) return (int)i;
+    }
     return -1;
 }
 
-size_t cuckoo_bytes(const cuckoo_filter_t *cf) {
-    return cf->nbuckets * cf->bucket_size * sizeof(ck_slot_t)
-         + cf->stash_cap * (sizeof(uint64_t) + sizeof(uint32_t));
+int cuckoo_enable_concurrent(cuckoo_filter_t *cf) {
+    if (!cf || !cf->table) return -1;
+
+    for (cuckoo_filter_t *lv = cf; lv; lv = lv->next) {
+        if (!lv->stripe_ver && level_stripes(lv) != 0) return -1;
+    }
+    return 0;
+}
+
+static int level_has_mt(const cuckoo_filter_t *cf, uint64_t h, uint32_t fp) {
+    size_t i1 = hash1(h, cf->nbuckets);
+    size_t i2 = hash2(i1, fp, cf->nbuckets);
+
+    const uint32_t *v1 = stripe_of(cf, i1);
+    const uint32_t *v2 = stripe_of(cf, i2);
+
+    int hit;
+    uint32_t s1, s2;
+    do {
+        s1 = stripe_read_begin(v1);
+        s2 = stripe_read_begin(v2);
+        uint64_t w1[2] = {0}, w2[2] = {0};
+        bucket_load_mt(cf, i1, w1);
+        bucket_load_mt(cf, i2, w2);
+        hit = pair_has_fp(cf, w1, w2, fp);
+    } while (stripe_read_retry(v1, s1) || stripe_read_retry(v2, s2));
+
+    return hit;
+}
+
+int cuckoo_query_mt(const cuckoo_filter_t *cf, uint64_t key) {
+    uint64_t h = key_hash(key);
+    uint32_t fp = fingerprint(h, cf->fp_mask);
+
+    for (const cuckoo_filter_t *lv = cf; lv; lv = lv->next) {
+        if (level_has_mt(lv, h, fp)) return 1;
+    }
+    return 0;
+}
+
+typedef struct {
+    size_t   bucket;
+    size_t   slot;
+    uint32_t fp;     // fingerprint expected in (bucket, slot)
+} ck_hop_t;
+
+// Read-only random walk from `start` until a bucket with a free slot is
+// found. hops[0..len-1] are the displacements, *free_b/*free_s the hole.
+static size_t find_path_mt(const cuckoo_filter_t *cf, size_t start, uint64_t rng,
+                           ck_hop_t *hops, size_t *free_b, size_t *free_s) {
+    size_t idx = start;
+    for (size_t len = 0; len < MAX_KICKS; len++) {
+        size_t victim = (size_t)(splitmix64(&rng) % BUCKET_SIZE);
+        uint32_t vfp = slot_load(cf, idx, victim);
+        if (vfp == 0) {
+            *free_b = idx;
+            *free_s = victim;
+            return len;
+        }
+        hops[len] = (ck_hop_t){ .bucket = idx, .slot = victim, .fp = vfp };
+
+        idx = hash2(idx, vfp, cf->nbuckets);
+        int j = bucket_find_mt(cf, idx, 0);
+        if (j >= 0) {
+            *free_b = idx;
+            *free_s = (size_t)j;
+            return len + 1;
+        }
+    }
+    return (size_t)-1;
+}
+
+// Levels are not added in concurrent mode: inserts go to the newest level
+// and fail when it is full.
+int cuckoo_insert_mt(cuckoo_filter_t *top, uint64_t key) {
+    if (top->map) return -1;
+    uint64_t h = key_hash(key);
+    uint32_t fp = fingerprint(h, top->fp_mask);
+
+    cuckoo_filter_t *cf = top;
+    while (cf->next) cf = cf->next;
+    size_t i1 = hash1(h, cf->nbuckets);
+    size_t i2 = hash2(i1, fp, cf->nbuckets);
+
+    ck_hop_t hops[MAX_KICKS];
+
+    for (int attempt = 0; attempt < CK_MT_RETRIES; attempt++) {
+        lock_pair(cf, i1, i2);
+        size_t dst_b = i1;
+        int s = bucket_find_mt(cf, i1, 0);
+        if (s < 0) {
+            dst_b = i2;
+            s = bucket_find_mt(cf, i2, 0);
+        }
+        if (s >= 0) {
+            slot_store(cf, dst_b, (size_t)s, fp);
+            unlock_pair(cf, i1, i2);
+            __atomic_fetch_add(&top->nitems, 1, __ATOMIC_RELAXED);
+            return 0;
+        }
+        unlock_pair(cf, i1, i2);
+
+        size_t start = (attempt & 1) ? i2 : i1;
+        size_t free_b = 0, free_s = 0;
+        size_t len = find_path_mt(cf, start, key ^ (uint64_t)attempt, hops, &free_b, &free_s);
+        if (len == (size_t)-1) continue;
+
+        // Apply the path back to front so every fingerprint is always in
+        // one of its two buckets; each hop locks only its two buckets.
+        int ok = 1;
+        for (size_t j = len; j-- > 0; ) {
+            size_t src_b = hops[j].bucket;
+            size_t src_s = hops[j].slot;
+
+            lock_pair(cf, src_b, free_b);
+            if (slot_load(cf, src_b, src_s) != hops[j].fp || slot_load(cf, free_b, free_s) != 0) {
+                unlock_pair(cf, src_b, free_b);
+                ok = 0;
+                break;
+            }
+            slot_store(cf, free_b, free_s, hops[j].fp);
+            slot_store(cf, src_b, src_s, 0);
+            unlock_pair(cf, src_b, free_b);
+
+            free_b = src_b;
+            free_s = src_s;
+        }
+        if (!ok) continue;
+
+        // free_b is now i1 or i2; the hole may have been taken meanwhile
+        lock_pair(cf, i1, i2);
+        if (slot_load(cf, free_b, free_s) == 0) {
+            slot_store(cf, free_b, free_s, fp);
+            unlock_pair(cf, i1, i2);
+            __atomic_fetch_add(&top->nitems, 1, __ATOMIC_RELAXED);
+            return 0;
+        }
+        unlock_pair(cf, i1, i2);
+    }
+    return -1;
+}
+
+// Newest level first, as in cuckoo_delete.
+int cuckoo_delete_mt(cuckoo_filter_t *top, uint64_t key) {
+    if (top->map) return -1;
+    uint64_t h = key_hash(key);
+    uint32_t fp = fingerprint(h, top->fp_mask);
+
+    cuckoo_filter_t *lvs[CK_MAX_LEVELS];
+    for (size_t k = level_list(top, lvs); k-- > 0; ) {
+        cuckoo_filter_t *cf = lvs[k];
+        size_t i1 = hash1(h, cf->nbuckets);
+        size_t i2 = hash2(i1, fp, cf->nbuckets);
+
+        lock_pair(cf, i1, i2);
+        size_t hit_b = i1;
+        int s = bucket_find_mt(cf, i1, fp);
+        if (s < 0) {
+            hit_b = i2;
+            s = bucket_find_mt(cf, i2, fp);
+        }
+        if (s >= 0) slot_store(cf, hit_b, (size_t)s, 0);
+        unlock_pair(cf, i1, i2);
+
+        if (s >= 0) {
+            __atomic_fetch_sub(&top->nitems, 1, __ATOMIC_RELAXED);
+            return 0;
+        }
+    }
+    return -1;
 }
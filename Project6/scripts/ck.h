@@ -4,20 +4,28 @@
 #include <stdint.h>
 #include <stddef.h>
 
-typedef struct {
-    uint32_t fp;
-} ck_slot_t;
+#include "filter_mem.h"
+
+// How a full insert makes room. RANDOM_WALK kicks a victim per hop for up
+// to 500 hops; BFS searches the cuckoo graph breadth-first (bounded depth)
+// for the shortest path to a free slot and only then moves fingerprints.
+typedef enum {
+    CK_INSERT_RANDOM_WALK = 0,
+    CK_INSERT_BFS         = 1,
+} ck_insert_mode_t;
 
 typedef struct {
     size_t insert_calls;
     size_t insert_fails;
     size_t total_kicks;
     size_t total_probes;
-    size_t stash_inserts;
-    size_t stash_hits;
+    size_t levels_added;
 } cuckoo_stats_t;
 
-typedef struct {
+// A growable filter: a chain of levels, each with twice the buckets of the
+// one before. Only the newest level takes inserts; lookups and deletes
+// check every level. Stats and nitems live on the first level.
+typedef struct cuckoo_filter {
     size_t nbuckets;
     size_t bucket_size;
     size_t nitems;
@@ -25,30 +33,106 @@ typedef struct {
     int fp_bits;
     uint32_t fp_mask;
 
-    ck_slot_t *table;
+    // buckets of 4 fingerprints packed in 8/16/32-bit lanes (4/8/16 bytes)
+    int lane_bits;
+    size_t bucket_bytes;
+    void *table;
+    fmem_backing_t backing;   // of table (filter_mem.h); new levels ask for the same
+
+    ck_insert_mode_t insert_mode;
 
     cuckoo_stats_t stats;
 
-    size_t stash_cap;
-    size_t stash_size;
-    uint64_t *stash_keys;
-    uint32_t *stash_fp;
+    struct cuckoo_filter *next;
+
+    // concurrent mode: one seqlock-style version per bucket stripe,
+    // odd while a writer holds it (NULL until cuckoo_enable_concurrent)
+    uint32_t *stripe_ver;
+    size_t stripe_mask;
+
+    // first level only, set by cuckoo_open_mmap: every level's table lives
+    // in this read-only mapping
+    void *map;
+    size_t map_bytes;
 } cuckoo_filter_t;
 
 int cuckoo_init(cuckoo_filter_t *cf, size_t nkeys_hint, int fp_bits);
 
 void cuckoo_free(cuckoo_filter_t *cf);
 
+// Adds a level when the newest one is full; -1 only if that allocation
+// fails.
 int cuckoo_insert(cuckoo_filter_t *cf, uint64_t key);
 
-int cuckoo_query(cuckoo_filter_t *cf, uint64_t key);
+// Bulk insert for tables much larger than the cache. Keys are
+// radix-partitioned by first-bucket range (up to CK_BULK_CHUNK at a time)
+// and each goes into a free slot of that bucket while its part of the
+// newest level is cache-resident; keys whose bucket is full get a second
+// partitioned pass over their alternate bucket, and the few left take
+// cuckoo_insert (kicks, growth). Slots can differ from inserting one by
+// one; every key is still found. -1 on a mapped filter or if a level
+// cannot be added.
+#define CK_BULK_CHUNK (1u << 24)
+int cuckoo_insert_bulk(cuckoo_filter_t *cf, const uint64_t *keys, size_t n);
+
+// -1 on an unknown mode.
+int cuckoo_set_insert_mode(cuckoo_filter_t *cf, ck_insert_mode_t mode);
+
+int cuckoo_query(const cuckoo_filter_t *cf, uint64_t key);
+
+// Batched lookup: bit i of out_bitmap (ceil(n/64) words) is set iff keys[i]
+// may be present. Both first-level buckets are prefetched `dist` keys ahead
+// (0 = no prefetch, max 64). Returns the number of hits.
+#define CK_PREFETCH_DIST 16
+size_t cuckoo_query_batch(const cuckoo_filter_t *cf, const uint64_t *keys, size_t n, uint64_t *out_bitmap);
+size_t cuckoo_query_batch_dist(const cuckoo_filter_t *cf, const uint64_t *keys, size_t n,
+                               uint64_t *out_bitmap, size_t dist);
 
 int cuckoo_delete(cuckoo_filter_t *cf, uint64_t key);
 
 size_t cuckoo_bytes(const cuckoo_filter_t *cf);
 
+// Bytes cuckoo_init would allocate for these arguments (the first level;
+// growth adds more), without allocating; 0 on a bad fp_bits.
+size_t cuckoo_bytes_for(size_t nkeys_hint, int fp_bits);
+
+// Moves every level's table into memory of the given backing
+// (filter_mem.h), prefaulted if asked; each level's backing records what
+// was obtained. -1 on a mapped filter or if allocation fails (levels
+// already moved stay moved).
+int cuckoo_set_backing(cuckoo_filter_t *cf, fmem_backing_t backing, int prefault);
+
+// Writes every level in the shared on-disk format (filter_io.h). Stats are
+// not saved. 0 or -1.
+int cuckoo_save(const cuckoo_filter_t *cf, const char *path);
+
+// Opens a saved filter in place from a read-only mapping: lookups only
+// (cuckoo_query*, and cuckoo_query_mt after cuckoo_enable_concurrent);
+// inserts and deletes return -1. cuckoo_free unmaps it. 0 or -1.
+int cuckoo_open_mmap(cuckoo_filter_t *cf, const char *path);
+
+// Thread-safe mode. Lookups are optimistic and validated against the
+// version stripes of both buckets; writers lock only the two buckets they
+// touch, and kick paths are searched first and then applied one
+// displacement at a time (libcuckoo style). No levels are added here: an
+// *_mt insert that finds the newest level full returns -1. Stats are not
+// updated. A plain cuckoo_insert may still add a level afterwards (not
+// concurrently with *_mt calls); that level gets its stripes as it is
+// added, and the insert returns -1 if they cannot be allocated.
+int cuckoo_enable_concurrent(cuckoo_filter_t *cf);
+
+int cuckoo_query_mt(const cuckoo_filter_t *cf, uint64_t key);
+
+int cuckoo_insert_mt(cuckoo_filter_t *cf, uint64_t key);
+
+int cuckoo_delete_mt(cuckoo_filter_t *cf, uint64_t key);
+
 static inline size_t cuckoo_capacity_slots(const cuckoo_filter_t *cf) {
-    return cf->nbuckets * cf->bucket_size;
+    size_t slots = 0;
+    for (const cuckoo_filter_t *lv = cf; lv; lv = lv->next) {
+        slots += lv->nbuckets * lv->bucket_size;
+    }
+    return slots;
 }
 
 #endif
@@ -1,4 +1,4 @@
-#define _POSIX_C_SOURCE 199309L
+#define _POSIX_C_SOURCE 200809L
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -6,11 +6,13 @@
 #include <math.h>
 #include <time.h>
 #include <inttypes.h>
+#include <unistd.h>
 
 #include "bb.h"
 #include "ck.h"
 #include "qf.h"
 #include "xor.h"
+#include "ribbon.h"
 
 
 static inline uint64_t now_ns(void) {
@@ -36,6 +38,35 @@ static double bpe_from_bytes(size_t bytes, size_t n_inserted) {
     return (double)bytes * 8.0 / (double)n_inserted;
 }
 
+// Peak RSS of the whole process (VmHWM), reset before each build so the
+// reported value is the high-water mark during that build, key arrays
+// included. Linux only; 0 when /proc is unavailable.
+static void rss_peak_reset(void) {
+    FILE *f = fopen("/proc/self/clear_refs", "w");
+    if (!f) return;
+    fputs("5", f);
+    fclose(f);
+}
+
+static double rss_peak_mb(void) {
+    FILE *f = fopen("/proc/self/status", "r");
+    if (!f) return 0.0;
+    char line[256];
+    double kb = 0.0;
+    while (fgets(line, sizeof(line), f)) {
+        if (strncmp(line, "VmHWM:", 6) == 0) {
+            kb = strtod(line + 6, NULL);
+            break;
+        }
+    }
+    fclose(f);
+    return kb / 1024.0;
+}
+
+static double keys_per_s(size_t n, uint64_t ns) {
+    return ns ? (double)n * 1e9 / (double)ns : 0.0;
+}
+
 static size_t round_up_pow2(size_t x) {
     if (x <= 1) return 1;
     if ((x & (x - 1)) == 0) return x;
@@ -59,24 +90,48 @@ static const cfg_t CFGS[] = {
     {0.001,16},
 };
 
+static int g_threads = 1;
+static const char *g_key_file = NULL;
+
+// table backing requested for every filter (filter_mem.h); rows record
+// the backing each one got
+static fmem_backing_t g_backing = FMEM_DEFAULT;
+static int g_prefault = 0;
+
+static int want_backing(void) {
+    return g_backing != FMEM_DEFAULT || g_prefault;
+}
+
 static void print_csv_header(void) {
-    printf("filter,target_fpr,param_bits,n_inserted,bytes,bpe,neg_queries,fp_count,achieved_fpr,build_ms\n");
+    printf("filter,target_fpr,param_bits,n_inserted,bytes,bpe,neg_queries,fp_count,achieved_fpr,build_ms,"
+           "build_keys_per_s,peak_rss_mb,backing,prefault\n");
 }
 
 
-static void run_blocked_bloom(size_t n, size_t qneg,
+typedef enum {
+    BUILD_LOOP,       // one insert call per key
+    BUILD_PARALLEL,   // blocked_bloom_build_parallel, g_threads threads
+    BUILD_BULK,       // *_insert_bulk: partitioned by block / bucket range
+} build_mode_t;
+
+static void run_blocked_bloom(const char *name, bb_layout_t layout, build_mode_t mode, size_t n, size_t qneg,
                               const uint64_t *pos, const uint64_t *neg,
                               double target_fpr)
 {
     blocked_bloom_t bf;
 
+    rss_peak_reset();
     uint64_t t0 = now_ns();
-    if (blocked_bloom_init(&bf, n, target_fpr) != 0) {
-        fprintf(stderr, "[BlockedBloom] init failed\n");
+    if (blocked_bloom_init_layout(&bf, n, target_fpr, layout) != 0) {
+        fprintf(stderr, "[%s] init failed\n", name);
         return;
     }
-    for (size_t i = 0; i < n; i++) blocked_bloom_insert(&bf, pos[i]);
+    if (want_backing()) blocked_bloom_set_backing(&bf, g_backing, g_prefault);
+    if (mode == BUILD_PARALLEL) blocked_bloom_build_parallel(&bf, pos, n, g_threads);
+    else if (mode == BUILD_BULK) blocked_bloom_insert_bulk(&bf, pos, n);
+    else for (size_t i = 0; i < n; i++) blocked_bloom_insert(&bf, pos[i]);
     uint64_t t1 = now_ns();
+    double peak_mb = rss_peak_mb();
 
     size_t fp = 0;
     for (size_t i = 0; i < qneg; i++) if (blocked_bloom_query(&bf, neg[i])) fp++;
@@ -86,28 +141,50 @@ static void run_blocked_bloom(size_t n, size_t qneg,
     double fpr = (double)fp / (double)qneg;
     double build_ms = (double)(t1 - t0) / 1e6;
 
-    printf("BlockedBloom,%.6f,%d,%zu,%zu,%.6f,%zu,%zu,%.6f,%.3f\n",
-           target_fpr, -1, n, bytes, bpe, qneg, fp, fpr, build_ms);
+    printf("%s,%.6f,%d,%zu,%zu,%.6f,%zu,%zu,%.6f,%.3f,%.0f,%.1f,%s,%d\n",
+           name, target_fpr, -1, n, bytes, bpe, qneg, fp, fpr, build_ms,
+           keys_per_s(n, t1 - t0), peak_mb, fmem_name(bf.backing), g_prefault);
 
     blocked_bloom_free(&bf);
 }
 
-static void run_xor(size_t n, size_t qneg,
+typedef enum {
+    XOR_CLASSIC,
+    XOR_FUSE3,
+    XOR_FUSE4,
+    XOR_PARALLEL,   // partitioned, g_threads threads
+    XOR_FILE,       // partitioned, keys streamed from g_key_file
+} xor_mode_t;
+
+static void run_xor(const char *name, xor_mode_t mode, size_t n, size_t qneg,
                     const uint64_t *pos, const uint64_t *neg,
                     double target_fpr, int fp_bits)
 {
     xor_filter_t xf;
+    if (mode == XOR_FILE && !g_key_file) return;
 
+    rss_peak_reset();
     uint64_t t0 = now_ns();
-    if (xor_build(&xf, pos, (uint32_t)n, (uint32_t)fp_bits, 1) != 0) {
-        fprintf(stderr, "[XOR] build failed\n");
+    int rc;
+    switch (mode) {
+    case XOR_FUSE3:    rc = xor_build_fuse(&xf, pos, (uint32_t)n, (uint32_t)fp_bits, 1, 3); break;
+    case XOR_FUSE4:    rc = xor_build_fuse(&xf, pos, (uint32_t)n, (uint32_t)fp_bits, 1, 4); break;
+    case XOR_PARALLEL: rc = xor_build_parallel(&xf, pos, n, (uint32_t)fp_bits, 1, g_threads); break;
+    case XOR_FILE:     rc = xor_build_file(&xf, g_key_file, (uint32_t)fp_bits, 1, g_threads, 0); break;
+    default:           rc = xor_build(&xf, pos, (uint32_t)n, (uint32_t)fp_bits, 1); break;
+    }
+    if (rc != 0) {
+        fprintf(stderr, "[%s] build failed\n", name);
         return;
     }
+    // fps are allocated by the build, so they are moved afterwards
+    if (want_backing()) xor_set_backing(&xf, g_backing, g_prefault);
     uint64_t t1 = now_ns();
+    double peak_mb = rss_peak_mb();
 
     size_t fn = 0;
     for (size_t i = 0; i < n; i++) if (!xor_query(&xf, pos[i])) fn++;
-    if (fn) fprintf(stderr, "[XOR] FN=%zu (should be 0)\n", fn);
+    if (fn) fprintf(stderr, "[%s] FN=%zu (should be 0)\n", name, fn);
 
     size_t fp = 0;
     for (size_t i = 0; i < qneg; i++) if (xor_query(&xf, neg[i])) fp++;
@@ -117,34 +194,78 @@ static void run_xor(size_t n, size_t qneg,
     double fpr = (double)fp / (double)qneg;
     double build_ms = (double)(t1 - t0) / 1e6;
 
-    printf("XOR,%.6f,%d,%zu,%zu,%.6f,%zu,%zu,%.6f,%.3f\n",
-           target_fpr, fp_bits, n, bytes, bpe, qneg, fp, fpr, build_ms);
+    printf("%s,%.6f,%d,%zu,%zu,%.6f,%zu,%zu,%.6f,%.3f,%.0f,%.1f,%s,%d\n",
+           name, target_fpr, fp_bits, n, bytes, bpe, qneg, fp, fpr, build_ms,
+           keys_per_s(n, t1 - t0), peak_mb, fmem_name(xf.backing), g_prefault);
 
     xor_free(&xf);
 }
 
-static void run_cuckoo(size_t n, size_t qneg,
+static void run_ribbon(const char *name, uint32_t w, size_t n, size_t qneg,
+                       const uint64_t *pos, const uint64_t *neg,
+                       double target_fpr, int fp_bits)
+{
+    ribbon_filter_t rf;
+
+    rss_peak_reset();
+    uint64_t t0 = now_ns();
+    if (ribbon_build(&rf, pos, (uint32_t)n, (uint32_t)fp_bits, w, 1) != 0) {
+        fprintf(stderr, "[%s] build failed\n", name);
+        return;
+    }
+    if (want_backing()) ribbon_set_backing(&rf, g_backing, g_prefault);
+    uint64_t t1 = now_ns();
+    double peak_mb = rss_peak_mb();
+
+    size_t fn = 0;
+    for (size_t i = 0; i < n; i++) if (!ribbon_query(&rf, pos[i])) fn++;
+    if (fn) fprintf(stderr, "[%s] FN=%zu (should be 0)\n", name, fn);
+
+    size_t fp = 0;
+    for (size_t i = 0; i < qneg; i++) if (ribbon_query(&rf, neg[i])) fp++;
+
+    size_t bytes = ribbon_bytes(&rf);
+    double bpe = bpe_from_bytes(bytes, n);
+    double fpr = (double)fp / (double)qneg;
+    double build_ms = (double)(t1 - t0) / 1e6;
+
+    printf("%s,%.6f,%d,%zu,%zu,%.6f,%zu,%zu,%.6f,%.3f,%.0f,%.1f,%s,%d\n",
+           name, target_fpr, fp_bits, n, bytes, bpe, qneg, fp, fpr, build_ms,
+           keys_per_s(n, t1 - t0), peak_mb, fmem_name(rf.backing), g_prefault);
+
+    ribbon_free(&rf);
+}
+
+// hint < n makes the filter grow: bytes then include every added level
+static void run_cuckoo(const char *name, build_mode_t mode, size_t n, size_t hint, size_t qneg,
                        const uint64_t *pos, const uint64_t *neg,
                        double target_fpr,
                        int fp_bits)
 {
     cuckoo_filter_t cf;
 
+    rss_peak_reset();
     uint64_t t0 = now_ns();
-    if (cuckoo_init(&cf, n, fp_bits) != 0) {
-        fprintf(stderr, "[Cuckoo] init failed\n");
+    if (cuckoo_init(&cf, hint, fp_bits) != 0) {
+        fprintf(stderr, "[%s] init failed\n", name);
         return;
     }
+    if (want_backing()) cuckoo_set_backing(&cf, g_backing, g_prefault);
 
     size_t fail = 0;
-    for (size_t i = 0; i < n; i++) {
-        if (cuckoo_insert(&cf, pos[i]) != 0) fail++;
+    if (mode == BUILD_BULK) {
+        if (cuckoo_insert_bulk(&cf, pos, n) != 0) fail = n - cf.nitems;
+    } else {
+        for (size_t i = 0; i < n; i++) {
+            if (cuckoo_insert(&cf, pos[i]) != 0) fail++;
+        }
     }
     uint64_t t1 = now_ns();
+    double peak_mb = rss_peak_mb();
 
     size_t fn = 0;
     for (size_t i = 0; i < n; i++) if (!cuckoo_query(&cf, pos[i])) fn++;
-    if (fn) fprintf(stderr, "[Cuckoo] FN=%zu (insert_fail=%zu)\n", fn, fail);
+    if (fn) fprintf(stderr, "[%s] FN=%zu (insert_fail=%zu)\n", name, fn, fail);
 
     size_t fp = 0;
     for (size_t i = 0; i < qneg; i++) if (cuckoo_query(&cf, neg[i])) fp++;
@@ -155,8 +276,9 @@ static void run_cuckoo(size_t n, size_t qneg,
     double fpr = (double)fp / (double)qneg;
     double build_ms = (double)(t1 - t0) / 1e6;
 
-    printf("Cuckoo,%.6f,%d,%zu,%zu,%.6f,%zu,%zu,%.6f,%.3f\n",
-       target_fpr, fp_bits, inserted, bytes, bpe, qneg, fp, fpr, build_ms);
+    printf("%s,%.6f,%d,%zu,%zu,%.6f,%zu,%zu,%.6f,%.3f,%.0f,%.1f,%s,%d\n",
+       name, target_fpr, fp_bits, inserted, bytes, bpe, qneg, fp, fpr, build_ms,
+           keys_per_s(n, t1 - t0), peak_mb, fmem_name(cf.backing), g_prefault);
 
 
     cuckoo_free(&cf);
@@ -178,17 +300,20 @@ static void run_qf(size_t n, size_t qneg,
     while ((1ULL << qbits) < slots) qbits++;
 
     quotient_filter_t qf;
+    rss_peak_reset();
     uint64_t t0 = now_ns();
     if (qf_init(&qf, qbits, (size_t)rbits) != 0) {
         fprintf(stderr, "[QF] init failed\n");
         return;
     }
+    if (want_backing()) qf_set_backing(&qf, g_backing, g_prefault);
 
     size_t fail = 0;
     for (size_t i = 0; i < n; i++) {
         if (qf_insert(&qf, pos[i]) != 0) fail++;
     }
     uint64_t t1 = now_ns();
+    double peak_mb = rss_peak_mb();
 
     size_t fn = 0;
     for (size_t i = 0; i < n; i++) if (!qf_query(&qf, pos[i])) fn++;
@@ -203,8 +328,9 @@ static void run_qf(size_t n, size_t qneg,
     double fpr = (double)fp / (double)qneg;
     double build_ms = (double)(t1 - t0) / 1e6;
 
-    printf("Quotient,%.6f,%d,%zu,%zu,%.6f,%zu,%zu,%.6f,%.3f\n",
-           target_fpr, rbits, inserted, bytes, bpe, qneg, fp, fpr, build_ms);
+    printf("Quotient,%.6f,%d,%zu,%zu,%.6f,%zu,%zu,%.6f,%.3f,%.0f,%.1f,%s,%d\n",
+           target_fpr, rbits, inserted, bytes, bpe, qneg, fp, fpr, build_ms,
+           keys_per_s(n, t1 - t0), peak_mb, fmem_name(qf.backing), g_prefault);
 
     qf_free(&qf);
 }
@@ -212,11 +338,13 @@ static void run_qf(size_t n, size_t qneg,
 
 static void usage(const char *prog) {
     fprintf(stderr,
-        "Usage: %s [n] [qneg] [pos_seed] [neg_seed]\n"
+        "Usage: %s [n] [qneg] [pos_seed] [neg_seed] [threads] [backing]\n"
         "  n        default 1000000\n"
         "  qneg     default 1000000\n"
         "  pos_seed default 123456789\n"
-        "  neg_seed default 987654321\n",
+        "  neg_seed default 987654321\n"
+        "  threads  default: online CPUs (XORParallel / XORFile / BlockedBloomParallel builds)\n"
+        "  backing  default | thp | hugetlb, optionally +prefault (default: default)\n",
         prog);
 }
 
@@ -225,8 +353,10 @@ int main(int argc, char **argv) {
     size_t qneg = (argc >= 3) ? (size_t)atoll(argv[2]) : 1000000ULL;
     uint64_t pos_seed = (argc >= 4) ? (uint64_t)strtoull(argv[3], NULL, 10) : 123456789ULL;
     uint64_t neg_seed = (argc >= 5) ? (uint64_t)strtoull(argv[4], NULL, 10) : 987654321ULL;
+    g_threads = (argc >= 6) ? atoi(argv[5]) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (g_threads < 1) g_threads = 1;
 
-    if (n == 0 || qneg == 0) {
+    if (n == 0 || qneg == 0 || (argc >= 7 && fmem_parse(argv[6], &g_backing, &g_prefault) != 0)) {
         usage(argv[0]);
         return 1;
     }
@@ -242,18 +372,50 @@ int main(int argc, char **argv) {
     gen_keys(pos, n,    pos_seed, 0);
     gen_keys(neg, qneg, neg_seed, 0x9e3779b97f4a7c15ULL);
 
+    // the positive keys again as a flat file for the streaming XOR build
+    char key_path[] = "/tmp/exp1_keys_XXXXXX";
+    int key_fd = mkstemp(key_path);
+    if (key_fd >= 0) {
+        FILE *kf = fdopen(key_fd, "wb");
+        int ok = kf && fwrite(pos, sizeof(uint64_t), n, kf) == n;
+        if (kf) {
+            if (fclose(kf) != 0) ok = 0;
+        } else {
+            close(key_fd);
+        }
+        if (ok) {
+            g_key_file = key_path;
+        } else {
+            fprintf(stderr, "[XORFile] could not write %s, skipping\n", key_path);
+            unlink(key_path);
+        }
+    }
+
     print_csv_header();
 
     for (size_t i = 0; i < sizeof(CFGS)/sizeof(CFGS[0]); i++) {
         double target = CFGS[i].target_fpr;
         int bits = CFGS[i].bits;
 
-        run_blocked_bloom(n, qneg, pos, neg, target);
-        run_xor(n, qneg, pos, neg, target, bits);
-        run_cuckoo(n, qneg, pos, neg, target, bits);
+        run_blocked_bloom("BlockedBloom", BB_LAYOUT_BLOCKED, BUILD_LOOP, n, qneg, pos, neg, target);
+        run_blocked_bloom("BlockedBloomParallel", BB_LAYOUT_BLOCKED, BUILD_PARALLEL, n, qneg, pos, neg, target);
+        run_blocked_bloom("BlockedBloomBulk", BB_LAYOUT_BLOCKED, BUILD_BULK, n, qneg, pos, neg, target);
+        run_blocked_bloom("SplitBlockBloom", BB_LAYOUT_SPLIT, BUILD_LOOP, n, qneg, pos, neg, target);
+        run_blocked_bloom("RegisterBloom", BB_LAYOUT_REGISTER, BUILD_LOOP, n, qneg, pos, neg, target);
+        run_xor("XOR", XOR_CLASSIC, n, qneg, pos, neg, target, bits);
+        run_xor("Fuse3", XOR_FUSE3, n, qneg, pos, neg, target, bits);
+        run_xor("Fuse4", XOR_FUSE4, n, qneg, pos, neg, target, bits);
+        run_xor("XORParallel", XOR_PARALLEL, n, qneg, pos, neg, target, bits);
+        run_xor("XORFile", XOR_FILE, n, qneg, pos, neg, target, bits);
+        run_ribbon("Ribbon64", 64, n, qneg, pos, neg, target, bits);
+        run_ribbon("Ribbon128", 128, n, qneg, pos, neg, target, bits);
+        run_cuckoo("Cuckoo", BUILD_LOOP, n, n, qneg, pos, neg, target, bits);
+        run_cuckoo("CuckooBulk", BUILD_BULK, n, n, qneg, pos, neg, target, bits);
+        run_cuckoo("CuckooGrow", BUILD_LOOP, n, n / 16, qneg, pos, neg, target, bits);
         run_qf(n, qneg, pos, neg, target, bits);
     }
 
+    if (g_key_file) unlink(g_key_file);
     free(pos);
     free(neg);
     return 0;
@@ -11,6 +11,8 @@
 #include "ck.h"
 #include "qf.h"
 #include "xor.h"
+#include "ribbon.h"
+#include "bench_lat.h"
 
 
 static inline uint64_t now_ns(void) {
@@ -48,17 +50,6 @@ static void shuffle_u64(uint64_t *a, size_t n, uint64_t seed) {
     }
 }
 
-static int cmp_u64(const void *a, const void *b) {
-    uint64_t x = *(const uint64_t*)a;
-    uint64_t y = *(const uint64_t*)b;
-    return (x > y) - (x < y);
-}
-
-static uint64_t percentile_u64(uint64_t *arr, size_t n, double p) {
-    if (n == 0) return 0;
-    size_t idx = (size_t)floor(p * (double)(n - 1));
-    return arr[idx];
-}
 
 
 typedef struct {
@@ -73,10 +64,29 @@ static const cfg_t CFGS[] = {
 };
 
 
+// table backing requested for every filter (filter_mem.h), applied once
+// it is built; rows record the backing each one got
+static fmem_backing_t g_backing = FMEM_DEFAULT;
+static int g_prefault = 0;
+
+// mix mode: every g_sample_every-th query is timed into the histogram
+static lat_clock_t g_clock;
+static size_t g_sample_every = 1;
+
 static const int NEG_SHARES[] = {0,10,20,30,40,50,60,70,80,90};
 
 static void print_csv_header(void) {
-    printf("filter,target_fpr,param_bits,neg_share,nqueries,secs,qps,mops,lat_p50_ns,lat_p95_ns,lat_p99_ns,hit_rate\n");
+    printf("filter,target_fpr,param_bits,neg_share,nqueries,secs,qps,mops,lat_p50_ns,lat_p95_ns,lat_p99_ns,lat_p999_ns,hit_rate,backing,prefault,"
+           "lat_sample_every\n");
+}
+
+// batch mode: queries are issued in batches through *_query_batch_dist
+static const size_t BATCH_SIZES[] = {1, 16, 64, 256, 1024, 4096};
+static const size_t PREFETCH_DISTS[] = {0, 2, 4, 8, 16, 32, 64};
+static const int BATCH_NEG_SHARE = 50;
+
+static void print_batch_csv_header(void) {
+    printf("filter,target_fpr,param_bits,neg_share,batch,prefetch_dist,nqueries,secs,mqps,hit_rate,backing,prefault\n");
 }
 
 
@@ -104,9 +114,10 @@ static void measure_mix(const char *name,
                         int neg_share,
                         query_fn_t qfn,
                         const void *filter,
+                        fmem_backing_t backing,
                         const uint64_t *queries,
                         size_t nqueries,
-                        uint64_t *lat_ns_buf)
+                        lat_hist_t *hist)
 {
     volatile uint64_t sink = 0;
     size_t hits = 0;
@@ -115,12 +126,20 @@ static void measure_mix(const char *name,
         sink += (uint64_t)qfn(filter, queries[i]);
     }
 
+    lat_hist_reset(hist);
+    size_t countdown = g_sample_every;
     uint64_t t0 = now_ns();
     for (size_t i = 0; i < nqueries; i++) {
-        uint64_t a = now_ns();
-        int h = qfn(filter, queries[i]);
-        uint64_t b = now_ns();
-        lat_ns_buf[i] = (b - a);
+        int h;
+        if (--countdown == 0) {
+            countdown = g_sample_every;
+            uint64_t a = lat_start();
+            h = qfn(filter, queries[i]);
+            uint64_t b = lat_stop();
+            lat_hist_add(hist, &g_clock, a, b);
+        } else {
+            h = qfn(filter, queries[i]);
+        }
         hits += (size_t)h;
         sink += (uint64_t)h;
     }
@@ -132,17 +151,74 @@ static void measure_mix(const char *name,
     double qps  = (secs > 0) ? ((double)nqueries / secs) : 0.0;
     double mops = qps / 1e6;
 
-    qsort(lat_ns_buf, nqueries, sizeof(uint64_t), cmp_u64);
-    uint64_t p50 = percentile_u64(lat_ns_buf, nqueries, 0.50);
-    uint64_t p95 = percentile_u64(lat_ns_buf, nqueries, 0.95);
-    uint64_t p99 = percentile_u64(lat_ns_buf, nqueries, 0.99);
+    double p50  = lat_hist_quantile_ns(hist, &g_clock, 0.50);
+    double p95  = lat_hist_quantile_ns(hist, &g_clock, 0.95);
+    double p99  = lat_hist_quantile_ns(hist, &g_clock, 0.99);
+    double p999 = lat_hist_quantile_ns(hist, &g_clock, 0.999);
+
+    double hit_rate = (nqueries > 0) ? ((double)hits / (double)nqueries) : 0.0;
+
+    printf("%s,%.6f,%d,%d,%zu,%.6f,%.3f,%.3f,%.1f,%.1f,%.1f,%.1f,%.6f,%s,%d,%zu\n",
+           name, target_fpr, param_bits, neg_share, nqueries, secs, qps, mops, p50, p95, p99, p999,
+           hit_rate, fmem_name(backing), g_prefault, g_sample_every);
+}
+
+
+typedef size_t (*batch_fn_t)(const void *filter, const uint64_t *keys, size_t n,
+                             uint64_t *out_bitmap, size_t dist);
+
+static void measure_batch(const char *name,
+                          double target_fpr,
+                          int param_bits,
+                          int neg_share,
+                          batch_fn_t bfn,
+                          const void *filter,
+                          fmem_backing_t backing,
+                          const uint64_t *queries,
+                          size_t nqueries,
+                          size_t batch,
+                          size_t dist,
+                          uint64_t *bitmap_buf)
+{
+    size_t warm = (nqueries < 10000 ? nqueries : 10000);
+    (void)bfn(filter, queries, warm < batch ? warm : batch, bitmap_buf, dist);
+
+    size_t hits = 0;
+    uint64_t t0 = now_ns();
+    for (size_t i = 0; i < nqueries; i += batch) {
+        size_t len = (nqueries - i < batch) ? (nqueries - i) : batch;
+        hits += bfn(filter, queries + i, len, bitmap_buf, dist);
+    }
+    uint64_t t1 = now_ns();
 
+    double secs = (double)(t1 - t0) * 1e-9;
+    double mqps = (secs > 0) ? ((double)nqueries / secs / 1e6) : 0.0;
     double hit_rate = (nqueries > 0) ? ((double)hits / (double)nqueries) : 0.0;
 
-    printf("%s,%.6f,%d,%d,%zu,%.6f,%.3f,%.3f,%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%.6f\n",
-           name, target_fpr, param_bits, neg_share, nqueries, secs, qps, mops, p50, p95, p99, hit_rate);
+    printf("%s,%.6f,%d,%d,%zu,%zu,%zu,%.6f,%.3f,%.6f,%s,%d\n",
+           name, target_fpr, param_bits, neg_share, batch, dist, nqueries, secs, mqps, hit_rate,
+           fmem_name(backing), g_prefault);
 }
 
+static size_t bb_batch_adapter(const void *f, const uint64_t *k, size_t n, uint64_t *out, size_t d) {
+    return blocked_bloom_query_batch_dist((const blocked_bloom_t*)f, k, n, out, d);
+}
+
+static size_t xor_batch_adapter(const void *f, const uint64_t *k, size_t n, uint64_t *out, size_t d) {
+    return xor_query_batch_dist((const xor_filter_t*)f, k, n, out, d);
+}
+
+static size_t ribbon_batch_adapter(const void *f, const uint64_t *k, size_t n, uint64_t *out, size_t d) {
+    return ribbon_query_batch_dist((const ribbon_filter_t*)f, k, n, out, d);
+}
+
+static size_t ck_batch_adapter(const void *f, const uint64_t *k, size_t n, uint64_t *out, size_t d) {
+    return cuckoo_query_batch_dist((const cuckoo_filter_t*)f, k, n, out, d);
+}
+
+static size_t qf_batch_adapter(const void *f, const uint64_t *k, size_t n, uint64_t *out, size_t d) {
+    return qf_query_batch_dist((const quotient_filter_t*)f, k, n, out, d);
+}
 
 static int bb_query_adapter(const void *f, uint64_t k) {
     const blocked_bloom_t *bf = (const blocked_bloom_t*)f;
@@ -154,9 +230,13 @@ static int xor_query_adapter(const void *f, uint64_t k) {
     return xor_query(xf, k);
 }
 
+static int ribbon_query_adapter(const void *f, uint64_t k) {
+    const ribbon_filter_t *rf = (const ribbon_filter_t*)f;
+    return ribbon_query(rf, k);
+}
+
 static int ck_query_adapter(const void *f, uint64_t k) {
-  
-    cuckoo_filter_t *cf = (cuckoo_filter_t*)f;
+    const cuckoo_filter_t *cf = (const cuckoo_filter_t*)f;
     return cuckoo_query(cf, k);
 }
 
@@ -170,6 +250,16 @@ int main(int argc, char **argv) {
   
     size_t n = (argc >= 2) ? (size_t)atoll(argv[1]) : 1000000ULL;
     size_t nqueries = (argc >= 3) ? (size_t)atoll(argv[2]) : 1000000ULL;
+    int batch_mode = (argc >= 4) && strcmp(argv[3], "batch") == 0;
+    if (argc >= 6) g_sample_every = (size_t)atoll(argv[5]);
+    int bad_mode = (argc >= 4) && !batch_mode && strcmp(argv[3], "mix") != 0;
+    if (bad_mode || (argc >= 5 && fmem_parse(argv[4], &g_backing, &g_prefault) != 0) ||
+        g_sample_every == 0) {
+        fprintf(stderr, "Usage: %s [n] [nqueries] [mix|batch] [default|thp|hugetlb[+prefault]] [sample_every]\n",
+                argv[0]);
+        return 1;
+    }
+    g_clock = lat_calibrate(20);
 
     // pos keys for building
     uint64_t *pos = (uint64_t*)malloc(sizeof(uint64_t) * n);
@@ -177,19 +267,23 @@ int main(int argc, char **argv) {
     uint64_t *neg = (uint64_t*)malloc(sizeof(uint64_t) * nqueries);
     // mixed query array
     uint64_t *queries = (uint64_t*)malloc(sizeof(uint64_t) * nqueries);
-    // latency buffer
-    uint64_t *lat = (uint64_t*)malloc(sizeof(uint64_t) * nqueries);
+    // latency histogram (mix mode)
+    lat_hist_t *lat = (lat_hist_t*)malloc(sizeof(lat_hist_t));
+    // batch result bitmap (batch mode)
+    size_t max_batch = BATCH_SIZES[sizeof(BATCH_SIZES)/sizeof(BATCH_SIZES[0]) - 1];
+    uint64_t *bitmap = (uint64_t*)malloc(sizeof(uint64_t) * ((max_batch + 63) / 64));
 
-    if (!pos || !neg || !queries || !lat) {
+    if (!pos || !neg || !queries || !lat || !bitmap) {
         fprintf(stderr, "alloc failed\n");
-        free(pos); free(neg); free(queries); free(lat);
+        free(pos); free(neg); free(queries); free(lat); free(bitmap);
         return 1;
     }
 
     gen_keys(pos, n, 123456789ULL, 0);
     gen_keys(neg, nqueries, 987654321ULL, 0x9e3779b97f4a7c15ULL);
 
-    print_csv_header();
+    if (batch_mode) print_batch_csv_header();
+    else print_csv_header();
 
     for (size_t ci = 0; ci < sizeof(CFGS)/sizeof(CFGS[0]); ci++) {
         double target_fpr = CFGS[ci].target_fpr;
@@ -202,11 +296,43 @@ int main(int argc, char **argv) {
             continue;
         }
         for (size_t i = 0; i < n; i++) blocked_bloom_insert(&bf, pos[i]);
+        int bb_avx2 = (blocked_bloom_set_path(&bf, BB_PATH_AVX2) == 0);
+
+        // Split-block and register-blocked layouts, best path
+        blocked_bloom_t sb, rb;
+        if (blocked_bloom_init_layout(&sb, n, target_fpr, BB_LAYOUT_SPLIT) != 0) {
+            fprintf(stderr, "[SplitBlockBloom] init failed\n");
+            blocked_bloom_free(&bf);
+            continue;
+        }
+        if (blocked_bloom_init_layout(&rb, n, target_fpr, BB_LAYOUT_REGISTER) != 0) {
+            fprintf(stderr, "[RegisterBloom] init failed\n");
+            blocked_bloom_free(&sb);
+            blocked_bloom_free(&bf);
+            continue;
+        }
+        for (size_t i = 0; i < n; i++) {
+            blocked_bloom_insert(&sb, pos[i]);
+            blocked_bloom_insert(&rb, pos[i]);
+        }
 
         // XOR
         xor_filter_t xf;
         if (xor_build(&xf, pos, (uint32_t)n, (uint32_t)bits, 1) != 0) {
             fprintf(stderr, "[XOR] build failed\n");
+            blocked_bloom_free(&rb);
+            blocked_bloom_free(&sb);
+            blocked_bloom_free(&bf);
+            continue;
+        }
+
+        // Ribbon, widest band (least space)
+        ribbon_filter_t rf;
+        if (ribbon_build(&rf, pos, (uint32_t)n, (uint32_t)bits, 128, 1) != 0) {
+            fprintf(stderr, "[Ribbon] build failed\n");
+            xor_free(&xf);
+            blocked_bloom_free(&rb);
+            blocked_bloom_free(&sb);
             blocked_bloom_free(&bf);
             continue;
         }
@@ -215,12 +341,29 @@ int main(int argc, char **argv) {
         cuckoo_filter_t cf;
         if (cuckoo_init(&cf, n, bits) != 0) {
             fprintf(stderr, "[Cuckoo] init failed\n");
+            ribbon_free(&rf);
             xor_free(&xf);
+            blocked_bloom_free(&rb);
+            blocked_bloom_free(&sb);
             blocked_bloom_free(&bf);
             continue;
         }
         for (size_t i = 0; i < n; i++) (void)cuckoo_insert(&cf, pos[i]);
 
+        // Cuckoo sized for n/16 keys, so lookups walk the grown levels
+        cuckoo_filter_t cg;
+        if (cuckoo_init(&cg, n / 16, bits) != 0) {
+            fprintf(stderr, "[CuckooGrow] init failed\n");
+            cuckoo_free(&cf);
+            ribbon_free(&rf);
+            xor_free(&xf);
+            blocked_bloom_free(&rb);
+            blocked_bloom_free(&sb);
+            blocked_bloom_free(&bf);
+            continue;
+        }
+        for (size_t i = 0; i < n; i++) (void)cuckoo_insert(&cg, pos[i]);
+
         // QF 
         const double qf_load = 0.70;
         size_t slots_need = (size_t)ceil((double)n / qf_load);
@@ -231,27 +374,75 @@ int main(int argc, char **argv) {
         quotient_filter_t qf;
         if (qf_init(&qf, qbits, (size_t)bits) != 0) {
             fprintf(stderr, "[QF] init failed\n");
+            cuckoo_free(&cg);
             cuckoo_free(&cf);
+            ribbon_free(&rf);
             xor_free(&xf);
+            blocked_bloom_free(&rb);
+            blocked_bloom_free(&sb);
             blocked_bloom_free(&bf);
             continue;
         }
         for (size_t i = 0; i < n; i++) (void)qf_insert(&qf, pos[i]);
 
-        for (size_t si = 0; si < sizeof(NEG_SHARES)/sizeof(NEG_SHARES[0]); si++) {
+        if (g_backing != FMEM_DEFAULT || g_prefault) {
+            blocked_bloom_set_backing(&bf, g_backing, g_prefault);
+            blocked_bloom_set_backing(&sb, g_backing, g_prefault);
+            blocked_bloom_set_backing(&rb, g_backing, g_prefault);
+            xor_set_backing(&xf, g_backing, g_prefault);
+            ribbon_set_backing(&rf, g_backing, g_prefault);
+            cuckoo_set_backing(&cf, g_backing, g_prefault);
+            cuckoo_set_backing(&cg, g_backing, g_prefault);
+            qf_set_backing(&qf, g_backing, g_prefault);
+        }
+
+        if (batch_mode) {
+            build_mixed_queries(queries, nqueries, pos, n, neg, nqueries, BATCH_NEG_SHARE,
+                                0xBADC0FFEEULL + (uint64_t)BATCH_NEG_SHARE);
+
+            for (size_t bi = 0; bi < sizeof(BATCH_SIZES)/sizeof(BATCH_SIZES[0]); bi++) {
+                for (size_t di = 0; di < sizeof(PREFETCH_DISTS)/sizeof(PREFETCH_DISTS[0]); di++) {
+                    size_t batch = BATCH_SIZES[bi];
+                    size_t dist = PREFETCH_DISTS[di];
+                    measure_batch("BlockedBloom", target_fpr, -1,  BATCH_NEG_SHARE, bb_batch_adapter,  &bf, bf.backing, queries, nqueries, batch, dist, bitmap);
+                    measure_batch("SplitBlockBloom", target_fpr, -1, BATCH_NEG_SHARE, bb_batch_adapter, &sb, sb.backing, queries, nqueries, batch, dist, bitmap);
+                    measure_batch("RegisterBloom", target_fpr, -1, BATCH_NEG_SHARE, bb_batch_adapter,  &rb, rb.backing, queries, nqueries, batch, dist, bitmap);
+                    measure_batch("XOR",          target_fpr, bits, BATCH_NEG_SHARE, xor_batch_adapter, &xf, xf.backing, queries, nqueries, batch, dist, bitmap);
+                    measure_batch("Ribbon128",    target_fpr, bits, BATCH_NEG_SHARE, ribbon_batch_adapter, &rf, rf.backing, queries, nqueries, batch, dist, bitmap);
+                    measure_batch("Cuckoo",       target_fpr, bits, BATCH_NEG_SHARE, ck_batch_adapter,  &cf, cf.backing, queries, nqueries, batch, dist, bitmap);
+                    measure_batch("CuckooGrow",   target_fpr, bits, BATCH_NEG_SHARE, ck_batch_adapter,  &cg, cg.backing, queries, nqueries, batch, dist, bitmap);
+                    measure_batch("Quotient",     target_fpr, bits, BATCH_NEG_SHARE, qf_batch_adapter,  &qf, qf.backing, queries, nqueries, batch, dist, bitmap);
+                }
+            }
+        }
+
+        for (size_t si = 0; !batch_mode && si < sizeof(NEG_SHARES)/sizeof(NEG_SHARES[0]); si++) {
             int neg_share = NEG_SHARES[si];
 
             build_mixed_queries(queries, nqueries, pos, n, neg, nqueries, neg_share, 0xBADC0FFEEULL + (uint64_t)neg_share);
 
-            measure_mix("BlockedBloom", target_fpr, -1,  neg_share, bb_query_adapter,  &bf, queries, nqueries, lat);
-            measure_mix("XOR",         target_fpr, bits, neg_share, xor_query_adapter, &xf, queries, nqueries, lat);
-            measure_mix("Cuckoo",      target_fpr, bits, neg_share, ck_query_adapter,  &cf, queries, nqueries, lat);
-            measure_mix("Quotient",    target_fpr, bits, neg_share, qf_query_adapter,  &qf, queries, nqueries, lat);
+            blocked_bloom_set_path(&bf, BB_PATH_SCALAR);
+            measure_mix("BlockedBloom", target_fpr, -1,  neg_share, bb_query_adapter,  &bf, bf.backing, queries, nqueries, lat);
+            if (bb_avx2) {
+                blocked_bloom_set_path(&bf, BB_PATH_AVX2);
+                measure_mix("BlockedBloomAVX2", target_fpr, -1, neg_share, bb_query_adapter, &bf, bf.backing, queries, nqueries, lat);
+            }
+            measure_mix("SplitBlockBloom", target_fpr, -1, neg_share, bb_query_adapter, &sb, sb.backing, queries, nqueries, lat);
+            measure_mix("RegisterBloom", target_fpr, -1, neg_share, bb_query_adapter,  &rb, rb.backing, queries, nqueries, lat);
+            measure_mix("XOR",         target_fpr, bits, neg_share, xor_query_adapter, &xf, xf.backing, queries, nqueries, lat);
+            measure_mix("Ribbon128",   target_fpr, bits, neg_share, ribbon_query_adapter, &rf, rf.backing, queries, nqueries, lat);
+            measure_mix("Cuckoo",      target_fpr, bits, neg_share, ck_query_adapter,  &cf, cf.backing, queries, nqueries, lat);
+            measure_mix("CuckooGrow",  target_fpr, bits, neg_share, ck_query_adapter,  &cg, cg.backing, queries, nqueries, lat);
+            measure_mix("Quotient",    target_fpr, bits, neg_share, qf_query_adapter,  &qf, qf.backing, queries, nqueries, lat);
         }
 
         qf_free(&qf);
+        cuckoo_free(&cg);
         cuckoo_free(&cf);
+        ribbon_free(&rf);
         xor_free(&xf);
+        blocked_bloom_free(&rb);
+        blocked_bloom_free(&sb);
         blocked_bloom_free(&bf);
     }
 
@@ -259,5 +450,6 @@ int main(int argc, char **argv) {
     free(neg);
     free(queries);
     free(lat);
+    free(bitmap);
     return 0;
 }
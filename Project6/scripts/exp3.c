@@ -7,6 +7,7 @@
 #include <math.h>
 #include <inttypes.h>
 
+#include "bb.h"
 #include "ck.h"
 #include "qf.h"
 
@@ -40,34 +41,59 @@ static void shuffle_u64(uint64_t *a, size_t n, uint64_t seed) {
 
 static inline double ns_to_sec(uint64_t ns) { return (double)ns / 1e9; }
 
-static inline int qf_slot_empty(const qf_slot_t *s) {
-    return (s->rem == 0) && (s->continuation == 0) && (s->shifted == 0) && (s->occupied == 0);
+static inline int qf_bit(uint64_t word, size_t i) {
+    return (int)((word >> (i % QF_BLOCK_SLOTS)) & 1);
 }
 
-static size_t qf_collect_cluster_lengths(const quotient_filter_t *qf, uint32_t **out_lens) {
-    size_t n = qf->nslots;
+// One pass over the occupieds/runends bitvectors. A slot is in use while
+// some occupied quotient seen so far has an unfinished run; a cluster starts
+// at a run that sits in its home slot. For every occupied quotient also
+// record the slots the classic QF walk would scan to reach its run (back to
+// the cluster start, then forward run by run) -- the scan that rank/select
+// on the block metadata replaces.
+static size_t qf_collect_cluster_lengths(const quotient_filter_t *qf, uint32_t **out_lens,
+                                         uint32_t **out_scans, size_t *out_nscans) {
+    size_t n = qf->xnslots;
     uint32_t *lens = (uint32_t*)malloc(sizeof(uint32_t) * n);
-    if (!lens) return 0;
+    uint32_t *scans = (uint32_t*)malloc(sizeof(uint32_t) * n);
+    size_t *pending = (size_t*)malloc(sizeof(size_t) * n);
+    if (!lens || !scans || !pending) {
+        free(lens); free(scans); free(pending);
+        return 0;
+    }
+
+    size_t cnt = 0, nscans = 0;
+    size_t pushed = 0, started = 0, ended = 0;
+    size_t cstart = 0;
+    int run_start = 1;
 
-    size_t cnt = 0;
     for (size_t i = 0; i < n; i++) {
-        const qf_slot_t *s = &qf->slots[i];
-        if (qf_slot_empty(s)) continue;
-        if (s->shifted) continue;
-
-        uint32_t len = 1;
-        size_t j = (i + 1) & (n - 1);
-        while (j != i) {
-            const qf_slot_t *t = &qf->slots[j];
-            if (qf_slot_empty(t)) break;
-            if (!(t->shifted || t->continuation)) break;
-            len++;
-            j = (j + 1) & (n - 1);
+        const qf_block_t *b = qf_block(qf, i / QF_BLOCK_SLOTS);
+        if (qf_bit(b->occupieds, i)) pending[pushed++] = i;
+
+        if (pushed == ended) {  // empty slot
+            run_start = 1;
+            continue;
+        }
+
+        if (run_start) {
+            size_t q = pending[started++];
+            if (q == i) {
+                cstart = i;
+                lens[cnt++] = 0;
+            }
+            scans[nscans++] = (uint32_t)((q - cstart) + (i - cstart));
         }
-        lens[cnt++] = len;
+        lens[cnt - 1]++;
+
+        run_start = qf_bit(b->runends, i);
+        if (run_start) ended++;
     }
+    free(pending);
 
     *out_lens = lens;
+    *out_scans = scans;
+    *out_nscans = nscans;
     return cnt;
 }
 
@@ -89,9 +115,24 @@ static const double LOADS[] = {
 
 static const int BITS[] = { 8, 12, 16 };
 
-static void run_cuckoo_sweep(size_t n_max, const uint64_t *keys, int fp_bits) {
+// table backing requested for every filter (filter_mem.h), applied right
+// after init; rows record the backing each one got
+static fmem_backing_t g_backing = FMEM_DEFAULT;
+static int g_prefault = 0;
+
+static int want_backing(void) {
+    return g_backing != FMEM_DEFAULT || g_prefault;
+}
+
+static void run_cuckoo_sweep(size_t n_max, const uint64_t *keys, int fp_bits, ck_insert_mode_t mode) {
+    const char *name = (mode == CK_INSERT_BFS) ? "CuckooBFS" : "Cuckoo";
+
+    // cuckoo_init sizes for 85% load; half of n_max keeps the table small
+    // enough that n_max keys reach every load in LOADS
+    size_t hint = (size_t)(0.85 * (double)(n_max / 2));
+
     cuckoo_filter_t cf;
-    if (cuckoo_init(&cf, n_max, fp_bits) != 0) {
+    if (cuckoo_init(&cf, hint, fp_bits) != 0) {
         fprintf(stderr, "[Cuckoo] init failed (n_max=%zu fp_bits=%d)\n", n_max, fp_bits);
         return;
     }
@@ -100,10 +141,12 @@ static void run_cuckoo_sweep(size_t n_max, const uint64_t *keys, int fp_bits) {
         double target_load = LOADS[li];
 
         cuckoo_free(&cf);
-        if (cuckoo_init(&cf, n_max, fp_bits) != 0) {
+        if (cuckoo_init(&cf, hint, fp_bits) != 0) {
             fprintf(stderr, "[Cuckoo] init failed in loop\n");
             return;
         }
+        cuckoo_set_insert_mode(&cf, mode);
+        if (want_backing()) cuckoo_set_backing(&cf, g_backing, g_prefault);
 
         size_t capacity_slots = cuckoo_capacity_slots(&cf);
         size_t target_items = (size_t)floor(target_load * (double)capacity_slots);
@@ -143,7 +186,8 @@ static void run_cuckoo_sweep(size_t n_max, const uint64_t *keys, int fp_bits) {
         double delete_sec = ns_to_sec(t3 - t2);
         double delete_mops = delete_sec > 0 ? (double)del_ops / delete_sec / 1e6 : 0.0;
 
-        printf("Cuckoo,%d,%.2f,%zu,%zu,%zu,%.6f,%.6f,%zu,%zu,%.6f,%.6f,,,,\n",
+        printf("%s,%d,%.2f,%zu,%zu,%zu,%.6f,%.6f,%zu,%zu,%.6f,%.6f,,,,,,,,%s,%d\n",
+               name,
                fp_bits,
                target_load,
                capacity_slots,
@@ -152,27 +196,19 @@ static void run_cuckoo_sweep(size_t n_max, const uint64_t *keys, int fp_bits) {
                insert_mops,
                fail_rate,
                cf.stats.total_kicks,
-               cf.stats.stash_inserts,
+               cf.stats.levels_added,
                avg_probe,
-               delete_mops);
+               delete_mops,
+               fmem_name(cf.backing), g_prefault);
     }
 
     cuckoo_free(&cf);
 }
 
-static size_t round_up_pow2(size_t x) {
-    if (x <= 1) return 1;
-    if ((x & (x - 1)) == 0) return x;
-    size_t p = 1;
-    while (p < x) p <<= 1;
-    return p;
-}
-
 static void run_qf_sweep(size_t n_max, const uint64_t *keys, int rbits) {
-    size_t slots_need = (size_t)ceil((double)n_max / 0.95);
-    size_t slots = round_up_pow2(slots_need);
+    // largest table that n_max keys can fill to every load in LOADS
     size_t qbits = 0;
-    while ((1ULL << qbits) < slots) qbits++;
+    while ((2ULL << qbits) <= n_max) qbits++;
 
     for (size_t li = 0; li < sizeof(LOADS)/sizeof(LOADS[0]); li++) {
         double target_load = LOADS[li];
@@ -181,6 +217,7 @@ static void run_qf_sweep(size_t n_max, const uint64_t *keys, int rbits) {
             fprintf(stderr, "[QF] init failed (qbits=%zu rbits=%d)\n", qbits, rbits);
             return;
         }
+        if (want_backing()) qf_set_backing(&qf, g_backing, g_prefault);
 
         size_t target_items = (size_t)floor(target_load * (double)qf.nslots);
         if (target_items > n_max) target_items = n_max;
@@ -194,11 +231,13 @@ static void run_qf_sweep(size_t n_max, const uint64_t *keys, int rbits) {
         }
         uint64_t t1 = now_ns();
 
+        size_t inserted = qf.nitems;
         double insert_sec = ns_to_sec(t1 - t0);
         double insert_mops = insert_sec > 0 ? (double)attempts / insert_sec / 1e6 : 0.0;
 
-        uint32_t *lens = NULL;
-        size_t cnt = qf_collect_cluster_lengths(&qf, &lens);
+        uint32_t *lens = NULL, *scans = NULL;
+        size_t nscans = 0;
+        size_t cnt = qf_collect_cluster_lengths(&qf, &lens, &scans, &nscans);
 
         uint32_t p50 = 0, p95 = 0, p99 = 0, mx = 0;
         if (cnt > 0) {
@@ -210,6 +249,18 @@ static void run_qf_sweep(size_t n_max, const uint64_t *keys, int rbits) {
         }
         free(lens);
 
+        double scan_avg = 0.0;
+        uint32_t scan_p99 = 0, scan_max = 0;
+        if (nscans > 0) {
+            uint64_t sum = 0;
+            for (size_t i = 0; i < nscans; i++) sum += scans[i];
+            scan_avg = (double)sum / (double)nscans;
+            qsort(scans, nscans, sizeof(uint32_t), cmp_u32);
+            scan_p99 = quantile_u32(scans, nscans, 0.99);
+            scan_max = scans[nscans - 1];
+        }
+        free(scans);
+
         uint64_t *del = (uint64_t*)malloc(sizeof(uint64_t) * target_items);
         if (!del) { fprintf(stderr, "alloc failed\n"); qf_free(&qf); return; }
         memcpy(del, keys, sizeof(uint64_t) * target_items);
@@ -227,29 +278,100 @@ static void run_qf_sweep(size_t n_max, const uint64_t *keys, int rbits) {
         double delete_sec = ns_to_sec(t3 - t2);
         double delete_mops = delete_sec > 0 ? (double)del_ops / delete_sec / 1e6 : 0.0;
 
-        printf("Quotient,%d,%.2f,%zu,%zu,%zu,%.6f,%.6f,,,,%.6f,%u,%u,%u,%u\n",
+        printf("Quotient,%d,%.2f,%zu,%zu,%zu,%.6f,%.6f,,,,%.6f,%u,%u,%u,%u,%.3f,%u,%u,%s,%d\n",
                rbits,
                target_load,
                qf.nslots,
                attempts,
-               qf.nitems,
+               inserted,
                insert_mops,
                attempts ? (double)fails / (double)attempts : 0.0,
                delete_mops,
-               p50, p95, p99, mx);
+               p50, p95, p99, mx,
+               scan_avg, scan_p99, scan_max,
+               fmem_name(qf.backing), g_prefault);
 
         qf_free(&qf);
     }
 }
 
+// Counting blocked Bloom sized for half of n_max keys at the FPR a cuckoo
+// filter with the same fingerprint bits has (2 * 4 / 2^bits), so `load` is
+// the fraction of that design count inserted. capacity_slots counts 4-bit
+// counters.
+static void run_cbf_sweep(size_t n_max, const uint64_t *keys, int bits) {
+    size_t design = n_max / 2;
+    double target_fpr = 8.0 / (double)(1ULL << bits);
+
+    for (size_t li = 0; li < sizeof(LOADS)/sizeof(LOADS[0]); li++) {
+        double target_load = LOADS[li];
+        blocked_bloom_t bf;
+        if (blocked_bloom_init_layout(&bf, design, target_fpr, BB_LAYOUT_COUNTING) != 0) {
+            fprintf(stderr, "[CountingBloom] init failed (design=%zu bits=%d)\n", design, bits);
+            return;
+        }
+        if (want_backing()) blocked_bloom_set_backing(&bf, g_backing, g_prefault);
+
+        size_t target_items = (size_t)floor(target_load * (double)design);
+        if (target_items > n_max) target_items = n_max;
+
+        uint64_t t0 = now_ns();
+        size_t attempts = 0;
+        size_t fails = 0;
+        for (size_t i = 0; i < target_items; i++) {
+            attempts++;
+            if (blocked_bloom_insert(&bf, keys[i]) != 0) fails++;
+        }
+        uint64_t t1 = now_ns();
+
+        double insert_sec = ns_to_sec(t1 - t0);
+        double insert_mops = insert_sec > 0 ? (double)attempts / insert_sec / 1e6 : 0.0;
+
+        uint64_t *del = (uint64_t*)malloc(sizeof(uint64_t) * target_items);
+        if (!del) { fprintf(stderr, "alloc failed\n"); blocked_bloom_free(&bf); return; }
+        memcpy(del, keys, sizeof(uint64_t) * target_items);
+        shuffle_u64(del, target_items, 0x5678ULL ^ (uint64_t)target_items);
+
+        uint64_t t2 = now_ns();
+        size_t del_ops = 0;
+        for (size_t i = 0; i < target_items; i++) {
+            (void)blocked_bloom_delete(&bf, del[i]);
+            del_ops++;
+        }
+        uint64_t t3 = now_ns();
+        free(del);
+
+        double delete_sec = ns_to_sec(t3 - t2);
+        double delete_mops = delete_sec > 0 ? (double)del_ops / delete_sec / 1e6 : 0.0;
+
+        printf("CountingBloom,%d,%.2f,%zu,%zu,%zu,%.6f,%.6f,,,,%.6f,,,,,,,,%s,%d\n",
+               bits,
+               target_load,
+               bf.nblocks * 128,
+               attempts,
+               attempts - fails,
+               insert_mops,
+               attempts ? (double)fails / (double)attempts : 0.0,
+               delete_mops,
+               fmem_name(bf.backing), g_prefault);
+
+        blocked_bloom_free(&bf);
+    }
+}
+
 static void print_header(void) {
     printf("filter,param_bits,load,capacity_slots,insert_attempts,inserted,insert_mops,insert_fail_rate,"
-           "cuckoo_total_kicks,cuckoo_stash_inserts,cuckoo_avg_probe,delete_mops,"
-           "qf_cluster_p50,qf_cluster_p95,qf_cluster_p99,qf_cluster_max\n");
+           "cuckoo_total_kicks,cuckoo_levels_added,cuckoo_avg_probe,delete_mops,"
+           "qf_cluster_p50,qf_cluster_p95,qf_cluster_p99,qf_cluster_max,"
+           "qf_scan_avoided_avg,qf_scan_avoided_p99,qf_scan_avoided_max,backing,prefault\n");
 }
 
 int main(int argc, char **argv) {
     size_t n_max = (argc >= 2) ? (size_t)atoll(argv[1]) : 1000000ULL;
+    if (argc >= 3 && fmem_parse(argv[2], &g_backing, &g_prefault) != 0) {
+        fprintf(stderr, "Usage: %s [n_max] [default|thp|hugetlb[+prefault]]\n", argv[0]);
+        return 1;
+    }
 
     uint64_t *keys = (uint64_t*)malloc(sizeof(uint64_t) * n_max);
     if (!keys) {
@@ -262,8 +384,10 @@ int main(int argc, char **argv) {
 
     for (size_t bi = 0; bi < sizeof(BITS)/sizeof(BITS[0]); bi++) {
         int bits = BITS[bi];
-        run_cuckoo_sweep(n_max, keys, bits);
+        run_cuckoo_sweep(n_max, keys, bits, CK_INSERT_RANDOM_WALK);
+        run_cuckoo_sweep(n_max, keys, bits, CK_INSERT_BFS);
         run_qf_sweep(n_max, keys, bits);
+        run_cbf_sweep(n_max, keys, bits);
     }
 
     free(keys);
@@ -11,6 +11,7 @@
 #include <inttypes.h>
 #include <math.h>
 
+#include "bb.h"
 #include "ck.h"
 #include "qf.h"
 
@@ -32,17 +33,39 @@ static void gen_keys(uint64_t *out, size_t n, uint64_t seed, uint64_t add) {
     for (size_t i = 0; i < n; i++) out[i] = splitmix64(&s) + add;
 }
 
+// Time is read once every TIME_CHECK_OPS ops, not per op.
+#define TIME_CHECK_OPS 256
+
+// One filter's operations on an opaque filter pointer, resolved once in
+// main(). Each table gets its own copy of the worker loop (worker_loop is
+// always inlined with a constant table), so the calls are direct.
+typedef struct {
+    int (*query)(void *f, uint64_t key);
+    int (*insert)(void *f, uint64_t key);
+    int (*del)(void *f, uint64_t key);
+} filter_ops_t;
+
+typedef enum {
+    OPS_CUCKOO,
+    OPS_CUCKOO_MT,
+    OPS_QF,
+    OPS_QF_MT,
+    OPS_BB,       // BlockedBloom and CountingBloom
+    OPS_BB_MT,
+} ops_kind_t;
+
 typedef struct {
     int nthreads;
     int pin;
     int tid;
 
-    const char *filter_name;
-    int bits;
+    ops_kind_t kind;
+    void *filter;
 
-    double read_frac;
-    double ins_frac;
-    double del_frac;
+    // op mix as thresholds on a 32-bit draw: < read_thr reads,
+    // < ins_thr inserts, the rest deletes
+    uint64_t read_thr;
+    uint64_t ins_thr;
 
     uint64_t t_warm_end;
     uint64_t t_end;
@@ -55,9 +78,6 @@ typedef struct {
     const uint64_t *ins_keys;
     size_t n_ins;
 
-    cuckoo_filter_t *cf;
-    quotient_filter_t *qf;
-
     pthread_mutex_t *wlock;
 
     uint64_t ops;
@@ -78,81 +98,84 @@ static void pin_thread(int tid, int nthreads) {
     pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
 }
 
-static inline int do_cuckoo_insert(cuckoo_filter_t *cf, uint64_t key) {
-    return cuckoo_insert(cf, key);
-}
-static inline int do_cuckoo_delete(cuckoo_filter_t *cf, uint64_t key) {
-    return cuckoo_delete(cf, key);
-}
-static inline int do_cuckoo_query(const cuckoo_filter_t *cf, uint64_t key) {
-    return cuckoo_query(cf, key);
-}
-
-static inline int do_qf_insert(quotient_filter_t *qf, uint64_t key) {
-    return qf_insert(qf, key);
-}
-static inline int do_qf_delete(quotient_filter_t *qf, uint64_t key) {
-    return qf_delete(qf, key);
-}
-static inline int do_qf_query(const quotient_filter_t *qf, uint64_t key) {
-    return qf_query(qf, key);
-}
-
-static void *worker_main(void *arg) {
-    worker_t *w = (worker_t*)arg;
-    if (w->pin) pin_thread(w->tid, sysconf(_SC_NPROCESSORS_ONLN));
-
-    while (!*w->start_flag) { }
-
+static int ck_query_op(void *f, uint64_t key)  { return cuckoo_query((const cuckoo_filter_t*)f, key); }
+static int ck_insert_op(void *f, uint64_t key) { return cuckoo_insert((cuckoo_filter_t*)f, key); }
+static int ck_delete_op(void *f, uint64_t key) { return cuckoo_delete((cuckoo_filter_t*)f, key); }
+
+static int ck_query_mt_op(void *f, uint64_t key)  { return cuckoo_query_mt((const cuckoo_filter_t*)f, key); }
+static int ck_insert_mt_op(void *f, uint64_t key) { return cuckoo_insert_mt((cuckoo_filter_t*)f, key); }
+static int ck_delete_mt_op(void *f, uint64_t key) { return cuckoo_delete_mt((cuckoo_filter_t*)f, key); }
+
+static int qf_query_op(void *f, uint64_t key)  { return qf_query((const quotient_filter_t*)f, key); }
+static int qf_insert_op(void *f, uint64_t key) { return qf_insert((quotient_filter_t*)f, key); }
+static int qf_delete_op(void *f, uint64_t key) { return qf_delete((quotient_filter_t*)f, key); }
+
+static int qf_query_mt_op(void *f, uint64_t key)  { return qf_query_mt((const quotient_filter_t*)f, key); }
+static int qf_insert_mt_op(void *f, uint64_t key) { return qf_insert_mt((quotient_filter_t*)f, key); }
+static int qf_delete_mt_op(void *f, uint64_t key) { return qf_delete_mt((quotient_filter_t*)f, key); }
+
+static int bb_query_op(void *f, uint64_t key)  { return blocked_bloom_query((const blocked_bloom_t*)f, key); }
+static int bb_insert_op(void *f, uint64_t key) { return blocked_bloom_insert((blocked_bloom_t*)f, key); }
+static int bb_delete_op(void *f, uint64_t key) { return blocked_bloom_delete((blocked_bloom_t*)f, key); }
+
+static int bb_query_mt_op(void *f, uint64_t key)  { return blocked_bloom_query_mt((const blocked_bloom_t*)f, key); }
+static int bb_insert_mt_op(void *f, uint64_t key) { return blocked_bloom_insert_mt((blocked_bloom_t*)f, key); }
+
+// BlockedBloom and CountingBloom share OPS_BB. main() runs CountingBloom
+// with sync=global only and BlockedBloom (no deletes) read-mostly only, so
+// OPS_BB_MT's delete is never reached.
+static const filter_ops_t OPS[] = {
+    [OPS_CUCKOO]    = { ck_query_op,    ck_insert_op,    ck_delete_op },
+    [OPS_CUCKOO_MT] = { ck_query_mt_op, ck_insert_mt_op, ck_delete_mt_op },
+    [OPS_QF]        = { qf_query_op,    qf_insert_op,    qf_delete_op },
+    [OPS_QF_MT]     = { qf_query_mt_op, qf_insert_mt_op, qf_delete_mt_op },
+    [OPS_BB]        = { bb_query_op,    bb_insert_op,    bb_delete_op },
+    [OPS_BB_MT]     = { bb_query_mt_op, bb_insert_mt_op, bb_delete_op },
+};
+
+// locked: writers take w->wlock (sync=global); lookups never do.
+// Ops done before t_warm_end are not counted.
+__attribute__((always_inline))
+static inline void worker_loop(worker_t *w, const filter_ops_t *fo, int locked) {
+    void *f = w->filter;
     uint64_t ops = 0, reads = 0, ins = 0, del = 0, ins_ok = 0, del_ok = 0;
+    int warm = 1;
 
     for (;;) {
-        uint64_t t = now_ns();
-        if (t >= w->t_end) break;
+        if ((ops & (TIME_CHECK_OPS - 1)) == 0) {
+            uint64_t t = now_ns();
+            if (t >= w->t_end) break;
+            if (warm && t >= w->t_warm_end) {
+                warm = 0;
+                ops = reads = ins = del = ins_ok = del_ok = 0;
+            }
+        }
 
+        // high half picks the op, low half the key (multiply-shift range)
         uint64_t r = splitmix64(&w->rng);
-        double u = (double)(r >> 11) * (1.0 / 9007199254740992.0);
+        uint64_t u = r >> 32;
+        uint64_t pick = r & 0xFFFFFFFFu;
 
-        if (u < w->read_frac) {
-            size_t idx = (size_t)(splitmix64(&w->rng) % w->n_pos);
-            uint64_t key = w->pos_keys[idx];
-            if (strcmp(w->filter_name, "Cuckoo") == 0) (void)do_cuckoo_query(w->cf, key);
-            else (void)do_qf_query(w->qf, key);
+        if (u < w->read_thr) {
+            (void)fo->query(f, w->pos_keys[(pick * w->n_pos) >> 32]);
             reads++;
-        } else if (u < w->read_frac + w->ins_frac) {
-            size_t idx = (size_t)(splitmix64(&w->rng) % w->n_ins);
-            uint64_t key = w->ins_keys[idx];
-
-            pthread_mutex_lock(w->wlock);
-            int rc = 0;
-            if (strcmp(w->filter_name, "Cuckoo") == 0) rc = do_cuckoo_insert(w->cf, key);
-            else rc = do_qf_insert(w->qf, key);
+        } else if (u < w->ins_thr) {
+            uint64_t key = w->ins_keys[(pick * w->n_ins) >> 32];
+            if (locked) pthread_mutex_lock(w->wlock);
+            int rc = fo->insert(f, key);
+            if (locked) pthread_mutex_unlock(w->wlock);
             if (rc == 0) {
                 if (w->stack_sz < w->stack_cap) w->local_stack[w->stack_sz++] = key;
                 ins_ok++;
             }
-            pthread_mutex_unlock(w->wlock);
             ins++;
         } else {
-            uint64_t key = 0;
-            int have = 0;
-            if (w->stack_sz > 0) {
-                key = w->local_stack[--w->stack_sz];
-                have = 1;
-            } else {
-                size_t idx = (size_t)(splitmix64(&w->rng) % w->n_ins);
-                key = w->ins_keys[idx];
-                have = 1;
-            }
-
-            if (have) {
-                pthread_mutex_lock(w->wlock);
-                int rc = 0;
-                if (strcmp(w->filter_name, "Cuckoo") == 0) rc = do_cuckoo_delete(w->cf, key);
-                else rc = do_qf_delete(w->qf, key);
-                if (rc == 0) del_ok++;
-                pthread_mutex_unlock(w->wlock);
-            }
+            uint64_t key = (w->stack_sz > 0) ? w->local_stack[--w->stack_sz]
+                                             : w->ins_keys[(pick * w->n_ins) >> 32];
+            if (locked) pthread_mutex_lock(w->wlock);
+            int rc = fo->del(f, key);
+            if (locked) pthread_mutex_unlock(w->wlock);
+            if (rc == 0) del_ok++;
             del++;
         }
 
@@ -165,7 +188,22 @@ static void *worker_main(void *arg) {
     w->del = del;
     w->ins_ok = ins_ok;
     w->del_ok = del_ok;
+}
+
+static void *worker_main(void *arg) {
+    worker_t *w = (worker_t*)arg;
+    if (w->pin) pin_thread(w->tid, sysconf(_SC_NPROCESSORS_ONLN));
+
+    while (!*w->start_flag) { }
 
+    switch (w->kind) {
+    case OPS_CUCKOO:    worker_loop(w, &OPS[OPS_CUCKOO], 1); break;
+    case OPS_CUCKOO_MT: worker_loop(w, &OPS[OPS_CUCKOO_MT], 0); break;
+    case OPS_QF:        worker_loop(w, &OPS[OPS_QF], 1); break;
+    case OPS_QF_MT:     worker_loop(w, &OPS[OPS_QF_MT], 0); break;
+    case OPS_BB:        worker_loop(w, &OPS[OPS_BB], 1); break;
+    case OPS_BB_MT:     worker_loop(w, &OPS[OPS_BB_MT], 0); break;
+    }
     return NULL;
 }
 
@@ -180,9 +218,13 @@ static size_t round_up_pow2(size_t x) {
 static void usage(const char *p) {
     fprintf(stderr,
         "Usage:\n"
-        "  %s <filter:Cuckoo|Quotient> <bits> <nkeys> <load> <threads> <warm_ms> <run_ms> <workload:readmostly|balanced> [pin:0|1]\n"
+        "  %s <filter:Cuckoo|Quotient|CountingBloom|BlockedBloom> <bits> <nkeys> <load> <threads> <warm_ms> <run_ms> <workload:readmostly|balanced> [pin:0|1] [sync:global|fine] [backing]\n"
+        "  sync=global serializes writers on one mutex; sync=fine uses the filter's concurrent mode\n"
+        "  CountingBloom and BlockedBloom are sized for nkeys at FPR 8/2^bits and loaded to load*nkeys;\n"
+        "  CountingBloom runs with sync=global only, BlockedBloom (no deletes) readmostly only\n"
+        "  backing = default|thp|hugetlb, optionally +prefault: the filter table's memory (filter_mem.h)\n"
         "Example:\n"
-        "  %s Cuckoo 12 1000000 0.85 8 500 2000 balanced 1\n",
+        "  %s Cuckoo 12 1000000 0.85 8 500 2000 balanced 1 fine\n",
         p, p
     );
 }
@@ -199,6 +241,14 @@ int main(int argc, char **argv) {
     int run_ms = atoi(argv[7]);
     const char *workload = argv[8];
     int pin = (argc >= 10) ? atoi(argv[9]) : 1;
+    const char *sync = (argc >= 11) ? argv[10] : "global";
+    fmem_backing_t backing = FMEM_DEFAULT;
+    int prefault = 0;
+    if (argc >= 12 && fmem_parse(argv[11], &backing, &prefault) != 0) {
+        fprintf(stderr, "Unknown backing: %s\n", argv[11]);
+        return 1;
+    }
+    int want_backing = backing != FMEM_DEFAULT || prefault;
 
     double read_frac = 0.95, ins_frac = 0.05, del_frac = 0.0;
     if (strcmp(workload, "balanced") == 0) {
@@ -215,8 +265,27 @@ int main(int argc, char **argv) {
     }
 
     if (nthreads <= 0) return 1;
-    if (!(strcmp(filter, "Cuckoo") == 0 || strcmp(filter, "Quotient") == 0)) {
-        fprintf(stderr, "filter must be Cuckoo or Quotient\n");
+    if (nkeys == 0 || nkeys > UINT32_MAX) {
+        fprintf(stderr, "nkeys must be in [1, 2^32)\n");
+        return 1;
+    }
+    int is_cbf = (strcmp(filter, "CountingBloom") == 0);
+    int is_bb = (strcmp(filter, "BlockedBloom") == 0);
+    if (!(strcmp(filter, "Cuckoo") == 0 || strcmp(filter, "Quotient") == 0 || is_cbf || is_bb)) {
+        fprintf(stderr, "filter must be Cuckoo, Quotient, CountingBloom or BlockedBloom\n");
+        return 1;
+    }
+    if (is_bb && del_frac > 0.0) {
+        fprintf(stderr, "BlockedBloom cannot delete; use workload readmostly\n");
+        return 1;
+    }
+    int fine = (strcmp(sync, "fine") == 0);
+    if (!fine && strcmp(sync, "global") != 0) {
+        fprintf(stderr, "Unknown sync: %s\n", sync);
+        return 1;
+    }
+    if (fine && is_cbf) {
+        fprintf(stderr, "CountingBloom supports sync=global only\n");
         return 1;
     }
 
@@ -234,25 +303,46 @@ int main(int argc, char **argv) {
 
     cuckoo_filter_t cf;
     quotient_filter_t qf;
+    blocked_bloom_t bf;
     memset(&cf, 0, sizeof(cf));
     memset(&qf, 0, sizeof(qf));
+    memset(&bf, 0, sizeof(bf));
 
     if (strcmp(filter, "Cuckoo") == 0) {
         if (cuckoo_init(&cf, nkeys, bits) != 0) { fprintf(stderr, "cuckoo_init failed\n"); return 1; }
+        if (want_backing) cuckoo_set_backing(&cf, backing, prefault);
         size_t cap = cf.nbuckets * cf.bucket_size;
         size_t target_items = (size_t)floor(load * (double)cap);
         if (target_items > n_pos) target_items = n_pos;
         for (size_t i = 0; i < target_items; i++) (void)cuckoo_insert(&cf, pos_keys[i]);
+        if (fine && cuckoo_enable_concurrent(&cf) != 0) { fprintf(stderr, "cuckoo_enable_concurrent failed\n"); return 1; }
+    } else if (is_cbf || is_bb) {
+        double target_fpr = 8.0 / (double)(1ULL << bits);
+        bb_layout_t layout = is_cbf ? BB_LAYOUT_COUNTING : BB_LAYOUT_BLOCKED;
+        if (blocked_bloom_init_layout(&bf, nkeys, target_fpr, layout) != 0) {
+            fprintf(stderr, "blocked_bloom_init_layout failed\n");
+            return 1;
+        }
+        if (want_backing) blocked_bloom_set_backing(&bf, backing, prefault);
+        size_t target_items = (size_t)floor(load * (double)nkeys);
+        if (target_items > n_pos) target_items = n_pos;
+        if (is_bb) {
+            (void)blocked_bloom_build_parallel(&bf, pos_keys, target_items, nthreads);
+        } else {
+            for (size_t i = 0; i < target_items; i++) (void)blocked_bloom_insert(&bf, pos_keys[i]);
+        }
     } else {
         size_t slots_need = (size_t)ceil((double)nkeys / 0.95);
         size_t slots = round_up_pow2(slots_need);
         size_t qbits = 0;
         while ((1ULL << qbits) < slots) qbits++;
         if (qf_init(&qf, qbits, (size_t)bits) != 0) { fprintf(stderr, "qf_init failed\n"); return 1; }
+        if (want_backing) qf_set_backing(&qf, backing, prefault);
         size_t cap = qf.nslots;
         size_t target_items = (size_t)floor(load * (double)cap);
         if (target_items > n_pos) target_items = n_pos;
         for (size_t i = 0; i < target_items; i++) (void)qf_insert(&qf, pos_keys[i]);
+        if (fine && qf_enable_concurrent(&qf, 0) != 0) { fprintf(stderr, "qf_enable_concurrent failed\n"); return 1; }
     }
 
     pthread_t *ths = (pthread_t*)malloc(sizeof(pthread_t) * (size_t)nthreads);
@@ -265,17 +355,32 @@ int main(int argc, char **argv) {
     uint64_t t_warm_end = t0 + (uint64_t)warm_ms * 1000000ULL;
     uint64_t t_end = t_warm_end + (uint64_t)run_ms * 1000000ULL;
 
+    ops_kind_t kind;
+    void *fptr;
+    if (strcmp(filter, "Cuckoo") == 0) {
+        kind = fine ? OPS_CUCKOO_MT : OPS_CUCKOO;
+        fptr = &cf;
+    } else if (strcmp(filter, "Quotient") == 0) {
+        kind = fine ? OPS_QF_MT : OPS_QF;
+        fptr = &qf;
+    } else {
+        kind = fine ? OPS_BB_MT : OPS_BB;
+        fptr = &bf;
+    }
+    uint64_t read_thr = (uint64_t)(read_frac * 4294967296.0);
+    uint64_t ins_thr = (del_frac > 0.0) ? (uint64_t)((read_frac + ins_frac) * 4294967296.0)
+                                        : (1ULL << 32);
+
     for (int i = 0; i < nthreads; i++) {
         ws[i].nthreads = nthreads;
         ws[i].pin = pin;
         ws[i].tid = i;
 
-        ws[i].filter_name = filter;
-        ws[i].bits = bits;
+        ws[i].kind = kind;
+        ws[i].filter = fptr;
 
-        ws[i].read_frac = read_frac;
-        ws[i].ins_frac = ins_frac;
-        ws[i].del_frac = del_frac;
+        ws[i].read_thr = read_thr;
+        ws[i].ins_thr = ins_thr;
 
         ws[i].t_warm_end = t_warm_end;
         ws[i].t_end = t_end;
@@ -287,9 +392,6 @@ int main(int argc, char **argv) {
         ws[i].ins_keys = ins_keys;
         ws[i].n_ins = n_ins;
 
-        ws[i].cf = &cf;
-        ws[i].qf = &qf;
-
         ws[i].wlock = &wlock;
 
         ws[i].rng = 0xC0FFEEULL ^ (uint64_t)i * 0x9e3779b97f4a7c15ULL;
@@ -321,18 +423,23 @@ int main(int argc, char **argv) {
         free(ws[i].local_stack);
     }
 
+    fmem_backing_t got = (strcmp(filter, "Cuckoo") == 0) ? cf.backing
+                       : (is_cbf || is_bb) ? bf.backing : qf.backing;
+
     double secs = (double)run_ms / 1000.0;
     double mops = secs > 0 ? (double)total_ops / secs / 1e6 : 0.0;
 
-    printf("workload,filter,bits,threads,load,throughput_mops,total_ops,reads,ins,del,ins_ok,del_ok,pin\n");
-    printf("%s,%s,%d,%d,%.2f,%.6f,%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%d\n",
+    printf("workload,filter,bits,threads,load,throughput_mops,total_ops,reads,ins,del,ins_ok,del_ok,pin,sync,backing,prefault\n");
+    printf("%s,%s,%d,%d,%.2f,%.6f,%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%d,%s,%s,%d\n",
            workload, filter, bits, nthreads, load, mops,
-           total_ops, total_reads, total_ins, total_del, total_ins_ok, total_del_ok, pin);
+           total_ops, total_reads, total_ins, total_del, total_ins_ok, total_del_ok, pin, sync,
+           fmem_name(got), prefault);
 
     free(ths);
     free(ws);
 
     if (strcmp(filter, "Cuckoo") == 0) cuckoo_free(&cf);
+    else if (is_cbf || is_bb) blocked_bloom_free(&bf);
     else qf_free(&qf);
 
     pthread_mutex_destroy(&wlock);
@@ -0,0 +1,270 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "bb.h"
+#include "ck.h"
+#include "qf.h"
+#include "xor.h"
+
+// Time to first query: rebuilding a filter from keys already in memory
+// against opening a saved copy with *_open_mmap. Cold opens drop the file
+// from the page cache first, so their first query pays for reading the
+// pages it touches; a first pass over n positive keys shows how long a
+// mapped filter takes to reach built-in-memory query speed.
+
+static inline uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static inline uint64_t splitmix64(uint64_t *x) {
+    uint64_t z = (*x += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static void gen_keys(uint64_t *out, size_t n, uint64_t seed) {
+    uint64_t s = seed;
+    for (size_t i = 0; i < n; i++) out[i] = splitmix64(&s);
+}
+
+static inline double ns_to_ms(uint64_t ns) { return (double)ns / 1e6; }
+
+typedef enum { F_BB, F_CK, F_QF, F_XOR, F_FUSE3 } fkind_t;
+
+static const struct {
+    fkind_t kind;
+    const char *name;
+} FILTERS[] = {
+    {F_BB,    "BlockedBloom"},
+    {F_CK,    "Cuckoo"},
+    {F_QF,    "Quotient"},
+    {F_XOR,   "XOR"},
+    {F_FUSE3, "Fuse3"},
+};
+
+typedef struct {
+    double target_fpr;
+    int bits;
+} cfg_t;
+
+static const cfg_t CFGS[] = {
+    {0.05,  8},
+    {0.01, 12},
+    {0.001,16},
+};
+
+typedef struct {
+    blocked_bloom_t bb;
+    cuckoo_filter_t ck;
+    quotient_filter_t qf;
+    xor_filter_t xf;
+} filter_t;
+
+static size_t qf_qbits(size_t n) {
+    size_t slots = (size_t)ceil((double)n / 0.85);
+    size_t qbits = 0;
+    while ((1ULL << qbits) < slots) qbits++;
+    return qbits;
+}
+
+static int build(fkind_t k, filter_t *f, const uint64_t *keys, size_t n, const cfg_t *c) {
+    switch (k) {
+    case F_BB:
+        if (blocked_bloom_init(&f->bb, n, c->target_fpr) != 0) return -1;
+        for (size_t i = 0; i < n; i++) blocked_bloom_insert(&f->bb, keys[i]);
+        return 0;
+    case F_CK:
+        if (cuckoo_init(&f->ck, n, c->bits) != 0) return -1;
+        for (size_t i = 0; i < n; i++) {
+            if (cuckoo_insert(&f->ck, keys[i]) != 0) return -1;
+        }
+        return 0;
+    case F_QF:
+        if (qf_init(&f->qf, qf_qbits(n), (size_t)c->bits) != 0) return -1;
+        for (size_t i = 0; i < n; i++) {
+            if (qf_insert(&f->qf, keys[i]) != 0) return -1;
+        }
+        return 0;
+    case F_XOR:
+        return xor_build(&f->xf, keys, (uint32_t)n, (uint32_t)c->bits, 1) ? -1 : 0;
+    case F_FUSE3:
+        return xor_build_fuse(&f->xf, keys, (uint32_t)n, (uint32_t)c->bits, 1, 3) ? -1 : 0;
+    }
+    return -1;
+}
+
+static int save(fkind_t k, const filter_t *f, const char *path) {
+    switch (k) {
+    case F_BB:  return blocked_bloom_save(&f->bb, path) ? -1 : 0;
+    case F_CK:  return cuckoo_save(&f->ck, path);
+    case F_QF:  return qf_save(&f->qf, path) ? -1 : 0;
+    default:    return xor_save(&f->xf, path) ? -1 : 0;
+    }
+}
+
+static int open_mmap(fkind_t k, filter_t *f, const char *path) {
+    switch (k) {
+    case F_BB:  return blocked_bloom_open_mmap(&f->bb, path) ? -1 : 0;
+    case F_CK:  return cuckoo_open_mmap(&f->ck, path);
+    case F_QF:  return qf_open_mmap(&f->qf, path) ? -1 : 0;
+    default:    return xor_open_mmap(&f->xf, path) ? -1 : 0;
+    }
+}
+
+static int query(fkind_t k, filter_t *f, uint64_t key) {
+    switch (k) {
+    case F_BB:  return blocked_bloom_query(&f->bb, key);
+    case F_CK:  return cuckoo_query(&f->ck, key);
+    case F_QF:  return qf_query(&f->qf, key);
+    default:    return xor_query(&f->xf, key);
+    }
+}
+
+static void release(fkind_t k, filter_t *f) {
+    switch (k) {
+    case F_BB:  blocked_bloom_free(&f->bb); break;
+    case F_CK:  cuckoo_free(&f->ck); break;
+    case F_QF:  qf_free(&f->qf); break;
+    default:    xor_free(&f->xf); break;
+    }
+}
+
+// Evict the file's pages so the next open starts cold. Best effort: pages
+// still mapped elsewhere stay resident.
+static void drop_cache(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return;
+    fdatasync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+}
+
+static size_t first_pass(fkind_t k, filter_t *f, const uint64_t *keys, size_t n, uint64_t *ns) {
+    size_t fn = 0;
+    uint64_t t0 = now_ns();
+    for (size_t i = 0; i < n; i++) fn += !query(k, f, keys[i]);
+    *ns = now_ns() - t0;
+    return fn;
+}
+
+static void print_csv_header(void) {
+    printf("filter,target_fpr,param_bits,n_inserted,file_mb,save_ms,rebuild_first_query_ms,"
+           "mmap_cold_first_query_ms,mmap_warm_first_query_ms,speedup_cold,built_pass_ms,"
+           "mmap_cold_pass_ms,false_negatives\n");
+}
+
+static void run(fkind_t k, const char *name, const cfg_t *c, const uint64_t *keys, size_t n,
+                const char *dir) {
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/exp5_%s_b%d.filter", dir, name, c->bits);
+
+    filter_t f;
+    memset(&f, 0, sizeof(f));
+
+    // rebuild: keys in memory -> first answered query
+    uint64_t t0 = now_ns();
+    if (build(k, &f, keys, n, c) != 0) {
+        fprintf(stderr, "[%s] build failed\n", name);
+        release(k, &f);
+        return;
+    }
+    volatile int hit = query(k, &f, keys[0]);
+    uint64_t t_rebuild = now_ns() - t0;
+
+    uint64_t t_built_pass;
+    size_t fn = first_pass(k, &f, keys, n, &t_built_pass);
+
+    t0 = now_ns();
+    int rc = save(k, &f, path);
+    uint64_t t_save = now_ns() - t0;
+    release(k, &f);
+    if (rc != 0) {
+        fprintf(stderr, "[%s] save to %s failed\n", name, path);
+        return;
+    }
+
+    struct stat st;
+    double file_mb = (stat(path, &st) == 0) ? (double)st.st_size / (1024.0 * 1024.0) : 0.0;
+
+    // cold: open + first query, then a full pass faulting pages in
+    drop_cache(path);
+    t0 = now_ns();
+    if (open_mmap(k, &f, path) != 0) {
+        fprintf(stderr, "[%s] open_mmap failed\n", name);
+        unlink(path);
+        return;
+    }
+    hit = query(k, &f, keys[0]);
+    uint64_t t_cold = now_ns() - t0;
+    uint64_t t_cold_pass;
+    fn += first_pass(k, &f, keys, n, &t_cold_pass);
+    release(k, &f);
+
+    // warm: the pages are cached now, so this is the mapping setup alone
+    t0 = now_ns();
+    if (open_mmap(k, &f, path) != 0) {
+        fprintf(stderr, "[%s] open_mmap failed\n", name);
+        unlink(path);
+        return;
+    }
+    hit = query(k, &f, keys[0]);
+    uint64_t t_warm = now_ns() - t0;
+    release(k, &f);
+    (void)hit;
+
+    unlink(path);
+
+    printf("%s,%.6f,%d,%zu,%.3f,%.3f,%.3f,%.4f,%.4f,%.1f,%.3f,%.3f,%zu\n",
+           name, c->target_fpr, c->bits, n, file_mb, ns_to_ms(t_save), ns_to_ms(t_rebuild),
+           ns_to_ms(t_cold), ns_to_ms(t_warm),
+           t_cold ? (double)t_rebuild / (double)t_cold : 0.0,
+           ns_to_ms(t_built_pass), ns_to_ms(t_cold_pass), fn);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+        "Usage: %s [n] [dir] [seed]\n"
+        "  n     default 1000000\n"
+        "  dir   where filter files are written (default /tmp)\n"
+        "  seed  default 123456789\n",
+        prog);
+}
+
+int main(int argc, char **argv) {
+    size_t n = (argc >= 2) ? (size_t)atoll(argv[1]) : 1000000ULL;
+    const char *dir = (argc >= 3) ? argv[2] : "/tmp";
+    uint64_t seed = (argc >= 4) ? (uint64_t)strtoull(argv[3], NULL, 10) : 123456789ULL;
+
+    if (n == 0 || n > UINT32_MAX) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    uint64_t *keys = (uint64_t*)malloc(sizeof(uint64_t) * n);
+    if (!keys) {
+        fprintf(stderr, "alloc failed\n");
+        return 1;
+    }
+    gen_keys(keys, n, seed);
+
+    print_csv_header();
+    for (size_t i = 0; i < sizeof(CFGS)/sizeof(CFGS[0]); i++) {
+        for (size_t j = 0; j < sizeof(FILTERS)/sizeof(FILTERS[0]); j++) {
+            run(FILTERS[j].kind, FILTERS[j].name, &CFGS[i], keys, n, dir);
+        }
+    }
+
+    free(keys);
+    return 0;
+}
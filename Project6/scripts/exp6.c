@@ -0,0 +1,354 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+
+#include "ck.h"
+#include "qf.h"
+
+// Counts and small values per key: the quotient filter's counting and
+// maplet modes against a cuckoo filter in front of an exact side table
+// (key, count, value). Counts follow a heavy tail, P(c >= k) = k^-1.5, and
+// are inserted one occurrence at a time in shuffled order; each key also
+// gets a shard id of vbits. Lookups go over every key, then over as many
+// absent ones. The side table is exact, so its answers are never wrong;
+// the filters' are when a fingerprint is shared (pos_exact) and for absent
+// keys that match one (neg_nonzero).
+
+#define SIDE_LOAD 0.75
+#define COUNT_TAIL 1.5
+#define COUNT_MAX (1u << 20)
+
+static inline uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static inline uint64_t splitmix64(uint64_t *x) {
+    uint64_t z = (*x += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static inline double mops(size_t n, uint64_t ns) {
+    return ns ? (double)n * 1e3 / (double)ns : 0.0;
+}
+
+// ---- side table: open addressing, linear probing; count 0 = empty ----
+
+typedef struct {
+    uint64_t key;
+    uint32_t count;
+    uint32_t value;
+} side_entry_t;
+
+typedef struct {
+    side_entry_t *slots;
+    size_t mask;
+    int shift;
+} side_table_t;
+
+static int side_init(side_table_t *t, size_t n) {
+    size_t cap = 1;
+    int bits = 0;
+    while ((double)cap * SIDE_LOAD < (double)n) { cap <<= 1; bits++; }
+    t->slots = (side_entry_t*)calloc(cap, sizeof(side_entry_t));
+    t->mask = cap - 1;
+    t->shift = 64 - (bits ? bits : 1);
+    return t->slots ? 0 : -1;
+}
+
+static void side_free(side_table_t *t) {
+    free(t->slots);
+    memset(t, 0, sizeof(*t));
+}
+
+static inline size_t side_home(const side_table_t *t, uint64_t key) {
+    return (size_t)((key * 0x9e3779b97f4a7c15ULL) >> t->shift) & t->mask;
+}
+
+// Entry of key, or the empty slot where it would go.
+static inline side_entry_t *side_find(side_table_t *t, uint64_t key) {
+    size_t i = side_home(t, key);
+    while (t->slots[i].count && t->slots[i].key != key) i = (i + 1) & t->mask;
+    return &t->slots[i];
+}
+
+static inline size_t side_bytes(const side_table_t *t) {
+    return (t->mask + 1) * sizeof(side_entry_t);
+}
+
+typedef struct {
+    cuckoo_filter_t ck;
+    side_table_t side;
+} ck_side_t;
+
+// A new key goes into both; a repeat only bumps its count.
+static inline int ck_side_add(ck_side_t *s, uint64_t key, uint32_t value) {
+    side_entry_t *e = side_find(&s->side, key);
+    if (e->count) {
+        e->count++;
+        return 0;
+    }
+    if (cuckoo_insert(&s->ck, key) != 0) return -1;
+    e->key = key;
+    e->count = 1;
+    e->value = value;
+    return 0;
+}
+
+// The filter screens out absent keys before the table is probed.
+static inline const side_entry_t *ck_side_get(ck_side_t *s, uint64_t key) {
+    if (!cuckoo_query(&s->ck, key)) return NULL;
+    const side_entry_t *e = side_find(&s->side, key);
+    return e->count ? e : NULL;
+}
+
+// ---- workload ----
+
+typedef struct {
+    size_t n;
+    uint64_t *keys;      // distinct keys
+    uint64_t *absent;    // n keys never inserted
+    uint32_t *count;     // occurrences of keys[i]
+    uint32_t *value;     // shard id of keys[i]
+    uint32_t *stream;    // key index per occurrence, shuffled
+    size_t nstream;
+} workload_t;
+
+static uint32_t draw_count(uint64_t *s) {
+    double u = (double)((splitmix64(s) >> 11) + 1) * 0x1.0p-53;
+    double c = floor(pow(u, -1.0 / COUNT_TAIL));
+    return (c >= COUNT_MAX) ? COUNT_MAX : (uint32_t)c;
+}
+
+static int gen_workload(workload_t *w, size_t n, int vbits, uint64_t seed) {
+    memset(w, 0, sizeof(*w));
+    w->n = n;
+    w->keys = (uint64_t*)malloc(n * sizeof(uint64_t));
+    w->absent = (uint64_t*)malloc(n * sizeof(uint64_t));
+    w->count = (uint32_t*)malloc(n * sizeof(uint32_t));
+    w->value = (uint32_t*)malloc(n * sizeof(uint32_t));
+    if (!w->keys || !w->absent || !w->count || !w->value) return -1;
+
+    uint64_t s = seed;
+    for (size_t i = 0; i < n; i++) w->keys[i] = splitmix64(&s);
+    for (size_t i = 0; i < n; i++) w->absent[i] = splitmix64(&s);
+    for (size_t i = 0; i < n; i++) {
+        w->count[i] = draw_count(&s);
+        w->value[i] = (uint32_t)(splitmix64(&s) & ((1ULL << vbits) - 1));
+        w->nstream += w->count[i];
+    }
+
+    w->stream = (uint32_t*)malloc(w->nstream * sizeof(uint32_t));
+    if (!w->stream) return -1;
+    size_t k = 0;
+    for (size_t i = 0; i < n; i++) {
+        for (uint32_t c = 0; c < w->count[i]; c++) w->stream[k++] = (uint32_t)i;
+    }
+    for (size_t i = w->nstream; i > 1; i--) {
+        size_t j = (size_t)(splitmix64(&s) % i);
+        uint32_t t = w->stream[i - 1];
+        w->stream[i - 1] = w->stream[j];
+        w->stream[j] = t;
+    }
+    return 0;
+}
+
+static void free_workload(workload_t *w) {
+    free(w->keys);
+    free(w->absent);
+    free(w->count);
+    free(w->value);
+    free(w->stream);
+}
+
+// Smallest qbits whose home slots keep `slots` at or below 85% load.
+static size_t qf_qbits_for(size_t slots) {
+    size_t qbits = 1;
+    while ((double)(1ULL << qbits) * 0.85 < (double)slots) qbits++;
+    return qbits;
+}
+
+// Slots the counting mode needs: one per key plus one per count digit.
+static size_t counting_slots(const workload_t *w, int rbits) {
+    size_t slots = 0;
+    for (size_t i = 0; i < w->n; i++) {
+        slots++;
+        for (uint64_t v = w->count[i] - 1; v; v >>= rbits) slots++;
+    }
+    return slots;
+}
+
+typedef struct {
+    size_t bytes;
+    uint64_t build_ns;
+    uint64_t pos_ns;
+    uint64_t neg_ns;
+    size_t pos_exact;
+    size_t neg_nonzero;
+} result_t;
+
+static void print_csv_header(void) {
+    printf("workload,filter,n_keys,n_updates,param_bits,value_bits,bytes,bits_per_key,"
+           "build_mops,pos_query_mops,neg_query_mops,pos_exact,neg_nonzero\n");
+}
+
+static void print_row(const char *workload, const char *filter, const workload_t *w, size_t nupd,
+                      int bits, int vbits, const result_t *r) {
+    printf("%s,%s,%zu,%zu,%d,%d,%zu,%.3f,%.3f,%.3f,%.3f,%.6f,%.6f\n",
+           workload, filter, w->n, nupd, bits, vbits, r->bytes,
+           (double)r->bytes * 8.0 / (double)w->n,
+           mops(nupd, r->build_ns), mops(w->n, r->pos_ns), mops(w->n, r->neg_ns),
+           (double)r->pos_exact / (double)w->n, (double)r->neg_nonzero / (double)w->n);
+}
+
+static int run_qf_counting(const workload_t *w, int bits) {
+    quotient_filter_t qf;
+    size_t qbits = qf_qbits_for(counting_slots(w, bits));
+    if (qf_init_mode(&qf, qbits, (size_t)bits, QF_COUNTING, 0) != 0) {
+        fprintf(stderr, "[QF-Counting] init failed (qbits=%zu)\n", qbits);
+        return -1;
+    }
+
+    result_t r;
+    memset(&r, 0, sizeof(r));
+    size_t fail = 0;
+    uint64_t t0 = now_ns();
+    for (size_t i = 0; i < w->nstream; i++) fail += qf_insert(&qf, w->keys[w->stream[i]]) != 0;
+    r.build_ns = now_ns() - t0;
+    if (fail) fprintf(stderr, "[QF-Counting] %zu inserts failed\n", fail);
+
+    t0 = now_ns();
+    for (size_t i = 0; i < w->n; i++) r.pos_exact += qf_count(&qf, w->keys[i]) == w->count[i];
+    r.pos_ns = now_ns() - t0;
+
+    t0 = now_ns();
+    for (size_t i = 0; i < w->n; i++) r.neg_nonzero += qf_count(&qf, w->absent[i]) != 0;
+    r.neg_ns = now_ns() - t0;
+
+    r.bytes = qf_bytes(&qf);
+    print_row("count", "QF-Counting", w, w->nstream, bits, 0, &r);
+    qf_free(&qf);
+    return 0;
+}
+
+static int run_qf_maplet(const workload_t *w, int bits, int vbits) {
+    quotient_filter_t qf;
+    size_t qbits = qf_qbits_for(w->n);
+    if (qf_init_mode(&qf, qbits, (size_t)bits, QF_MAPLET, (size_t)vbits) != 0) {
+        fprintf(stderr, "[QF-Maplet] init failed (qbits=%zu vbits=%d)\n", qbits, vbits);
+        return -1;
+    }
+
+    result_t r;
+    memset(&r, 0, sizeof(r));
+    size_t fail = 0;
+    uint64_t t0 = now_ns();
+    for (size_t i = 0; i < w->n; i++) fail += qf_insert_value(&qf, w->keys[i], w->value[i]) != 0;
+    r.build_ns = now_ns() - t0;
+    if (fail) fprintf(stderr, "[QF-Maplet] %zu inserts failed\n", fail);
+
+    // exact = the key's shard and nothing else
+    uint64_t vals[4];
+    t0 = now_ns();
+    for (size_t i = 0; i < w->n; i++) {
+        size_t nv = qf_query_value(&qf, w->keys[i], vals, 4);
+        r.pos_exact += nv == 1 && vals[0] == w->value[i];
+    }
+    r.pos_ns = now_ns() - t0;
+
+    t0 = now_ns();
+    for (size_t i = 0; i < w->n; i++) r.neg_nonzero += qf_query_value(&qf, w->absent[i], vals, 4) != 0;
+    r.neg_ns = now_ns() - t0;
+
+    r.bytes = qf_bytes(&qf);
+    print_row("value", "QF-Maplet", w, w->n, bits, vbits, &r);
+    qf_free(&qf);
+    return 0;
+}
+
+// workload "count" replays the occurrence stream, "value" each key once
+static int run_ck_side(const workload_t *w, const char *workload, int bits, int vbits) {
+    int counting = strcmp(workload, "count") == 0;
+    ck_side_t s;
+    memset(&s, 0, sizeof(s));
+    if (cuckoo_init(&s.ck, w->n, bits) != 0 || side_init(&s.side, w->n) != 0) {
+        fprintf(stderr, "[Cuckoo+Table] init failed\n");
+        cuckoo_free(&s.ck);
+        side_free(&s.side);
+        return -1;
+    }
+
+    result_t r;
+    memset(&r, 0, sizeof(r));
+    size_t nupd = counting ? w->nstream : w->n;
+    size_t fail = 0;
+    uint64_t t0 = now_ns();
+    for (size_t i = 0; i < nupd; i++) {
+        size_t k = counting ? w->stream[i] : i;
+        fail += ck_side_add(&s, w->keys[k], w->value[k]) != 0;
+    }
+    r.build_ns = now_ns() - t0;
+    if (fail) fprintf(stderr, "[Cuckoo+Table] %zu inserts failed\n", fail);
+
+    t0 = now_ns();
+    for (size_t i = 0; i < w->n; i++) {
+        const side_entry_t *e = ck_side_get(&s, w->keys[i]);
+        r.pos_exact += e && (counting ? e->count == w->count[i] : e->value == w->value[i]);
+    }
+    r.pos_ns = now_ns() - t0;
+
+    t0 = now_ns();
+    for (size_t i = 0; i < w->n; i++) r.neg_nonzero += ck_side_get(&s, w->absent[i]) != NULL;
+    r.neg_ns = now_ns() - t0;
+
+    r.bytes = cuckoo_bytes(&s.ck) + side_bytes(&s.side);
+    print_row(workload, "Cuckoo+Table", w, nupd, bits, counting ? 0 : vbits, &r);
+    cuckoo_free(&s.ck);
+    side_free(&s.side);
+    return 0;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+        "Usage: %s [n] [bits] [vbits] [seed]\n"
+        "  n      distinct keys (default 1000000)\n"
+        "  bits   QF remainder / cuckoo fingerprint bits, 4..16 (default 12)\n"
+        "  vbits  shard id bits, 1..%d (default 4)\n"
+        "  seed   default 123456789\n",
+        prog, QF_MAX_VBITS);
+}
+
+int main(int argc, char **argv) {
+    size_t n = (argc >= 2) ? (size_t)atoll(argv[1]) : 1000000ULL;
+    int bits = (argc >= 3) ? atoi(argv[2]) : 12;
+    int vbits = (argc >= 4) ? atoi(argv[3]) : 4;
+    uint64_t seed = (argc >= 5) ? (uint64_t)strtoull(argv[4], NULL, 10) : 123456789ULL;
+
+    if (n == 0 || n > UINT32_MAX || bits < 4 || bits > 16 || vbits < 1 || vbits > QF_MAX_VBITS) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    workload_t w;
+    if (gen_workload(&w, n, vbits, seed) != 0) {
+        fprintf(stderr, "alloc failed\n");
+        free_workload(&w);
+        return 1;
+    }
+
+    print_csv_header();
+    run_qf_counting(&w, bits);
+    run_ck_side(&w, "count", bits, vbits);
+    run_qf_maplet(&w, bits, vbits);
+    run_ck_side(&w, "value", bits, vbits);
+
+    free_workload(&w);
+    return 0;
+}
@@ -0,0 +1,202 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "qf.h"
+
+// Quotient filter expansion and merge throughput, in GB/s of input slot
+// array, against doing the same job with inserts. expand grows a filter at
+// 90% load to twice the slots; its baseline re-inserts every key into an
+// empty filter of the new geometry. merge combines two filters of one
+// geometry (two shards of disjoint keys; in counting mode the same keys
+// twice, so counts add) into one at 90% load; its baseline inserts the
+// second filter's keys into the first. Every key is looked up afterwards.
+
+#define TARGET_LOAD 0.90
+#define VALUE_BITS 4
+
+static inline uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static inline uint64_t splitmix64(uint64_t *x) {
+    uint64_t z = (*x += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static inline double ns_to_ms(uint64_t ns) { return (double)ns / 1e6; }
+
+static const struct {
+    qf_mode_t mode;
+    const char *name;
+} MODES[] = {
+    {QF_SET,      "set"},
+    {QF_COUNTING, "counting"},
+    {QF_MAPLET,   "maplet"},
+};
+
+static int init(quotient_filter_t *qf, size_t qbits, size_t rbits, qf_mode_t mode) {
+    return qf_init_mode(qf, qbits, rbits, mode, (mode == QF_MAPLET) ? VALUE_BITS : 0);
+}
+
+static int add(quotient_filter_t *qf, uint64_t key) {
+    if (qf->mode == QF_MAPLET) return qf_insert_value(qf, key, key & ((1u << VALUE_BITS) - 1));
+    return qf_insert(qf, key);
+}
+
+static size_t count_missing(const quotient_filter_t *qf, const uint64_t *keys, size_t n) {
+    size_t fn = 0;
+    for (size_t i = 0; i < n; i++) fn += !qf_query(qf, keys[i]);
+    return fn;
+}
+
+static void print_csv_header(void) {
+    printf("op,mode,qbits_in,rbits_in,qbits_out,rbits_out,n_keys,slots_used,in_mb,out_mb,"
+           "op_ms,gbps,insert_ms,speedup,false_negatives\n");
+}
+
+static void print_row(const char *op, const char *mode, const quotient_filter_t *in,
+                      const quotient_filter_t *out, size_t n, size_t in_bytes,
+                      uint64_t op_ns, uint64_t ins_ns, size_t fn) {
+    printf("%s,%s,%zu,%zu,%zu,%zu,%zu,%zu,%.3f,%.3f,%.3f,%.3f,%.3f,%.2f,%zu\n",
+           op, mode, in->qbits, in->rbits, out->qbits, out->rbits, n, out->nitems,
+           (double)in_bytes / (1024.0 * 1024.0), (double)qf_bytes(out) / (1024.0 * 1024.0),
+           ns_to_ms(op_ns), op_ns ? (double)in_bytes / (double)op_ns : 0.0,
+           ns_to_ms(ins_ns), op_ns ? (double)ins_ns / (double)op_ns : 0.0, fn);
+}
+
+static void run_expand(qf_mode_t mode, const char *name, size_t qbits, size_t rbits,
+                       const uint64_t *keys, size_t nkeys) {
+    // counting mode takes every key twice: two slots each
+    int reps = (mode == QF_COUNTING) ? 2 : 1;
+    size_t n = (size_t)(TARGET_LOAD * (double)(1ULL << qbits)) / (size_t)reps;
+    if (n > nkeys) n = nkeys;
+
+    quotient_filter_t qf, ref;
+    if (init(&qf, qbits, rbits, mode) != 0) {
+        fprintf(stderr, "[expand] init failed (qbits=%zu)\n", qbits);
+        return;
+    }
+    if (init(&ref, qbits + 1, rbits - 1, mode) != 0) {
+        fprintf(stderr, "[expand] init failed (qbits=%zu)\n", qbits + 1);
+        qf_free(&qf);
+        return;
+    }
+    for (int r = 0; r < reps; r++) {
+        for (size_t i = 0; i < n; i++) (void)add(&qf, keys[i]);
+    }
+    quotient_filter_t before = qf;
+    size_t in_bytes = qf_bytes(&qf);
+
+    uint64_t t0 = now_ns();
+    int err = qf_expand(&qf);
+    uint64_t t_op = now_ns() - t0;
+    if (err) {
+        fprintf(stderr, "[expand] failed: %d\n", err);
+        qf_free(&qf);
+        qf_free(&ref);
+        return;
+    }
+
+    t0 = now_ns();
+    for (int r = 0; r < reps; r++) {
+        for (size_t i = 0; i < n; i++) (void)add(&ref, keys[i]);
+    }
+    uint64_t t_ins = now_ns() - t0;
+
+    print_row("expand", name, &before, &qf, n, in_bytes, t_op, t_ins, count_missing(&qf, keys, n));
+    qf_free(&qf);
+    qf_free(&ref);
+}
+
+static void run_merge(qf_mode_t mode, const char *name, size_t qbits, size_t rbits,
+                      const uint64_t *keys, size_t nkeys) {
+    int counting = (mode == QF_COUNTING);
+    size_t n = (size_t)(TARGET_LOAD * (double)(1ULL << qbits)) / (counting ? 2 : 1);
+    if (n > nkeys) n = nkeys;
+
+    quotient_filter_t a, b, out;
+    if (init(&a, qbits, rbits, mode) != 0) {
+        fprintf(stderr, "[merge] init failed (qbits=%zu)\n", qbits);
+        return;
+    }
+    if (init(&b, qbits, rbits, mode) != 0) {
+        fprintf(stderr, "[merge] init failed (qbits=%zu)\n", qbits);
+        qf_free(&a);
+        return;
+    }
+    for (size_t i = 0; i < n; i++) {
+        if (counting || !(i & 1)) (void)add(&a, keys[i]);
+        if (counting || (i & 1)) (void)add(&b, keys[i]);
+    }
+    size_t in_bytes = qf_bytes(&a) + qf_bytes(&b);
+
+    uint64_t t0 = now_ns();
+    int err = qf_merge(&out, &a, &b);
+    uint64_t t_op = now_ns() - t0;
+    if (err) {
+        fprintf(stderr, "[merge] failed: %d\n", err);
+        qf_free(&a);
+        qf_free(&b);
+        return;
+    }
+    size_t fn = count_missing(&out, keys, n);
+
+    t0 = now_ns();
+    for (size_t i = 0; i < n; i++) {
+        if (counting || (i & 1)) (void)add(&a, keys[i]);
+    }
+    uint64_t t_ins = now_ns() - t0;
+
+    print_row("merge", name, &b, &out, n, in_bytes, t_op, t_ins, fn);
+    qf_free(&out);
+    qf_free(&a);
+    qf_free(&b);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+        "Usage: %s [max_qbits] [rbits] [seed]\n"
+        "  max_qbits  largest input quotient bits; sweeps 16, 18, ... (default 22)\n"
+        "  rbits      input remainder bits, 5..16 (default 12)\n"
+        "  seed       default 123456789\n",
+        prog);
+}
+
+int main(int argc, char **argv) {
+    size_t max_qbits = (argc >= 2) ? (size_t)atoll(argv[1]) : 22;
+    size_t rbits = (argc >= 3) ? (size_t)atoll(argv[2]) : 12;
+    uint64_t seed = (argc >= 4) ? (uint64_t)strtoull(argv[3], NULL, 10) : 123456789ULL;
+
+    if (max_qbits < 16 || max_qbits > 32 || rbits < 5 || rbits > 16) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    size_t nkeys = (size_t)(TARGET_LOAD * (double)(1ULL << max_qbits));
+    uint64_t *keys = (uint64_t*)malloc(sizeof(uint64_t) * nkeys);
+    if (!keys) {
+        fprintf(stderr, "alloc failed\n");
+        return 1;
+    }
+    uint64_t s = seed;
+    for (size_t i = 0; i < nkeys; i++) keys[i] = splitmix64(&s);
+
+    print_csv_header();
+    for (size_t qbits = 16; qbits <= max_qbits; qbits += 2) {
+        for (size_t m = 0; m < sizeof(MODES)/sizeof(MODES[0]); m++) {
+            run_expand(MODES[m].mode, MODES[m].name, qbits, rbits, keys, nkeys);
+            run_merge(MODES[m].mode, MODES[m].name, qbits, rbits, keys, nkeys);
+        }
+    }
+
+    free(keys);
+    return 0;
+}
@@ -0,0 +1,197 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "filter_auto.h"
+
+// Filter factory check. The cost model is calibrated on this host (or the
+// built-in table is used), then for each scenario every candidate kind
+// fauto_candidates offers is built through the factory and run on the
+// scenario's op mix: lookups (half absent) and writes, which insert fresh
+// keys, or with deletes insert one and delete it again. Each row has the
+// model's bytes / FPR / ns per op next to the measured ones; `chosen`
+// marks fauto_plan's pick.
+
+static inline uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static inline uint64_t splitmix64(uint64_t *x) {
+    uint64_t z = (*x += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static void gen_keys(uint64_t *out, size_t n, uint64_t seed, uint64_t add) {
+    uint64_t s = seed;
+    for (size_t i = 0; i < n; i++) out[i] = splitmix64(&s) + add;
+}
+
+// Budgets are in bits per key, so scenarios scale with n.
+typedef struct {
+    const char *name;
+    double target_fpr;
+    double budget_bpk;
+    int    deletes;
+    double write_share;
+} scenario_t;
+
+static const scenario_t SCENARIOS[] = {
+    {"static-1%",        0.01,   0.0,  0, 0.0},
+    {"static-10bpk",     0.0,   10.0,  0, 0.0},
+    {"static-fast-1%",   0.01,  32.0,  0, 0.0},
+    {"dynamic-1%",       0.01,   0.0,  0, 0.3},
+    {"dynamic-16bpk",    0.0,   16.0,  0, 0.3},
+    {"deletes-0.1%",     0.001,  0.0,  1, 0.3},
+    {"deletes-24bpk",    0.0,   24.0,  1, 0.1},
+};
+
+static void print_csv_header(void) {
+    printf("scenario,n_keys,target_fpr,budget_bytes,deletes,write_share,filter,chosen,bits,"
+           "model_bytes,model_fpr,model_op_ns,bytes,fpr,op_ns,false_negatives\n");
+}
+
+static void run_candidate(const scenario_t *sc, const fauto_spec_t *spec, const fauto_plan_t *p, int chosen,
+                          const uint64_t *pos, size_t n, const uint64_t *neg, const uint64_t *fresh,
+                          size_t nops)
+{
+    fauto_filter_t f;
+    int rc = fauto_build(&f, p, pos, n);
+    if (rc != 0) {
+        fprintf(stderr, "[%s/%s] build failed: %d\n", sc->name, fauto_kind_name(p->kind), rc);
+        return;
+    }
+
+    size_t fn = 0;
+    for (size_t i = 0; i < n; i++) fn += !fauto_query(&f, pos[i]);
+    size_t fp = 0;
+    for (size_t i = 0; i < nops; i++) fp += (size_t)fauto_query(&f, neg[i]);
+    size_t bytes = fauto_bytes(&f);
+
+    // the op stream: a write every 1/write_share ops on average, drawn
+    // up front so the timed loop only runs filter calls
+    uint32_t thr = (uint32_t)(spec->write_share * 4294967295.0);
+    uint64_t s = 0xC0FFEEULL;
+    uint8_t *is_write = (uint8_t*)malloc(nops);
+    uint64_t *qk = (uint64_t*)malloc(sizeof(uint64_t) * nops);
+    if (!is_write || !qk) {
+        free(is_write); free(qk);
+        fauto_free(&f);
+        return;
+    }
+    for (size_t i = 0; i < nops; i++) {
+        uint64_t r = splitmix64(&s);
+        is_write[i] = (uint32_t)r < thr;
+        qk[i] = (i & 1) ? neg[i] : pos[(r >> 32) % n];
+    }
+
+    volatile uint64_t sink = 0;
+    size_t hits = 0, w = 0;
+    uint64_t t0 = now_ns();
+    for (size_t i = 0; i < nops; i++) {
+        if (!is_write[i]) {
+            hits += (size_t)fauto_query(&f, qk[i]);
+        } else if (spec->deletes && (w & 1)) {
+            (void)fauto_delete(&f, fresh[w++ / 2]);
+        } else {
+            (void)fauto_insert(&f, fresh[spec->deletes ? w++ / 2 : w++]);
+        }
+    }
+    uint64_t ns = now_ns() - t0;
+
+    printf("%s,%zu,%.6f,%zu,%d,%.2f,%s,%d,%u,%zu,%.8f,%.1f,%zu,%.8f,%.1f,%zu\n",
+           sc->name, n, sc->target_fpr, spec->mem_budget, sc->deletes, sc->write_share,
+           fauto_kind_name(p->kind), chosen, p->bits, p->bytes, p->fpr, p->op_ns,
+           bytes, (double)fp / (double)nops, (double)ns / (double)nops, fn);
+    sink = hits;
+    (void)sink;
+
+    free(is_write);
+    free(qk);
+    fauto_free(&f);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+        "Usage: %s [n] [nops] [calibrate|default]\n"
+        "  n          keys per filter (default 1000000)\n"
+        "  nops       ops per candidate and absent keys for the FPR (default 1000000)\n"
+        "  calibrate  measure the cost model here first (default); default = built-in table\n",
+        prog);
+}
+
+int main(int argc, char **argv) {
+    size_t n = (argc >= 2) ? (size_t)atoll(argv[1]) : 1000000ULL;
+    size_t nops = (argc >= 3) ? (size_t)atoll(argv[2]) : 1000000ULL;
+    const char *cost_mode = (argc >= 4) ? argv[3] : "calibrate";
+    int calibrate = strcmp(cost_mode, "calibrate") == 0;
+    if (n == 0 || nops == 0 || (!calibrate && strcmp(cost_mode, "default") != 0)) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    fauto_cost_t cost = FAUTO_DEFAULT_COST;
+    if (calibrate) {
+        int rc = fauto_calibrate(&cost, NULL, 0);
+        if (rc != 0) {
+            fprintf(stderr, "calibration failed: %d\n", rc);
+            return 1;
+        }
+        for (int k = 0; k < FAUTO_NKINDS; k++) {
+            const fauto_kind_cost_t *kc = &cost.kind[k];
+            fprintf(stderr, "[cost] %-16s query %.1f/%.1f/%.1f ns  insert %.1f/%.1f/%.1f ns  "
+                    "delete %.1f/%.1f/%.1f ns\n", fauto_kind_name((fauto_kind_t)k),
+                    kc->query_ns[0], kc->query_ns[1], kc->query_ns[2],
+                    kc->insert_ns[0], kc->insert_ns[1], kc->insert_ns[2],
+                    kc->delete_ns[0], kc->delete_ns[1], kc->delete_ns[2]);
+        }
+    }
+
+    // every write takes a fresh key: at most nops of them
+    uint64_t *pos = (uint64_t*)malloc(sizeof(uint64_t) * n);
+    uint64_t *neg = (uint64_t*)malloc(sizeof(uint64_t) * nops);
+    uint64_t *fresh = (uint64_t*)malloc(sizeof(uint64_t) * nops);
+    if (!pos || !neg || !fresh) {
+        fprintf(stderr, "alloc failed\n");
+        free(pos); free(neg); free(fresh);
+        return 1;
+    }
+    gen_keys(pos, n, 123456789ULL, 0);
+    gen_keys(neg, nops, 987654321ULL, 0x9e3779b97f4a7c15ULL);
+    gen_keys(fresh, nops, 555555555ULL, 0x5555555555555555ULL);
+
+    print_csv_header();
+    for (size_t si = 0; si < sizeof(SCENARIOS)/sizeof(SCENARIOS[0]); si++) {
+        const scenario_t *sc = &SCENARIOS[si];
+        fauto_spec_t spec = {
+            .n_keys = n,
+            .target_fpr = sc->target_fpr,
+            .mem_budget = (size_t)(sc->budget_bpk * (double)n / 8.0),
+            .deletes = sc->deletes,
+            .write_share = sc->write_share,
+        };
+
+        fauto_plan_t pick;
+        int rc = fauto_plan(&spec, &cost, &pick);
+        if (rc != 0) {
+            fprintf(stderr, "[%s] no plan: %d\n", sc->name, rc);
+            continue;
+        }
+        fauto_plan_t cands[FAUTO_NKINDS];
+        size_t nc = fauto_candidates(&spec, &cost, cands, FAUTO_NKINDS);
+        for (size_t i = 0; i < nc; i++) {
+            run_candidate(sc, &spec, &cands[i], cands[i].kind == pick.kind, pos, n, neg, fresh, nops);
+        }
+    }
+
+    free(pos);
+    free(neg);
+    free(fresh);
+    return 0;
+}
@@ -0,0 +1,465 @@
+#define _GNU_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <math.h>
+
+#include "bb.h"
+#include "ck.h"
+#include "qf.h"
+#include "xor.h"
+
+// Read-only thread scaling. For each filter size (half of L2, half of the
+// LLC, 2x and 8x the LLC) one BlockedBloom, Cuckoo, Quotient and
+// XORParallel filter is built as close to that size as its sizing allows,
+// then probed by 1, 2, 4, ... pinned threads with no locks. Every thread
+// walks its own key stream (half present keys, half absent), generated and
+// first touched by that thread.
+//
+// Memory bandwidth is not read from counters: each filter gets a model of
+// the cache lines one lookup touches (LINES_PER_QUERY), and before the
+// filters, LineRead runs the same threads reading random 64-byte lines of a
+// buffer of the same size and backing. bw_util is the filter's lines/s over
+// LineRead's, so it approaches 1 where the filter is as DRAM-bound as
+// random reads get. size_dev is how far the filter's real bytes are from
+// the size it is compared at (Cuckoo and Quotient grow in powers of two).
+
+static inline uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static inline uint64_t splitmix64(uint64_t *x) {
+    uint64_t z = (*x += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+// Key i of the splitmix64 stream from seed, so a thread can draw present
+// keys without the key array.
+static inline uint64_t key_at(uint64_t seed, uint64_t i) {
+    uint64_t s = seed + i * 0x9e3779b97f4a7c15ULL;
+    return splitmix64(&s);
+}
+
+#define POS_SEED 123456789ULL
+
+// Time is read once every TIME_CHECK_OPS lookups, not per lookup.
+#define TIME_CHECK_OPS 256
+// Keys per thread stream; walked round and round.
+#define STREAM_KEYS (1u << 18)
+// Keys generated per chunk while filling the dynamic filters.
+#define FILL_CHUNK (1u << 20)
+
+typedef enum {
+    RS_LINEREAD,
+    RS_BB,
+    RS_CUCKOO,
+    RS_QF,
+    RS_XOR,
+    RS_NKINDS
+} rs_kind_t;
+
+static const char *const RS_NAMES[RS_NKINDS] = {
+    [RS_LINEREAD] = "LineRead",
+    [RS_BB]       = "BlockedBloom",
+    [RS_CUCKOO]   = "Cuckoo",
+    [RS_QF]       = "Quotient",
+    [RS_XOR]      = "XORParallel",
+};
+
+// Cache lines per lookup with half the keys absent: one 64-byte block;
+// two buckets for absent keys and 1.5 on average for present ones; the
+// home block (runs rarely leave it); three cells of a 3-wise fuse window.
+static const double LINES_PER_QUERY[RS_NKINDS] = {
+    [RS_LINEREAD] = 1.0,
+    [RS_BB]       = 1.0,
+    [RS_CUCKOO]   = 1.75,
+    [RS_QF]       = 1.0,
+    [RS_XOR]      = 3.0,
+};
+
+typedef struct {
+    const uint64_t *lines;
+    size_t nlines;
+} line_buf_t;
+
+static int lr_query_op(void *f, uint64_t key) {
+    const line_buf_t *b = (const line_buf_t*)f;
+    return (int)(b->lines[((key >> 32) * b->nlines >> 32) * 8] & 1);
+}
+static int bb_query_op(void *f, uint64_t key) { return blocked_bloom_query((const blocked_bloom_t*)f, key); }
+static int ck_query_op(void *f, uint64_t key) { return cuckoo_query((const cuckoo_filter_t*)f, key); }
+static int qf_query_op(void *f, uint64_t key) { return qf_query((const quotient_filter_t*)f, key); }
+static int xor_query_op(void *f, uint64_t key) { return xor_query((const xor_filter_t*)f, key); }
+
+typedef int (*query_fn)(void *f, uint64_t key);
+
+typedef struct {
+    int tid;
+    int pin;
+    rs_kind_t kind;
+    void *filter;
+    size_t n_pos;
+
+    uint64_t t_warm_end;
+    uint64_t t_end;
+    volatile int *ready;
+    volatile int *start_flag;
+
+    uint64_t ops;
+    uint64_t hits;
+} worker_t;
+
+static void pin_thread(int tid, int nthreads) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(tid % nthreads, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+// Always inlined with a constant query, so each kind gets its own loop
+// with a direct call. Ops done before t_warm_end are not counted.
+__attribute__((always_inline))
+static inline void worker_loop(worker_t *w, const uint64_t *stream, query_fn query) {
+    void *f = w->filter;
+    uint64_t ops = 0, hits = 0;
+    size_t i = 0;
+    int warm = 1;
+
+    for (;;) {
+        if ((ops & (TIME_CHECK_OPS - 1)) == 0) {
+            uint64_t t = now_ns();
+            if (t >= w->t_end) break;
+            if (warm && t >= w->t_warm_end) {
+                warm = 0;
+                ops = hits = 0;
+            }
+        }
+        hits += (uint64_t)query(f, stream[i]);
+        i = (i + 1) & (STREAM_KEYS - 1);
+        ops++;
+    }
+
+    w->ops = ops;
+    w->hits = hits;
+}
+
+static void *worker_main(void *arg) {
+    worker_t *w = (worker_t*)arg;
+    if (w->pin) pin_thread(w->tid, (int)sysconf(_SC_NPROCESSORS_ONLN));
+
+    // the thread's own stream, in memory it touched first
+    uint64_t *stream = (uint64_t*)malloc(sizeof(uint64_t) * STREAM_KEYS);
+    if (stream) {
+        uint64_t s = 0xC0FFEEULL ^ (uint64_t)w->tid * 0x9e3779b97f4a7c15ULL;
+        for (size_t i = 0; i < STREAM_KEYS; i++) {
+            uint64_t r = splitmix64(&s);
+            stream[i] = (i & 1) ? r : key_at(POS_SEED, ((r >> 32) * w->n_pos) >> 32);
+        }
+    }
+    __atomic_add_fetch(w->ready, 1, __ATOMIC_RELEASE);
+    while (!__atomic_load_n(w->start_flag, __ATOMIC_ACQUIRE)) { }
+    if (!stream) return NULL;
+
+    switch (w->kind) {
+    case RS_LINEREAD: worker_loop(w, stream, lr_query_op); break;
+    case RS_BB:       worker_loop(w, stream, bb_query_op); break;
+    case RS_CUCKOO:   worker_loop(w, stream, ck_query_op); break;
+    case RS_QF:       worker_loop(w, stream, qf_query_op); break;
+    case RS_XOR:      worker_loop(w, stream, xor_query_op); break;
+    default:          break;
+    }
+    free(stream);
+    return NULL;
+}
+
+// Lookups per second of nthreads workers on f; 0 if a thread fails.
+static double run_threads(rs_kind_t kind, void *f, size_t n_pos, int nthreads, int pin,
+                          int warm_ms, int run_ms) {
+    pthread_t *ths = (pthread_t*)malloc(sizeof(pthread_t) * (size_t)nthreads);
+    worker_t *ws = (worker_t*)calloc((size_t)nthreads, sizeof(worker_t));
+    if (!ths || !ws) {
+        free(ths); free(ws);
+        return 0.0;
+    }
+
+    volatile int ready = 0, start_flag = 0;
+    int started = 0;
+    for (int i = 0; i < nthreads; i++) {
+        ws[i].tid = i;
+        ws[i].pin = pin;
+        ws[i].kind = kind;
+        ws[i].filter = f;
+        ws[i].n_pos = n_pos;
+        ws[i].ready = &ready;
+        ws[i].start_flag = &start_flag;
+        ws[i].t_end = UINT64_MAX;
+        if (pthread_create(&ths[i], NULL, worker_main, &ws[i]) != 0) break;
+        started++;
+    }
+    while (__atomic_load_n(&ready, __ATOMIC_ACQUIRE) < started) { }
+
+    // the clock starts once every stream is ready
+    uint64_t t_warm_end = now_ns() + (uint64_t)warm_ms * 1000000ULL;
+    for (int i = 0; i < started; i++) {
+        ws[i].t_warm_end = t_warm_end;
+        ws[i].t_end = t_warm_end + (uint64_t)run_ms * 1000000ULL;
+    }
+    __atomic_store_n(&start_flag, 1, __ATOMIC_RELEASE);
+
+    volatile uint64_t sink = 0;
+    uint64_t ops = 0;
+    for (int i = 0; i < started; i++) {
+        pthread_join(ths[i], NULL);
+        ops += ws[i].ops;
+        sink += ws[i].hits;
+    }
+    (void)sink;
+
+    free(ths);
+    free(ws);
+    if (started < nthreads) return 0.0;
+    return (double)ops / ((double)run_ms / 1000.0);
+}
+
+typedef struct {
+    rs_kind_t kind;
+    size_t n_keys;
+    size_t bytes;
+    fmem_backing_t backing;
+    union {
+        line_buf_t        lb;
+        blocked_bloom_t   bb;
+        cuckoo_filter_t   ck;
+        quotient_filter_t qf;
+        xor_filter_t      xf;
+    } u;
+} rs_filter_t;
+
+// Bytes of each kind holding n keys at `bits`; QF n is its qbits, XOR is
+// partitioned for nthreads build threads.
+static size_t bytes_for(rs_kind_t kind, size_t n, int bits, int nthreads) {
+    switch (kind) {
+    case RS_BB:     return blocked_bloom_bytes_for(n, 8.0 / (double)(1ULL << bits), BB_LAYOUT_BLOCKED, NULL);
+    case RS_CUCKOO: return cuckoo_bytes_for(n, bits);
+    case RS_QF:     return qf_bytes_for(n, (size_t)bits);
+    case RS_XOR:    return xor_bytes_for_parallel(n, (uint32_t)bits, nthreads);
+    default:        return 0;
+    }
+}
+
+// Largest n whose filter fits target bytes (at least the smallest filter).
+static size_t fit_keys(rs_kind_t kind, size_t target, int bits, int nthreads) {
+    if (kind == RS_QF) {
+        size_t q = 6;
+        while (q < 40 && bytes_for(kind, q + 1, bits, nthreads) <= target) q++;
+        return q;
+    }
+    size_t lo = 1, hi = (size_t)UINT32_MAX;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo + 1) / 2;
+        size_t b = bytes_for(kind, mid, bits, nthreads);
+        if (b != 0 && b <= target) lo = mid;
+        else hi = mid - 1;
+    }
+    return lo;
+}
+
+static void fill_chunks(rs_filter_t *f, size_t n, uint64_t *chunk) {
+    for (size_t base = 0; base < n; base += FILL_CHUNK) {
+        size_t m = (n - base < FILL_CHUNK) ? n - base : FILL_CHUNK;
+        for (size_t i = 0; i < m; i++) chunk[i] = key_at(POS_SEED, base + i);
+        switch (f->kind) {
+        case RS_BB:     (void)blocked_bloom_insert_bulk(&f->u.bb, chunk, m); break;
+        case RS_CUCKOO: (void)cuckoo_insert_bulk(&f->u.ck, chunk, m); break;
+        case RS_QF:
+            for (size_t i = 0; i < m; i++) (void)qf_insert(&f->u.qf, chunk[i]);
+            break;
+        default: break;
+        }
+    }
+}
+
+// Builds kind near target bytes on the given backing; nonzero on failure.
+static int rs_build(rs_filter_t *f, rs_kind_t kind, size_t target, int bits, int nthreads,
+                    fmem_backing_t backing, int prefault) {
+    memset(f, 0, sizeof(*f));
+    f->kind = kind;
+
+    if (kind == RS_LINEREAD) {
+        size_t nlines = target / 64;
+        if (nlines == 0) nlines = 1;
+        fmem_backing_t got;
+        uint64_t *lines = (uint64_t*)fmem_alloc(nlines * 64, backing, prefault, &got);
+        if (!lines) return 1;
+        for (size_t i = 0; i < nlines; i++) lines[i * 8] = i;
+        f->u.lb.lines = lines;
+        f->u.lb.nlines = nlines;
+        f->n_keys = nlines;
+        f->bytes = nlines * 64;
+        f->backing = got;
+        return 0;
+    }
+
+    size_t n = fit_keys(kind, target, bits, nthreads);
+    int rc = 0;
+    if (kind == RS_XOR) {
+        uint64_t *keys = (uint64_t*)malloc(sizeof(uint64_t) * n);
+        if (!keys) return 1;
+        for (size_t i = 0; i < n; i++) keys[i] = key_at(POS_SEED, i);
+        rc = xor_build_parallel(&f->u.xf, keys, n, (uint32_t)bits, 1, nthreads);
+        free(keys);
+        if (rc != 0) return 1;
+        xor_set_backing(&f->u.xf, backing, prefault);
+        f->n_keys = n;
+        f->bytes = xor_bytes(&f->u.xf);
+        f->backing = f->u.xf.backing;
+        return 0;
+    }
+
+    uint64_t *chunk = (uint64_t*)malloc(sizeof(uint64_t) * FILL_CHUNK);
+    if (!chunk) return 1;
+    switch (kind) {
+    case RS_BB:
+        rc = blocked_bloom_init_layout(&f->u.bb, n, 8.0 / (double)(1ULL << bits), BB_LAYOUT_BLOCKED);
+        if (rc == 0) blocked_bloom_set_backing(&f->u.bb, backing, prefault);
+        break;
+    case RS_CUCKOO:
+        rc = cuckoo_init(&f->u.ck, n, bits);
+        if (rc == 0) cuckoo_set_backing(&f->u.ck, backing, prefault);
+        break;
+    default:
+        rc = qf_init(&f->u.qf, n, (size_t)bits);
+        if (rc == 0) qf_set_backing(&f->u.qf, backing, prefault);
+        n = (size_t)floor(0.85 * (double)f->u.qf.nslots);
+        break;
+    }
+    if (rc != 0) {
+        free(chunk);
+        return 1;
+    }
+    fill_chunks(f, n, chunk);
+    free(chunk);
+
+    f->n_keys = n;
+    switch (kind) {
+    case RS_BB:     f->bytes = blocked_bloom_bytes(&f->u.bb); f->backing = f->u.bb.backing; break;
+    case RS_CUCKOO: f->bytes = cuckoo_bytes(&f->u.ck);        f->backing = f->u.ck.backing; break;
+    default:        f->bytes = qf_bytes(&f->u.qf);            f->backing = f->u.qf.backing; break;
+    }
+    return 0;
+}
+
+static void rs_free(rs_filter_t *f) {
+    switch (f->kind) {
+    case RS_LINEREAD: fmem_free((void*)f->u.lb.lines, f->bytes, f->backing); break;
+    case RS_BB:       blocked_bloom_free(&f->u.bb); break;
+    case RS_CUCKOO:   cuckoo_free(&f->u.ck); break;
+    case RS_QF:       qf_free(&f->u.qf); break;
+    case RS_XOR:      xor_free(&f->u.xf); break;
+    default:          break;
+    }
+}
+
+static size_t cache_bytes(int name, size_t fallback) {
+    long v = sysconf(name);
+    return v > 0 ? (size_t)v : fallback;
+}
+
+#define MAX_THREAD_COUNTS 16
+
+static void usage(const char *p) {
+    fprintf(stderr,
+        "Usage: %s [max_threads] [bits] [warm_ms] [run_ms] [max_mb] [pin:0|1] [backing]\n"
+        "  max_threads  thread counts 1, 2, 4, ... up to this (default: online CPUs)\n"
+        "  bits         fingerprint / remainder bits, 4..16; BlockedBloom at FPR 8/2^bits;\n"
+        "               XOR only at 8, 12 or 16 (default 12)\n"
+        "  warm_ms, run_ms  per point (default 200, 1000)\n"
+        "  max_mb       skip sizes above this many MB (default 0 = none)\n"
+        "  backing      default|thp|hugetlb, optionally +prefault (filter_mem.h)\n"
+        "Sizes: L2/2, LLC/2, 2x LLC, 8x LLC from sysconf.\n",
+        p);
+}
+
+int main(int argc, char **argv) {
+    int ncpu = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    int max_threads = (argc >= 2) ? atoi(argv[1]) : ncpu;
+    int bits = (argc >= 3) ? atoi(argv[2]) : 12;
+    int warm_ms = (argc >= 4) ? atoi(argv[3]) : 200;
+    int run_ms = (argc >= 5) ? atoi(argv[4]) : 1000;
+    size_t max_mb = (argc >= 6) ? (size_t)atoll(argv[5]) : 0;
+    int pin = (argc >= 7) ? atoi(argv[6]) : 1;
+    fmem_backing_t backing = FMEM_DEFAULT;
+    int prefault = 0;
+    if (argc >= 8 && fmem_parse(argv[7], &backing, &prefault) != 0) {
+        fprintf(stderr, "Unknown backing: %s\n", argv[7]);
+        return 1;
+    }
+    if (max_threads <= 0 || bits < 4 || bits > 16 || run_ms <= 0 || warm_ms < 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    int counts[MAX_THREAD_COUNTS];
+    int ncounts = 0;
+    for (int t = 1; t < max_threads && ncounts < MAX_THREAD_COUNTS - 1; t *= 2) counts[ncounts++] = t;
+    counts[ncounts++] = max_threads;
+
+    size_t l2 = cache_bytes(_SC_LEVEL2_CACHE_SIZE, (size_t)1 << 20);
+    size_t llc = cache_bytes(_SC_LEVEL3_CACHE_SIZE, (size_t)32 << 20);
+    const struct { const char *label; size_t bytes; } SIZES[] = {
+        {"L2/2",   l2 / 2},
+        {"LLC/2",  llc / 2},
+        {"2xLLC",  llc * 2},
+        {"8xLLC",  llc * 8},
+    };
+    fprintf(stderr, "[caches] L2 %zu KB, LLC %zu KB, %d CPUs\n", l2 >> 10, llc >> 10, ncpu);
+
+    printf("size,target_bytes,filter,bits,n_keys,bytes,size_dev,threads,pin,backing,prefault,"
+           "mqps,lines_per_query,gbps,line_gbps,bw_util\n");
+
+    for (size_t si = 0; si < sizeof(SIZES)/sizeof(SIZES[0]); si++) {
+        size_t target = SIZES[si].bytes;
+        if (max_mb && target > (max_mb << 20)) {
+            fprintf(stderr, "[%s] %zu MB over max_mb, skipped\n", SIZES[si].label, target >> 20);
+            continue;
+        }
+
+        // LineRead first: the bandwidth each thread count can get here
+        double line_gbps[MAX_THREAD_COUNTS] = {0};
+        for (int k = 0; k < RS_NKINDS; k++) {
+            if (k == RS_XOR && bits != 8 && bits != 12 && bits != 16) {
+                fprintf(stderr, "[%s/%s] unsupported width %d (8, 12 or 16), skipped\n",
+                        SIZES[si].label, RS_NAMES[k], bits);
+                continue;
+            }
+            rs_filter_t f;
+            if (rs_build(&f, (rs_kind_t)k, target, bits, max_threads, backing, prefault) != 0) {
+                fprintf(stderr, "[%s/%s] build failed\n", SIZES[si].label, RS_NAMES[k]);
+                continue;
+            }
+            for (int ti = 0; ti < ncounts; ti++) {
+                double qps = run_threads((rs_kind_t)k, &f.u, f.n_keys, counts[ti], pin, warm_ms, run_ms);
+                double gbps = qps * LINES_PER_QUERY[k] * 64.0 / 1e9;
+                if (k == RS_LINEREAD) line_gbps[ti] = gbps;
+                printf("%s,%zu,%s,%d,%zu,%zu,%.4f,%d,%d,%s,%d,%.3f,%.2f,%.3f,%.3f,%.3f\n",
+                       SIZES[si].label, target, RS_NAMES[k], k == RS_LINEREAD ? 0 : bits,
+                       f.n_keys, f.bytes, (double)f.bytes / (double)target - 1.0, counts[ti], pin, fmem_name(f.backing), prefault,
+                       qps / 1e6, LINES_PER_QUERY[k], gbps, line_gbps[ti],
+                       line_gbps[ti] > 0 ? gbps / line_gbps[ti] : 0.0);
+                fflush(stdout);
+            }
+            rs_free(&f);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,476 @@
+#define _POSIX_C_SOURCE 200809L
+#include "filter_auto.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+// Quotient filters get the fewest slots that keep them at most this full.
+#define FAUTO_QF_LOAD 0.85
+
+// Calibration filters: Bloom kinds at this FPR, the others at these bits
+// (cuckoo lanes are 8, 16 or 32 bits).
+#define CAL_FPR     0.01
+#define CAL_BITS    12
+#define CAL_CK_BITS 16
+
+static const char *KIND_NAMES[FAUTO_NKINDS] = {
+    [FAUTO_BLOCKED_BLOOM]  = "BlockedBloom",
+    [FAUTO_SPLIT_BLOOM]    = "SplitBlockBloom",
+    [FAUTO_REGISTER_BLOOM] = "RegisterBloom",
+    [FAUTO_COUNTING_BLOOM] = "CountingBloom",
+    [FAUTO_CUCKOO]         = "Cuckoo",
+    [FAUTO_QUOTIENT]       = "Quotient",
+    [FAUTO_FUSE4]          = "Fuse4",
+    [FAUTO_RIBBON]         = "Ribbon128",
+};
+
+// Mean of two `fauto_calibrate(&c, NULL, 0)` runs on a single-core VM (2 MiB
+// L2); services should calibrate on their own hosts.
+const fauto_cost_t FAUTO_DEFAULT_COST = {
+    .bytes = {256 << 10, 4 << 20, 64 << 20},
+    .kind = {
+        [FAUTO_BLOCKED_BLOOM]  = { { 21,  32, 114}, { 29,  54, 126}, {  0,   0,   0} },
+        [FAUTO_SPLIT_BLOOM]    = { { 12,  18,  58}, { 11,  30,  62}, {  0,   0,   0} },
+        [FAUTO_REGISTER_BLOOM] = { { 14,  28,  68}, { 15,  34,  74}, {  0,   0,   0} },
+        [FAUTO_COUNTING_BLOOM] = { { 30,  44, 134}, { 26,  64, 134}, { 48,  68, 217} },
+        [FAUTO_CUCKOO]         = { { 13,  34, 106}, { 22,  44,  93}, { 23,  40,  63} },
+        [FAUTO_QUOTIENT]       = { { 98, 135, 227}, {166, 262, 364}, {145, 182, 422} },
+        [FAUTO_FUSE4]          = { { 16,  38, 110}, { 76, 107, 143}, {  0,   0,   0} },
+        [FAUTO_RIBBON]         = { { 50,  83, 303}, {127, 160, 855}, {  0,   0,   0} },
+    },
+};
+
+const char *fauto_kind_name(fauto_kind_t kind) {
+    return ((unsigned)kind < FAUTO_NKINDS) ? KIND_NAMES[kind] : "unknown";
+}
+
+static int kind_static(fauto_kind_t kind) {
+    return kind == FAUTO_FUSE4 || kind == FAUTO_RIBBON;
+}
+
+static int kind_deletes(fauto_kind_t kind) {
+    return kind == FAUTO_COUNTING_BLOOM || kind == FAUTO_CUCKOO || kind == FAUTO_QUOTIENT;
+}
+
+static bb_layout_t kind_layout(fauto_kind_t kind) {
+    switch (kind) {
+    case FAUTO_SPLIT_BLOOM:    return BB_LAYOUT_SPLIT;
+    case FAUTO_REGISTER_BLOOM: return BB_LAYOUT_REGISTER;
+    case FAUTO_COUNTING_BLOOM: return BB_LAYOUT_COUNTING;
+    default:                   return BB_LAYOUT_BLOCKED;
+    }
+}
+
+static int kind_bloom(fauto_kind_t kind) {
+    return kind <= FAUTO_COUNTING_BLOOM;
+}
+
+static size_t qf_qbits_for(size_t n) {
+    size_t q = 6;
+    while ((double)n > FAUTO_QF_LOAD * (double)((size_t)1 << q)) q++;
+    return q;
+}
+
+// Size and modelled FPR of one parameter choice (bits, or fpr for Bloom
+// kinds); 0 bytes if the kind cannot take it.
+static void kind_size(fauto_kind_t kind, size_t n, uint32_t bits, double fpr, fauto_plan_t *p) {
+    memset(p, 0, sizeof(*p));
+    p->kind = kind;
+    p->n_keys = n;
+    p->bits = bits;
+    if (kind_bloom(kind)) {
+        p->bits = 0;
+        p->bloom_fpr = fpr;
+        p->fpr = blocked_bloom_fpr_for(n, fpr, kind_layout(kind));
+        p->bytes = blocked_bloom_bytes_for(n, fpr, kind_layout(kind), NULL);
+        return;
+    }
+    switch (kind) {
+    case FAUTO_CUCKOO: {
+        // two buckets of 4 lanes, each matching with probability 2^-bits
+        p->bytes = cuckoo_bytes_for(n, (int)bits);
+        double slots = (double)p->bytes * 8.0 / (double)(bits <= 8 ? 8 : bits <= 16 ? 16 : 32);
+        double load = (double)n / slots;
+        p->fpr = 1.0 - pow(1.0 - ldexp(1.0, -(int)bits), 8.0 * load);
+        break;
+    }
+    case FAUTO_QUOTIENT: {
+        // some key of the home run shares the remainder
+        p->qbits = (uint32_t)qf_qbits_for(n);
+        if (p->qbits + bits > 64) return;
+        double load = (double)n / ldexp(1.0, (int)p->qbits);
+        p->fpr = 1.0 - exp(-load * ldexp(1.0, -(int)bits));
+        p->bytes = qf_bytes_for(p->qbits, bits);
+        break;
+    }
+    case FAUTO_FUSE4:
+        if (n > UINT32_MAX) return;
+        p->fpr = ldexp(1.0, -(int)bits);
+        p->bytes = xor_bytes_for((uint32_t)n, bits, 4);
+        break;
+    case FAUTO_RIBBON:
+        if (n > UINT32_MAX) return;
+        p->fpr = ldexp(1.0, -(int)bits);
+        p->bytes = ribbon_bytes_for((uint32_t)n, bits, 128);
+        break;
+    default:
+        break;
+    }
+}
+
+// Parameter choices of a non-Bloom kind, lowest FPR last.
+static size_t kind_bits(fauto_kind_t kind, uint32_t *out) {
+    static const uint32_t CK[] = {8, 16, 32}, FUSE[] = {8, 12, 16};
+    size_t n = 0;
+    switch (kind) {
+    case FAUTO_CUCKOO:
+        for (size_t i = 0; i < 3; i++) out[n++] = CK[i];
+        break;
+    case FAUTO_FUSE4:
+        for (size_t i = 0; i < 3; i++) out[n++] = FUSE[i];
+        break;
+    case FAUTO_QUOTIENT:
+        for (uint32_t b = 4; b <= 16; b++) out[n++] = b;
+        break;
+    case FAUTO_RIBBON:
+        for (uint32_t b = 1; b <= 32; b++) out[n++] = b;
+        break;
+    default:
+        break;
+    }
+    return n;
+}
+
+static int fits(const fauto_spec_t *spec, const fauto_plan_t *p) {
+    if (p->bytes == 0) return 0;
+    if (spec->mem_budget && p->bytes > spec->mem_budget) return 0;
+    if (spec->target_fpr > 0.0 && p->fpr > spec->target_fpr) return 0;
+    return 1;
+}
+
+// Best parameters of one kind: with a target, the smallest filter that
+// meets it; otherwise the lowest FPR within the budget. Bloom kinds are
+// sized by a requested FPR, which is bisected on its log for the largest
+// one whose filter meets the target, or the smallest that fits the budget.
+static int kind_best(const fauto_spec_t *spec, fauto_kind_t kind, fauto_plan_t *best) {
+    size_t n = spec->n_keys;
+    if (kind_bloom(kind)) {
+        int by_target = spec->target_fpr > 0.0;
+        double lo = log(1e-12), hi = log(0.5);   // by_target: lo meets it; else hi fits
+        fauto_plan_t p;
+        kind_size(kind, n, 0, exp(by_target ? lo : hi), &p);
+        if (!(by_target ? p.fpr <= spec->target_fpr : fits(spec, &p))) return 0;
+        for (int it = 0; it < 40; it++) {
+            double mid = 0.5 * (lo + hi);
+            kind_size(kind, n, 0, exp(mid), &p);
+            int ok = by_target ? p.fpr <= spec->target_fpr : fits(spec, &p);
+            if (ok == by_target) lo = mid;
+            else hi = mid;
+        }
+        kind_size(kind, n, 0, exp(by_target ? lo : hi), best);
+        return fits(spec, best);
+    }
+
+    uint32_t bits[32];
+    size_t nb = kind_bits(kind, bits);
+    int found = 0;
+    for (size_t i = 0; i < nb; i++) {
+        fauto_plan_t p;
+        kind_size(kind, n, bits[i], 0.0, &p);
+        if (!fits(spec, &p)) continue;
+        if (!found || (spec->target_fpr > 0.0 ? p.bytes < best->bytes : p.fpr < best->fpr)) {
+            *best = p;
+            found = 1;
+        }
+    }
+    return found;
+}
+
+// Log-linear between calibration sizes, flat outside them.
+static double cost_at(const fauto_cost_t *cost, const double *v, size_t bytes) {
+    if (bytes <= cost->bytes[0]) return v[0];
+    for (int i = 1; i < FAUTO_COST_POINTS; i++) {
+        if (bytes >= cost->bytes[i]) continue;
+        double t = log((double)bytes / (double)cost->bytes[i - 1]) /
+                   log((double)cost->bytes[i] / (double)cost->bytes[i - 1]);
+        return v[i - 1] + t * (v[i] - v[i - 1]);
+    }
+    return v[FAUTO_COST_POINTS - 1];
+}
+
+static void price(const fauto_spec_t *spec, const fauto_cost_t *cost, fauto_plan_t *p) {
+    const fauto_kind_cost_t *kc = &cost->kind[p->kind];
+    p->query_ns = cost_at(cost, kc->query_ns, p->bytes);
+    p->update_ns = cost_at(cost, kc->insert_ns, p->bytes);
+    if (spec->deletes) p->update_ns = 0.5 * (p->update_ns + cost_at(cost, kc->delete_ns, p->bytes));
+    p->op_ns = (1.0 - spec->write_share) * p->query_ns + spec->write_share * p->update_ns;
+}
+
+size_t fauto_candidates(const fauto_spec_t *spec, const fauto_cost_t *cost,
+                        fauto_plan_t *plans, size_t max) {
+    if (!spec || spec->n_keys == 0) return 0;
+    if (!cost) cost = &FAUTO_DEFAULT_COST;
+
+    size_t count = 0;
+    for (int k = 0; k < FAUTO_NKINDS; k++) {
+        fauto_kind_t kind = (fauto_kind_t)k;
+        if (spec->deletes && !kind_deletes(kind)) continue;
+        if (spec->write_share > 0.0 && kind_static(kind)) continue;
+        fauto_plan_t p;
+        if (!kind_best(spec, kind, &p)) continue;
+        price(spec, cost, &p);
+        if (count < max) plans[count] = p;
+        count++;
+    }
+    return count;
+}
+
+int fauto_plan(const fauto_spec_t *spec, const fauto_cost_t *cost, fauto_plan_t *plan) {
+    if (!spec || !plan || spec->n_keys == 0) return EINVAL;
+    if (spec->target_fpr <= 0.0 && spec->mem_budget == 0) return EINVAL;
+    if (spec->write_share < 0.0 || spec->write_share > 1.0) return EINVAL;
+
+    fauto_plan_t c[FAUTO_NKINDS];
+    size_t nc = fauto_candidates(spec, cost, c, FAUTO_NKINDS);
+    if (nc == 0) return ENOSPC;
+
+    double fastest = c[0].op_ns, lowest_fpr = c[0].fpr;
+    for (size_t i = 1; i < nc; i++) {
+        if (c[i].op_ns < fastest) fastest = c[i].op_ns;
+        if (c[i].fpr < lowest_fpr) lowest_fpr = c[i].fpr;
+    }
+
+    size_t pick = nc;
+    for (size_t i = 0; i < nc; i++) {
+        if (spec->target_fpr > 0.0 && spec->mem_budget) {
+            if (pick == nc || c[i].op_ns < c[pick].op_ns) pick = i;
+        } else if (spec->target_fpr > 0.0) {
+            if (c[i].op_ns > FAUTO_TIME_SLACK * fastest) continue;
+            if (pick == nc || c[i].bytes < c[pick].bytes) pick = i;
+        } else {
+            if (c[i].fpr > FAUTO_FPR_SLACK * lowest_fpr) continue;
+            if (pick == nc || c[i].op_ns < c[pick].op_ns) pick = i;
+        }
+    }
+    *plan = c[pick];
+    return 0;
+}
+
+static int bb_insert_op(void *f, uint64_t key)  { return blocked_bloom_insert((blocked_bloom_t*)f, key); }
+static int bb_delete_op(void *f, uint64_t key)  { return blocked_bloom_delete((blocked_bloom_t*)f, key); }
+static int bb_query_op(const void *f, uint64_t key) { return blocked_bloom_query((const blocked_bloom_t*)f, key); }
+static size_t bb_batch_op(const void *f, const uint64_t *k, size_t n, uint64_t *out) {
+    return blocked_bloom_query_batch((const blocked_bloom_t*)f, k, n, out);
+}
+static size_t bb_bytes_op(const void *f) { return blocked_bloom_bytes((const blocked_bloom_t*)f); }
+static int bb_backing_op(void *f, fmem_backing_t b, int pf) { return blocked_bloom_set_backing((blocked_bloom_t*)f, b, pf); }
+static void bb_free_op(void *f) { blocked_bloom_free((blocked_bloom_t*)f); }
+
+static int ck_insert_op(void *f, uint64_t key)  { return cuckoo_insert((cuckoo_filter_t*)f, key); }
+static int ck_delete_op(void *f, uint64_t key)  { return cuckoo_delete((cuckoo_filter_t*)f, key); }
+static int ck_query_op(const void *f, uint64_t key) { return cuckoo_query((const cuckoo_filter_t*)f, key); }
+static size_t ck_batch_op(const void *f, const uint64_t *k, size_t n, uint64_t *out) {
+    return cuckoo_query_batch((const cuckoo_filter_t*)f, k, n, out);
+}
+static size_t ck_bytes_op(const void *f) { return cuckoo_bytes((const cuckoo_filter_t*)f); }
+static int ck_backing_op(void *f, fmem_backing_t b, int pf) { return cuckoo_set_backing((cuckoo_filter_t*)f, b, pf); }
+static void ck_free_op(void *f) { cuckoo_free((cuckoo_filter_t*)f); }
+
+static int qf_insert_op(void *f, uint64_t key)  { return qf_insert((quotient_filter_t*)f, key); }
+static int qf_delete_op(void *f, uint64_t key)  { return qf_delete((quotient_filter_t*)f, key); }
+static int qf_query_op(const void *f, uint64_t key) { return qf_query((const quotient_filter_t*)f, key); }
+static size_t qf_batch_op(const void *f, const uint64_t *k, size_t n, uint64_t *out) {
+    return qf_query_batch((const quotient_filter_t*)f, k, n, out);
+}
+static size_t qf_bytes_op(const void *f) { return qf_bytes((const quotient_filter_t*)f); }
+static int qf_backing_op(void *f, fmem_backing_t b, int pf) { return qf_set_backing((quotient_filter_t*)f, b, pf); }
+static void qf_free_op(void *f) { qf_free((quotient_filter_t*)f); }
+
+static int xor_query_op(const void *f, uint64_t key) { return xor_query((const xor_filter_t*)f, key); }
+static size_t xor_batch_op(const void *f, const uint64_t *k, size_t n, uint64_t *out) {
+    return xor_query_batch((const xor_filter_t*)f, k, n, out);
+}
+static size_t xor_bytes_op(const void *f) { return xor_bytes((const xor_filter_t*)f); }
+static int xor_backing_op(void *f, fmem_backing_t b, int pf) { return xor_set_backing((xor_filter_t*)f, b, pf); }
+static void xor_free_op(void *f) { xor_free((xor_filter_t*)f); }
+
+static int rb_query_op(const void *f, uint64_t key) { return ribbon_query((const ribbon_filter_t*)f, key); }
+static size_t rb_batch_op(const void *f, const uint64_t *k, size_t n, uint64_t *out) {
+    return ribbon_query_batch((const ribbon_filter_t*)f, k, n, out);
+}
+static size_t rb_bytes_op(const void *f) { return ribbon_bytes((const ribbon_filter_t*)f); }
+static int rb_backing_op(void *f, fmem_backing_t b, int pf) { return ribbon_set_backing((ribbon_filter_t*)f, b, pf); }
+static void rb_free_op(void *f) { ribbon_free((ribbon_filter_t*)f); }
+
+static const fauto_ops_t BB_OPS  = { bb_insert_op, NULL, bb_query_op, bb_batch_op, bb_bytes_op, bb_backing_op, bb_free_op };
+static const fauto_ops_t CBB_OPS = { bb_insert_op, bb_delete_op, bb_query_op, bb_batch_op, bb_bytes_op, bb_backing_op, bb_free_op };
+static const fauto_ops_t CK_OPS  = { ck_insert_op, ck_delete_op, ck_query_op, ck_batch_op, ck_bytes_op, ck_backing_op, ck_free_op };
+static const fauto_ops_t QF_OPS  = { qf_insert_op, qf_delete_op, qf_query_op, qf_batch_op, qf_bytes_op, qf_backing_op, qf_free_op };
+static const fauto_ops_t XOR_OPS = { NULL, NULL, xor_query_op, xor_batch_op, xor_bytes_op, xor_backing_op, xor_free_op };
+static const fauto_ops_t RB_OPS  = { NULL, NULL, rb_query_op, rb_batch_op, rb_bytes_op, rb_backing_op, rb_free_op };
+
+static const fauto_ops_t *const KIND_OPS[FAUTO_NKINDS] = {
+    [FAUTO_BLOCKED_BLOOM]  = &BB_OPS,
+    [FAUTO_SPLIT_BLOOM]    = &BB_OPS,
+    [FAUTO_REGISTER_BLOOM] = &BB_OPS,
+    [FAUTO_COUNTING_BLOOM] = &CBB_OPS,
+    [FAUTO_CUCKOO]         = &CK_OPS,
+    [FAUTO_QUOTIENT]       = &QF_OPS,
+    [FAUTO_FUSE4]          = &XOR_OPS,
+    [FAUTO_RIBBON]         = &RB_OPS,
+};
+
+int fauto_create(fauto_filter_t *f, const fauto_plan_t *plan) {
+    if (!f || !plan || (unsigned)plan->kind >= FAUTO_NKINDS || kind_static(plan->kind)) return EINVAL;
+
+    memset(f, 0, sizeof(*f));
+    int rc;
+    if (kind_bloom(plan->kind)) {
+        rc = blocked_bloom_init_layout(&f->u.bb, plan->n_keys, plan->bloom_fpr, kind_layout(plan->kind));
+    } else if (plan->kind == FAUTO_CUCKOO) {
+        rc = (cuckoo_init(&f->u.ck, plan->n_keys, (int)plan->bits) == 0) ? 0 : ENOMEM;
+    } else {
+        rc = qf_init(&f->u.qf, plan->qbits, plan->bits);
+    }
+    if (rc != 0) return rc;
+    f->ops = KIND_OPS[plan->kind];
+    f->plan = *plan;
+    return 0;
+}
+
+int fauto_build(fauto_filter_t *f, const fauto_plan_t *plan, const uint64_t *keys, size_t n) {
+    if (!f || !plan || (unsigned)plan->kind >= FAUTO_NKINDS || (!keys && n)) return EINVAL;
+
+    if (kind_static(plan->kind)) {
+        if (n == 0 || n > UINT32_MAX) return EINVAL;
+        memset(f, 0, sizeof(*f));
+        int rc = (plan->kind == FAUTO_FUSE4)
+               ? xor_build_fuse(&f->u.xf, keys, (uint32_t)n, plan->bits, 1, 4)
+               : ribbon_build(&f->u.rf, keys, (uint32_t)n, plan->bits, 128, 1);
+        if (rc != 0) return ENOMEM;
+        f->ops = KIND_OPS[plan->kind];
+        f->plan = *plan;
+        return 0;
+    }
+
+    int rc = fauto_create(f, plan);
+    if (rc != 0) return rc;
+    if (kind_bloom(plan->kind)) {
+        rc = blocked_bloom_insert_bulk(&f->u.bb, keys, n);
+    } else if (plan->kind == FAUTO_CUCKOO) {
+        rc = (cuckoo_insert_bulk(&f->u.ck, keys, n) == 0) ? 0 : ENOMEM;
+    } else {
+        for (size_t i = 0; i < n && rc == 0; i++) {
+            if (qf_insert(&f->u.qf, keys[i]) != 0) rc = ENOSPC;
+        }
+    }
+    if (rc != 0) fauto_free(f);
+    return rc;
+}
+
+void fauto_free(fauto_filter_t *f) {
+    if (!f || !f->ops) return;
+    f->ops->free(&f->u);
+    memset(f, 0, sizeof(*f));
+}
+
+static inline uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static inline uint64_t splitmix64(uint64_t *x) {
+    uint64_t z = (*x += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static volatile size_t g_sink;
+
+// One calibration point: a filter of the kind sized to about `bytes`,
+// filled with its keys one insert at a time (or built), then probed with
+// nq lookups, half of them absent, and for kinds with deletes emptied of
+// up to nq of its keys.
+static int calibrate_at(fauto_kind_t kind, size_t bytes, size_t nq, double *q_ns, double *ins_ns, double *del_ns) {
+    const size_t n0 = (size_t)1 << 20;
+    fauto_plan_t p;
+    kind_size(kind, n0, kind == FAUTO_CUCKOO ? CAL_CK_BITS : CAL_BITS, CAL_FPR, &p);
+    if (p.bytes == 0) return EINVAL;
+    size_t n = (size_t)((double)bytes * (double)n0 / (double)p.bytes);
+    if (n < 1024) n = 1024;
+    kind_size(kind, n, p.bits, CAL_FPR, &p);
+
+    uint64_t *keys = (uint64_t*)malloc(sizeof(uint64_t) * n);
+    uint64_t *queries = (uint64_t*)malloc(sizeof(uint64_t) * nq);
+    if (!keys || !queries) {
+        free(keys); free(queries);
+        return ENOMEM;
+    }
+    uint64_t s = 0x5eedULL + (uint64_t)kind * 7919 + bytes;
+    for (size_t i = 0; i < n; i++) keys[i] = splitmix64(&s);
+    for (size_t i = 0; i < nq; i++) {
+        uint64_t r = splitmix64(&s);
+        queries[i] = (i & 1) ? r : keys[r % n];
+    }
+
+    fauto_filter_t f;
+    int rc;
+    uint64_t t0 = now_ns();
+    if (kind_static(kind)) {
+        rc = fauto_build(&f, &p, keys, n);
+    } else if ((rc = fauto_create(&f, &p)) == 0) {
+        t0 = now_ns();
+        for (size_t i = 0; i < n; i++) (void)fauto_insert(&f, keys[i]);
+    }
+    uint64_t t1 = now_ns();
+    if (rc != 0) {
+        free(keys); free(queries);
+        return rc;
+    }
+    *ins_ns = (double)(t1 - t0) / (double)n;
+
+    size_t hits = 0;
+    t0 = now_ns();
+    for (size_t i = 0; i < nq; i++) hits += (size_t)fauto_query(&f, queries[i]);
+    t1 = now_ns();
+    *q_ns = (double)(t1 - t0) / (double)nq;
+    g_sink += hits;
+
+    *del_ns = 0.0;
+    if (f.ops->del) {
+        size_t nd = (nq < n) ? nq : n;
+        t0 = now_ns();
+        for (size_t i = 0; i < nd; i++) (void)fauto_delete(&f, keys[i]);
+        t1 = now_ns();
+        *del_ns = (double)(t1 - t0) / (double)nd;
+    }
+
+    fauto_free(&f);
+    free(keys); free(queries);
+    return 0;
+}
+
+int fauto_calibrate(fauto_cost_t *cost, const size_t *bytes, size_t nqueries) {
+    static const size_t DEFAULT_BYTES[FAUTO_COST_POINTS] = {256 << 10, 4 << 20, 64 << 20};
+    if (!cost) return EINVAL;
+    if (!bytes) bytes = DEFAULT_BYTES;
+    if (nqueries == 0) nqueries = (size_t)1 << 20;
+    for (int i = 1; i < FAUTO_COST_POINTS; i++) {
+        if (bytes[i] <= bytes[i - 1]) return EINVAL;
+    }
+
+    memset(cost, 0, sizeof(*cost));
+    memcpy(cost->bytes, bytes, sizeof(cost->bytes));
+    for (int k = 0; k < FAUTO_NKINDS; k++) {
+        fauto_kind_cost_t *kc = &cost->kind[k];
+        for (int i = 0; i < FAUTO_COST_POINTS; i++) {
+            int rc = calibrate_at((fauto_kind_t)k, bytes[i], nqueries,
+                                  &kc->query_ns[i], &kc->insert_ns[i], &kc->delete_ns[i]);
+            if (rc != 0) return rc;
+        }
+    }
+    return 0;
+}
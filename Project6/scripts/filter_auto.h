@@ -0,0 +1,154 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <errno.h>
+
+#include "bb.h"
+#include "ck.h"
+#include "qf.h"
+#include "xor.h"
+#include "ribbon.h"
+
+// Filter factory. A spec says what a service needs: how many keys, a target
+// FPR or a memory budget (or both), whether keys are deleted, and what share
+// of operations after the build are writes. fauto_plan picks a filter kind
+// and its parameters, and fauto_build makes it behind a handle whose ops
+// table hides the type.
+//
+// A candidate's bytes come from the filters' own sizing (*_bytes_for) and
+// its FPR from the usual model of each kind. Its time per operation comes
+// from a cost table: ns per lookup, insert and delete of each kind, measured
+// at a few filter sizes (L2-, LLC- and DRAM-resident by default) and
+// interpolated on log(bytes) in between. fauto_calibrate measures that
+// table on the host; FAUTO_DEFAULT_COST is one such run.
+
+typedef enum {
+    FAUTO_BLOCKED_BLOOM  = 0,
+    FAUTO_SPLIT_BLOOM    = 1,
+    FAUTO_REGISTER_BLOOM = 2,
+    FAUTO_COUNTING_BLOOM = 3,   // deletes
+    FAUTO_CUCKOO         = 4,   // deletes
+    FAUTO_QUOTIENT       = 5,   // deletes
+    FAUTO_FUSE4          = 6,   // static: all keys given to the build
+    FAUTO_RIBBON         = 7,   // static, band width 128
+    FAUTO_NKINDS
+} fauto_kind_t;
+
+// Name as in the exp CSVs ("BlockedBloom", "Cuckoo", ...).
+const char *fauto_kind_name(fauto_kind_t kind);
+
+typedef struct {
+    size_t n_keys;
+    double target_fpr;    // 0: the lowest FPR that fits mem_budget
+    size_t mem_budget;    // bytes; 0: none
+    int    deletes;
+    double write_share;   // of ops after the build; writes are half deletes
+                          // when deletes is set. Static kinds need 0.
+} fauto_spec_t;
+
+// Point i is measured at a filter of cost->bytes[i].
+#define FAUTO_COST_POINTS 3
+typedef struct {
+    double query_ns[FAUTO_COST_POINTS];    // half of the lookups absent
+    double insert_ns[FAUTO_COST_POINTS];   // static kinds: build time per key
+    double delete_ns[FAUTO_COST_POINTS];   // 0 for kinds without deletes
+} fauto_kind_cost_t;
+
+typedef struct {
+    size_t bytes[FAUTO_COST_POINTS];       // ascending
+    fauto_kind_cost_t kind[FAUTO_NKINDS];
+} fauto_cost_t;
+
+extern const fauto_cost_t FAUTO_DEFAULT_COST;
+
+// Fills cost from filters of each of the given sizes (NULL = 256 KiB,
+// 4 MiB, 64 MiB; the last should be well past the LLC), filled to their
+// planned load one insert at a time (static kinds: built) and probed with
+// nqueries lookups (0 = 1M) through the ops table. Needs memory for the
+// largest filters' keys and takes a few seconds per kind. EINVAL on sizes
+// not ascending, otherwise ENOMEM or the build's error on failure.
+int fauto_calibrate(fauto_cost_t *cost, const size_t *bytes, size_t nqueries);
+
+typedef struct {
+    fauto_kind_t kind;
+    size_t   n_keys;
+    uint32_t bits;        // fingerprint or remainder bits; 0 for Bloom kinds
+    uint32_t qbits;       // quotient only
+    double   bloom_fpr;   // Bloom kinds: the target_fpr they are sized for
+    double   fpr;         // modelled
+    size_t   bytes;
+    double   query_ns;
+    double   update_ns;   // static kinds: build time per key
+    double   op_ns;       // query and update weighted by the spec's mix
+} fauto_plan_t;
+
+// The best parameters of every kind that meets the spec, at most max into
+// plans, in kind order. Returns how many kinds qualified.
+size_t fauto_candidates(const fauto_spec_t *spec, const fauto_cost_t *cost,
+                        fauto_plan_t *plans, size_t max);
+
+// Picks one candidate (cost NULL = FAUTO_DEFAULT_COST):
+//  target and budget  the fastest
+//  target only        the smallest within FAUTO_TIME_SLACK of the fastest
+//  budget only        the fastest within FAUTO_FPR_SLACK of the lowest FPR
+// EINVAL on a spec with neither or with no keys, ENOSPC if nothing fits.
+#define FAUTO_TIME_SLACK 1.10
+#define FAUTO_FPR_SLACK  1.25
+int fauto_plan(const fauto_spec_t *spec, const fauto_cost_t *cost, fauto_plan_t *plan);
+
+// The same operations for every kind, on the handle's filter. Writes
+// return 0 on success and the filter's own error otherwise; insert is
+// NULL for static kinds and del for kinds without deletes.
+typedef struct {
+    int    (*insert)(void *f, uint64_t key);
+    int    (*del)(void *f, uint64_t key);
+    int    (*query)(const void *f, uint64_t key);
+    size_t (*query_batch)(const void *f, const uint64_t *keys, size_t n, uint64_t *out_bitmap);
+    size_t (*bytes)(const void *f);
+    int    (*set_backing)(void *f, fmem_backing_t backing, int prefault);
+    void   (*free)(void *f);
+} fauto_ops_t;
+
+typedef struct {
+    const fauto_ops_t *ops;
+    fauto_plan_t plan;
+    union {
+        blocked_bloom_t   bb;
+        cuckoo_filter_t   ck;
+        quotient_filter_t qf;
+        xor_filter_t      xf;
+        ribbon_filter_t   rf;
+    } u;
+} fauto_filter_t;
+
+// An empty filter of a dynamic kind; EINVAL for static kinds, ENOMEM if
+// allocation fails.
+int fauto_create(fauto_filter_t *f, const fauto_plan_t *plan);
+
+// A filter of any kind holding keys[0..n): static kinds are built from
+// them, dynamic ones created and bulk-inserted. ENOSPC if a quotient
+// filter fills up, ENOMEM if allocation or a static build fails.
+int fauto_build(fauto_filter_t *f, const fauto_plan_t *plan, const uint64_t *keys, size_t n);
+
+static inline int fauto_insert(fauto_filter_t *f, uint64_t key) {
+    return f->ops->insert ? f->ops->insert(&f->u, key) : EINVAL;
+}
+
+static inline int fauto_delete(fauto_filter_t *f, uint64_t key) {
+    return f->ops->del ? f->ops->del(&f->u, key) : EINVAL;
+}
+
+static inline int fauto_query(const fauto_filter_t *f, uint64_t key) {
+    return f->ops->query(&f->u, key);
+}
+
+static inline size_t fauto_query_batch(const fauto_filter_t *f, const uint64_t *keys, size_t n,
+                                       uint64_t *out_bitmap) {
+    return f->ops->query_batch(&f->u, keys, n, out_bitmap);
+}
+
+static inline size_t fauto_bytes(const fauto_filter_t *f) {
+    return f->ops->bytes(&f->u);
+}
+
+void fauto_free(fauto_filter_t *f);
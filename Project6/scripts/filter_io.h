@@ -0,0 +1,145 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// On-disk format shared by the *_save / *_open_mmap calls of every filter.
+// A file is one header page followed by sections, each a filter array
+// written byte-for-byte as it sits in memory and starting on a page
+// boundary, so an opened filter points straight into a read-only mapping:
+// nothing is parsed or copied and pages fault in as queries touch them.
+// Fields are native-endian. FIO_VERSION changes whenever a filter's
+// in-memory layout does; files of another version are rejected.
+#define FIO_MAGIC        "P6FILTER"
+#define FIO_VERSION      1
+#define FIO_ALIGN        4096
+#define FIO_MAX_PARAMS   8
+#define FIO_MAX_SECTIONS 64
+
+enum {
+    FIO_KIND_BB  = 1,
+    FIO_KIND_CK  = 2,
+    FIO_KIND_QF  = 3,
+    FIO_KIND_XOR = 4,
+};
+
+typedef struct {
+    uint64_t offset;
+    uint64_t bytes;
+    uint64_t aux;      // per-section parameter (a cuckoo level's buckets)
+} fio_section_t;
+
+typedef struct {
+    char     magic[8];
+    uint32_t version;
+    uint32_t kind;
+    uint64_t file_bytes;
+    uint64_t params[FIO_MAX_PARAMS];   // filter-specific scalars
+    uint32_t nsections;
+    uint32_t reserved;
+    fio_section_t sections[FIO_MAX_SECTIONS];
+} fio_header_t;
+
+_Static_assert(sizeof(fio_header_t) <= FIO_ALIGN, "header must fit its page");
+
+static inline uint64_t fio_align(uint64_t x) {
+    return (x + FIO_ALIGN - 1) & ~(uint64_t)(FIO_ALIGN - 1);
+}
+
+static inline int fio_put(FILE *f, uint64_t *pos, const void *p, uint64_t n) {
+    if (n && fwrite(p, 1, n, f) != n) return errno ? errno : EIO;
+    *pos += n;
+    return 0;
+}
+
+static inline int fio_pad(FILE *f, uint64_t *pos) {
+    static const char zero[FIO_ALIGN];
+    return fio_put(f, pos, zero, fio_align(*pos) - *pos);
+}
+
+// Writes h (kind, params, nsections and each section's bytes/aux filled
+// in by the caller) and the section data. Offsets and the total size are
+// filled in here. 0 or an errno value; a partial file is removed.
+static inline int fio_write(const char *path, fio_header_t *h, const void *const *data) {
+    if (!path || h->nsections > FIO_MAX_SECTIONS) return EINVAL;
+
+    memcpy(h->magic, FIO_MAGIC, sizeof(h->magic));
+    h->version = FIO_VERSION;
+    uint64_t off = fio_align(sizeof(*h));
+    for (uint32_t i = 0; i < h->nsections; i++) {
+        h->sections[i].offset = off;
+        off = fio_align(off + h->sections[i].bytes);
+    }
+    h->file_bytes = off;
+
+    FILE *f = fopen(path, "wb");
+    if (!f) return errno;
+
+    uint64_t pos = 0;
+    int err = fio_put(f, &pos, h, sizeof(*h));
+    if (!err) err = fio_pad(f, &pos);
+    for (uint32_t i = 0; i < h->nsections && !err; i++) {
+        err = fio_put(f, &pos, data[i], h->sections[i].bytes);
+        if (!err) err = fio_pad(f, &pos);
+    }
+    if (fclose(f) != 0 && !err) err = errno ? errno : EIO;
+    if (err) unlink(path);
+    return err;
+}
+
+// Maps path read-only and checks the header against kind and the file
+// size. On success *h is a copy of the header and fio_section() gives each
+// section's address. 0, an errno value, or EINVAL for a malformed file.
+static inline int fio_map(const char *path, uint32_t kind, fio_header_t *h,
+                          void **map, size_t *map_bytes) {
+    memset(h, 0, sizeof(*h));
+    if (!path) return EINVAL;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return errno;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        int err = errno;
+        close(fd);
+        return err;
+    }
+    if ((uint64_t)st.st_size < FIO_ALIGN) {
+        close(fd);
+        return EINVAL;
+    }
+
+    size_t bytes = (size_t)st.st_size;
+    void *m = mmap(NULL, bytes, PROT_READ, MAP_SHARED, fd, 0);
+    int err = errno;
+    close(fd);
+    if (m == MAP_FAILED) return err;
+
+    memcpy(h, m, sizeof(*h));
+    int ok = memcmp(h->magic, FIO_MAGIC, sizeof(h->magic)) == 0
+          && h->version == FIO_VERSION
+          && h->kind == kind
+          && h->file_bytes == bytes
+          && h->nsections <= FIO_MAX_SECTIONS;
+    for (uint32_t i = 0; ok && i < h->nsections; i++) {
+        const fio_section_t *s = &h->sections[i];
+        ok = s->offset % FIO_ALIGN == 0 && s->offset <= bytes && s->bytes <= bytes - s->offset;
+    }
+    if (!ok) {
+        munmap(m, bytes);
+        return EINVAL;
+    }
+
+    *map = m;
+    *map_bytes = bytes;
+    return 0;
+}
+
+static inline void *fio_section(void *map, const fio_header_t *h, uint32_t i) {
+    return (char*)map + h->sections[i].offset;
+}
@@ -0,0 +1,107 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+// Backing memory for filter tables, chosen per filter with its
+// *_set_backing call. DEFAULT is calloc with 4K pages. THP is an anonymous
+// mapping aligned to 2MB and marked MADV_HUGEPAGE, so the kernel backs it
+// with transparent huge pages when it can. HUGETLB takes explicit 2MB
+// pages (MAP_HUGETLB) from the pool reserved in vm.nr_hugepages and falls
+// back to THP, then DEFAULT, when that is short. Prefaulting touches every
+// page up front so probes never pay for a page fault. The backing a filter
+// ended up with is kept in its struct; every backing returns zeroed memory.
+typedef enum {
+    FMEM_DEFAULT = 0,
+    FMEM_THP     = 1,
+    FMEM_HUGETLB = 2,
+} fmem_backing_t;
+
+#define FMEM_HUGE_BYTES ((size_t)2 << 20)
+
+static inline size_t fmem_huge_round(size_t bytes) {
+    return (bytes + FMEM_HUGE_BYTES - 1) & ~(FMEM_HUGE_BYTES - 1);
+}
+
+static inline void fmem_prefault(void *p, size_t bytes) {
+    volatile uint8_t *c = (volatile uint8_t*)p;
+    for (size_t i = 0; i < bytes; i += 4096) c[i] = 0;
+}
+
+static inline void *fmem_thp(size_t bytes) {
+#ifdef MADV_HUGEPAGE
+    size_t len = fmem_huge_round(bytes);
+    // over-map by one huge page and trim to a 2MB-aligned start
+    uint8_t *m = (uint8_t*)mmap(NULL, len + FMEM_HUGE_BYTES, PROT_READ | PROT_WRITE,
+                                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (m == MAP_FAILED) return NULL;
+    uint8_t *p = (uint8_t*)(((uintptr_t)m + FMEM_HUGE_BYTES - 1) & ~(uintptr_t)(FMEM_HUGE_BYTES - 1));
+    if (p > m) munmap(m, (size_t)(p - m));
+    if (p + len < m + len + FMEM_HUGE_BYTES) munmap(p + len, (size_t)(m + len + FMEM_HUGE_BYTES - (p + len)));
+    if (madvise(p, len, MADV_HUGEPAGE) != 0) {
+        munmap(p, len);
+        return NULL;
+    }
+    return p;
+#else
+    (void)bytes;
+    return NULL;
+#endif
+}
+
+static inline void *fmem_hugetlb(size_t bytes) {
+#ifdef MAP_HUGETLB
+    void *p = mmap(NULL, fmem_huge_round(bytes), PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    return (p == MAP_FAILED) ? NULL : p;
+#else
+    (void)bytes;
+    return NULL;
+#endif
+}
+
+// Zeroed memory for `bytes`, trying `want` and then the fallbacks above;
+// *got is the backing obtained. NULL only if calloc fails too.
+static inline void *fmem_alloc(size_t bytes, fmem_backing_t want, int prefault, fmem_backing_t *got) {
+    void *p = NULL;
+    *got = FMEM_DEFAULT;
+    if (bytes == 0) return NULL;
+    if (want == FMEM_HUGETLB && (p = fmem_hugetlb(bytes)) != NULL) *got = FMEM_HUGETLB;
+    else if (want != FMEM_DEFAULT && (p = fmem_thp(bytes)) != NULL) *got = FMEM_THP;
+    else p = calloc(1, bytes);
+    if (p && prefault) fmem_prefault(p, bytes);
+    return p;
+}
+
+static inline void fmem_free(void *p, size_t bytes, fmem_backing_t backing) {
+    if (!p) return;
+    if (backing == FMEM_DEFAULT) free(p);
+    else munmap(p, fmem_huge_round(bytes));
+}
+
+static inline const char *fmem_name(fmem_backing_t backing) {
+    switch (backing) {
+    case FMEM_THP:     return "thp";
+    case FMEM_HUGETLB: return "hugetlb";
+    default:           return "default";
+    }
+}
+
+// "default", "thp" or "hugetlb", optionally followed by "+prefault".
+// 0, or -1 on anything else.
+static inline int fmem_parse(const char *s, fmem_backing_t *backing, int *prefault) {
+    const char *plus = strchr(s, '+');
+    size_t len = plus ? (size_t)(plus - s) : strlen(s);
+    *prefault = 0;
+    if (plus) {
+        if (strcmp(plus, "+prefault") != 0) return -1;
+        *prefault = 1;
+    }
+    if (len == 7 && strncmp(s, "default", 7) == 0) *backing = FMEM_DEFAULT;
+    else if (len == 3 && strncmp(s, "thp", 3) == 0) *backing = FMEM_THP;
+    else if (len == 7 && strncmp(s, "hugetlb", 7) == 0) *backing = FMEM_HUGETLB;
+    else return -1;
+    return 0;
+}
@@ -6,7 +6,8 @@ df = pd.read_csv("exp1.csv")
 
 numeric_cols = [
     "target_fpr", "param_bits", "n_inserted", "bytes",
-    "bpe", "neg_queries", "fp_count", "achieved_fpr", "build_ms"
+    "bpe", "neg_queries", "fp_count", "achieved_fpr", "build_ms",
+    "build_keys_per_s", "peak_rss_mb"
 ]
 for c in numeric_cols:
     df[c] = pd.to_numeric(df[c])
@@ -90,3 +91,51 @@ plt.legend()
 plt.tight_layout()
 plt.savefig("exp1_build_time.png", dpi=200)
 plt.show()
+
+
+plt.figure(figsize=(8, 4))
+
+for i, t in enumerate(targets):
+    sub = df[df["target_fpr"] == t]
+    plt.bar(
+        [j + i * bar_width for j in x],
+        sub["build_keys_per_s"] / 1e6,
+        width=bar_width,
+        label=f"target_fpr={t}"
+    )
+
+plt.xticks(
+    [j + bar_width for j in x],
+    filters,
+    rotation=30
+)
+plt.ylabel("Build Throughput (M keys/s)")
+plt.title("Build Throughput Comparison")
+plt.legend()
+plt.tight_layout()
+plt.savefig("exp1_build_throughput.png", dpi=200)
+plt.show()
+
+
+plt.figure(figsize=(8, 4))
+
+for i, t in enumerate(targets):
+    sub = df[df["target_fpr"] == t]
+    plt.bar(
+        [j + i * bar_width for j in x],
+        sub["peak_rss_mb"],
+        width=bar_width,
+        label=f"target_fpr={t}"
+    )
+
+plt.xticks(
+    [j + bar_width for j in x],
+    filters,
+    rotation=30
+)
+plt.ylabel("Peak RSS during build (MB)")
+plt.title("Build Memory Comparison")
+plt.legend()
+plt.tight_layout()
+plt.savefig("exp1_build_peak_rss.png", dpi=200)
+plt.show()
@@ -79,33 +79,34 @@ def main():
 
     numeric_cols = [
         "insert_mops", "delete_mops", "insert_fail_rate",
-        "cuckoo_total_kicks", "cuckoo_stash_inserts", "cuckoo_avg_probe",
-        "qf_cluster_p50", "qf_cluster_p95", "qf_cluster_p99", "qf_cluster_max"
+        "cuckoo_total_kicks", "cuckoo_levels_added", "cuckoo_avg_probe",
+        "qf_cluster_p50", "qf_cluster_p95", "qf_cluster_p99", "qf_cluster_max",
+        "qf_scan_avoided_avg", "qf_scan_avoided_p99", "qf_scan_avoided_max"
     ]
     for c in numeric_cols:
         if c in df.columns:
             df[c] = pd.to_numeric(df[c], errors="coerce")
 
-    df_c = df[df["filter"] == "Cuckoo"].copy()
+    df_c = df[df["filter"].isin(["Cuckoo", "CuckooBFS"])].copy()
     df_q = df[df["filter"] == "Quotient"].copy()
 
     plot_metric(
         df, "insert_mops",
-        "Task 3: Insert Throughput vs Load (Cuckoo + Quotient, b=8/12/16)",
+        "Task 3: Insert Throughput vs Load (Cuckoo + Quotient + Counting Bloom, b=8/12/16)",
         "Insert throughput (Mops/s)",
         "01_insert_mops_all.png"
     )
 
     plot_metric(
         df, "delete_mops",
-        "Task 3: Delete Throughput vs Load (Cuckoo + Quotient, b=8/12/16)",
+        "Task 3: Delete Throughput vs Load (Cuckoo + Quotient + Counting Bloom, b=8/12/16)",
         "Delete throughput (Mops/s)",
         "02_delete_mops_all.png"
     )
 
     plot_metric(
         df, "insert_fail_rate",
-        "Task 3: Insert Hard-Fail Rate vs Load (Cuckoo + Quotient, b=8/12/16)",
+        "Task 3: Insert Hard-Fail Rate vs Load (Cuckoo + Quotient + Counting Bloom, b=8/12/16)",
         "Insert failure rate",
         "03_insert_fail_rate_all.png"
     )
@@ -126,10 +127,10 @@ def main():
         )
 
         plot_metric(
-            df_c, "cuckoo_stash_inserts",
-            "Cuckoo: Stash Inserts vs Load (b=8/12/16)",
-            "Stash inserts",
-            "06_cuckoo_stash_inserts.png"
+            df_c, "cuckoo_levels_added",
+            "Cuckoo: Levels Added vs Load (b=8/12/16)",
+            "Levels added",
+            "06_cuckoo_levels_added.png"
         )
 
     if not df_q.empty:
@@ -147,5 +148,13 @@ def main():
             "08_qf_cluster_max.png"
         )
 
+        if "qf_scan_avoided_avg" in df_q.columns:
+            plot_two_metrics_same_fig(
+                df_q, "qf_scan_avoided_avg", "qf_scan_avoided_p99",
+                "Quotient: Slot Scan Replaced by Rank/Select vs Load (b=8/12/16)",
+                "Slots a linear walk would scan per run lookup",
+                "09_qf_scan_avoided.png"
+            )
+
 if __name__ == "__main__":
     main()
@@ -9,20 +9,24 @@ df["throughput_mops"] = pd.to_numeric(df["throughput_mops"], errors="coerce")
 df = df.dropna(subset=["threads", "throughput_mops"])
 df["threads"] = df["threads"].astype(int)
 
+if "sync" not in df.columns:
+    df["sync"] = "global"
+df["sync"] = df["sync"].fillna("global")
+
 g = (
-    df.groupby(["workload", "filter", "threads"], as_index=False)["throughput_mops"]
+    df.groupby(["workload", "filter", "sync", "threads"], as_index=False)["throughput_mops"]
       .mean()
       .sort_values("threads")
 )
 
 plt.figure()
-for (workload, filt), sub in g.groupby(["workload", "filter"]):
+for (workload, filt, sync), sub in g.groupby(["workload", "filter", "sync"]):
     plt.plot(sub["threads"], sub["throughput_mops"], marker="o", linewidth=1.5,
-             label=f"{workload}-{filt}")
+             label=f"{workload}-{filt}-{sync}")
 
 plt.xlabel("Threads")
 plt.ylabel("Throughput (Mops/s)")
-plt.title("Task 3.4: Thread Scaling (Cuckoo vs Quotient, Read-mostly vs Balanced)")
+plt.title("Task 3.4: Thread Scaling (Cuckoo, Quotient, Blocked + Counting Bloom; Read-mostly vs Balanced)")
 plt.grid(True)
 plt.legend()
 plt.savefig("exp4_thread_scaling_all.png", dpi=200, bbox_inches="tight")
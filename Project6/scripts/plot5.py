@@ -0,0 +1,77 @@
+import pandas as pd
+import matplotlib.pyplot as plt
+
+df = pd.read_csv("exp5.csv")
+
+
+numeric_cols = [
+    "target_fpr", "param_bits", "n_inserted", "file_mb", "save_ms",
+    "rebuild_first_query_ms", "mmap_cold_first_query_ms", "mmap_warm_first_query_ms",
+    "speedup_cold", "built_pass_ms", "mmap_cold_pass_ms", "false_negatives"
+]
+for c in numeric_cols:
+    df[c] = pd.to_numeric(df[c])
+
+filters = df["filter"].unique()
+
+
+for bits, sub in df.groupby("param_bits", sort=True):
+    plt.figure(figsize=(8, 4))
+
+    bar_width = 0.25
+    x = range(len(sub))
+    series = [
+        ("rebuild_first_query_ms", "rebuild"),
+        ("mmap_cold_first_query_ms", "mmap (cold cache)"),
+        ("mmap_warm_first_query_ms", "mmap (warm cache)"),
+    ]
+    for i, (col, label) in enumerate(series):
+        plt.bar(
+            [j + i * bar_width for j in x],
+            sub[col],
+            width=bar_width,
+            label=label
+        )
+
+    plt.xticks(
+        [j + bar_width for j in x],
+        sub["filter"],
+        rotation=30
+    )
+    plt.yscale("log")
+    plt.ylabel("Time to First Query (ms)")
+    plt.title(f"Rebuild vs mmap Load ({int(bits)}-bit, n={int(sub['n_inserted'].iloc[0])})")
+    plt.grid(True, axis="y", which="both", linestyle="--", alpha=0.5)
+    plt.legend()
+    plt.tight_layout()
+    plt.savefig(f"exp5_first_query_b{int(bits)}.png", dpi=200)
+    plt.show()
+
+
+plt.figure(figsize=(8, 4))
+
+bar_width = 0.25
+targets = sorted(df["target_fpr"].unique())
+x = range(len(filters))
+
+for i, t in enumerate(targets):
+    sub = df[df["target_fpr"] == t]
+    plt.bar(
+        [j + i * bar_width for j in x],
+        sub["mmap_cold_pass_ms"] / sub["built_pass_ms"],
+        width=bar_width,
+        label=f"target_fpr={t}"
+    )
+
+plt.xticks(
+    [j + bar_width for j in x],
+    filters,
+    rotation=30
+)
+plt.axhline(1.0, color="k", linestyle="--", linewidth=1)
+plt.ylabel("First pass time, mmap cold / built")
+plt.title("Query Pass Cost While Pages Fault In")
+plt.legend()
+plt.tight_layout()
+plt.savefig("exp5_cold_pass_ratio.png", dpi=200)
+plt.show()
@@ -0,0 +1,50 @@
+import pandas as pd
+import matplotlib.pyplot as plt
+
+df = pd.read_csv("exp6.csv")
+
+
+numeric_cols = [
+    "n_keys", "n_updates", "param_bits", "value_bits", "bytes", "bits_per_key",
+    "build_mops", "pos_query_mops", "neg_query_mops", "pos_exact", "neg_nonzero"
+]
+for c in numeric_cols:
+    df[c] = pd.to_numeric(df[c])
+
+df["label"] = df["filter"] + " (" + df["param_bits"].astype(int).astype(str) + "-bit)"
+
+
+for workload, sub in df.groupby("workload", sort=False):
+    fig, axes = plt.subplots(1, 2, figsize=(11, 4))
+
+    axes[0].bar(sub["label"], sub["bits_per_key"])
+    axes[0].set_ylabel("Bits per Key")
+    axes[0].set_yscale("log")
+    axes[0].set_title(f"Memory ({workload})")
+    axes[0].tick_params(axis="x", rotation=30)
+    axes[0].grid(True, axis="y", which="both", linestyle="--", alpha=0.5)
+
+    bar_width = 0.25
+    x = range(len(sub))
+    series = [
+        ("build_mops", "updates"),
+        ("pos_query_mops", "present lookups"),
+        ("neg_query_mops", "absent lookups"),
+    ]
+    for i, (col, label) in enumerate(series):
+        axes[1].bar(
+            [j + i * bar_width for j in x],
+            sub[col],
+            width=bar_width,
+            label=label
+        )
+    axes[1].set_xticks([j + bar_width for j in x])
+    axes[1].set_xticklabels(sub["label"], rotation=30)
+    axes[1].set_ylabel("Throughput (Mops/s)")
+    axes[1].set_title(f"Throughput ({workload})")
+    axes[1].grid(True, axis="y", linestyle="--", alpha=0.5)
+    axes[1].legend()
+
+    plt.tight_layout()
+    plt.savefig(f"exp6_{workload}.png", dpi=200)
+    plt.show()
@@ -0,0 +1,32 @@
+import pandas as pd
+import matplotlib.pyplot as plt
+
+df = pd.read_csv("exp7.csv")
+
+
+numeric_cols = [
+    "qbits_in", "rbits_in", "qbits_out", "rbits_out", "n_keys", "slots_used",
+    "in_mb", "out_mb", "op_ms", "gbps", "insert_ms", "speedup", "false_negatives"
+]
+for c in numeric_cols:
+    df[c] = pd.to_numeric(df[c])
+
+
+for col, ylabel, fname in [
+    ("gbps", "Throughput (GB/s of input slot array)", "exp7_gbps.png"),
+    ("speedup", "Speedup over Inserting", "exp7_speedup.png"),
+]:
+    plt.figure(figsize=(8, 4))
+    for (op, mode), sub in df.groupby(["op", "mode"], sort=False):
+        sub = sub.sort_values("in_mb")
+        plt.plot(sub["in_mb"], sub[col], marker="o",
+                 linestyle="-" if op == "merge" else "--", label=f"{op} ({mode})")
+    plt.xscale("log")
+    plt.xlabel("Input Slot Array (MB)")
+    plt.ylabel(ylabel)
+    plt.title("Quotient Filter Expansion and Merge")
+    plt.grid(True, which="both", linestyle="--", alpha=0.5)
+    plt.legend()
+    plt.tight_layout()
+    plt.savefig(fname, dpi=200)
+    plt.show()
@@ -0,0 +1,49 @@
+import pandas as pd
+import matplotlib.pyplot as plt
+
+df = pd.read_csv("exp8.csv")
+
+
+numeric_cols = [
+    "n_keys", "target_fpr", "budget_bytes", "deletes", "write_share", "chosen", "bits",
+    "model_bytes", "model_fpr", "model_op_ns", "bytes", "fpr", "op_ns", "false_negatives"
+]
+for c in numeric_cols:
+    df[c] = pd.to_numeric(df[c])
+
+
+scenarios = list(df["scenario"].unique())
+fig, axes = plt.subplots(len(scenarios), 1, figsize=(9, 2.6 * len(scenarios)))
+for ax, sc in zip(axes, scenarios):
+    sub = df[df["scenario"] == sc].reset_index(drop=True)
+    x = range(len(sub))
+    ax.bar([i - 0.2 for i in x], sub["model_op_ns"], width=0.4, label="model")
+    ax.bar([i + 0.2 for i in x], sub["op_ns"], width=0.4, label="measured")
+    labels = [f"{f}*" if c else f for f, c in zip(sub["filter"], sub["chosen"])]
+    ax.set_xticks(list(x))
+    ax.set_xticklabels(labels)
+    ax.set_ylabel("ns / op")
+    ax.set_title(f"{sc} (* = chosen)")
+    ax.grid(True, axis="y", linestyle="--", alpha=0.5)
+    ax.legend()
+plt.tight_layout()
+plt.savefig("exp8_op_ns.png", dpi=200)
+plt.show()
+
+
+plt.figure(figsize=(6, 6))
+for f, sub in df.groupby("filter", sort=False):
+    plt.scatter(sub["model_fpr"], sub["fpr"], label=f)
+lo = df[["model_fpr", "fpr"]].min().min()
+hi = df[["model_fpr", "fpr"]].max().max()
+plt.plot([lo, hi], [lo, hi], color="gray", linestyle="--")
+plt.xscale("log")
+plt.yscale("log")
+plt.xlabel("Modelled FPR")
+plt.ylabel("Measured FPR")
+plt.title("Filter Factory: FPR Model")
+plt.grid(True, which="both", linestyle="--", alpha=0.5)
+plt.legend()
+plt.tight_layout()
+plt.savefig("exp8_fpr.png", dpi=200)
+plt.show()
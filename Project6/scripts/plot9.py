@@ -0,0 +1,40 @@
+import pandas as pd
+import matplotlib.pyplot as plt
+
+df = pd.concat([pd.read_csv("exp9.csv"), pd.read_csv("exp9_thp.csv")], ignore_index=True)
+
+
+numeric_cols = [
+    "target_bytes", "bits", "n_keys", "bytes", "size_dev", "threads", "pin", "prefault",
+    "mqps", "lines_per_query", "gbps", "line_gbps", "bw_util"
+]
+for c in numeric_cols:
+    df[c] = pd.to_numeric(df[c])
+
+
+sizes = list(df["size"].unique())
+for col, ylabel, fname in [
+    ("mqps", "Throughput (Mqueries/s)", "exp9_mqps.png"),
+    ("bw_util", "Share of Random-Line Read Bandwidth", "exp9_bw_util.png"),
+]:
+    fig, axes = plt.subplots(1, len(sizes), figsize=(4.5 * len(sizes), 4), sharey=(col == "bw_util"))
+    if len(sizes) == 1:
+        axes = [axes]
+    for ax, size in zip(axes, sizes):
+        sub = df[df["size"] == size]
+        if col == "bw_util":
+            sub = sub[sub["filter"] != "LineRead"]
+        for (filt, backing), g in sub.groupby(["filter", "backing"], sort=False):
+            g = g.sort_values("threads")
+            ax.plot(g["threads"], g[col], marker="o",
+                    linestyle="-" if backing == "default" else "--", label=f"{filt} ({backing})")
+        ax.set_xscale("log", base=2)
+        ax.set_xlabel("Threads")
+        ax.set_title(f"{size} ({sub['target_bytes'].iloc[0] / 2**20:.0f} MB)")
+        ax.grid(True, which="both", linestyle="--", alpha=0.5)
+    axes[0].set_ylabel(ylabel)
+    axes[-1].legend(fontsize=7)
+    fig.suptitle("Read-Only Thread Scaling")
+    plt.tight_layout()
+    plt.savefig(fname, dpi=200)
+    plt.show()
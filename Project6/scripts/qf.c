@@ -1,7 +1,16 @@
+#define _DEFAULT_SOURCE
 #include "qf.h"
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <math.h>
+
+#include "filter_io.h"
+
+#define QF_BATCH_RING 64
+#define QF_REGION_SLOTS 4096
+#define QF_MT_MAX_WINDOW 16
+#define QF_OFFSET_SAT 255
 
 static inline uint64_t splitmix64(uint64_t *x) {
     uint64_t z = (*x += 0x9e3779b97f4a7c15ULL);
@@ -14,23 +23,61 @@ static inline uint64_t hash64(uint64_t k) {
     return splitmix64(&x);
 }
 
-static inline size_t inc(size_t i, size_t n) { return (i + 1) & (n - 1); }
-static inline size_t dec(size_t i, size_t n) { return (i - 1) & (n - 1); }
-
-static inline int slot_empty(const qf_slot_t *s) {
-    return (s->rem == 0) && (s->continuation == 0) && (s->shifted == 0);
+// Block words are read and written with relaxed atomics: qf_query_mt reads
+// them while *_mt writers change them, and validates with the region
+// versions afterwards. On the usual targets these are plain loads/stores.
+static inline uint64_t word_load(const uint64_t *p) {
+    return __atomic_load_n(p, __ATOMIC_RELAXED);
+}
+static inline void word_store(uint64_t *p, uint64_t v) {
+    __atomic_store_n(p, v, __ATOMIC_RELAXED);
 }
 
-static inline void clear_elem_keep_occupied(qf_slot_t *s) {
-    s->rem = 0;
-    s->continuation = 0;
-    s->shifted = 0;
+static inline qf_block_t *blk(const quotient_filter_t *qf, size_t i) {
+    return qf_block(qf, i / QF_BLOCK_SLOTS);
 }
 
-static inline void copy_elem_keep_dst_occupied(qf_slot_t *dst, const qf_slot_t *src) {
-    dst->rem = src->rem;
-    dst->continuation = src->continuation;
-    dst->shifted = src->shifted;
+static inline int is_occupied(const quotient_filter_t *qf, size_t i) {
+    return (int)((word_load(&blk(qf, i)->occupieds) >> (i % QF_BLOCK_SLOTS)) & 1);
+}
+static inline int is_runend(const quotient_filter_t *qf, size_t i) {
+    return (int)((word_load(&blk(qf, i)->runends) >> (i % QF_BLOCK_SLOTS)) & 1);
+}
+static inline void set_occupied(quotient_filter_t *qf, size_t i, int v) {
+    uint64_t bit = 1ULL << (i % QF_BLOCK_SLOTS);
+    qf_block_t *bl = blk(qf, i);
+    uint64_t w = word_load(&bl->occupieds);
+    word_store(&bl->occupieds, v ? (w | bit) : (w & ~bit));
+}
+static inline void set_runend(quotient_filter_t *qf, size_t i, int v) {
+    uint64_t bit = 1ULL << (i % QF_BLOCK_SLOTS);
+    qf_block_t *bl = blk(qf, i);
+    uint64_t w = word_load(&bl->runends);
+    word_store(&bl->runends, v ? (w | bit) : (w & ~bit));
+}
+// Slot j of a block sits at bit j * sbits of its rem words and may
+// straddle two of them.
+static inline uint64_t get_slot(const quotient_filter_t *qf, size_t i) {
+    const uint64_t *w = blk(qf, i)->rem;
+    size_t bit = (i % QF_BLOCK_SLOTS) * qf->sbits;
+    size_t k = bit / 64, sh = bit % 64;
+    uint64_t v = word_load(&w[k]) >> sh;
+    if (sh + qf->sbits > 64) v |= word_load(&w[k + 1]) << (64 - sh);
+    return v & ((1ULL << qf->sbits) - 1);
+}
+static inline void set_slot(quotient_filter_t *qf, size_t i, uint64_t r) {
+    uint64_t *w = blk(qf, i)->rem;
+    uint64_t mask = (1ULL << qf->sbits) - 1;
+    size_t bit = (i % QF_BLOCK_SLOTS) * qf->sbits;
+    size_t k = bit / 64, sh = bit % 64;
+    word_store(&w[k], (word_load(&w[k]) & ~(mask << sh)) | (r << sh));
+    if (sh + qf->sbits > 64) {
+        size_t hi = 64 - sh;
+        word_store(&w[k + 1], (word_load(&w[k + 1]) & ~(mask >> hi)) | (r >> hi));
+    }
+}
+static inline uint64_t get_rem(const quotient_filter_t *qf, size_t i) {
+    return get_slot(qf, i) >> qf->vbits;
 }
 
 static inline size_t home_index(uint64_t h, size_t qbits) {
@@ -38,80 +85,347 @@ static inline size_t home_index(uint64_t h, size_t qbits) {
 }
 static inline uint16_t rem_bits(uint64_t h, size_t qbits, size_t rbits) {
     uint64_t mask = (rbits == 64) ? ~0ULL : ((1ULL << rbits) - 1ULL);
-    uint16_t r = (uint16_t)((h >> qbits) & mask);
-    return (r == 0) ? 1 : r;
+    return (uint16_t)((h >> qbits) & mask);
+}
+
+// Position of the k-th (0-based) set bit of x.
+static inline unsigned select64(uint64_t x, unsigned k) {
+    unsigned base = 0;
+    for (;;) {
+        unsigned c = (unsigned)__builtin_popcountll(x & 0xff);
+        if (k < c) break;
+        k -= c;
+        x >>= 8;
+        base += 8;
+    }
+    while (k--) x &= x - 1;
+    return base + (unsigned)__builtin_ctzll(x);
 }
 
-static size_t find_cluster_start(const quotient_filter_t *qf, size_t q) {
-    size_t i = q;
-    while (qf->slots[i].shifted) {
-        i = dec(i, qf->nslots);
+// Slot of the k-th (0-based) runend at or after `from`; xnslots if none.
+static size_t select_runend(const quotient_filter_t *qf, size_t from, size_t k) {
+    if (from >= qf->xnslots) return qf->xnslots;
+    size_t w = from / QF_BLOCK_SLOTS;
+    uint64_t word = word_load(&qf_block(qf, w)->runends) & (~0ULL << (from % QF_BLOCK_SLOTS));
+    for (;;) {
+        size_t c = (size_t)__builtin_popcountll(word);
+        if (k < c) return w * QF_BLOCK_SLOTS + select64(word, (unsigned)k);
+        k -= c;
+        if (++w >= qf->nblocks) return qf->xnslots;
+        word = word_load(&qf_block(qf, w)->runends);
     }
-    return i;
 }
 
-static size_t find_run_start(const quotient_filter_t *qf, size_t q) {
-    size_t c = find_cluster_start(qf, q);
+static size_t run_end_past(const quotient_filter_t *qf, size_t x);
+
+// Slots at the start of block b used by runs of quotients from earlier blocks.
+static size_t block_offset(const quotient_filter_t *qf, size_t b) {
+    size_t o = (uint8_t)word_load(&qf_block(qf, b)->offset);
+    if (o < QF_OFFSET_SAT || b == 0) return o;
+    size_t start = b * QF_BLOCK_SLOTS;
+    size_t p = run_end_past(qf, start - 1);
+    return (p > start) ? p - start : 0;
+}
+
+// One past the runend of the last run whose quotient is <= x. Slot x is in
+// use iff the result is > x.
+static size_t run_end_past(const quotient_filter_t *qf, size_t x) {
+    size_t b = x / QF_BLOCK_SLOTS;
+    size_t base = b * QF_BLOCK_SLOTS + block_offset(qf, b);
+    uint64_t occ = word_load(&qf_block(qf, b)->occupieds) & ((2ULL << (x % QF_BLOCK_SLOTS)) - 1);
+    if (!occ) return base;
+    return select_runend(qf, base, (size_t)__builtin_popcountll(occ) - 1) + 1;
+}
+
+// [*start, *end] of the run of occupied quotient q. Returns -1 if the
+// runends do not add up (only possible on a torn concurrent read).
+static int run_bounds(const quotient_filter_t *qf, size_t q, size_t *start, size_t *end) {
+    size_t b = q / QF_BLOCK_SLOTS;
+    size_t base = b * QF_BLOCK_SLOTS + block_offset(qf, b);
+    uint64_t occ = word_load(&qf_block(qf, b)->occupieds) & ((2ULL << (q % QF_BLOCK_SLOTS)) - 1);
+    size_t d = (size_t)__builtin_popcountll(occ);
+    if (d == 0) return -1;
 
-    size_t s = c;
-    while (slot_empty(&qf->slots[s])) {
-        s = inc(s, qf->nslots);
+    size_t prev = (d == 1) ? base : select_runend(qf, base, d - 2) + 1;
+    size_t e = select_runend(qf, prev, 0);
+    if (e >= qf->xnslots) return -1;
+    *start = (prev > q) ? prev : q;
+    *end = e;
+    return 0;
+}
+
+// First unused slot at or after i (xnslots if the table is full).
+static size_t first_empty(const quotient_filter_t *qf, size_t i) {
+    while (i < qf->xnslots) {
+        size_t t = run_end_past(qf, i);
+        if (t <= i) return i;
+        i = t;
     }
+    return qf->xnslots;
+}
 
-    for (size_t b = c; b != q; b = inc(b, qf->nslots)) {
-        if (qf->slots[b].occupied) {
-            s = inc(s, qf->nslots);
-            while (qf->slots[s].continuation) {
-                s = inc(s, qf->nslots);
-            }
-            while (slot_empty(&qf->slots[s])) {
-                s = inc(s, qf->nslots);
-            }
+// First occupied home slot in (from, limit], or limit + 1.
+static size_t next_occupied(const quotient_filter_t *qf, size_t from, size_t limit) {
+    size_t i = from + 1;
+    while (i <= limit) {
+        uint64_t word = word_load(&blk(qf, i)->occupieds) >> (i % QF_BLOCK_SLOTS);
+        if (word) {
+            size_t j = i + (size_t)__builtin_ctzll(word);
+            return (j <= limit) ? j : limit + 1;
         }
+        i = (i / QF_BLOCK_SLOTS + 1) * QF_BLOCK_SLOTS;
     }
-    return s;
+    return limit + 1;
+}
+
+// First block whose metadata a lookup at q reads: saturated offsets are
+// recomputed from the previous block.
+static size_t first_block_read(const quotient_filter_t *qf, size_t q) {
+    size_t b = q / QF_BLOCK_SLOTS;
+    while (b > 0 && (uint8_t)word_load(&qf_block(qf, b)->offset) == QF_OFFSET_SAT) b--;
+    return b;
 }
 
-static void shift_right_make_hole(quotient_filter_t *qf, size_t pos) {
-    size_t i = pos;
-    while (!slot_empty(&qf->slots[i])) {
-        i = inc(i, qf->nslots);
+// Slots taken by the entry starting at s, e being the last slot of its
+// run: in counting mode a remainder is followed by its count digits.
+static inline size_t entry_len(const quotient_filter_t *qf, size_t s, size_t e) {
+    size_t n = 1;
+    if (qf->mode == QF_COUNTING) {
+        while (s + n <= e && (get_slot(qf, s + n) & 1)) n++;
     }
-    while (i != pos) {
-        size_t p = dec(i, qf->nslots);
-        copy_elem_keep_dst_occupied(&qf->slots[i], &qf->slots[p]);
-        qf->slots[i].shifted = 1;
-        clear_elem_keep_occupied(&qf->slots[p]);
-        i = p;
+    return n;
+}
+
+// 1 = present, 0 = absent, -1 = torn read. *lo/*hi get the first and last
+// slot read.
+static int query_qr(const quotient_filter_t *qf, size_t q, uint64_t r, size_t *lo, size_t *hi) {
+    if (lo) *lo = q;
+    if (hi) *hi = q;
+    if (!is_occupied(qf, q)) return 0;
+
+    if (lo) *lo = first_block_read(qf, q) * QF_BLOCK_SLOTS;
+    size_t s, e;
+    if (run_bounds(qf, q, &s, &e) != 0) return -1;
+    if (hi) *hi = e;
+
+    // remainders are sorted inside a run
+    for (; s <= e; s += entry_len(qf, s, e)) {
+        uint64_t rem = get_rem(qf, s);
+        if (rem == r) return 1;
+        if (rem > r) return 0;
     }
+    return 0;
 }
 
-static void shift_left_fill_hole(quotient_filter_t *qf, size_t pos) {
-    size_t cur = pos;
-    while (1) {
-        size_t nxt = inc(cur, qf->nslots);
-        if (slot_empty(&qf->slots[nxt])) {
-            clear_elem_keep_occupied(&qf->slots[cur]);
-            return;
+// Opens slot s for quotient q and writes v there, shifting [s, first empty
+// slot) right by one. s lies inside or just past the run [.., re] of q, or
+// is where that run starts if q was not occupied. -1 if no slot is free.
+static int put_slot(quotient_filter_t *qf, size_t q, size_t s, int was_occ, size_t re, uint64_t v) {
+    size_t E = first_empty(qf, s);
+    if (E >= qf->xnslots) return -1;
+
+    for (size_t i = E; i > s; i--) {
+        set_slot(qf, i, get_slot(qf, i - 1));
+        set_runend(qf, i, is_runend(qf, i - 1));
+    }
+    set_slot(qf, s, v);
+
+    if (!was_occ) {
+        set_occupied(qf, q, 1);
+        set_runend(qf, s, 1);
+    } else if (s > re) {
+        set_runend(qf, re, 0);
+        set_runend(qf, s, 1);
+    } else {
+        set_runend(qf, s, 0);
+    }
+
+    // every block starting in (q, E] now has one more slot taken by runs
+    // of earlier quotients
+    for (size_t b = q / QF_BLOCK_SLOTS + 1; b * QF_BLOCK_SLOTS <= E; b++) {
+        uint64_t *off = &qf_block(qf, b)->offset;
+        uint64_t o = word_load(off);
+        if (o < QF_OFFSET_SAT) word_store(off, o + 1);
+    }
+    return 0;
+}
+
+// Removes slot pos from the run [rs, re] of quotient q.
+static void drop_slot(quotient_filter_t *qf, size_t q, size_t pos, size_t rs, size_t re) {
+    // Everything after pos slides left by one, up to the first empty slot
+    // or the first run that sits at its home slot.
+    size_t cq = q;
+    size_t T = pos + 1;
+    for (; T < qf->xnslots; T++) {
+        if (!is_runend(qf, T - 1)) continue;
+        size_t nq = next_occupied(qf, cq, T);
+        if (nq >= T) break;
+        cq = nq;
+    }
+
+    if (pos == rs && pos == re) set_occupied(qf, q, 0);
+    else if (pos == re) set_runend(qf, pos - 1, 1);
+
+    for (size_t i = pos; i + 1 < T; i++) {
+        set_slot(qf, i, get_slot(qf, i + 1));
+        set_runend(qf, i, is_runend(qf, i + 1));
+    }
+    set_slot(qf, T - 1, 0);
+    set_runend(qf, T - 1, 0);
+
+    for (size_t b = q / QF_BLOCK_SLOTS + 1; b * QF_BLOCK_SLOTS < T; b++) {
+        uint64_t *off = &qf_block(qf, b)->offset;
+        uint64_t cur = word_load(off);
+        if (cur < QF_OFFSET_SAT) {
+            if (cur) word_store(off, cur - 1);
+        } else {
+            size_t o = block_offset(qf, b);
+            word_store(off, (uint8_t)((o < QF_OFFSET_SAT) ? o : QF_OFFSET_SAT));
         }
-        copy_elem_keep_dst_occupied(&qf->slots[cur], &qf->slots[nxt]);
-        clear_elem_keep_occupied(&qf->slots[nxt]);
-        cur = nxt;
+    }
+}
+
+// Where slot value v goes in the run of q, runs being sorted by slot
+// value (set and maplet modes). 1 if v is already there.
+static int find_slot(const quotient_filter_t *qf, size_t q, uint64_t v, int *was_occ,
+                     size_t *rs, size_t *re, size_t *pos) {
+    *was_occ = is_occupied(qf, q);
+    *rs = *re = 0;
+    if (!*was_occ) {
+        size_t p = run_end_past(qf, q);
+        *pos = (p > q) ? p : q;
+        return 0;
+    }
+    if (run_bounds(qf, q, rs, re) != 0) return -1;
+    size_t s;
+    for (s = *rs; s <= *re; s++) {
+        if (get_slot(qf, s) >= v) break;
+    }
+    *pos = s;
+    return s <= *re && get_slot(qf, s) == v;
+}
+
+// Adds slot value v (the remainder, plus its value in maplet mode).
+// 1 = added, 0 = already present, -1 = no free slot.
+static int insert_qr(quotient_filter_t *qf, size_t q, uint64_t v) {
+    int was_occ;
+    size_t rs, re, s;
+    int found = find_slot(qf, q, v, &was_occ, &rs, &re, &s);
+    if (found) return found < 0 ? -1 : 0;
+    return put_slot(qf, q, s, was_occ, re, v) ? -1 : 1;
+}
+
+// 1 = removed, 0 = not found.
+static int delete_qr(quotient_filter_t *qf, size_t q, uint64_t v) {
+    int was_occ;
+    size_t rs, re, pos;
+    if (find_slot(qf, q, v, &was_occ, &rs, &re, &pos) != 1) return 0;
+    drop_slot(qf, q, pos, rs, re);
+    return 1;
+}
+
+// ---- counting mode ----
+//
+// A count c > 1 is kept as the digits of c - 1, little-endian in base
+// 2^rbits, in the slots right after the key's remainder; the low bit of a
+// slot tells digits (1) from remainders (0).
+
+static inline size_t count_digits(uint64_t v, size_t rbits) {
+    size_t d = 0;
+    for (; v; v >>= rbits) d++;
+    return d;
+}
+
+static uint64_t entry_count(const quotient_filter_t *qf, size_t pos, size_t len) {
+    uint64_t v = 0;
+    for (size_t j = len - 1; j >= 1; j--) v = (v << qf->rbits) | (get_slot(qf, pos + j) >> 1);
+    return v + 1;
+}
+
+// Entry of remainder r in the run [rs, re]: 1 with *pos/*len, or 0 with
+// *pos where it would go.
+static int find_entry(const quotient_filter_t *qf, size_t rs, size_t re, uint64_t r,
+                      size_t *pos, size_t *len) {
+    size_t s = rs;
+    while (s <= re) {
+        size_t n = entry_len(qf, s, re);
+        uint64_t rem = get_rem(qf, s);
+        if (rem >= r) {
+            *pos = s;
+            *len = (rem == r) ? n : 0;
+            return rem == r;
+        }
+        s += n;
+    }
+    *pos = s;
+    *len = 0;
+    return 0;
+}
+
+// Resizes the entry at pos (len slots, run ending at *re) to hold count c
+// and rewrites its digits. The new length, or -1 with the entry unchanged
+// if no slot is free.
+static long set_entry_count(quotient_filter_t *qf, size_t q, size_t rs, size_t *re,
+                            size_t pos, size_t len, uint64_t c) {
+    size_t want = 1 + count_digits(c - 1, qf->rbits);
+    size_t n = len;
+    while (n < want) {
+        if (put_slot(qf, q, pos + n, 1, *re, 1) != 0) {
+            for (; n > len; n--, (*re)--) drop_slot(qf, q, pos + n - 1, rs, *re);
+            return -1;
+        }
+        n++;
+        (*re)++;
+    }
+    for (; n > want; n--, (*re)--) drop_slot(qf, q, pos + n - 1, rs, *re);
+
+    uint64_t v = c - 1;
+    uint64_t mask = (1ULL << qf->rbits) - 1;
+    for (size_t j = 1; j < n; j++, v >>= qf->rbits) set_slot(qf, pos + j, ((v & mask) << 1) | 1);
+    return (long)n;
+}
+
+// Bits a slot carries beyond its remainder, or -1 if vbits does not suit
+// the mode.
+static int slot_vbits(int mode, size_t vbits) {
+    switch (mode) {
+    case QF_SET:      return vbits == 0 ? 0 : -1;
+    case QF_COUNTING: return vbits == 0 ? 1 : -1;
+    case QF_MAPLET:   return (vbits >= 1 && vbits <= QF_MAX_VBITS) ? (int)vbits : -1;
+    default:          return -1;
     }
 }
 
 int qf_init(quotient_filter_t *qf, size_t qbits, size_t rbits) {
-    if (!qf || qbits == 0 || rbits == 0 || rbits > 16) {
+    return qf_init_mode(qf, qbits, rbits, QF_SET, 0);
+}
+
+// runs near the end spill into overflow slots instead of wrapping
+static size_t layout_blocks(size_t nslots) {
+    size_t extra = 10 * (size_t)sqrt((double)nslots);
+    return (nslots + extra + QF_BLOCK_SLOTS - 1) / QF_BLOCK_SLOTS;
+}
+
+int qf_init_mode(quotient_filter_t *qf, size_t qbits, size_t rbits, qf_mode_t mode, size_t vbits) {
+    int extra_bits = slot_vbits(mode, vbits);
+    if (!qf || qbits == 0 || rbits < 4 || rbits > 16 || extra_bits < 0) {
         return EINVAL;
     }
 
     memset(qf, 0, sizeof(*qf));
     qf->qbits = qbits;
     qf->rbits = rbits;
+    qf->mode = mode;
+    qf->vbits = (size_t)extra_bits;
+    qf->sbits = rbits + qf->vbits;
     qf->nslots = 1ULL << qbits;
 
-    qf->slots = (qf_slot_t*)calloc(qf->nslots, sizeof(qf_slot_t));
-    if (!qf->slots) {
+    qf->nblocks = layout_blocks(qf->nslots);
+    qf->xnslots = qf->nblocks * QF_BLOCK_SLOTS;
+
+    qf->block_bytes = sizeof(qf_block_t) + qf->sbits * sizeof(uint64_t);
+    qf->blocks = (qf_block_t*)calloc(qf->nblocks, qf->block_bytes);
+    if (!qf->blocks) {
         return ENOMEM;
     }
     return 0;
@@ -119,7 +433,9 @@ int qf_init(quotient_filter_t *qf, size_t qbits, size_t rbits) {
 
 void qf_free(quotient_filter_t *qf) {
     if (!qf) return;
-    free(qf->slots);
+    free(qf->region_ver);
+    if (qf->map) munmap(qf->map, qf->map_bytes);
+    else fmem_free(qf->blocks, qf_bytes(qf), qf->backing);
     memset(qf, 0, sizeof(*qf));
 }
 
@@ -127,126 +443,702 @@ int qf_query(const quotient_filter_t *qf, uint64_t key) {
     uint64_t h = hash64(key);
     size_t q = home_index(h, qf->qbits);
     uint16_t r = rem_bits(h, qf->qbits, qf->rbits);
+    return query_qr(qf, q, r, NULL, NULL) == 1;
+}
 
-    if (!qf->slots[q].occupied) return 0;
+typedef struct {
+    size_t   q;
+    uint16_t r;
+} qf_probe_t;
 
-    size_t s = find_run_start(qf, q);
-    size_t i = s;
+static inline void qf_locate(const quotient_filter_t *qf, uint64_t key, qf_probe_t *p) {
+    uint64_t h = hash64(key);
+    p->q = home_index(h, qf->qbits);
+    p->r = rem_bits(h, qf->qbits, qf->rbits);
+    // block metadata, then the line holding the home remainder; the run
+    // usually starts at or just after it
+    __builtin_prefetch(blk(qf, p->q), 0, 3);
+    __builtin_prefetch(&blk(qf, p->q)->rem[(p->q % QF_BLOCK_SLOTS) * qf->sbits / 64], 0, 3);
+}
+
+size_t qf_query_batch_dist(const quotient_filter_t *qf, const uint64_t *keys, size_t n,
+                           uint64_t *out_bitmap, size_t dist) {
+    if (!qf || !qf->blocks || !keys || !out_bitmap) return 0;
+    if (dist > QF_BATCH_RING) dist = QF_BATCH_RING;
+
+    memset(out_bitmap, 0, ((n + 63) / 64) * sizeof(uint64_t));
+
+    qf_probe_t ring[QF_BATCH_RING];
+    size_t hits = 0;
 
-    while (1) {
-        if (slot_empty(&qf->slots[i])) return 0;
-        if (qf->slots[i].rem == r) return 1;
+    size_t head = (dist < n) ? dist : n;
+    for (size_t i = 0; i < head; i++) qf_locate(qf, keys[i], &ring[i & (QF_BATCH_RING - 1)]);
 
-        size_t nxt = inc(i, qf->nslots);
-        if (!qf->slots[nxt].continuation) return 0;
-        i = nxt;
+    for (size_t i = 0; i < n; i++) {
+        qf_probe_t cur;
+        if (dist == 0) qf_locate(qf, keys[i], &cur);
+        else cur = ring[i & (QF_BATCH_RING - 1)];
+
+        size_t ahead = i + dist;
+        if (dist && ahead < n) qf_locate(qf, keys[ahead], &ring[ahead & (QF_BATCH_RING - 1)]);
+
+        if (query_qr(qf, cur.q, cur.r, NULL, NULL) == 1) {
+            out_bitmap[i >> 6] |= 1ULL << (i & 63);
+            hits++;
+        }
     }
+    return hits;
+}
+
+size_t qf_query_batch(const quotient_filter_t *qf, const uint64_t *keys, size_t n, uint64_t *out_bitmap) {
+    return qf_query_batch_dist(qf, keys, n, out_bitmap, QF_PREFETCH_DIST);
 }
 
 int qf_insert(quotient_filter_t *qf, uint64_t key) {
+    if (qf->map) return EINVAL;
+    if (qf->mode == QF_COUNTING) return qf_insert_count(qf, key, 1);
+    if (qf->mode != QF_SET) return EINVAL;
     if (qf_load_factor(qf) > 0.95) return 1;
 
     uint64_t h = hash64(key);
     size_t q = home_index(h, qf->qbits);
     uint16_t r = rem_bits(h, qf->qbits, qf->rbits);
 
-    if (qf_query(qf, key)) return 0;
+    int rc = insert_qr(qf, q, r);
+    if (rc < 0) return 1;
+    if (rc) qf->nitems++;
+    return 0;
+}
 
-    if (!qf->slots[q].occupied && slot_empty(&qf->slots[q])) {
-        qf->slots[q].occupied = 1;
-        qf->slots[q].rem = r;
-        qf->slots[q].continuation = 0;
-        qf->slots[q].shifted = 0;
-        qf->nitems++;
+
+int qf_delete(quotient_filter_t *qf, uint64_t key) {
+    if (qf->map) return EINVAL;
+    if (qf->mode == QF_COUNTING) return qf_delete_count(qf, key, 1);
+
+    uint64_t h = hash64(key);
+    size_t q = home_index(h, qf->qbits);
+    uint16_t r = rem_bits(h, qf->qbits, qf->rbits);
+
+    if (qf->mode == QF_MAPLET) {
+        // every value of the key: they sit together, sorted by value
+        size_t rs, re, pos;
+        if (!is_occupied(qf, q) || run_bounds(qf, q, &rs, &re) != 0) return 1;
+        pos = rs;
+        while (pos <= re && get_rem(qf, pos) < r) pos++;
+        size_t n = 0;
+        while (pos + n <= re && get_rem(qf, pos + n) == r) n++;
+        if (n == 0) return 1;
+        for (size_t j = 0; j < n; j++, re--) drop_slot(qf, q, pos, rs, re);
+        qf->nitems -= n;
         return 0;
     }
 
-    qf->slots[q].occupied = 1;
-
-    size_t run_start = find_run_start(qf, q);
+    if (!delete_qr(qf, q, r)) return 1;
+    if (qf->nitems) qf->nitems--;
+    return 0;
+}
 
-    size_t ins = run_start;
-    while (1) {
-        if (slot_empty(&qf->slots[ins])) break; 
-        if (qf->slots[ins].rem > r) break;
+uint64_t qf_count(const quotient_filter_t *qf, uint64_t key) {
+    uint64_t h = hash64(key);
+    size_t q = home_index(h, qf->qbits);
+    uint16_t r = rem_bits(h, qf->qbits, qf->rbits);
 
-        size_t nxt = inc(ins, qf->nslots);
-        if (!qf->slots[nxt].continuation) 
-            ins = nxt;
-            break;
-        }
-        ins = nxt;
+    size_t rs, re, pos, len;
+    if (!is_occupied(qf, q) || run_bounds(qf, q, &rs, &re) != 0) return 0;
+    if (qf->mode == QF_COUNTING) {
+        return find_entry(qf, rs, re, r, &pos, &len) ? entry_count(qf, pos, len) : 0;
     }
 
-    shift_right_make_hole(qf, ins);
+    uint64_t c = 0;
+    for (pos = rs; pos <= re; pos++) {
+        uint64_t rem = get_rem(qf, pos);
+        if (rem > r) break;
+        c += (rem == r);
+    }
+    return c;
+}
 
-    qf->slots[ins].rem = r;
-    qf->slots[ins].shifted = (ins != q);
+int qf_insert_count(quotient_filter_t *qf, uint64_t key, uint64_t count) {
+    if (qf->map || qf->mode != QF_COUNTING) return EINVAL;
+    if (count == 0) return 0;
+    if (qf_load_factor(qf) > 0.95) return 1;
 
-    if (ins == run_start) {
-        qf->slots[ins].continuation = 0;
+    uint64_t h = hash64(key);
+    size_t q = home_index(h, qf->qbits);
+    uint16_t r = rem_bits(h, qf->qbits, qf->rbits);
 
-        size_t nxt = inc(ins, qf->nslots);
-        if (!slot_empty(&qf->slots[nxt])) {
-            qf->slots[nxt].continuation = 1;
-            qf->slots[nxt].shifted = 1;
+    int was_occ = is_occupied(qf, q);
+    size_t rs = 0, re = 0, pos, len = 0;
+    uint64_t c = count;
+    if (was_occ) {
+        if (run_bounds(qf, q, &rs, &re) != 0) return 1;
+        if (find_entry(qf, rs, re, r, &pos, &len)) {
+            uint64_t old = entry_count(qf, pos, len);
+            if (old > UINT64_MAX - count) return 1;
+            c = old + count;
         }
     } else {
-        qf->slots[ins].continuation = 1;
+        size_t p = run_end_past(qf, q);
+        pos = (p > q) ? p : q;
+    }
+
+    int added = 0;
+    if (len == 0) {
+        if (put_slot(qf, q, pos, was_occ, re, (uint64_t)r << 1) != 0) return 1;
+        if (!was_occ) rs = re = pos;
+        else re++;
+        len = 1;
+        added = 1;
+        qf->nitems++;
     }
+    if (c == 1) return 0;
 
+    long n = set_entry_count(qf, q, rs, &re, pos, len, c);
+    if (n < 0) {
+        if (added) {
+            drop_slot(qf, q, pos, rs, re);
+            qf->nitems--;
+        }
+        return 1;
+    }
+    qf->nitems += (size_t)n - len;
+    return 0;
+}
 
-    qf->slots[run_start].continuation = 0;
+int qf_delete_count(quotient_filter_t *qf, uint64_t key, uint64_t count) {
+    if (qf->map || qf->mode != QF_COUNTING) return EINVAL;
 
-    qf->nitems++;
+    uint64_t h = hash64(key);
+    size_t q = home_index(h, qf->qbits);
+    uint16_t r = rem_bits(h, qf->qbits, qf->rbits);
+
+    size_t rs, re, pos, len;
+    if (!is_occupied(qf, q) || run_bounds(qf, q, &rs, &re) != 0) return 1;
+    if (!find_entry(qf, rs, re, r, &pos, &len)) return 1;
+
+    uint64_t c = entry_count(qf, pos, len);
+    if (count < c) {
+        // shrinking only drops slots, so it cannot fail
+        long n = set_entry_count(qf, q, rs, &re, pos, len, c - count);
+        qf->nitems -= len - (size_t)n;
+        return 0;
+    }
+    for (size_t j = len; j > 0; j--, re--) drop_slot(qf, q, pos + j - 1, rs, re);
+    qf->nitems -= len;
     return 0;
 }
 
+int qf_insert_value(quotient_filter_t *qf, uint64_t key, uint64_t value) {
+    if (qf->map || qf->mode != QF_MAPLET || (value >> qf->vbits)) return EINVAL;
+    if (qf_load_factor(qf) > 0.95) return 1;
 
-int qf_delete(quotient_filter_t *qf, uint64_t key) {
     uint64_t h = hash64(key);
     size_t q = home_index(h, qf->qbits);
     uint16_t r = rem_bits(h, qf->qbits, qf->rbits);
 
-    if (!qf->slots[q].occupied) return 1;
+    int rc = insert_qr(qf, q, ((uint64_t)r << qf->vbits) | value);
+    if (rc < 0) return 1;
+    if (rc) qf->nitems++;
+    return 0;
+}
 
-    size_t run_start = find_run_start(qf, q);
-    size_t i = run_start;
+size_t qf_query_value(const quotient_filter_t *qf, uint64_t key, uint64_t *values, size_t max) {
+    if (qf->mode != QF_MAPLET) return 0;
 
-    while (1) {
-        if (slot_empty(&qf->slots[i])) return 1;
-        if (qf->slots[i].rem == r) break;
+    uint64_t h = hash64(key);
+    size_t q = home_index(h, qf->qbits);
+    uint16_t r = rem_bits(h, qf->qbits, qf->rbits);
+
+    size_t rs, re;
+    if (!is_occupied(qf, q) || run_bounds(qf, q, &rs, &re) != 0) return 0;
 
-        size_t nxt = inc(i, qf->nslots);
-        if (!qf->slots[nxt].continuation) return 1;
-        i = nxt;
+    uint64_t vmask = (1ULL << qf->vbits) - 1;
+    size_t n = 0;
+    for (size_t s = rs; s <= re; s++) {
+        uint64_t v = get_slot(qf, s);
+        uint64_t rem = v >> qf->vbits;
+        if (rem > r) break;
+        if (rem < r) continue;
+        if (n < max) values[n] = v & vmask;
+        n++;
     }
+    return n;
+}
 
-    int removed_was_run_start = (i == run_start);
+int qf_delete_value(quotient_filter_t *qf, uint64_t key, uint64_t value) {
+    if (qf->map || qf->mode != QF_MAPLET || (value >> qf->vbits)) return EINVAL;
 
-   
-    shift_left_fill_hole(qf, i);
-    if (qf->nitems) qf->nitems--;
+    uint64_t h = hash64(key);
+    size_t q = home_index(h, qf->qbits);
+    uint16_t r = rem_bits(h, qf->qbits, qf->rbits);
+
+    if (!delete_qr(qf, q, ((uint64_t)r << qf->vbits) | value)) return 1;
+    qf->nitems--;
+    return 0;
+}
+
+double qf_load_factor(const quotient_filter_t *qf) {
+    return (double)qf->nitems / (double)qf->nslots;
+}
+
+// params: qbits, rbits, nblocks, nitems, mode, maplet value bits; one
+// section of blocks
+int qf_save(const quotient_filter_t *qf, const char *path) {
+    if (!qf || !qf->blocks) return EINVAL;
+
+    fio_header_t h;
+    memset(&h, 0, sizeof(h));
+    h.kind = FIO_KIND_QF;
+    h.params[0] = qf->qbits;
+    h.params[1] = qf->rbits;
+    h.params[2] = qf->nblocks;
+    h.params[3] = qf->nitems;
+    h.params[4] = (uint64_t)qf->mode;
+    h.params[5] = (qf->mode == QF_MAPLET) ? qf->vbits : 0;
+    h.nsections = 1;
+    h.sections[0].bytes = qf->nblocks * (uint64_t)qf->block_bytes;
+
+    const void *data[1] = { qf->blocks };
+    return fio_write(path, &h, data);
+}
+
+int qf_open_mmap(quotient_filter_t *qf, const char *path) {
+    if (!qf) return EINVAL;
+
+    fio_header_t h;
+    void *map = NULL;
+    size_t map_bytes = 0;
+    int err = fio_map(path, FIO_KIND_QF, &h, &map, &map_bytes);
+    if (err) return err;
+
+    size_t qbits = (size_t)h.params[0], rbits = (size_t)h.params[1];
+    size_t nblocks = (size_t)h.params[2];
+    int mode = (h.params[4] <= QF_MAPLET) ? (int)h.params[4] : -1;
+    int vbits = slot_vbits(mode, (size_t)h.params[5]);
+    size_t block_bytes = sizeof(qf_block_t) + (rbits + (size_t)vbits) * sizeof(uint64_t);
+    if (h.nsections != 1 || qbits == 0 || qbits >= 48 || rbits < 4 || rbits > 16 || vbits < 0 ||
+        nblocks * QF_BLOCK_SLOTS < (1ULL << qbits) ||
+        h.sections[0].bytes != nblocks * (uint64_t)block_bytes) {
+        munmap(map, map_bytes);
+        return EINVAL;
+    }
+
+    memset(qf, 0, sizeof(*qf));
+    qf->qbits = qbits;
+    qf->rbits = rbits;
+    qf->mode = (qf_mode_t)mode;
+    qf->vbits = (size_t)vbits;
+    qf->sbits = rbits + qf->vbits;
+    qf->nslots = 1ULL << qbits;
+    qf->nblocks = nblocks;
+    qf->xnslots = nblocks * QF_BLOCK_SLOTS;
+    qf->nitems = (size_t)h.params[3];
+    qf->block_bytes = block_bytes;
+    qf->blocks = (qf_block_t*)fio_section(map, &h, 0);
+    qf->map = map;
+    qf->map_bytes = map_bytes;
+    return 0;
+}
+
+size_t qf_bytes(const quotient_filter_t *qf) {
+    return qf->nblocks * qf->block_bytes;
+}
+
+size_t qf_bytes_for(size_t qbits, size_t sbits) {
+    if (qbits == 0 || qbits >= 8 * sizeof(size_t)) return 0;
+    return layout_blocks((size_t)1 << qbits) * (sizeof(qf_block_t) + sbits * sizeof(uint64_t));
+}
+
+int qf_set_backing(quotient_filter_t *qf, fmem_backing_t backing, int prefault) {
+    if (!qf || !qf->blocks || qf->map) return EINVAL;
+
+    size_t bytes = qf_bytes(qf);
+    fmem_backing_t got;
+    qf_block_t *mem = (qf_block_t*)fmem_alloc(bytes, backing, prefault, &got);
+    if (!mem) return ENOMEM;
+    memcpy(mem, qf->blocks, bytes);
+    fmem_free(qf->blocks, bytes, qf->backing);
+    qf->blocks = mem;
+    qf->backing = got;
+    return 0;
+}
+
+// ---- expansion and merge ----
+//
+// Both stream entries out of their source(s) in (quotient, remainder) order
+// and append them to an empty filter, so every table is read and written
+// front to back. Appending in that order places each run at
+// max(home, end of the previous run), and a block's offset is just how far
+// the runs of earlier quotients reach past its start.
+
+typedef struct {
+    size_t   q;
+    uint64_t v;       // the remainder (plus value bits in maplet mode)
+    uint64_t count;   // 1 outside counting mode
+} qf_entry_t;
+
+typedef struct {
+    const quotient_filter_t *qf;
+    size_t   q;       // quotient of the current run
+    size_t   pos;     // next slot to read
+    int      in_run;  // pos continues the run of q
+    size_t   ob;      // block of q
+    uint64_t occ;     // its occupied bits above q
+} qf_iter_t;
 
-  
-    if (removed_was_run_start) {
-        if (!slot_empty(&qf->slots[run_start])) {
-            qf->slots[run_start].continuation = 0;
+static void iter_init(qf_iter_t *it, const quotient_filter_t *qf) {
+    it->qf = qf;
+    it->q = 0;
+    it->pos = 0;
+    it->in_run = 0;
+    it->ob = 0;
+    it->occ = qf_block(qf, 0)->occupieds;
+}
+
+// Next entry in (quotient, remainder) order; 0 after the last. A run
+// starts at its home slot or right after the previous one, so the walk
+// needs only the next occupied bit and each slot's runend bit.
+static int iter_next(qf_iter_t *it, qf_entry_t *out) {
+    const quotient_filter_t *qf = it->qf;
+    if (!it->in_run) {
+        while (!it->occ) {
+            if (++it->ob * QF_BLOCK_SLOTS >= qf->nslots) return 0;
+            it->occ = qf_block(qf, it->ob)->occupieds;
         }
+        it->q = it->ob * QF_BLOCK_SLOTS + (size_t)__builtin_ctzll(it->occ);
+        it->occ &= it->occ - 1;
+        if (it->pos < it->q) it->pos = it->q;
     }
 
-    size_t check = find_run_start(qf, q);
-    if (slot_empty(&qf->slots[check])) {
-        qf->slots[q].occupied = 0;
+    size_t s = it->pos, last = s;
+    out->q = it->q;
+    if (qf->mode == QF_COUNTING) {
+        while (!is_runend(qf, last) && last + 1 < qf->xnslots && (get_slot(qf, last + 1) & 1)) last++;
+        out->v = get_rem(qf, s);
+        out->count = entry_count(qf, s, last - s + 1);
+    } else {
+        out->v = get_slot(qf, s);
+        out->count = 1;
+    }
+    it->in_run = !is_runend(qf, last);
+    it->pos = last + 1;
+    return 1;
+}
+
+typedef struct {
+    quotient_filter_t *qf;
+    size_t q;         // quotient of the last run (SIZE_MAX before the first)
+    size_t end;       // first slot past everything appended
+} qf_appender_t;
+
+// Appends slot value v to the run of q. Quotients must not decrease and
+// slots come in run order. -1 once the table is out of slots.
+static int append_slot(qf_appender_t *ap, size_t q, uint64_t v) {
+    quotient_filter_t *qf = ap->qf;
+    size_t pos = (q > ap->end) ? q : ap->end;
+    if (pos >= qf->xnslots) return -1;
+
+    if (q == ap->q) {
+        set_runend(qf, pos - 1, 0);
+    } else {
+        set_occupied(qf, q, 1);
+        ap->q = q;
     }
+    set_runend(qf, pos, 1);
+    set_slot(qf, pos, v);
+    ap->end = pos + 1;
+    qf->nitems++;
 
+    // blocks from q's up to pos's now reach to pos; once one is saturated
+    // every earlier one is too
+    for (size_t b = pos / QF_BLOCK_SLOTS; b > q / QF_BLOCK_SLOTS; b--) {
+        qf_block_t *bl = qf_block(qf, b);
+        if (bl->offset == QF_OFFSET_SAT) break;
+        size_t o = pos + 1 - b * QF_BLOCK_SLOTS;
+        bl->offset = (o < QF_OFFSET_SAT) ? o : QF_OFFSET_SAT;
+    }
     return 0;
 }
 
-double qf_load_factor(const quotient_filter_t *qf) {
-    return (double)qf->nitems / (double)qf->nslots;
+// Entry v of q with the given count, encoded for the appender's filter.
+static int append_entry(qf_appender_t *ap, size_t q, uint64_t v, uint64_t count) {
+    const quotient_filter_t *qf = ap->qf;
+    if (qf->mode != QF_COUNTING) return append_slot(ap, q, v);
+
+    if (append_slot(ap, q, v << 1) != 0) return -1;
+    uint64_t mask = (1ULL << qf->rbits) - 1;
+    for (uint64_t d = count - 1; d; d >>= qf->rbits) {
+        if (append_slot(ap, q, ((d & mask) << 1) | 1) != 0) return -1;
+    }
+    return 0;
 }
 
-size_t qf_bytes(const quotient_filter_t *qf) {
-    return qf->nslots * sizeof(qf_slot_t);
+// An empty filter shaped like qf but with the given qbits and rbits.
+static int init_like(quotient_filter_t *out, const quotient_filter_t *qf, size_t qbits, size_t rbits) {
+    size_t vbits = (qf->mode == QF_MAPLET) ? qf->vbits : 0;
+    int err = qf_init_mode(out, qbits, rbits, qf->mode, vbits);
+    if (err) return err;
+    if (qf->backing != FMEM_DEFAULT) err = qf_set_backing(out, qf->backing, 0);
+    if (err) qf_free(out);
+    return err;
+}
+
+int qf_expand(quotient_filter_t *qf) {
+    if (!qf || !qf->blocks || qf->map || qf->rbits <= 4 || qf->qbits + 1 >= 48) return EINVAL;
+
+    quotient_filter_t nq;
+    int err = init_like(&nq, qf, qf->qbits + 1, qf->rbits - 1);
+    if (err) return err;
+
+    // the stolen bit becomes the top quotient bit, so entries with an even
+    // remainder keep their quotient and odd ones move up by nslots: one
+    // pass per half keeps the appends in order
+    qf_appender_t ap = { &nq, SIZE_MAX, 0 };
+    uint64_t vmask = (1ULL << qf->vbits) - 1;
+    size_t vshift = (qf->mode == QF_MAPLET) ? qf->vbits : 0;
+    for (uint64_t half = 0; half < 2 && !err; half++) {
+        qf_iter_t it;
+        qf_entry_t en;
+        iter_init(&it, qf);
+        while (iter_next(&it, &en)) {
+            uint64_t r = en.v >> vshift;
+            if ((r & 1) != half) continue;
+            uint64_t v = ((r >> 1) << vshift) | (vshift ? (en.v & vmask) : 0);
+            if (append_entry(&ap, en.q | (size_t)(half << qf->qbits), v, en.count) != 0) {
+                err = ENOSPC;
+                break;
+            }
+        }
+    }
+    if (!err && qf->region_ver) err = qf_enable_concurrent(&nq, (size_t)1 << qf->region_shift);
+    if (err) {
+        qf_free(&nq);
+        return err;
+    }
+
+    qf_free(qf);
+    *qf = nq;
+    return 0;
+}
+
+int qf_merge(quotient_filter_t *out, const quotient_filter_t *a, const quotient_filter_t *b) {
+    if (!out || !a || !b || !a->blocks || !b->blocks || a->qbits != b->qbits ||
+        a->rbits != b->rbits || a->mode != b->mode || a->vbits != b->vbits) {
+        return EINVAL;
+    }
+
+    int err = init_like(out, a, a->qbits, a->rbits);
+    if (err) return err;
+
+    qf_appender_t ap = { out, SIZE_MAX, 0 };
+    qf_iter_t ia, ib;
+    qf_entry_t ea, eb;
+    iter_init(&ia, a);
+    iter_init(&ib, b);
+    int ha = iter_next(&ia, &ea), hb = iter_next(&ib, &eb);
+    while (ha || hb) {
+        int cmp = !hb ? -1 : !ha ? 1
+                : (ea.q != eb.q) ? (ea.q < eb.q ? -1 : 1)
+                : (ea.v != eb.v) ? (ea.v < eb.v ? -1 : 1) : 0;
+        const qf_entry_t *en = (cmp <= 0) ? &ea : &eb;
+        uint64_t count = en->count;
+        if (cmp == 0 && a->mode == QF_COUNTING) {
+            if (eb.count > UINT64_MAX - count) {
+                err = EOVERFLOW;
+                break;
+            }
+            count += eb.count;
+        }
+        if (append_entry(&ap, en->q, en->v, count) != 0) {
+            err = ENOSPC;
+            break;
+        }
+        if (cmp <= 0) ha = iter_next(&ia, &ea);
+        if (cmp >= 0) hb = iter_next(&ib, &eb);
+    }
+    if (err) qf_free(out);
+    return err;
+}
+
+// ---- concurrent mode ----
+//
+// An insert/delete at home slot q writes only inside [q, E], E being the
+// first empty slot at or after q (remainders, runend bits, the occupied bit
+// of q and the offsets of blocks starting in that range). It also reads
+// back to the first block whose offset is not saturated. Writers hold every
+// region covering that span; readers take no locks and validate the
+// versions of the regions between the first block and the end of the run.
+
+static inline void cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+static inline size_t region_of(const quotient_filter_t *qf, size_t slot) {
+    return slot >> qf->region_shift;
+}
+
+static inline uint32_t region_read_begin(const uint32_t *v) {
+    uint32_t x;
+    while ((x = __atomic_load_n(v, __ATOMIC_ACQUIRE)) & 1u) cpu_relax();
+    return x;
+}
+
+static inline int region_trylock(uint32_t *v) {
+    uint32_t x = __atomic_load_n(v, __ATOMIC_RELAXED);
+    if ((x & 1u) ||
+        !__atomic_compare_exchange_n(v, &x, x + 1u, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        return 0;
+    }
+    // order the odd version before the block stores that follow
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    return 1;
+}
+
+static inline void region_lock(uint32_t *v) {
+    while (!region_trylock(v)) cpu_relax();
+}
+
+static inline void region_unlock(uint32_t *v) {
+    __atomic_fetch_add(v, 1u, __ATOMIC_RELEASE);
+}
+
+static void unlock_regions(quotient_filter_t *qf, size_t r0, size_t cnt) {
+    for (size_t j = 0; j < cnt; j++) region_unlock(&qf->region_ver[r0 + j]);
+}
+
+// Regions a write at q touches, from an unlocked (possibly torn) read.
+static void cluster_regions(const quotient_filter_t *qf, size_t q, size_t *r0, size_t *r1) {
+    size_t e = first_empty(qf, q);
+    if (e >= qf->xnslots) e = qf->xnslots - 1;
+    *r0 = region_of(qf, first_block_read(qf, q) * QF_BLOCK_SLOTS);
+    *r1 = region_of(qf, e);
+    if (*r1 < *r0) *r1 = *r0;
+}
+
+// Lock every region a write at q touches. Only the first region is waited
+// for; the rest are try-locked, and the span is re-read under the locks
+// since it may have grown meanwhile.
+static void lock_cluster(quotient_filter_t *qf, size_t q, size_t *r0_out, size_t *cnt_out) {
+    for (;;) {
+        size_t r0, r1;
+        cluster_regions(qf, q, &r0, &r1);
+        region_lock(&qf->region_ver[r0]);
+
+        size_t cnt = 1;
+        int ok = 1;
+        for (size_t r = r0 + 1; r <= r1; r++, cnt++) {
+            if (!region_trylock(&qf->region_ver[r])) { ok = 0; break; }
+        }
+
+        if (ok) {
+            size_t c0, c1;
+            cluster_regions(qf, q, &c0, &c1);
+            if (c0 >= r0 && c1 <= r1) {
+                *r0_out = r0;
+                *cnt_out = cnt;
+                return;
+            }
+        }
+        unlock_regions(qf, r0, cnt);
+        cpu_relax();
+    }
+}
+
+int qf_enable_concurrent(quotient_filter_t *qf, size_t region_slots) {
+    if (!qf || !qf->blocks) return EINVAL;
+    if (qf->region_ver) return 0;
+
+    if (region_slots == 0) region_slots = QF_REGION_SLOTS;
+    if (region_slots & (region_slots - 1)) return EINVAL;
+    if (region_slots < QF_BLOCK_SLOTS) region_slots = QF_BLOCK_SLOTS;
+
+    size_t shift = 0;
+    while ((1ULL << shift) < region_slots) shift++;
+
+    qf->nregions = (qf->xnslots + region_slots - 1) >> shift;
+    qf->region_shift = shift;
+    qf->region_ver = (uint32_t*)calloc(qf->nregions, sizeof(uint32_t));
+    if (!qf->region_ver) return ENOMEM;
+    return 0;
+}
+
+int qf_query_mt(const quotient_filter_t *qf, uint64_t key) {
+    uint64_t h = hash64(key);
+    size_t q = home_index(h, qf->qbits);
+    uint16_t r = rem_bits(h, qf->qbits, qf->rbits);
+
+    size_t w0 = region_of(qf, q);
+    size_t wn = 1;
+    uint32_t snap[QF_MT_MAX_WINDOW];
+
+    while (wn <= QF_MT_MAX_WINDOW) {
+        for (size_t j = 0; j < wn; j++) snap[j] = region_read_begin(&qf->region_ver[w0 + j]);
+
+        size_t lo = q, hi = q;
+        int res = query_qr(qf, q, r, &lo, &hi);
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        int stable = 1;
+        for (size_t j = 0; j < wn; j++) {
+            if (__atomic_load_n(&qf->region_ver[w0 + j], __ATOMIC_RELAXED) != snap[j]) {
+                stable = 0;
+                break;
+            }
+        }
+        if (!stable) continue;
+
+        // everything read must lie inside the validated window
+        if (res >= 0 && region_of(qf, lo) >= w0 && region_of(qf, hi) < w0 + wn) return res;
+
+        if (res >= 0 && hi < qf->xnslots && lo <= hi) {
+            w0 = region_of(qf, lo);
+            wn = region_of(qf, hi) - w0 + 1;
+        }
+    }
+
+    // pathological cluster: read under the writers' locks instead
+    quotient_filter_t *mut = (quotient_filter_t*)qf;
+    size_t r0, cnt;
+    lock_cluster(mut, q, &r0, &cnt);
+    int res = query_qr(qf, q, r, NULL, NULL);
+    unlock_regions(mut, r0, cnt);
+    return res == 1;
+}
+
+int qf_insert_mt(quotient_filter_t *qf, uint64_t key) {
+    if (!qf->region_ver || qf->map || qf->mode != QF_SET) return EINVAL;
+    size_t nitems = __atomic_load_n(&qf->nitems, __ATOMIC_RELAXED);
+    if ((double)nitems / (double)qf->nslots > 0.95) return 1;
+
+    uint64_t h = hash64(key);
+    size_t q = home_index(h, qf->qbits);
+    uint16_t r = rem_bits(h, qf->qbits, qf->rbits);
+
+    size_t r0, cnt;
+    lock_cluster(qf, q, &r0, &cnt);
+    int rc = insert_qr(qf, q, r);
+    unlock_regions(qf, r0, cnt);
+
+    if (rc < 0) return 1;
+    if (rc) __atomic_fetch_add(&qf->nitems, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+int qf_delete_mt(quotient_filter_t *qf, uint64_t key) {
+    if (!qf->region_ver || qf->map || qf->mode != QF_SET) return EINVAL;
+
+    uint64_t h = hash64(key);
+    size_t q = home_index(h, qf->qbits);
+    uint16_t r = rem_bits(h, qf->qbits, qf->rbits);
+
+    size_t r0, cnt;
+    lock_cluster(qf, q, &r0, &cnt);
+    int removed = delete_qr(qf, q, r);
+    unlock_regions(qf, r0, cnt);
+
+    if (!removed) return 1;
+    __atomic_fetch_sub(&qf->nitems, 1, __ATOMIC_RELAXED);
+    return 0;
 }
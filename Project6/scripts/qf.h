@@ -2,27 +2,152 @@
 #include <stdint.h>
 #include <stddef.h>
 
+#include "filter_mem.h"
+
+// Rank-and-select layout: slots are grouped in blocks of 64. Each block has
+// one occupied bit per home slot, one runend bit per slot, and an offset
+// byte giving how many of its first slots are taken by runs of quotients
+// from earlier blocks (255 = saturated, recomputed on demand). A run is
+// located with popcount + select over these words instead of a slot walk.
+// The 64 slots follow bit-packed at sbits each, so a block takes
+// 3 + sbits words: (sbits + 3) bits per slot.
+#define QF_BLOCK_SLOTS 64
+
+// What a slot holds; sbits = rbits + the bits noted.
+//  SET      a remainder (+0). Inserting a present key changes nothing.
+//  COUNTING a multiset (+1). A key's remainder slot is followed in its run
+//           by the digits of its count less one, little-endian base
+//           2^rbits, one per slot: a key seen c times takes
+//           1 + ceil(log_2^rbits(c)) slots. The extra bit marks digits.
+//  MAPLET   a remainder and a value of vbits (+vbits). A key may hold
+//           several values; a run is sorted by remainder, then value.
+#define QF_MAX_VBITS 16
+
+typedef enum {
+    QF_SET      = 0,
+    QF_COUNTING = 1,
+    QF_MAPLET   = 2,
+} qf_mode_t;
+
 typedef struct {
-    uint8_t  occupied;
-    uint8_t  continuation;
-    uint8_t  shifted;
-    uint16_t  rem;  
-} qf_slot_t;
+    uint64_t offset;     // only the low byte is used
+    uint64_t occupieds;
+    uint64_t runends;
+    uint64_t rem[];      // sbits words
+} qf_block_t;
 
 typedef struct {
-    qf_slot_t *slots;
+    qf_block_t *blocks;
+    size_t     nblocks;
+    size_t     block_bytes;
     size_t     qbits;
     size_t     rbits;
-    size_t     nslots;  
-    size_t     nitems;
+    qf_mode_t  mode;
+    size_t     vbits;    // slot bits beyond the remainder (see qf_mode_t)
+    size_t     sbits;    // rbits + vbits
+    size_t     nslots;   // home slots (2^qbits)
+    size_t     xnslots;  // nslots plus overflow slots at the end (no wraparound)
+    size_t     nitems;   // slots in use (keys, in set mode)
+    fmem_backing_t backing;   // of blocks (filter_mem.h)
+
+    // concurrent mode: one seqlock-style version per region of slots,
+    // odd while a writer holds it (NULL until qf_enable_concurrent)
+    uint32_t  *region_ver;
+    size_t     region_shift;
+    size_t     nregions;
+
+    // set by qf_open_mmap: blocks live in this read-only mapping
+    void      *map;
+    size_t     map_bytes;
 } quotient_filter_t;
 
+static inline qf_block_t *qf_block(const quotient_filter_t *qf, size_t b) {
+    return (qf_block_t*)((char*)qf->blocks + b * qf->block_bytes);
+}
+
+// rbits is 4..16 (EINVAL otherwise): remainders narrower than 4 bits make
+// the false-positive rate (about load / 2^rbits) too high to be useful.
 int  qf_init(quotient_filter_t *qf, size_t qbits, size_t rbits);
+// vbits is 1..QF_MAX_VBITS in maplet mode and 0 otherwise; EINVAL if not.
+int  qf_init_mode(quotient_filter_t *qf, size_t qbits, size_t rbits, qf_mode_t mode, size_t vbits);
 void qf_free(quotient_filter_t *qf);
 
+// In counting mode insert/delete add/remove one occurrence. In maplet mode
+// delete removes every value of the key, and insert is EINVAL (use
+// qf_insert_value).
 int  qf_insert(quotient_filter_t *qf, uint64_t key);   
 int  qf_query (const quotient_filter_t *qf, uint64_t key); 
 int  qf_delete(quotient_filter_t *qf, uint64_t key);   
 
+// Occurrences of key in counting mode, its number of values in maplet
+// mode, 0 or 1 in set mode. A false positive shows as the count of the
+// keys sharing its fingerprint.
+uint64_t qf_count(const quotient_filter_t *qf, uint64_t key);
+
+// Counting mode (EINVAL otherwise). insert adds count occurrences, 1 if
+// there is no room or the count would overflow. delete removes up to
+// count of them (the key goes at 0), 1 if the key is absent.
+int  qf_insert_count(quotient_filter_t *qf, uint64_t key, uint64_t count);
+int  qf_delete_count(quotient_filter_t *qf, uint64_t key, uint64_t count);
+
+// Maplet mode (EINVAL otherwise, or if value does not fit in vbits).
+// insert adds the pair (a no-op if present), 1 if there is no room; delete
+// removes it, 1 if absent. query_value writes up to max of the key's
+// values to values in ascending order and returns how many there are.
+int    qf_insert_value(quotient_filter_t *qf, uint64_t key, uint64_t value);
+int    qf_delete_value(quotient_filter_t *qf, uint64_t key, uint64_t value);
+size_t qf_query_value(const quotient_filter_t *qf, uint64_t key, uint64_t *values, size_t max);
+
+// Batched lookup: bit i of out_bitmap (ceil(n/64) words) is set iff keys[i]
+// may be present. Home slots are prefetched `dist` keys ahead (0 = no
+// prefetch, max 64). Returns the number of hits.
+#define QF_PREFETCH_DIST 16
+size_t qf_query_batch(const quotient_filter_t *qf, const uint64_t *keys, size_t n, uint64_t *out_bitmap);
+size_t qf_query_batch_dist(const quotient_filter_t *qf, const uint64_t *keys, size_t n,
+                           uint64_t *out_bitmap, size_t dist);
+
+// Thread-safe mode. The slot array is split into fixed regions of
+// region_slots (power of two, 0 = 4096, at least one 64-slot block) with
+// one lightweight lock each.
+// Writers lock their home region plus the following region(s) only when
+// their cluster spills over; lookups are lock-free and retry when a region
+// they read changed underneath them. Writes are set mode only (EINVAL).
+int  qf_enable_concurrent(quotient_filter_t *qf, size_t region_slots);
+int  qf_insert_mt(quotient_filter_t *qf, uint64_t key);
+int  qf_query_mt (const quotient_filter_t *qf, uint64_t key);
+int  qf_delete_mt(quotient_filter_t *qf, uint64_t key);
+
+// Doubles the home slots by moving the lowest remainder bit into the
+// quotient (qbits + 1, rbits - 1), so the fingerprint and its false
+// positive rate stay the same. The new table is written by two sequential
+// passes over the old one, one per half; backing and concurrent mode
+// carry over (no writers may run meanwhile). EINVAL at rbits 4 or on a
+// mapped filter, ENOMEM.
+int  qf_expand(quotient_filter_t *qf);
+
+// Initializes out with the union of a and b, which must have the same
+// qbits, rbits, mode and value bits (EINVAL otherwise), in one streaming
+// pass over both. Counts add up; a key in both keeps one copy (one per
+// value in maplet mode). ENOSPC if the union does not fit, EOVERFLOW if a
+// count would; out is left empty on error.
+int  qf_merge(quotient_filter_t *out, const quotient_filter_t *a, const quotient_filter_t *b);
+
 double qf_load_factor(const quotient_filter_t *qf);
 size_t qf_bytes(const quotient_filter_t *qf);
+
+// Bytes qf_init_mode would allocate for 2^qbits slots of sbits (rbits plus
+// the mode's bits), without allocating; 0 on a bad qbits.
+size_t qf_bytes_for(size_t qbits, size_t sbits);
+
+// Moves the blocks into memory of the given backing (filter_mem.h),
+// prefaulted if asked; qf->backing records what was obtained. EINVAL on a
+// mapped filter, ENOMEM if no memory at all.
+int  qf_set_backing(quotient_filter_t *qf, fmem_backing_t backing, int prefault);
+
+// Writes the filter in the shared on-disk format (filter_io.h).
+int  qf_save(const quotient_filter_t *qf, const char *path);
+
+// Opens a saved filter in place from a read-only mapping: lookups only
+// (qf_query*, and qf_query_mt after qf_enable_concurrent); inserts and
+// deletes return EINVAL. qf_free unmaps it. EINVAL on a bad file.
+int  qf_open_mmap(quotient_filter_t *qf, const char *path);
@@ -0,0 +1,311 @@
+#define _DEFAULT_SOURCE
+#include "ribbon.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define RIBBON_BATCH_RING 64
+#define RIBBON_ATTEMPTS 50
+
+typedef unsigned __int128 u128;
+
+static inline uint64_t splitmix64(uint64_t *x) {
+    uint64_t z = (*x += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+static inline uint64_t hash64(uint64_t k, uint64_t seed) {
+    uint64_t x = k ^ seed;
+    return splitmix64(&x);
+}
+
+static inline uint64_t seed_mix(uint32_t seed) {
+    return ((uint64_t)seed << 32) ^ 0xD6E8FEB86659FD93ULL;
+}
+
+static inline uint64_t mulhi64(uint64_t a, uint64_t b) {
+    return (uint64_t)(((u128)a * b) >> 64);
+}
+
+// The band start comes from the high bits of h (so sorting hashes sorts
+// starts), the fingerprint from its low bits, and the coefficients from
+// further mixes of h.
+static inline uint32_t band_start(uint64_t h, uint32_t nstarts) {
+    return (uint32_t)mulhi64(h, nstarts);
+}
+
+static inline uint32_t fingerprint(uint64_t h, uint32_t fp_bits) {
+    return (uint32_t)(h & ((1ULL << fp_bits) - 1));
+}
+
+static inline void coeffs(uint64_t h, uint32_t w, uint64_t *lo, uint64_t *hi) {
+    uint64_t x = h;
+    uint64_t a = splitmix64(&x);
+    *hi = (w == 128) ? splitmix64(&x) : 0;
+    *lo = ((w == 32) ? (a & 0xffffffffULL) : a) | 1;
+}
+
+static inline double eps_for(uint32_t w) {
+    switch (w) {
+    case 32:  return RIBBON_EPS_32;
+    case 64:  return RIBBON_EPS_64;
+    default:  return RIBBON_EPS_128;
+    }
+}
+
+static inline size_t sol_words(uint32_t m, uint32_t fp_bits) {
+    return ((size_t)m / 64 + 2) * fp_bits;
+}
+
+// Counting sort of the key hashes by 64-row block of their band start,
+// which is all the locality the elimination needs.
+static int sort_by_block(uint64_t *h, uint32_t n, uint32_t nstarts, uint32_t nblocks) {
+    uint32_t *cnt = (uint32_t*)calloc((size_t)nblocks + 1, sizeof(uint32_t));
+    uint64_t *out = (uint64_t*)malloc(sizeof(uint64_t) * n);
+    if (!cnt || !out) {
+        free(cnt); free(out);
+        return 1;
+    }
+    for (uint32_t i = 0; i < n; i++) cnt[band_start(h[i], nstarts) / 64 + 1]++;
+    for (uint32_t b = 0; b < nblocks; b++) cnt[b + 1] += cnt[b];
+    for (uint32_t i = 0; i < n; i++) out[cnt[band_start(h[i], nstarts) / 64]++] = h[i];
+    memcpy(h, out, sizeof(uint64_t) * n);
+    free(cnt); free(out);
+    return 0;
+}
+
+// Rows for nkeys keys at overhead eps, a multiple of 64; 0 if too many.
+static uint32_t ribbon_rows(uint32_t nkeys, uint32_t w, double eps) {
+    uint64_t rows = (uint64_t)ceil((double)nkeys * (1.0 + eps)) + w;
+    rows = (rows + 63) & ~63ULL;
+    return (rows > UINT32_MAX - 128) ? 0 : (uint32_t)rows;
+}
+
+static int ribbon_try_build(ribbon_filter_t *rf, const uint64_t *keys, uint32_t nkeys, uint32_t fp_bits,
+                            uint32_t w, uint32_t seed, double eps) {
+    uint32_t m = ribbon_rows(nkeys, w, eps);
+    if (m == 0) return 1;
+    uint32_t nstarts = m - w + 1;
+
+    uint64_t *hh = (uint64_t*)malloc(sizeof(uint64_t) * nkeys);
+    u128 *coeff = (u128*)calloc(m, sizeof(u128));
+    uint32_t *result = (uint32_t*)calloc(m, sizeof(uint32_t));
+    if (!hh || !coeff || !result) {
+        free(hh); free(coeff); free(result);
+        return 1;
+    }
+
+    for (uint32_t i = 0; i < nkeys; i++) hh[i] = hash64(keys[i], seed_mix(seed));
+    if (sort_by_block(hh, nkeys, nstarts, m / 64) != 0) {
+        free(hh); free(coeff); free(result);
+        return 1;
+    }
+
+    // on-the-fly elimination: row i keeps a coefficient whose lowest bit
+    // is i's own, so each key XORs its way down the band until it finds an
+    // empty row; running out of bits means a dependent row
+    for (uint32_t k = 0; k < nkeys; k++) {
+        uint64_t h = hh[k];
+        uint64_t lo, hi;
+        coeffs(h, w, &lo, &hi);
+        u128 c = ((u128)hi << 64) | lo;
+        uint32_t r = fingerprint(h, fp_bits);
+        uint32_t i = band_start(h, nstarts);
+        for (;;) {
+            if (coeff[i] == 0) {
+                coeff[i] = c;
+                result[i] = r;
+                break;
+            }
+            c ^= coeff[i];
+            r ^= result[i];
+            if (c == 0) {
+                if (r == 0) break;   // the same key twice
+                free(hh); free(coeff); free(result);
+                return 1;
+            }
+            uint64_t clo = (uint64_t)c;
+            unsigned tz = clo ? (unsigned)__builtin_ctzll(clo) : 64u + (unsigned)__builtin_ctzll((uint64_t)(c >> 64));
+            c >>= tz;
+            i += tz;
+        }
+    }
+    free(hh);
+
+    uint64_t *sol = (uint64_t*)calloc(sol_words(m, fp_bits), sizeof(uint64_t));
+    if (!sol) {
+        free(coeff); free(result);
+        return 1;
+    }
+
+    // back-substitution, last row first: state[j] holds bit j of the rows
+    // below i (bit 0 = row i + 1); rows no key claimed are set to 0
+    u128 state[32];
+    memset(state, 0, sizeof(state));
+    for (uint32_t i = m; i-- > 0;) {
+        u128 c = coeff[i] >> 1;
+        uint32_t r = result[i];
+        uint64_t *blk = sol + (size_t)(i / 64) * fp_bits;
+        for (uint32_t j = 0; j < fp_bits; j++) {
+            u128 x = c & state[j];
+            uint64_t z = ((r >> j) & 1) ^ (uint64_t)__builtin_parityll((uint64_t)x ^ (uint64_t)(x >> 64));
+            state[j] = (state[j] << 1) | z;
+            blk[j] |= z << (i % 64);
+        }
+    }
+    free(coeff); free(result);
+
+    rf->n = nkeys;
+    rf->m = m;
+    rf->nstarts = nstarts;
+    rf->w = w;
+    rf->fp_bits = fp_bits;
+    rf->seed = seed;
+    rf->sol = sol;
+    rf->backing = FMEM_DEFAULT;
+    return 0;
+}
+
+int ribbon_build(ribbon_filter_t *rf, const uint64_t *keys, uint32_t nkeys, uint32_t fp_bits,
+                 uint32_t w, uint32_t seed) {
+    if (!rf || !keys || nkeys == 0) return 1;
+    if (!(w == 32 || w == 64 || w == 128) || fp_bits == 0 || fp_bits > 32) return 1;
+
+    memset(rf, 0, sizeof(*rf));
+
+    for (uint32_t t = 0; t < RIBBON_ATTEMPTS; t++) {
+        uint32_t s = seed + 0x9e3779b9u * t;
+        double eps = eps_for(w) + 0.01 * (t / 8);
+        if (ribbon_try_build(rf, keys, nkeys, fp_bits, w, s, eps) == 0) return 0;
+    }
+    return 1;
+}
+
+typedef struct {
+    const uint64_t *blk;   // first of the blocks the band touches
+    uint64_t m0, m1, m2;   // the coefficients shifted to the band start
+    uint32_t fp;
+} ribbon_probe_t;
+
+static inline void ribbon_locate(const ribbon_filter_t *rf, uint64_t key, ribbon_probe_t *p) {
+    uint64_t h = hash64(key, seed_mix(rf->seed));
+    uint32_t s = band_start(h, rf->nstarts);
+    uint64_t lo, hi;
+    coeffs(h, rf->w, &lo, &hi);
+    unsigned o = s % 64;
+    p->blk = rf->sol + (size_t)(s / 64) * rf->fp_bits;
+    p->m0 = lo << o;
+    p->m1 = o ? (lo >> (64 - o)) | (hi << o) : hi;
+    p->m2 = o ? hi >> (64 - o) : 0;
+    p->fp = fingerprint(h, rf->fp_bits);
+}
+
+// Columns are checked a byte at a time so that most absent keys stop after
+// the first 8 parities.
+static inline int ribbon_match(const ribbon_filter_t *rf, const ribbon_probe_t *p) {
+    const uint32_t r = rf->fp_bits;
+    const uint64_t *b0 = p->blk, *b1 = p->blk + r, *b2 = p->blk + 2 * r;
+    for (uint32_t j0 = 0; j0 < r; j0 += 8) {
+        uint32_t end = (j0 + 8 < r) ? j0 + 8 : r;
+        uint32_t got = 0;
+        if (rf->w == 128) {
+            for (uint32_t j = j0; j < end; j++) {
+                uint64_t x = (b0[j] & p->m0) ^ (b1[j] & p->m1) ^ (b2[j] & p->m2);
+                got |= (uint32_t)__builtin_parityll(x) << (j - j0);
+            }
+        } else {
+            for (uint32_t j = j0; j < end; j++) {
+                uint64_t x = (b0[j] & p->m0) ^ (b1[j] & p->m1);
+                got |= (uint32_t)__builtin_parityll(x) << (j - j0);
+            }
+        }
+        if (got != ((p->fp >> j0) & 0xffu)) return 0;
+    }
+    return 1;
+}
+
+int ribbon_query(const ribbon_filter_t *rf, uint64_t key) {
+    if (!rf || !rf->sol) return 0;
+    ribbon_probe_t p;
+    ribbon_locate(rf, key, &p);
+    return ribbon_match(rf, &p);
+}
+
+static inline void ribbon_prefetch(const ribbon_filter_t *rf, const ribbon_probe_t *p) {
+    __builtin_prefetch(p->blk, 0, 3);
+    __builtin_prefetch(p->blk + rf->fp_bits, 0, 3);
+    if (rf->w == 128) __builtin_prefetch(p->blk + 2 * rf->fp_bits, 0, 3);
+}
+
+size_t ribbon_query_batch_dist(const ribbon_filter_t *rf, const uint64_t *keys, size_t n,
+                               uint64_t *out_bitmap, size_t dist) {
+    if (!rf || !rf->sol || !keys || !out_bitmap) return 0;
+    if (dist > RIBBON_BATCH_RING) dist = RIBBON_BATCH_RING;
+
+    memset(out_bitmap, 0, ((n + 63) / 64) * sizeof(uint64_t));
+
+    ribbon_probe_t ring[RIBBON_BATCH_RING];
+    size_t hits = 0;
+
+    size_t head = (dist < n) ? dist : n;
+    for (size_t i = 0; i < head; i++) {
+        ribbon_probe_t *p = &ring[i & (RIBBON_BATCH_RING - 1)];
+        ribbon_locate(rf, keys[i], p);
+        ribbon_prefetch(rf, p);
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        ribbon_probe_t cur;
+        if (dist == 0) ribbon_locate(rf, keys[i], &cur);
+        else cur = ring[i & (RIBBON_BATCH_RING - 1)];
+
+        size_t ahead = i + dist;
+        if (dist && ahead < n) {
+            ribbon_probe_t *p = &ring[ahead & (RIBBON_BATCH_RING - 1)];
+            ribbon_locate(rf, keys[ahead], p);
+            ribbon_prefetch(rf, p);
+        }
+
+        if (ribbon_match(rf, &cur)) {
+            out_bitmap[i >> 6] |= 1ULL << (i & 63);
+            hits++;
+        }
+    }
+    return hits;
+}
+
+size_t ribbon_query_batch(const ribbon_filter_t *rf, const uint64_t *keys, size_t n, uint64_t *out_bitmap) {
+    return ribbon_query_batch_dist(rf, keys, n, out_bitmap, RIBBON_PREFETCH_DIST);
+}
+
+void ribbon_free(ribbon_filter_t *rf) {
+    if (!rf) return;
+    fmem_free(rf->sol, sol_words(rf->m, rf->fp_bits) * sizeof(uint64_t), rf->backing);
+    memset(rf, 0, sizeof(*rf));
+}
+
+size_t ribbon_bytes(const ribbon_filter_t *rf) {
+    if (!rf || !rf->sol) return 0;
+    return sol_words(rf->m, rf->fp_bits) * sizeof(uint64_t);
+}
+
+size_t ribbon_bytes_for(uint32_t nkeys, uint32_t fp_bits, uint32_t w) {
+    if (nkeys == 0 || !(w == 32 || w == 64 || w == 128) || fp_bits == 0 || fp_bits > 32) return 0;
+    uint32_t m = ribbon_rows(nkeys, w, eps_for(w));
+    return m ? sol_words(m, fp_bits) * sizeof(uint64_t) : 0;
+}
+
+int ribbon_set_backing(ribbon_filter_t *rf, fmem_backing_t backing, int prefault) {
+    if (!rf || !rf->sol) return 1;
+
+    size_t bytes = ribbon_bytes(rf);
+    fmem_backing_t got;
+    void *mem = fmem_alloc(bytes, backing, prefault, &got);
+    if (!mem) return 1;
+    memcpy(mem, rf->sol, bytes);
+    fmem_free(rf->sol, bytes, rf->backing);
+    rf->sol = (uint64_t*)mem;
+    rf->backing = got;
+    return 0;
+}
@@ -0,0 +1,60 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+#include "filter_mem.h"
+
+// Standard Ribbon filter (Dillinger & Walzer): each key gets a band start
+// s, a w-bit coefficient row c (lowest bit set) and a fingerprint, and the
+// build solves the banded linear system "XOR of solution rows s + j over
+// the set bits j of c == fingerprint" over GF(2): rows are eliminated on
+// the fly as keys arrive sorted by s, then back-substituted. Space is
+// about (1 + eps) * fp_bits bits per key, eps shrinking with w.
+//
+// The solution is stored interleaved column-major: per block of 64 rows,
+// fp_bits words, word k holding bit k of each row. A lookup ANDs c,
+// shifted to s, with the words of two adjacent blocks (three for w = 128)
+// and takes one parity per fingerprint bit.
+typedef struct {
+    uint32_t n;        // keys built from
+    uint32_t m;        // solution rows, a multiple of 64
+    uint32_t nstarts;  // m - w + 1 band starts
+    uint32_t w;        // band width: 32, 64 or 128
+    uint32_t fp_bits;  // 1..32
+    uint32_t seed;
+    uint64_t *sol;     // m / 64 + 2 blocks of fp_bits words
+    fmem_backing_t backing;   // of sol (filter_mem.h)
+} ribbon_filter_t;
+
+// Rows per key beyond one: RIBBON_EPS_<w>. Builds that fail retry with a
+// new seed, and with 1% more rows every 8 attempts.
+#define RIBBON_EPS_32  0.30
+#define RIBBON_EPS_64  0.11
+#define RIBBON_EPS_128 0.045
+
+// 1 on a bad width or fp_bits, or if no attempt succeeds.
+int  ribbon_build(ribbon_filter_t *rf, const uint64_t *keys, uint32_t nkeys, uint32_t fp_bits,
+                  uint32_t w, uint32_t seed);
+
+int  ribbon_query(const ribbon_filter_t *rf, uint64_t key);
+
+// Batched lookup: bit i of out_bitmap (ceil(n/64) words) is set iff keys[i]
+// may be present. Both solution blocks are prefetched `dist` keys ahead
+// (0 = no prefetch, max 64). Returns the number of hits.
+#define RIBBON_PREFETCH_DIST 16
+size_t ribbon_query_batch(const ribbon_filter_t *rf, const uint64_t *keys, size_t n, uint64_t *out_bitmap);
+size_t ribbon_query_batch_dist(const ribbon_filter_t *rf, const uint64_t *keys, size_t n,
+                               uint64_t *out_bitmap, size_t dist);
+
+void ribbon_free(ribbon_filter_t *rf);
+
+size_t ribbon_bytes(const ribbon_filter_t *rf);
+
+// Bytes ribbon_build takes for nkeys keys when its first attempt succeeds
+// (retries may add 1-2%), without building; 0 on bad arguments.
+size_t ribbon_bytes_for(uint32_t nkeys, uint32_t fp_bits, uint32_t w);
+
+// Moves the solution of a built filter into memory of the given backing
+// (filter_mem.h), prefaulted if asked; rf->backing records what was
+// obtained. 1 on an empty filter or if allocation fails.
+int  ribbon_set_backing(ribbon_filter_t *rf, fmem_backing_t backing, int prefault);
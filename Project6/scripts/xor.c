@@ -1,6 +1,20 @@
+#define _DEFAULT_SOURCE
 #include "xor.h"
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "filter_io.h"
+
+#define XOR_BATCH_RING 64
+#define FUSE_MAX_SEGMENT_LENGTH 262144
+#define XOR_PART_KEYS (1u << 20)
+#define XOR_SCAN_CHUNK ((size_t)1 << 20)
 
 static inline uint64_t splitmix64(uint64_t *x) {
     uint64_t z = (*x += 0x9e3779b97f4a7c15ULL);
@@ -13,23 +27,35 @@ static inline uint64_t hash64(uint64_t k, uint64_t seed) {
     return splitmix64(&x);
 }
 
-static inline uint32_t rotl32(uint32_t x, int r) {
-    return (x << r) | (x >> (32 - r));
+static inline uint64_t seed_mix(uint32_t seed) {
+    return ((uint64_t)seed << 32) ^ 0xD6E8FEB86659FD93ULL;
+}
+
+// x * m / 2^32: maps x onto [0, m) with a multiply instead of a division.
+static inline uint32_t reduce32(uint32_t x, uint32_t m) {
+    return (uint32_t)(((uint64_t)x * m) >> 32);
+}
+
+static inline uint32_t add_mod(uint32_t x, uint32_t d, uint32_t m) {
+    x += d;
+    return x >= m ? x - m : x;
 }
 
 static inline void get3(uint64_t h, uint32_t m, uint32_t *h0, uint32_t *h1, uint32_t *h2) {
 
     uint32_t a = (uint32_t)(h);
     uint32_t b = (uint32_t)(h >> 32);
-    uint32_t c = rotl32(a ^ b, 11) + 0x9e3779b9u;
+    // reduce32 keeps the high bits, so c must not come from the low bits
+    // of a ^ b that also make the fingerprint
+    uint32_t c = (uint32_t)((h * 0x9e3779b97f4a7c15ULL) >> 32);
 
-    *h0 = (a) % m;
-    *h1 = (b) % m;
-    *h2 = (c) % m;
+    *h0 = reduce32(a, m);
+    *h1 = reduce32(b, m);
+    *h2 = reduce32(c, m);
 
-    if (*h1 == *h0) *h1 = (*h1 + 1) % m;
-    if (*h2 == *h0) *h2 = (*h2 + 2) % m;
-    if (*h2 == *h1) *h2 = (*h2 + 3) % m;
+    if (*h1 == *h0) *h1 = add_mod(*h1, 1, m);
+    if (*h2 == *h0) *h2 = add_mod(*h2, 2, m);
+    if (*h2 == *h1) *h2 = add_mod(*h2, 3, m);
 }
 
 static inline uint16_t fingerprint(uint64_t h, uint32_t fp_bits) {
@@ -39,6 +65,93 @@ static inline uint16_t fingerprint(uint64_t h, uint32_t fp_bits) {
     return fp;
 }
 
+// Cells are fp_bits wide: bytes for 8, 16-bit words for 16, and for 12 two
+// cells share three bytes (cell i is the 12 bits at byte 3i/2, shifted up a
+// nibble when i is odd). One spare byte keeps the last 16-bit load inside.
+static inline size_t fps_bytes(uint32_t fp_bits, size_t ncells) {
+    switch (fp_bits) {
+    case 8:  return ncells;
+    case 12: return ncells * 3 / 2 + 2;
+    default: return ncells * sizeof(uint16_t);
+    }
+}
+
+static inline const uint8_t *cell_addr(const void *fps, uint32_t i, uint32_t fp_bits) {
+    switch (fp_bits) {
+    case 8:  return (const uint8_t*)fps + i;
+    case 12: return (const uint8_t*)fps + (size_t)i * 3 / 2;
+    default: return (const uint8_t*)fps + (size_t)i * 2;
+    }
+}
+
+static inline uint16_t cell_get(const void *fps, uint32_t i, uint32_t fp_bits) {
+    const uint8_t *p = cell_addr(fps, i, fp_bits);
+    uint16_t w;
+    switch (fp_bits) {
+    case 8:
+        return *p;
+    case 12:
+        memcpy(&w, p, sizeof(w));
+        return (uint16_t)((w >> ((i & 1) * 4)) & 0xFFF);
+    default:
+        memcpy(&w, p, sizeof(w));
+        return w;
+    }
+}
+
+static inline void cell_set(void *fps, uint32_t i, uint32_t fp_bits, uint16_t v) {
+    uint8_t *p = (uint8_t*)cell_addr(fps, i, fp_bits);
+    uint16_t w;
+    switch (fp_bits) {
+    case 8:
+        *p = (uint8_t)v;
+        break;
+    case 12:
+        memcpy(&w, p, sizeof(w));
+        w = (i & 1) ? (uint16_t)((w & 0x000F) | (v << 4)) : (uint16_t)((w & 0xF000) | v);
+        memcpy(p, &w, sizeof(w));
+        break;
+    default:
+        memcpy(p, &v, sizeof(v));
+        break;
+    }
+}
+
+// Builds assign into 16-bit scratch cells and pack them here. base must be
+// even so that 12-bit cells of different calls never share a byte.
+static void fps_pack(void *fps, uint32_t fp_bits, uint32_t base, const uint16_t *cells, uint32_t m) {
+    if (fp_bits == 16) {
+        memcpy((uint16_t*)fps + base, cells, sizeof(uint16_t) * m);
+        return;
+    }
+    for (uint32_t i = 0; i < m; i++) cell_set(fps, base + i, fp_bits, cells[i]);
+}
+
+static inline uint64_t mulhi64(uint64_t a, uint64_t b) {
+    return (uint64_t)(((__uint128_t)a * b) >> 64);
+}
+
+// Cell layout of one fuse array: the whole filter, or one partition.
+typedef struct {
+    uint32_t arity;
+    uint32_t segment_length;
+    uint32_t segment_count_length;
+    uint32_t ncells;
+} fuse_layout_t;
+
+// Fuse filter cells: one per segment in `arity` consecutive segments, the
+// first segment picked by the high bits of h, the offsets by other bits.
+static inline void fuse_cells(const fuse_layout_t *lay, uint64_t h, uint32_t *c) {
+    uint32_t h0 = (uint32_t)mulhi64(h, lay->segment_count_length);
+    uint32_t len = lay->segment_length, mask = len - 1;
+    c[0] = h0;
+    c[1] = (h0 + len) ^ ((uint32_t)(h >> 18) & mask);
+    c[2] = (h0 + 2 * len) ^ ((uint32_t)h & mask);
+    if (lay->arity == 4) {
+        c[3] = (h0 + 3 * len) ^ ((uint32_t)((h * 0x9e3779b97f4a7c15ULL) >> 40) & mask);
+    }
+}
+
 typedef struct {
     uint32_t xormask;  
     uint8_t  degree;   
@@ -49,10 +162,14 @@ typedef struct {
     uint64_t h;
 } stack_item_t;
 
+static uint32_t classic_cells(uint32_t nkeys) {
+    uint32_t m = (uint32_t)( (double)nkeys * 1.30 ) + 32;
+    return m < 64 ? 64 : m;
+}
+
 static int xor_try_build(xor_filter_t *xf, const uint64_t *keys, uint32_t nkeys, uint32_t fp_bits, uint32_t seed) {
   
-    uint32_t m = (uint32_t)( (double)nkeys * 1.30 ) + 32;
-    if (m < 64) m = 64;
+    uint32_t m = classic_cells(nkeys);
 
     node_t *g = (node_t*)calloc(m, sizeof(node_t));
     if (!g) return 1;
@@ -120,9 +237,10 @@ static int xor_try_build(xor_filter_t *xf, const uint64_t *keys, uint32_t nkeys,
     xf->n = m;
     xf->fp_bits = fp_bits;
     xf->seed = seed;
-    xf->fps = (uint16_t*)calloc(m, sizeof(uint16_t));
-    if (!xf->fps) {
-        free(g); free(e0); free(e1); free(e2); free(hh); free(queue); free(stack);
+    uint16_t *cells = (uint16_t*)calloc(m, sizeof(uint16_t));
+    xf->fps = calloc(fps_bytes(fp_bits, m), 1);
+    if (!cells || !xf->fps) {
+        free(g); free(e0); free(e1); free(e2); free(hh); free(queue); free(stack); free(cells);
         return 1;
     }
 
@@ -136,11 +254,12 @@ static int xor_try_build(xor_filter_t *xf, const uint64_t *keys, uint32_t nkeys,
         get3(h, m, &a, &b, &c);
         uint16_t fp = fingerprint(h, fp_bits);
 
-        uint16_t val = fp ^ xf->fps[a] ^ xf->fps[b] ^ xf->fps[c];
-        xf->fps[v] = val;
+        uint16_t val = fp ^ cells[a] ^ cells[b] ^ cells[c];
+        cells[v] = val;
     }
+    fps_pack(xf->fps, fp_bits, 0, cells, m);
 
-    free(g); free(e0); free(e1); free(e2); free(hh); free(queue); free(stack);
+    free(g); free(e0); free(e1); free(e2); free(hh); free(queue); free(stack); free(cells);
     return 0;
 }
 
@@ -163,23 +282,658 @@ int xor_build(xor_filter_t *xf, const uint64_t *keys, uint32_t nkeys, uint32_t f
     return 1;
 }
 
+// Segment length and cells-per-key factor from the binary fuse paper's
+// fits; smaller key sets need relatively more room to peel.
+static uint32_t fuse_segment_length(uint32_t arity, uint32_t n) {
+    double l = (arity == 3) ? floor(log((double)n) / log(3.33) + 2.25)
+                            : floor(log((double)n) / log(2.91) - 0.5);
+    if (l < 2) l = 2;
+    if (l > 18) l = 18;
+    uint32_t len = 1u << (int)l;
+    return len > FUSE_MAX_SEGMENT_LENGTH ? FUSE_MAX_SEGMENT_LENGTH : len;
+}
+
+static double fuse_size_factor(uint32_t arity, uint32_t n) {
+    double ln = log((double)n);
+    if (arity == 3) return fmax(1.125, 0.875 + 0.25 * log(1000000.0) / ln);
+    return fmax(1.075, 0.77 + 0.305 * log(600000.0) / ln);
+}
+
+static void fuse_layout_init(fuse_layout_t *lay, uint32_t arity, uint32_t len, double factor, size_t nkeys) {
+    size_t capacity = (size_t)round((double)nkeys * factor);
+    size_t total = (capacity + len - 1) / len;
+    size_t nseg = (total <= arity - 1) ? 1 : total - (arity - 1);
+
+    lay->arity = arity;
+    lay->segment_length = len;
+    lay->segment_count_length = (uint32_t)(nseg * len);
+    lay->ncells = (uint32_t)((nseg + arity - 1) * len);
+}
+
+// One peeling attempt. Hashes are bucketed by first segment before the
+// cell counts are built, and degree-1 cells are peeled from a stack, so
+// both passes stay within a few neighbouring segments at a time. Each cell
+// keeps the XOR of its keys' hashes and, in the low two bits of the count,
+// the XOR of the positions it holds in those keys' cell lists.
+// keys may also be hashes (partitioned build); either way they are hashed
+// again with seed64. The cells are packed into fps from cell `base` on.
+static int fuse_try_build(const fuse_layout_t *lay, const uint64_t *keys, uint32_t nkeys,
+                          uint64_t seed64, uint32_t fp_bits, void *fps, uint32_t base) {
+    uint32_t m = lay->ncells;
+    uint32_t arity = lay->arity;
+    uint32_t nseg = lay->segment_count_length / lay->segment_length;
+
+    uint64_t *hs = (uint64_t*)malloc(sizeof(uint64_t) * nkeys);
+    uint64_t *sorted = (uint64_t*)malloc(sizeof(uint64_t) * nkeys);
+    uint32_t *seg_start = (uint32_t*)calloc((size_t)nseg + 1, sizeof(uint32_t));
+    uint8_t  *t2count = (uint8_t*)calloc(m, sizeof(uint8_t));
+    uint64_t *t2hash = (uint64_t*)calloc(m, sizeof(uint64_t));
+    uint32_t *alone = (uint32_t*)malloc(sizeof(uint32_t) * m);
+    uint8_t  *rev_k = (uint8_t*)malloc(sizeof(uint8_t) * nkeys);
+    uint16_t *cells = (uint16_t*)calloc(m, sizeof(uint16_t));
+    int rc = 1;
+    if (!hs || !sorted || !seg_start || !t2count || !t2hash || !alone || !rev_k || !cells) goto out;
+
+    for (uint32_t i = 0; i < nkeys; i++) {
+        uint64_t h = hash64(keys[i], seed64);
+        hs[i] = h;
+        seg_start[mulhi64(h, lay->segment_count_length) / lay->segment_length + 1]++;
+    }
+    for (uint32_t s = 0; s < nseg; s++) seg_start[s + 1] += seg_start[s];
+    for (uint32_t i = 0; i < nkeys; i++) {
+        uint64_t h = hs[i];
+        sorted[seg_start[mulhi64(h, lay->segment_count_length) / lay->segment_length]++] = h;
+    }
+
+    for (uint32_t i = 0; i < nkeys; i++) {
+        uint64_t h = sorted[i];
+        uint32_t c[4];
+        fuse_cells(lay, h, c);
+        for (uint32_t k = 0; k < arity; k++) {
+            if (t2count[c[k]] >= 0xFC) goto out;   // count would overflow 6 bits
+            t2count[c[k]] += 4;
+            t2count[c[k]] ^= (uint8_t)k;
+            t2hash[c[k]] ^= h;
+        }
+    }
+
+    uint32_t qsize = 0;
+    for (uint32_t v = 0; v < m; v++) if ((t2count[v] >> 2) == 1) alone[qsize++] = v;
+
+    // peeled hashes reuse `hs`, in peel order
+    uint32_t sp = 0;
+    while (qsize > 0) {
+        uint32_t v = alone[--qsize];
+        if ((t2count[v] >> 2) != 1) continue;
+
+        uint64_t h = t2hash[v];
+        uint8_t found = t2count[v] & 3;
+        hs[sp] = h;
+        rev_k[sp] = found;
+        sp++;
+
+        uint32_t c[4];
+        fuse_cells(lay, h, c);
+        for (uint32_t k = 0; k < arity; k++) {
+            uint32_t u = c[k];
+            t2count[u] -= 4;
+            t2count[u] ^= (uint8_t)k;
+            t2hash[u] ^= h;
+            if (k != found && (t2count[u] >> 2) == 1) alone[qsize++] = u;
+        }
+    }
+    if (sp != nkeys) goto out;
+
+    while (sp > 0) {
+        sp--;
+        uint64_t h = hs[sp];
+        uint32_t c[4];
+        fuse_cells(lay, h, c);
+        uint16_t val = fingerprint(h, fp_bits);
+        for (uint32_t k = 0; k < arity; k++) {
+            if (k != rev_k[sp]) val ^= cells[c[k]];
+        }
+        cells[c[rev_k[sp]]] = val;
+    }
+    fps_pack(fps, fp_bits, base, cells, m);
+    rc = 0;
+
+out:
+    free(hs); free(sorted); free(seg_start); free(t2count); free(t2hash); free(alone); free(rev_k);
+    free(cells);
+    return rc;
+}
+
+int xor_build_fuse(xor_filter_t *xf, const uint64_t *keys, uint32_t nkeys, uint32_t fp_bits,
+                   uint32_t seed, uint32_t arity) {
+    if (!xf || !keys || nkeys == 0) return 1;
+    if (!(fp_bits == 8 || fp_bits == 12 || fp_bits == 16)) return 1;
+    if (arity != 3 && arity != 4) return 1;
+
+    memset(xf, 0, sizeof(*xf));
+
+    uint32_t n = nkeys < 2 ? 2 : nkeys;
+    fuse_layout_t lay;
+    fuse_layout_init(&lay, arity, fuse_segment_length(arity, n), fuse_size_factor(arity, n), n);
+
+    xf->arity = arity;
+    xf->fp_bits = fp_bits;
+    xf->segment_length = lay.segment_length;
+    xf->segment_count_length = lay.segment_count_length;
+    xf->n = lay.ncells;
+    xf->fps = calloc(fps_bytes(fp_bits, xf->n), 1);
+    if (!xf->fps) return 1;
+
+    for (uint32_t t = 0; t < 50; t++) {
+        xf->seed = seed + 0x9e3779b9u * t;
+        if (fuse_try_build(&lay, keys, nkeys, seed_mix(xf->seed), fp_bits, xf->fps, 0) == 0) return 0;
+    }
+    xor_free(xf);
+    return 1;
+}
+
+// ---- partitioned parallel / out-of-core build ----
+
+typedef struct {
+    const uint64_t *keys;
+    size_t nkeys;
+    uint32_t fp_bits;
+    uint32_t seed;
+    uint32_t nparts;
+    int nthreads;
+    int drop_pages;     // keys are a file mapping: release pages once scanned
+
+    size_t *cnt;        // nthreads x nparts key counts
+    size_t *pstart;     // nparts + 1 prefix sums of the counts
+
+    // current round: partitions [p0, p1), their hashes grouped in buf
+    uint32_t p0, p1;
+    uint64_t *buf;
+    size_t *cursor;     // nthreads x nparts write positions in buf
+    uint32_t next_part;
+    int failed;
+
+    xor_filter_t *xf;
+} xor_par_t;
+
+typedef struct {
+    xor_par_t *par;
+    int tid;
+} xor_par_arg_t;
+
+// Drop the whole pages of [lo, hi) from a read-only file mapping; they
+// stay in the page cache but no longer count against RSS.
+static void drop_range(const void *lo, const void *hi) {
+    uintptr_t pg = (uintptr_t)sysconf(_SC_PAGESIZE);
+    uintptr_t a = ((uintptr_t)lo + pg - 1) & ~(pg - 1);
+    uintptr_t b = (uintptr_t)hi & ~(pg - 1);
+    if (a < b) madvise((void*)a, b - a, MADV_DONTNEED);
+}
+
+static void par_range(const xor_par_t *par, int tid, size_t *lo, size_t *hi) {
+    *lo = par->nkeys * (size_t)tid / (size_t)par->nthreads;
+    *hi = par->nkeys * (size_t)(tid + 1) / (size_t)par->nthreads;
+}
+
+static void *par_count(void *arg) {
+    xor_par_arg_t *a = (xor_par_arg_t*)arg;
+    xor_par_t *par = a->par;
+    size_t *cnt = par->cnt + (size_t)a->tid * par->nparts;
+    uint64_t seed64 = seed_mix(par->seed);
+
+    size_t lo, hi;
+    par_range(par, a->tid, &lo, &hi);
+    for (size_t i = lo; i < hi; i += XOR_SCAN_CHUNK) {
+        size_t end = (i + XOR_SCAN_CHUNK < hi) ? i + XOR_SCAN_CHUNK : hi;
+        for (size_t j = i; j < end; j++) {
+            cnt[mulhi64(hash64(par->keys[j], seed64), par->nparts)]++;
+        }
+        if (par->drop_pages) drop_range(par->keys + i, par->keys + end);
+    }
+    return NULL;
+}
+
+static void *par_scatter(void *arg) {
+    xor_par_arg_t *a = (xor_par_arg_t*)arg;
+    xor_par_t *par = a->par;
+    size_t *cur = par->cursor + (size_t)a->tid * par->nparts;
+    uint64_t seed64 = seed_mix(par->seed);
+
+    size_t lo, hi;
+    par_range(par, a->tid, &lo, &hi);
+    for (size_t i = lo; i < hi; i += XOR_SCAN_CHUNK) {
+        size_t end = (i + XOR_SCAN_CHUNK < hi) ? i + XOR_SCAN_CHUNK : hi;
+        for (size_t j = i; j < end; j++) {
+            uint64_t h = hash64(par->keys[j], seed64);
+            uint32_t p = (uint32_t)mulhi64(h, par->nparts);
+            if (p >= par->p0 && p < par->p1) par->buf[cur[p]++] = h;
+        }
+        if (par->drop_pages) drop_range(par->keys + i, par->keys + end);
+    }
+    return NULL;
+}
+
+static void *par_peel(void *arg) {
+    xor_par_t *par = ((xor_par_arg_t*)arg)->par;
+    xor_filter_t *xf = par->xf;
+
+    for (;;) {
+        uint32_t p = __atomic_fetch_add(&par->next_part, 1, __ATOMIC_RELAXED);
+        if (p >= par->p1 || __atomic_load_n(&par->failed, __ATOMIC_RELAXED)) break;
+
+        xor_part_t *pt = &xf->parts[p];
+        fuse_layout_t lay = {
+            .arity = 3,
+            .segment_length = xf->segment_length,
+            .segment_count_length = pt->segment_count_length,
+            .ncells = xf->parts[p + 1].base - pt->base,
+        };
+        const uint64_t *src = par->buf + (par->pstart[p] - par->pstart[par->p0]);
+        uint32_t n = (uint32_t)(par->pstart[p + 1] - par->pstart[p]);
+
+        int ok = 0;
+        for (uint32_t t = 0; t < 50 && !ok; t++) {
+            pt->seed = (par->seed ^ (p * 0x85ebca6bu)) + 0x9e3779b9u * t;
+            ok = fuse_try_build(&lay, src, n, seed_mix(pt->seed), par->fp_bits, xf->fps, pt->base) == 0;
+        }
+        if (!ok) __atomic_store_n(&par->failed, 1, __ATOMIC_RELAXED);
+    }
+    return NULL;
+}
+
+static int par_run(xor_par_t *par, void *(*fn)(void *)) {
+    pthread_t tids[XOR_MAX_THREADS];
+    xor_par_arg_t args[XOR_MAX_THREADS];
+    int started = 0;
+    for (int t = 0; t < par->nthreads; t++) {
+        args[t] = (xor_par_arg_t){ .par = par, .tid = t };
+        if (pthread_create(&tids[t], NULL, fn, &args[t]) != 0) break;
+        started++;
+    }
+    for (int t = 0; t < started; t++) pthread_join(tids[t], NULL);
+    return started == par->nthreads ? 0 : 1;
+}
+
+// At least one partition per thread, at most ~XOR_PART_KEYS keys each.
+static size_t part_count(size_t nkeys, int nthreads) {
+    size_t np = (nkeys + XOR_PART_KEYS - 1) / XOR_PART_KEYS;
+    if (np < (size_t)nthreads) np = (size_t)nthreads;
+    if (np > nkeys) np = nkeys;
+    return np;
+}
+
+static int xor_build_partitioned(xor_filter_t *xf, const uint64_t *keys, size_t nkeys, uint32_t fp_bits,
+                                 uint32_t seed, int nthreads, size_t round_keys, int drop_pages) {
+    if (!xf || !keys || nkeys == 0) return 1;
+    if (!(fp_bits == 8 || fp_bits == 12 || fp_bits == 16)) return 1;
+    if (nthreads < 1) nthreads = 1;
+    if (nthreads > XOR_MAX_THREADS) nthreads = XOR_MAX_THREADS;
+
+    memset(xf, 0, sizeof(*xf));
+
+    size_t np = part_count(nkeys, nthreads);
+
+    xor_par_t par = {
+        .keys = keys, .nkeys = nkeys, .fp_bits = fp_bits, .seed = seed,
+        .nparts = (uint32_t)np, .nthreads = nthreads, .drop_pages = drop_pages, .xf = xf,
+    };
+    par.cnt = (size_t*)calloc(np * (size_t)nthreads, sizeof(size_t));
+    par.cursor = (size_t*)malloc(sizeof(size_t) * np * (size_t)nthreads);
+    par.pstart = (size_t*)calloc(np + 1, sizeof(size_t));
+    xf->parts = (xor_part_t*)calloc(np + 1, sizeof(xor_part_t));
+    int rc = 1;
+    if (!par.cnt || !par.cursor || !par.pstart || !xf->parts) goto out;
+    xf->nparts = (uint32_t)np;
+    xf->arity = 3;
+    xf->fp_bits = fp_bits;
+    xf->seed = seed;
+
+    if (par_run(&par, par_count) != 0) goto out;
+
+    // One segment length and size factor for all partitions, from the
+    // average partition size; the segment count follows each partition.
+    uint32_t avg = (uint32_t)((nkeys + np - 1) / np);
+    if (avg < 2) avg = 2;
+    uint32_t len = fuse_segment_length(3, avg);
+    double factor = fuse_size_factor(3, avg);
+    xf->segment_length = len;
+
+    uint64_t cells = 0;
+    for (size_t p = 0; p < np; p++) {
+        size_t c = 0;
+        for (int t = 0; t < nthreads; t++) c += par.cnt[(size_t)t * np + p];
+        par.pstart[p + 1] = par.pstart[p] + c;
+
+        fuse_layout_t lay;
+        fuse_layout_init(&lay, 3, len, factor, c < 2 ? 2 : c);
+        xf->parts[p].base = (uint32_t)cells;
+        xf->parts[p].segment_count_length = lay.segment_count_length;
+        cells += lay.ncells;
+        if (cells > UINT32_MAX) goto out;
+    }
+    xf->parts[np].base = (uint32_t)cells;
+    xf->n = (uint32_t)cells;
+    xf->fps = calloc(fps_bytes(fp_bits, xf->n), 1);
+    if (!xf->fps) goto out;
+
+    // Rounds of whole partitions, each holding at most round_keys hashes
+    // (a single partition may exceed it).
+    for (uint32_t p0 = 0; p0 < np; ) {
+        uint32_t p1 = p0 + 1;
+        while (p1 < np && par.pstart[p1 + 1] - par.pstart[p0] <= round_keys) p1++;
+
+        size_t pos = 0;
+        for (uint32_t p = p0; p < p1; p++) {
+            for (int t = 0; t < nthreads; t++) {
+                par.cursor[(size_t)t * np + p] = pos;
+                pos += par.cnt[(size_t)t * np + p];
+            }
+        }
+        par.buf = (uint64_t*)malloc(sizeof(uint64_t) * (pos ? pos : 1));
+        if (!par.buf) goto out;
+        par.p0 = p0;
+        par.p1 = p1;
+        par.next_part = p0;
+
+        int err = par_run(&par, par_scatter) || par_run(&par, par_peel) || par.failed;
+        free(par.buf);
+        par.buf = NULL;
+        if (err) goto out;
+        p0 = p1;
+    }
+    rc = 0;
+
+out:
+    free(par.cnt);
+    free(par.cursor);
+    free(par.pstart);
+    if (rc != 0) xor_free(xf);
+    return rc;
+}
+
+int xor_build_parallel(xor_filter_t *xf, const uint64_t *keys, size_t nkeys, uint32_t fp_bits,
+                       uint32_t seed, int nthreads) {
+    return xor_build_partitioned(xf, keys, nkeys, fp_bits, seed, nthreads, SIZE_MAX, 0);
+}
+
+int xor_build_file(xor_filter_t *xf, const char *path, uint32_t fp_bits, uint32_t seed,
+                   int nthreads, size_t round_keys) {
+    if (!xf || !path) return 1;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return 1;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0 || st.st_size % sizeof(uint64_t) != 0) {
+        close(fd);
+        return 1;
+    }
+    size_t bytes = (size_t)st.st_size;
+    void *map = mmap(NULL, bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return 1;
+    madvise(map, bytes, MADV_SEQUENTIAL);
+
+    int rc = xor_build_partitioned(xf, (const uint64_t*)map, bytes / sizeof(uint64_t), fp_bits, seed,
+                                   nthreads, round_keys ? round_keys : XOR_FILE_ROUND_KEYS, 1);
+    munmap(map, bytes);
+    return rc;
+}
+
+// Cells and fingerprint of key in any of the three layouts; returns the
+// number of cells (3 or 4).
+static inline uint32_t xor_cells(const xor_filter_t *xf, uint64_t key, uint32_t *c, uint16_t *fp) {
+    uint64_t h = hash64(key, seed_mix(xf->seed));
+    c[3] = 0;
+    if (xf->nparts) {
+        const xor_part_t *pt = &xf->parts[mulhi64(h, xf->nparts)];
+        h = hash64(h, seed_mix(pt->seed));
+        fuse_layout_t lay = { 3, xf->segment_length, pt->segment_count_length, 0 };
+        fuse_cells(&lay, h, c);
+        c[0] += pt->base;
+        c[1] += pt->base;
+        c[2] += pt->base;
+    } else if (xf->arity) {
+        fuse_layout_t lay = { xf->arity, xf->segment_length, xf->segment_count_length, xf->n };
+        fuse_cells(&lay, h, c);
+    } else {
+        get3(h, xf->n, &c[0], &c[1], &c[2]);
+    }
+    *fp = fingerprint(h, xf->fp_bits);
+    return xf->arity == 4 ? 4 : 3;
+}
+
+// The query paths below take fp_bits as a constant and are instantiated
+// once per width, so each has straight-line cell loads.
+static inline __attribute__((always_inline))
+int query_w(const xor_filter_t *xf, uint64_t key, const uint32_t w) {
+    uint32_t c[4];
+    uint16_t fp;
+    uint32_t k = xor_cells(xf, key, c, &fp);
+    uint16_t got = cell_get(xf->fps, c[0], w) ^ cell_get(xf->fps, c[1], w) ^ cell_get(xf->fps, c[2], w);
+    if (k == 4) got ^= cell_get(xf->fps, c[3], w);
+    return (got == fp);
+}
+
 int xor_query(const xor_filter_t *xf, uint64_t key) {
     if (!xf || !xf->fps || xf->n == 0) return 0;
-    uint64_t h = hash64(key, ((uint64_t)xf->seed << 32) ^ 0xD6E8FEB86659FD93ULL);
-    uint32_t a,b,c;
-    get3(h, xf->n, &a, &b, &c);
-    uint16_t fp = fingerprint(h, xf->fp_bits);
-    uint16_t got = xf->fps[a] ^ xf->fps[b] ^ xf->fps[c];
-    return (got == fp);
+    switch (xf->fp_bits) {
+    case 8:  return query_w(xf, key, 8);
+    case 12: return query_w(xf, key, 12);
+    default: return query_w(xf, key, 16);
+    }
+}
+
+typedef struct {
+    uint32_t c[4];   // c[3] only for 4-wise fuse
+    uint16_t fp;
+} xor_probe_t;
+
+static inline __attribute__((always_inline))
+void xor_locate(const xor_filter_t *xf, uint64_t key, xor_probe_t *p, const uint32_t w) {
+    uint32_t k = xor_cells(xf, key, p->c, &p->fp);
+    __builtin_prefetch(cell_addr(xf->fps, p->c[0], w), 0, 3);
+    __builtin_prefetch(cell_addr(xf->fps, p->c[1], w), 0, 3);
+    __builtin_prefetch(cell_addr(xf->fps, p->c[2], w), 0, 3);
+    if (k == 4) __builtin_prefetch(cell_addr(xf->fps, p->c[3], w), 0, 3);
+}
+
+static inline __attribute__((always_inline))
+size_t batch_w(const xor_filter_t *xf, const uint64_t *keys, size_t n,
+               uint64_t *out_bitmap, size_t dist, const uint32_t w) {
+    xor_probe_t ring[XOR_BATCH_RING];
+    size_t hits = 0;
+
+    size_t head = (dist < n) ? dist : n;
+    for (size_t i = 0; i < head; i++) xor_locate(xf, keys[i], &ring[i & (XOR_BATCH_RING - 1)], w);
+
+    for (size_t i = 0; i < n; i++) {
+        xor_probe_t cur;
+        if (dist == 0) xor_locate(xf, keys[i], &cur, w);
+        else cur = ring[i & (XOR_BATCH_RING - 1)];
+
+        size_t ahead = i + dist;
+        if (dist && ahead < n) xor_locate(xf, keys[ahead], &ring[ahead & (XOR_BATCH_RING - 1)], w);
+
+        uint16_t got = cell_get(xf->fps, cur.c[0], w) ^ cell_get(xf->fps, cur.c[1], w)
+                     ^ cell_get(xf->fps, cur.c[2], w);
+        if (xf->arity == 4) got ^= cell_get(xf->fps, cur.c[3], w);
+        if (got == cur.fp) {
+            out_bitmap[i >> 6] |= 1ULL << (i & 63);
+            hits++;
+        }
+    }
+    return hits;
+}
+
+size_t xor_query_batch_dist(const xor_filter_t *xf, const uint64_t *keys, size_t n,
+                            uint64_t *out_bitmap, size_t dist) {
+    if (!xf || !xf->fps || xf->n == 0 || !keys || !out_bitmap) return 0;
+    if (dist > XOR_BATCH_RING) dist = XOR_BATCH_RING;
+
+    memset(out_bitmap, 0, ((n + 63) / 64) * sizeof(uint64_t));
+
+    switch (xf->fp_bits) {
+    case 8:  return batch_w(xf, keys, n, out_bitmap, dist, 8);
+    case 12: return batch_w(xf, keys, n, out_bitmap, dist, 12);
+    default: return batch_w(xf, keys, n, out_bitmap, dist, 16);
+    }
+}
+
+size_t xor_query_batch(const xor_filter_t *xf, const uint64_t *keys, size_t n, uint64_t *out_bitmap) {
+    return xor_query_batch_dist(xf, keys, n, out_bitmap, XOR_PREFETCH_DIST);
 }
 
 void xor_free(xor_filter_t *xf) {
     if (!xf) return;
-    free(xf->fps);
+    if (xf->map) {
+        munmap(xf->map, xf->map_bytes);
+    } else {
+        fmem_free(xf->fps, fps_bytes(xf->fp_bits, xf->n), xf->backing);
+        free(xf->parts);
+    }
+    memset(xf, 0, sizeof(*xf));
+}
+
+// params: n, fp_bits, seed, arity, segment_length, segment_count_length,
+// nparts; sections: fps, then parts when partitioned
+int xor_save(const xor_filter_t *xf, const char *path) {
+    if (!xf || !xf->fps) return 1;
+
+    fio_header_t h;
+    memset(&h, 0, sizeof(h));
+    h.kind = FIO_KIND_XOR;
+    h.params[0] = xf->n;
+    h.params[1] = xf->fp_bits;
+    h.params[2] = xf->seed;
+    h.params[3] = xf->arity;
+    h.params[4] = xf->segment_length;
+    h.params[5] = xf->segment_count_length;
+    h.params[6] = xf->nparts;
+    h.nsections = xf->nparts ? 2 : 1;
+    h.sections[0].bytes = fps_bytes(xf->fp_bits, xf->n);
+    h.sections[1].bytes = (uint64_t)(xf->nparts + 1) * sizeof(xor_part_t);
+
+    const void *data[2] = { xf->fps, xf->parts };
+    return fio_write(path, &h, data) ? 1 : 0;
+}
+
+// Whether a loaded fuse layout keeps every cell inside the n cells: a
+// power-of-two segment length, and whole-segment counts (per partition,
+// with monotonic bases ending at n) that add up to the array. Queries use
+// these unchecked.
+static int layout_ok(const xor_filter_t *xf) {
+    if (xf->arity == 0) return xf->nparts == 0;
+    uint32_t len = xf->segment_length;
+    if (len == 0 || (len & (len - 1)) != 0 || len > FUSE_MAX_SEGMENT_LENGTH) return 0;
+
+    uint64_t tail = (uint64_t)(xf->arity - 1) * len;
+    if (!xf->nparts) {
+        return xf->segment_count_length != 0 && xf->segment_count_length % len == 0 &&
+               (uint64_t)xf->segment_count_length + tail == xf->n;
+    }
+    if (xf->arity != 3 || xf->parts[0].base != 0 || xf->parts[xf->nparts].base != xf->n) return 0;
+    for (uint32_t p = 0; p < xf->nparts; p++) {
+        const xor_part_t *pt = &xf->parts[p];
+        if (xf->parts[p + 1].base < pt->base ||
+            pt->segment_count_length == 0 || pt->segment_count_length % len != 0 ||
+            (uint64_t)pt->segment_count_length + tail != xf->parts[p + 1].base - pt->base) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int xor_open_mmap(xor_filter_t *xf, const char *path) {
+    if (!xf) return 1;
+
+    fio_header_t h;
+    void *map = NULL;
+    size_t map_bytes = 0;
+    if (fio_map(path, FIO_KIND_XOR, &h, &map, &map_bytes) != 0) return 1;
+
+    uint32_t fp_bits = (uint32_t)h.params[1];
+    uint32_t nparts = (uint32_t)h.params[6];
+    if (h.nsections != (nparts ? 2u : 1u) || h.params[0] == 0 || h.params[0] > UINT32_MAX ||
+        !(fp_bits == 8 || fp_bits == 12 || fp_bits == 16) ||
+        !(h.params[3] == 0 || h.params[3] == 3 || h.params[3] == 4) ||
+        h.sections[0].bytes != fps_bytes(fp_bits, (size_t)h.params[0]) ||
+        (nparts && h.sections[1].bytes != (uint64_t)(nparts + 1) * sizeof(xor_part_t))) {
+        munmap(map, map_bytes);
+        return 1;
+    }
+
     memset(xf, 0, sizeof(*xf));
+    xf->n = (uint32_t)h.params[0];
+    xf->fp_bits = fp_bits;
+    xf->seed = (uint32_t)h.params[2];
+    xf->arity = (uint32_t)h.params[3];
+    xf->segment_length = (uint32_t)h.params[4];
+    xf->segment_count_length = (uint32_t)h.params[5];
+    xf->nparts = nparts;
+    xf->fps = fio_section(map, &h, 0);
+    xf->parts = nparts ? (xor_part_t*)fio_section(map, &h, 1) : NULL;
+    xf->map = map;
+    xf->map_bytes = map_bytes;
+    if (!layout_ok(xf)) {
+        munmap(map, map_bytes);
+        memset(xf, 0, sizeof(*xf));
+        return 1;
+    }
+    return 0;
 }
 
 size_t xor_bytes(const xor_filter_t *xf) {
     if (!xf || !xf->fps) return 0;
-    return (size_t)xf->n * sizeof(uint16_t);
+    return fps_bytes(xf->fp_bits, xf->n)
+         + (xf->nparts ? (size_t)(xf->nparts + 1) * sizeof(xor_part_t) : 0);
+}
+
+size_t xor_bytes_for(uint32_t nkeys, uint32_t fp_bits, uint32_t arity) {
+    if (nkeys == 0 || !(fp_bits == 8 || fp_bits == 12 || fp_bits == 16)) return 0;
+    if (arity == 0) return fps_bytes(fp_bits, classic_cells(nkeys));
+    if (arity != 3 && arity != 4) return 0;
+
+    uint32_t n = nkeys < 2 ? 2 : nkeys;
+    fuse_layout_t lay;
+    fuse_layout_init(&lay, arity, fuse_segment_length(arity, n), fuse_size_factor(arity, n), n);
+    return fps_bytes(fp_bits, lay.ncells);
+}
+
+size_t xor_bytes_for_parallel(size_t nkeys, uint32_t fp_bits, int nthreads) {
+    if (nkeys == 0 || !(fp_bits == 8 || fp_bits == 12 || fp_bits == 16)) return 0;
+    if (nthreads < 1) nthreads = 1;
+    if (nthreads > XOR_MAX_THREADS) nthreads = XOR_MAX_THREADS;
+
+    size_t np = part_count(nkeys, nthreads);
+    uint32_t avg = (uint32_t)((nkeys + np - 1) / np);
+    if (avg < 2) avg = 2;
+    uint32_t len = fuse_segment_length(3, avg);
+    double factor = fuse_size_factor(3, avg);
+
+    // partitions of nkeys / np keys, the first nkeys % np one more
+    uint64_t cells = 0;
+    for (int extra = 0; extra < 2; extra++) {
+        size_t count = extra ? nkeys % np : np - nkeys % np;
+        size_t c = nkeys / np + (size_t)extra;
+        if (count == 0) continue;
+        fuse_layout_t lay;
+        fuse_layout_init(&lay, 3, len, factor, c < 2 ? 2 : c);
+        cells += (uint64_t)count * lay.ncells;
+    }
+    if (cells > UINT32_MAX) return 0;
+    return fps_bytes(fp_bits, (uint32_t)cells);
+}
+
+int xor_set_backing(xor_filter_t *xf, fmem_backing_t backing, int prefault) {
+    if (!xf || !xf->fps || xf->map) return 1;
+
+    size_t bytes = fps_bytes(xf->fp_bits, xf->n);
+    fmem_backing_t got;
+    void *mem = fmem_alloc(bytes, backing, prefault, &got);
+    if (!mem) return 1;
+    memcpy(mem, xf->fps, bytes);
+    fmem_free(xf->fps, bytes, xf->backing);
+    xf->fps = mem;
+    xf->backing = got;
+    return 0;
 }
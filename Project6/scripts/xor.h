@@ -2,20 +2,100 @@
 #include <stdint.h>
 #include <stddef.h>
 
+#include "filter_mem.h"
+
+// One sub-filter of a partitioned build: a 3-wise fuse array starting at
+// cell `base`, hashed with its own seed.
+typedef struct {
+    uint32_t base;
+    uint32_t seed;
+    uint32_t segment_count_length;
+} xor_part_t;
+
 typedef struct {
     uint32_t n;        // number of fingerprints
     uint32_t fp_bits;  
     uint32_t seed;
-    uint16_t *fps;     
+    void *fps;         // n cells of fp_bits: uint8_t, packed 12-bit or uint16_t
+    fmem_backing_t backing;   // of fps (filter_mem.h)
+
+    // 0 for the classic filter (3 cells anywhere in the array). 3 or 4 for
+    // a binary fuse filter: the cells lie in `arity` consecutive segments
+    // of segment_length, the first one chosen from segment_count_length.
+    uint32_t arity;
+    uint32_t segment_length;
+    uint32_t segment_count_length;
+
+    // partitioned build: keys go by hash to one of nparts sub-filters
+    // (parts[nparts].base == n); 0 otherwise
+    uint32_t nparts;
+    xor_part_t *parts;
+
+    // set by xor_open_mmap: fps and parts live in this read-only mapping
+    void *map;
+    size_t map_bytes;
 } xor_filter_t;
 
 int  xor_build(xor_filter_t *xf, const uint64_t *keys, uint32_t nkeys, uint32_t fp_bits, uint32_t seed);
 
+// Binary fuse filter (Graf & Lemire) with arity 3 or 4: about 1.13x (3-wise)
+// or 1.08x (4-wise) cells per key instead of 1.30x, and a build whose
+// peeling stays mostly within a few neighbouring segments. Queried with the
+// same xor_query* functions.
+int  xor_build_fuse(xor_filter_t *xf, const uint64_t *keys, uint32_t nkeys, uint32_t fp_bits,
+                    uint32_t seed, uint32_t arity);
+
+// Partitioned build for large key sets: keys are split by hash into
+// independent 3-wise fuse sub-filters of about 1M keys (at least one per
+// thread), which nthreads threads count, scatter and peel in parallel.
+// Working memory is 8 bytes per key of hashes plus one sub-filter's peeling
+// state per thread.
+#define XOR_MAX_THREADS 256
+int  xor_build_parallel(xor_filter_t *xf, const uint64_t *keys, size_t nkeys, uint32_t fp_bits,
+                        uint32_t seed, int nthreads);
+
+// The same build streaming keys from a file of native uint64_t. The file is
+// mmapped and scanned once per round of partitions holding at most
+// round_keys keys (0 = XOR_FILE_ROUND_KEYS), so only that many hashes are
+// in memory; scanned pages are released as the scan moves on.
+#define XOR_FILE_ROUND_KEYS ((size_t)1 << 26)
+int  xor_build_file(xor_filter_t *xf, const char *path, uint32_t fp_bits, uint32_t seed,
+                    int nthreads, size_t round_keys);
+
 
 int  xor_query(const xor_filter_t *xf, uint64_t key);
 
+// Batched lookup: bit i of out_bitmap (ceil(n/64) words) is set iff keys[i]
+// may be present. The three fingerprint cells are prefetched `dist` keys
+// ahead (0 = no prefetch, max 64). Returns the number of hits.
+#define XOR_PREFETCH_DIST 16
+size_t xor_query_batch(const xor_filter_t *xf, const uint64_t *keys, size_t n, uint64_t *out_bitmap);
+size_t xor_query_batch_dist(const xor_filter_t *xf, const uint64_t *keys, size_t n,
+                            uint64_t *out_bitmap, size_t dist);
+
 
 void xor_free(xor_filter_t *xf);
 
+// Writes the filter in the shared on-disk format (filter_io.h).
+int  xor_save(const xor_filter_t *xf, const char *path);
+
+// Opens a saved filter in place from a read-only mapping; xor_free unmaps
+// it. 1 on a missing or malformed file.
+int  xor_open_mmap(xor_filter_t *xf, const char *path);
+
 
 size_t xor_bytes(const xor_filter_t *xf);
+
+// Bytes xor_build (arity 0) or xor_build_fuse (3, 4) would take for nkeys
+// keys, without building; 0 on bad arguments.
+size_t xor_bytes_for(uint32_t nkeys, uint32_t fp_bits, uint32_t arity);
+
+// The same for xor_build_parallel, with partitions holding the average
+// share of keys; the real ones vary by hash, so the build may differ by a
+// few cells per partition. 0 on bad arguments or over 2^32 cells.
+size_t xor_bytes_for_parallel(size_t nkeys, uint32_t fp_bits, int nthreads);
+
+// Moves the fingerprint array of a built filter into memory of the given
+// backing (filter_mem.h), prefaulted if asked; xf->backing records what
+// was obtained. 1 on a mapped or empty filter or if allocation fails.
+int  xor_set_backing(xor_filter_t *xf, fmem_backing_t backing, int prefault);